@@ -10,6 +10,8 @@
  * @def NBIOT_SOCK_RECV_BUF_SIZE
  *
  * 接收数据缓存大小
+ * 固件下载（block2）的分块大小取放得进此缓存的最大值（预留32字节报文头，
+ * 不超过REST_MAX_CHUNK_SIZE），128时为64字节，512时为128字节
 **/
 #ifdef HAVE_DTLS
 #define NBIOT_SOCK_RECV_BUF_SIZE        512
@@ -17,6 +19,61 @@
 #define NBIOT_SOCK_RECV_BUF_SIZE        128
 #endif
 
+/**
+ * @def NBIOT_SOCK_BATCH_SIZE
+ *
+ * 单次批量收发的最大数据报个数
+ * 为1时不做批量收发（节省栈和缓存空间）
+**/
+#ifndef NBIOT_SOCK_BATCH_SIZE
+#if defined(NBIOT_POSIX) || defined(NBIOT_WIN)
+#define NBIOT_SOCK_BATCH_SIZE           8
+#else
+#define NBIOT_SOCK_BATCH_SIZE           1
+#endif
+#endif
+
+/**
+ * @def NBIOT_DEVICE_POOL_SIZE
+ *
+ * 设备实例池默认大小
+ * 未调用nbiot_device_pool_init()时使用
+ * 每个实例包含协议栈上下文及其发送缓存（COAP_MAX_PACKET_SIZE），
+ * 约1.5KB，实例池按容量一次性分配
+**/
+#ifndef NBIOT_DEVICE_POOL_SIZE
+#define NBIOT_DEVICE_POOL_SIZE          1
+#endif
+
+/**
+ * @def NBIOT_MEMORY_POOL_SIZE
+ *
+ * 内存池大小（打开NBIOT_MEMORY_POOL时有效）
+ * nbiot_init_environment()时一次性分配
+**/
+#ifndef NBIOT_MEMORY_POOL_SIZE
+#define NBIOT_MEMORY_POOL_SIZE          (16*1024)
+#endif
+
+/**
+ * @def NBIOT_MEMORY_SLAB_SIZE
+ *
+ * 内存池按此大小切分为slab，每个slab只服务一个尺寸等级
+**/
+#ifndef NBIOT_MEMORY_SLAB_SIZE
+#define NBIOT_MEMORY_SLAB_SIZE          1024
+#endif
+
+/**
+ * @def NBIOT_BLOCK1_MAX_SIZE
+ *
+ * block1分块写入时重组数据的最大字节数
+ * 资源提供block回调（逐块接收）时不受此限制
+**/
+#ifndef NBIOT_BLOCK1_MAX_SIZE
+#define NBIOT_BLOCK1_MAX_SIZE           4096
+#endif
+
 /**
  * @def NBIOT_DEBUG
  *
@@ -30,6 +30,7 @@ extern "C" {
 #define NBIOT_RESOURCE_READABLE   0x1
 #define NBIOT_RESOURCE_WRITABLE   0x2
 #define NBIOT_RESOURCE_EXECUTABLE 0x4
+#define NBIOT_RESOURCE_BLOCK      0x8 /* 分块数据交给block回调（需设置block） */
 
 /**
  * value定义
@@ -76,6 +77,23 @@ typedef void(*nbiot_execute_callback_t)(nbiot_resource_t *res,
                                         const uint8_t    *buffer,
                                         int               length);
 
+/**
+ * block回调函数（block1分块write或execute时，按顺序每收到一个分块执行一次）
+ * 仅当flag含NBIOT_RESOURCE_BLOCK时使用，此时分块数据不再整体缓存，
+ * 也不再执行write/execute回调，资源的value不会被修改
+ * @param res    指向nbiot_resource_t内存
+ *        offset 分块数据在整体数据中的偏移
+ *        buffer 指向分块数据
+ *        length 分块数据字节数
+ *        more   是否还有后续分块
+ * @return 成功返回NBIOT_ERR_OK，否则终止本次传输
+**/
+typedef int(*nbiot_block_callback_t)(nbiot_resource_t *res,
+                                     size_t            offset,
+                                     const uint8_t    *buffer,
+                                     size_t            length,
+                                     bool              more);
+
 /**
  * resource定义
 **/
@@ -89,6 +107,7 @@ struct nbiot_resource_t
     nbiot_value_t            value;
     nbiot_write_callback_t   write;
     nbiot_execute_callback_t execute;
+    nbiot_block_callback_t   block;   /* flag不含NBIOT_RESOURCE_BLOCK时不使用，可不设置 */
 };
 
 /**
@@ -96,6 +115,21 @@ struct nbiot_resource_t
 **/
 typedef struct nbiot_device_t nbiot_device_t;
 
+/**
+ * 初始化设备实例池
+ * 未调用时，首次创建设备实例将按NBIOT_DEVICE_POOL_SIZE创建实例池
+ * 实例池一次性分配size个实例（每个约1.5KB，含发送缓存），
+ * 创建与销毁设备实例时持有进程内全局锁
+ * @param size 实例池容量（可同时存在的设备实例数）
+ * @return 成功返回NBIOT_ERR_OK
+**/
+int nbiot_device_pool_init( size_t size );
+
+/**
+ * 释放设备实例池（所有设备实例销毁后才会释放）
+**/
+void nbiot_device_pool_clear( void );
+
 /**
  * 创建OneNET接入设备实例
  * @param dev           [OUT] 指向nbiot_device_t指针的内存
@@ -122,6 +156,18 @@ int nbiot_device_connect( nbiot_device_t *dev,
                           const char     *server_uri,
                           time_t          life_time );
 
+/**
+ * 设置队列模式（UQ binding）
+ * 每次与服务交互后保持接收awake_time秒，之后关闭接收直到下次注册更新，
+ * 期间产生的上报在注册更新成功后一并发出（同一订阅只发最新值）
+ * 须在首次nbiot_device_step之前调用
+ * @param dev        指向nbiot_device_t的内存
+ *        awake_time 保持接收的时长（秒），0表示始终在线（U binding）
+ * @return 成功返回NBIOT_ERR_OK
+**/
+int nbiot_device_queue_mode( nbiot_device_t *dev,
+                             uint16_t        awake_time );
+
 /**
  * 关闭与OneNET服务的连接
  * @param dev 指向nbiot_device_t的内存
@@ -159,6 +205,16 @@ bool nbiot_device_ready( nbiot_device_t *dev );
 int nbiot_device_step( nbiot_device_t *dev,
                        time_t          timeout );
 
+/**
+ * 数据驱动以及设备保活（阻塞模式）
+ * 阻塞等待，直到有数据到达或者到达协议栈的下一个定时时刻
+ * @param dev     指向nbiot_device_t的内存
+ *        timeout 最长等待时间（毫秒）
+ * @return 成功返回NBIOT_ERR_OK
+**/
+int nbiot_device_wait( nbiot_device_t *dev,
+                       int             timeout );
+
 /**
  * 主动上报资源数据
  * @param dev    指向nbiot_device_t的内存
@@ -172,6 +228,165 @@ int nbiot_device_notify( nbiot_device_t *dev,
                          uint16_t        instid,
                          uint16_t        resid );
 
+/**
+ * 批量主动上报资源数据
+ * 同一对象实例被订阅时，多个资源的变化合并为一条TLV上报
+ * @param dev       指向nbiot_device_t的内存
+ *        res_array 发生变化的resources指针数组
+ *        res_num   resources总数
+ * @return 成功返回NBIOT_ERR_OK（任一resource不存在时不做上报）
+**/
+int nbiot_device_notify_batch( nbiot_device_t   *dev,
+                               nbiot_resource_t *res_array[],
+                               size_t            res_num );
+
+/**
+ * 固件升级状态（/5/0/3）
+**/
+#define NBIOT_FIRMWARE_IDLE        0
+#define NBIOT_FIRMWARE_DOWNLOADING 1
+#define NBIOT_FIRMWARE_DOWNLOADED  2
+#define NBIOT_FIRMWARE_UPDATING    3
+
+/**
+ * 固件升级结果（/5/0/5）
+**/
+#define NBIOT_FIRMWARE_RESULT_INITIAL         0
+#define NBIOT_FIRMWARE_RESULT_SUCCESS         1
+#define NBIOT_FIRMWARE_RESULT_NO_STORAGE      2
+#define NBIOT_FIRMWARE_RESULT_NO_MEMORY       3
+#define NBIOT_FIRMWARE_RESULT_CONNECTION_LOST 4
+#define NBIOT_FIRMWARE_RESULT_CRC_FAILED      5
+#define NBIOT_FIRMWARE_RESULT_UNSUPPORTED     6
+#define NBIOT_FIRMWARE_RESULT_INVALID_URI     7
+#define NBIOT_FIRMWARE_RESULT_UPDATE_FAILED   8
+#define NBIOT_FIRMWARE_RESULT_PROTOCOL        9
+
+/**
+ * 固件升级声明
+**/
+typedef struct nbiot_firmware_t nbiot_firmware_t;
+
+/**
+ * 固件写入回调函数（固件包按顺序分块到达，每块执行一次，不做整体缓存）
+ * @param fw     指向nbiot_firmware_t内存
+ *        offset 分块数据在固件包中的偏移，为0时表示开始接收新的固件包
+ *        buffer 指向分块数据
+ *        length 分块数据字节数
+ * @return 成功返回NBIOT_ERR_OK，否则终止本次下载
+**/
+typedef int(*nbiot_firmware_write_t)(nbiot_firmware_t *fw,
+                                     size_t            offset,
+                                     const uint8_t    *buffer,
+                                     size_t            length);
+
+/**
+ * 固件校验回调函数（固件包接收完成后执行）
+ * @param fw   指向nbiot_firmware_t内存
+ *        size 固件包总字节数
+ *        crc  固件包的CRC-32（与zlib的crc32一致）
+ * @return 校验通过返回NBIOT_ERR_OK
+**/
+typedef int(*nbiot_firmware_verify_t)(nbiot_firmware_t *fw,
+                                      size_t            size,
+                                      uint32_t          crc);
+
+/**
+ * 固件升级回调函数（收到/5/0/2的execute后执行）
+ * 回调中不要直接重启，升级结果通过nbiot_device_firmware_result上报
+ * @param fw 指向nbiot_firmware_t内存
+ * @return 成功返回NBIOT_ERR_OK
+**/
+typedef int(*nbiot_firmware_update_t)(nbiot_firmware_t *fw);
+
+/**
+ * 固件升级定义
+**/
+struct nbiot_firmware_t
+{
+    nbiot_firmware_write_t  write;
+    nbiot_firmware_verify_t verify; /* 可为NULL（不做校验） */
+    nbiot_firmware_update_t update;
+};
+
+/**
+ * 启用固件升级对象（/5/0）
+ * 支持服务端分块写入/5/0/0（push），以及写入/5/0/1后由设备分块下载（pull，
+ * 仅支持与服务连接相同的coap://或coaps://），固件包逐块交给fw->write
+ * 须在nbiot_device_configure之前调用
+ * @param dev 指向nbiot_device_t的内存
+ *        fw  指向nbiot_firmware_t的内存（设备销毁前须保持有效）
+ * @return 成功返回NBIOT_ERR_OK
+**/
+int nbiot_device_firmware( nbiot_device_t   *dev,
+                           nbiot_firmware_t *fw );
+
+/**
+ * 上报固件升级结果（升级完成或者重启后调用）
+ * @param dev    指向nbiot_device_t的内存
+ *        result 升级结果（NBIOT_FIRMWARE_RESULT_*）
+ * @return 成功返回NBIOT_ERR_OK
+**/
+int nbiot_device_firmware_result( nbiot_device_t *dev,
+                                  uint8_t         result );
+
+/**
+ * 事件循环声明
+**/
+typedef struct nbiot_loop_t nbiot_loop_t;
+
+/**
+ * 事件循环错误回调函数
+ * 回调中可以移出或销毁任意设备实例，但不能销毁事件循环
+ * @param dev   发生错误的设备实例
+ *        error 错误码（nbiot_device_step的返回值）
+**/
+typedef void(*nbiot_loop_callback_t)(nbiot_device_t *dev,
+                                     int             error);
+
+/**
+ * 创建事件循环（多个设备实例共享一个等待句柄和定时队列）
+ * @param loop     [OUT] 指向nbiot_loop_t指针的内存
+ *        callback 设备处理出错时的回调函数，可为NULL
+ * @return 成功返回NBIOT_ERR_OK
+**/
+int nbiot_loop_create( nbiot_loop_t        **loop,
+                       nbiot_loop_callback_t callback );
+
+/**
+ * 销毁事件循环（不会销毁已加入的设备实例）
+ * @param loop 指向nbiot_loop_t的内存
+**/
+void nbiot_loop_destroy( nbiot_loop_t *loop );
+
+/**
+ * 将设备实例加入事件循环
+ * @param loop 指向nbiot_loop_t的内存
+ *        dev  指向nbiot_device_t的内存
+ * @return 成功返回NBIOT_ERR_OK
+**/
+int nbiot_loop_add( nbiot_loop_t   *loop,
+                    nbiot_device_t *dev );
+
+/**
+ * 将设备实例移出事件循环
+ * @param loop 指向nbiot_loop_t的内存
+ *        dev  指向nbiot_device_t的内存
+ * @return 成功返回NBIOT_ERR_OK
+**/
+int nbiot_loop_remove( nbiot_loop_t   *loop,
+                       nbiot_device_t *dev );
+
+/**
+ * 执行一轮事件循环
+ * 等待直到有设备收到数据或者有设备定时到期，然后只驱动这些设备
+ * @param loop    指向nbiot_loop_t的内存
+ *        timeout 最长等待时间（毫秒）
+ * @return 成功返回NBIOT_ERR_OK
+**/
+int nbiot_loop_run( nbiot_loop_t *loop,
+                    int           timeout );
+
 #ifdef __cplusplus
 } /* extern "C" { */
 #endif
@@ -31,6 +31,17 @@ void nbiot_init_environment( void );
 **/
 void nbiot_clear_environment( void );
 
+/**
+ * 获取进程内全局锁（保护设备实例池等多个设备实例共享的状态）
+ * 不可重入
+**/
+void nbiot_global_lock( void );
+
+/**
+ * 释放进程内全局锁
+**/
+void nbiot_global_unlock( void );
+
 /**
  * 分配内存
  * @param size 需要分配的内存字节数
@@ -44,13 +55,45 @@ void *nbiot_malloc( size_t size );
 **/
 void nbiot_free( void *ptr );
 
+#ifdef NBIOT_MEMORY_POOL
+/**
+ * 内存池统计信息
+**/
+typedef struct nbiot_memory_stats_t
+{
+    size_t total;         /* 内存池总字节数 */
+    size_t used;          /* 当前已分配的块字节数 */
+    size_t peak;          /* used的最高水位 */
+    size_t slabs;         /* 已划分给各尺寸等级的slab字节数 */
+    size_t fallback;      /* 由系统堆分配的次数（超出等级或池已耗尽） */
+    int    fragmentation; /* slab中空闲字节所占百分比 */
+} nbiot_memory_stats_t;
+
+/**
+ * 分配内存池（由nbiot_init_environment调用）
+ * @return 成功返回NBIOT_ERR_OK
+**/
+int nbiot_memory_init( void );
+
+/**
+ * 释放内存池（由nbiot_clear_environment调用）
+ * 调用前需释放所有由内存池分配的内存
+**/
+void nbiot_memory_clear( void );
+
+/**
+ * 获取内存池统计信息
+ * @param stats 统计信息
+**/
+void nbiot_memory_stats( nbiot_memory_stats_t *stats );
+#endif
+
 /**
  * 获取当前时间
  * @return 返回当前距(00:00:00 UTC, January 1, 1970)的秒数
 **/
 time_t nbiot_time( void );
 
-#ifdef HAVE_DTLS
 #ifndef CLOCK_PER_SECOND
 #define CLOCK_PER_SECOND 1000
 #endif
@@ -60,7 +103,14 @@ time_t nbiot_time( void );
  * @return 返回当前时刻(毫秒)
 **/
 clock_t nbiot_tick( void );
-#endif
+
+/**
+ * 时刻A加上MS毫秒、时刻A与B之差（毫秒）及A是否早于B
+ * 按无符号数运算（有符号数溢出属未定义行为），nbiot_tick回绕后仍然成立
+**/
+#define NBIOT_TICK_ADD(A,MS)   ((clock_t)((unsigned long)(A) + (unsigned long)(MS)))
+#define NBIOT_TICK_DIFF(A,B)   ((long)((unsigned long)(A) - (unsigned long)(B)))
+#define NBIOT_TICK_BEFORE(A,B) (NBIOT_TICK_DIFF(A,B) < 0)
 
 /**
  * 休眠
@@ -143,6 +193,108 @@ int nbiot_udp_recv( nbiot_socket_t    *sock,
                     size_t            *read,
                     nbiot_sockaddr_t **src );
 
+/**
+ * 批量收发的数据报
+**/
+typedef struct nbiot_datagram_t
+{
+    void             *buff; /* 数据缓存 */
+    size_t            size; /* 接收时为缓存区大小，发送时为数据字节数 */
+    size_t            len;  /* [OUT] 实际接收或者发送的字节数 */
+    nbiot_sockaddr_t *addr; /* 接收时为源地址（为NULL时自动创建），发送时为目标地址 */
+} nbiot_datagram_t;
+
+/**
+ * 批量发送数据（尽量合并为一次系统调用）
+ * 数据报按顺序发送，返回时msgs[count]之后的数据报均未发出
+ * @param sock  指向UDP socket句柄的内存
+ *        msgs  指向将要被发送的数据报数组
+ *        num   数据报个数
+ *        count [OUT] 实际发送成功的数据报个数
+ * @return 发送数据正常返回NBIOT_ERR_OK（socket暂时不可写时count小于num），
+ *         出错时msgs[count]为出错的数据报
+**/
+int nbiot_udp_send_batch( nbiot_socket_t   *sock,
+                          nbiot_datagram_t *msgs,
+                          size_t            num,
+                          size_t           *count );
+
+/**
+ * 批量接收数据（尽量合并为一次系统调用）
+ * @param sock  指向UDP socket句柄的内存
+ *        msgs  指向存储接收数据报的数组
+ *        num   数据报数组的最大个数
+ *        count [OUT] 实际接收到的数据报个数，没有数据时为0
+ * @return 接收数据正常返回NBIOT_ERR_OK
+**/
+int nbiot_udp_recv_batch( nbiot_socket_t   *sock,
+                          nbiot_datagram_t *msgs,
+                          size_t            num,
+                          size_t           *count );
+
+/**
+ * 等待数据到达
+ * @param sock         指向UDP socket句柄的内存
+ *        milliseconds 最长等待时长（毫秒），小于0时一直等待
+ * @return 有数据可读或者等待超时返回NBIOT_ERR_OK
+**/
+int nbiot_udp_wait( nbiot_socket_t *sock,
+                    int             milliseconds );
+
+/**
+ * 多路等待句柄，移植时自行定义其具体属性
+**/
+typedef struct nbiot_poller_t nbiot_poller_t;
+
+/**
+ * 创建多路等待句柄
+ * @param poller [OUT] 指向保存多路等待句柄内存指针的内存
+ * @return 成功返回NBIOT_ERR_OK
+**/
+int nbiot_poller_create( nbiot_poller_t **poller );
+
+/**
+ * 关闭多路等待句柄
+ * @param poller 指向多路等待句柄的内存
+ * @return 成功返回NBIOT_ERR_OK
+**/
+int nbiot_poller_close( nbiot_poller_t *poller );
+
+/**
+ * 添加UDP socket句柄
+ * @param poller 指向多路等待句柄的内存
+ *        sock   指向UDP socket句柄的内存
+ *        data   socket可读时返回的用户数据
+ * @return 成功返回NBIOT_ERR_OK
+**/
+int nbiot_poller_add( nbiot_poller_t *poller,
+                      nbiot_socket_t *sock,
+                      void           *data );
+
+/**
+ * 移除UDP socket句柄
+ * @param poller 指向多路等待句柄的内存
+ *        sock   指向UDP socket句柄的内存
+ * @return 成功返回NBIOT_ERR_OK
+**/
+int nbiot_poller_remove( nbiot_poller_t *poller,
+                         nbiot_socket_t *sock );
+
+/**
+ * 等待任意UDP socket句柄可读
+ * @param poller       指向多路等待句柄的内存
+ *        ready        [OUT] 可读socket对应的用户数据
+ *        size         ready最大元素个数
+ *        count        [OUT] 可读socket个数
+ *        milliseconds 最长等待时长（毫秒），小于0时一直等待
+ * @return 成功（包括等待超时）返回NBIOT_ERR_OK
+**/
+int nbiot_poller_wait( nbiot_poller_t *poller,
+                       void          **ready,
+                       size_t          size,
+                       size_t         *count,
+                       int             milliseconds );
+
 /**
  * 比较2个socket地址信息是否一致
  * @return 一致返回true，否则返回false
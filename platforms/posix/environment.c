@@ -4,13 +4,27 @@
 **/
 
 #include <platform.h>
+#include <pthread.h>
+
+static pthread_mutex_t _nbiot_global_lock = PTHREAD_MUTEX_INITIALIZER;
+void nbiot_global_lock( void )
+{
+    pthread_mutex_lock( &_nbiot_global_lock );
+}
+
+void nbiot_global_unlock( void )
+{
+    pthread_mutex_unlock( &_nbiot_global_lock );
+}
 
 static bool _nbiot_init_state = false;
 void nbiot_init_environment( void )
 {
     if ( !_nbiot_init_state )
     {
-        /* todo */
+#ifdef NBIOT_MEMORY_POOL
+        nbiot_memory_init();
+#endif
         _nbiot_init_state = true;
     }
 }
@@ -19,7 +33,9 @@ void nbiot_clear_environment( void )
 {
     if ( _nbiot_init_state )
     {
-        /* todo */
+#ifdef NBIOT_MEMORY_POOL
+        nbiot_memory_clear();
+#endif
         _nbiot_init_state = false;
     }
 }
\ No newline at end of file
@@ -6,6 +6,182 @@
 #include <platform.h>
 #include <stdlib.h>
 
+#ifdef NBIOT_MEMORY_POOL
+#include <string.h>
+#include <error.h>
+#include <pthread.h>
+
+#define NBIOT_MEMORY_SLABS   (NBIOT_MEMORY_POOL_SIZE / NBIOT_MEMORY_SLAB_SIZE)
+#define NBIOT_MEMORY_CLASSES (sizeof(_classes) / sizeof(_classes[0]))
+
+typedef struct nbiot_block_t
+{
+    struct nbiot_block_t *next;
+} nbiot_block_t;
+
+/* 尺寸等级（不大于NBIOT_MEMORY_SLAB_SIZE） */
+static const size_t _classes[] = { 16, 32, 64, 128, 256, 512 };
+
+static uint8_t *_arena = NULL;
+static size_t _slabs = 0;
+static uint8_t _slab_class[NBIOT_MEMORY_SLABS];
+static nbiot_block_t *_free_list[NBIOT_MEMORY_CLASSES];
+static nbiot_memory_stats_t _stats;
+/* 池由所有设备实例（可能位于不同线程）共享，分配与释放需互斥 */
+static pthread_mutex_t _lock = PTHREAD_MUTEX_INITIALIZER;
+#define nbiot_memory_lock()   pthread_mutex_lock( &_lock )
+#define nbiot_memory_unlock() pthread_mutex_unlock( &_lock )
+
+int nbiot_memory_init( void )
+{
+    int ret = NBIOT_ERR_OK;
+
+    nbiot_memory_lock();
+    if ( NULL == _arena )
+    {
+        _arena = (uint8_t*)malloc( NBIOT_MEMORY_SLABS * NBIOT_MEMORY_SLAB_SIZE );
+        if ( NULL == _arena )
+        {
+            ret = NBIOT_ERR_NO_MEMORY;
+        }
+        else
+        {
+            _slabs = 0;
+            memset( _free_list, 0, sizeof(_free_list) );
+            memset( &_stats, 0, sizeof(_stats) );
+            _stats.total = NBIOT_MEMORY_SLABS * NBIOT_MEMORY_SLAB_SIZE;
+        }
+    }
+    nbiot_memory_unlock();
+
+    return ret;
+}
+
+void nbiot_memory_clear( void )
+{
+    nbiot_memory_lock();
+    if ( NULL != _arena )
+    {
+        free( _arena );
+        _arena = NULL;
+        _slabs = 0;
+        memset( _free_list, 0, sizeof(_free_list) );
+    }
+    nbiot_memory_unlock();
+}
+
+void nbiot_memory_stats( nbiot_memory_stats_t *stats )
+{
+    if ( NULL != stats )
+    {
+        nbiot_memory_lock();
+        *stats = _stats;
+        nbiot_memory_unlock();
+        if ( stats->slabs )
+        {
+            stats->fragmentation = (int)((stats->slabs - stats->used) * 100 / stats->slabs);
+        }
+    }
+}
+
+/* 从池中划出一个新slab给指定等级（持有_lock时调用） */
+static void nbiot_memory_carve( size_t index )
+{
+    uint8_t *slab;
+    size_t size;
+    size_t off;
+
+    if ( _slabs < NBIOT_MEMORY_SLABS )
+    {
+        size = _classes[index];
+        slab = _arena + _slabs * NBIOT_MEMORY_SLAB_SIZE;
+        _slab_class[_slabs++] = (uint8_t)index;
+        _stats.slabs += NBIOT_MEMORY_SLAB_SIZE;
+
+        /* 逆序入链，保证先分配低地址 */
+        for ( off = NBIOT_MEMORY_SLAB_SIZE; off >= size; off -= size )
+        {
+            nbiot_block_t *block = (nbiot_block_t*)(slab + off - size);
+
+            block->next = _free_list[index];
+            _free_list[index] = block;
+        }
+    }
+}
+
+void *nbiot_malloc( size_t size )
+{
+    size_t i;
+    nbiot_block_t *block = NULL;
+
+    nbiot_memory_lock();
+    if ( NULL != _arena )
+    {
+        for ( i = 0; i < NBIOT_MEMORY_CLASSES; ++i )
+        {
+            if ( size <= _classes[i] )
+            {
+                if ( NULL == _free_list[i] )
+                {
+                    nbiot_memory_carve( i );
+                }
+
+                block = _free_list[i];
+                if ( NULL != block )
+                {
+                    _free_list[i] = block->next;
+                    _stats.used += _classes[i];
+                    if ( _stats.used > _stats.peak )
+                    {
+                        _stats.peak = _stats.used;
+                    }
+                }
+
+                break;
+            }
+        }
+    }
+
+    if ( NULL == block )
+    {
+        ++_stats.fallback;
+    }
+    nbiot_memory_unlock();
+
+    if ( NULL != block )
+    {
+        return block;
+    }
+
+    return malloc( size );
+}
+
+void nbiot_free( void *ptr )
+{
+    bool pooled = false;
+    uint8_t *tmp = (uint8_t*)ptr;
+
+    nbiot_memory_lock();
+    if ( NULL != _arena &&
+         tmp >= _arena &&
+         tmp < _arena + NBIOT_MEMORY_SLABS * NBIOT_MEMORY_SLAB_SIZE )
+    {
+        nbiot_block_t *block = (nbiot_block_t*)ptr;
+        size_t index = _slab_class[(tmp - _arena) / NBIOT_MEMORY_SLAB_SIZE];
+
+        block->next = _free_list[index];
+        _free_list[index] = block;
+        _stats.used -= _classes[index];
+        pooled = true;
+    }
+    nbiot_memory_unlock();
+
+    if ( !pooled )
+    {
+        free( ptr );
+    }
+}
+#else
 #ifdef NBIOT_DEBUG
 #include <stdio.h>
 
@@ -48,4 +224,5 @@ void nbiot_free( void *ptr )
 #else
     free( ptr );
 #endif
-}
\ No newline at end of file
+}
+#endif /* NBIOT_MEMORY_POOL */
\ No newline at end of file
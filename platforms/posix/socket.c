@@ -3,16 +3,27 @@
  * All rights reserved.
 **/
 
+#ifdef __linux__
+#define _GNU_SOURCE /* for recvmmsg/sendmmsg */
+#endif
+
 #include <error.h>
 #include <platform.h>
 #include <utils.h>
 #include <ctype.h>
 #include <errno.h>
 #include <netdb.h>
+#include <poll.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+
+/* 单次recvmmsg/sendmmsg的最大数据报个数 */
+#define NBIOT_SOCK_MMSG_SIZE 16
+#endif
 
 #ifdef NBIOT_DEBUG
 #include <stdio.h>
@@ -346,6 +357,507 @@ int nbiot_udp_recv( nbiot_socket_t    *sock,
     return NBIOT_ERR_OK;
 }
 
+int nbiot_udp_send_batch( nbiot_socket_t   *sock,
+                          nbiot_datagram_t *msgs,
+                          size_t            num,
+                          size_t           *count )
+{
+    int ret;
+    size_t i;
+    size_t n;
+#ifdef __linux__
+    struct iovec iov[NBIOT_SOCK_MMSG_SIZE];
+    struct mmsghdr hdr[NBIOT_SOCK_MMSG_SIZE];
+#endif
+
+    if ( NULL == sock ||
+         NULL == msgs ||
+         NULL == count )
+    {
+        return NBIOT_ERR_BADPARAM;
+    }
+
+    *count = 0;
+    while ( *count < num )
+    {
+        n = num - *count;
+#ifdef __linux__
+        if ( n > NBIOT_SOCK_MMSG_SIZE )
+        {
+            n = NBIOT_SOCK_MMSG_SIZE;
+        }
+
+        nbiot_memzero( hdr, sizeof(struct mmsghdr) * n );
+        for ( i = 0; i < n; ++i )
+        {
+            nbiot_datagram_t *msg = &msgs[*count + i];
+
+            msg->len = 0;
+            iov[i].iov_base = msg->buff;
+            iov[i].iov_len = msg->size;
+            hdr[i].msg_hdr.msg_iov = &iov[i];
+            hdr[i].msg_hdr.msg_iovlen = 1;
+            hdr[i].msg_hdr.msg_name = &msg->addr->addr;
+            hdr[i].msg_hdr.msg_namelen = sizeof(msg->addr->addr);
+        }
+
+        ret = sendmmsg( sock->sock, hdr, (unsigned int)n, 0 );
+        if ( ret < 0 )
+        {
+            if ( EAGAIN == errno ||
+                 EWOULDBLOCK == errno ||
+                 EINTR == errno )
+            {
+                break;
+            }
+
+            return NBIOT_ERR_SOCKET;
+        }
+
+        for ( i = 0; i < (size_t)ret; ++i )
+        {
+            msgs[*count + i].len = hdr[i].msg_len;
+#ifdef NBIOT_DEBUG
+            nbiot_printf( "sendmmsg(len = %d)\n", (int)hdr[i].msg_len );
+            output_buffer( (uint8_t*)msgs[*count + i].buff, hdr[i].msg_len );
+#endif
+        }
+
+        /* 部分发出时出错的数据报在下一次调用中报告 */
+        *count += ret;
+#else
+        for ( i = 0; i < n; ++i )
+        {
+            ret = nbiot_udp_send( sock,
+                                  msgs[*count].buff,
+                                  msgs[*count].size,
+                                  &msgs[*count].len,
+                                  msgs[*count].addr );
+            if ( ret )
+            {
+                return ret;
+            }
+
+            if ( 0 == msgs[*count].len )
+            {
+                return NBIOT_ERR_OK;
+            }
+
+            ++(*count);
+        }
+#endif
+    }
+
+    return NBIOT_ERR_OK;
+}
+
+int nbiot_udp_recv_batch( nbiot_socket_t   *sock,
+                          nbiot_datagram_t *msgs,
+                          size_t            num,
+                          size_t           *count )
+{
+    int ret;
+    size_t i;
+#ifdef __linux__
+    struct iovec iov[NBIOT_SOCK_MMSG_SIZE];
+    struct mmsghdr hdr[NBIOT_SOCK_MMSG_SIZE];
+#endif
+
+    if ( NULL == sock ||
+         NULL == msgs ||
+         NULL == count )
+    {
+        return NBIOT_ERR_BADPARAM;
+    }
+
+    *count = 0;
+    for ( i = 0; i < num; ++i )
+    {
+        msgs[i].len = 0;
+        if ( NULL == msgs[i].addr )
+        {
+            msgs[i].addr = (nbiot_sockaddr_t*)nbiot_malloc( sizeof(nbiot_sockaddr_t) );
+            if ( NULL == msgs[i].addr )
+            {
+                return NBIOT_ERR_NO_MEMORY;
+            }
+
+            nbiot_memzero( msgs[i].addr, sizeof(nbiot_sockaddr_t) );
+        }
+    }
+
+#ifdef __linux__
+    if ( num > NBIOT_SOCK_MMSG_SIZE )
+    {
+        num = NBIOT_SOCK_MMSG_SIZE;
+    }
+
+    nbiot_memzero( hdr, sizeof(struct mmsghdr) * num );
+    for ( i = 0; i < num; ++i )
+    {
+        iov[i].iov_base = msgs[i].buff;
+        iov[i].iov_len = msgs[i].size;
+        hdr[i].msg_hdr.msg_iov = &iov[i];
+        hdr[i].msg_hdr.msg_iovlen = 1;
+        hdr[i].msg_hdr.msg_name = &msgs[i].addr->addr;
+        hdr[i].msg_hdr.msg_namelen = sizeof(msgs[i].addr->addr);
+    }
+
+    ret = recvmmsg( sock->sock, hdr, (unsigned int)num, MSG_DONTWAIT, NULL );
+    if ( ret < 0 )
+    {
+        if ( EAGAIN == errno ||
+             EWOULDBLOCK == errno ||
+             EINTR == errno )
+        {
+            return NBIOT_ERR_OK;
+        }
+
+        return NBIOT_ERR_SOCKET;
+    }
+
+    for ( i = 0; i < (size_t)ret; ++i )
+    {
+        msgs[i].len = hdr[i].msg_len;
+#ifdef NBIOT_DEBUG
+        nbiot_printf( "recvmmsg(len = %d)\n", (int)hdr[i].msg_len );
+        output_buffer( (uint8_t*)msgs[i].buff, hdr[i].msg_len );
+#endif
+    }
+
+    *count = ret;
+#else
+    for ( i = 0; i < num; ++i )
+    {
+        ret = nbiot_udp_recv( sock,
+                              msgs[i].buff,
+                              msgs[i].size,
+                              &msgs[i].len,
+                              &msgs[i].addr );
+        if ( ret )
+        {
+            return ret;
+        }
+
+        if ( 0 == msgs[i].len )
+        {
+            break;
+        }
+
+        ++(*count);
+    }
+#endif
+
+    return NBIOT_ERR_OK;
+}
+
+int nbiot_udp_wait( nbiot_socket_t *sock,
+                    int             milliseconds )
+{
+    int ret;
+    struct pollfd pfd;
+
+    if ( NULL == sock )
+    {
+        return NBIOT_ERR_BADPARAM;
+    }
+
+    pfd.fd = sock->sock;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    do
+    {
+        ret = poll( &pfd, 1, milliseconds < 0 ? -1 : milliseconds );
+    } while ( ret < 0 && EINTR == errno );
+
+    if ( ret < 0 )
+    {
+        return NBIOT_ERR_SOCKET;
+    }
+
+    return NBIOT_ERR_OK;
+}
+
+#ifdef __linux__
+struct nbiot_poller_t
+{
+    int fd;
+};
+
+int nbiot_poller_create( nbiot_poller_t **poller )
+{
+    if ( NULL == poller )
+    {
+        return NBIOT_ERR_BADPARAM;
+    }
+
+    *poller = (nbiot_poller_t*)nbiot_malloc( sizeof(nbiot_poller_t) );
+    if ( NULL == *poller )
+    {
+        return NBIOT_ERR_NO_MEMORY;
+    }
+
+    (*poller)->fd = epoll_create( 1024 );
+    if ( (*poller)->fd < 0 )
+    {
+        nbiot_free( *poller );
+        *poller = NULL;
+
+        return NBIOT_ERR_SOCKET;
+    }
+
+    return NBIOT_ERR_OK;
+}
+
+int nbiot_poller_close( nbiot_poller_t *poller )
+{
+    if ( NULL == poller )
+    {
+        return NBIOT_ERR_BADPARAM;
+    }
+
+    close( poller->fd );
+    nbiot_free( poller );
+
+    return NBIOT_ERR_OK;
+}
+
+int nbiot_poller_add( nbiot_poller_t *poller,
+                      nbiot_socket_t *sock,
+                      void           *data )
+{
+    struct epoll_event ev;
+
+    if ( NULL == poller ||
+         NULL == sock )
+    {
+        return NBIOT_ERR_BADPARAM;
+    }
+
+    nbiot_memzero( &ev, sizeof(ev) );
+    ev.events = EPOLLIN;
+    ev.data.ptr = data;
+    if ( epoll_ctl(poller->fd,EPOLL_CTL_ADD,sock->sock,&ev) )
+    {
+        return NBIOT_ERR_SOCKET;
+    }
+
+    return NBIOT_ERR_OK;
+}
+
+int nbiot_poller_remove( nbiot_poller_t *poller,
+                         nbiot_socket_t *sock )
+{
+    struct epoll_event ev;
+
+    if ( NULL == poller ||
+         NULL == sock )
+    {
+        return NBIOT_ERR_BADPARAM;
+    }
+
+    nbiot_memzero( &ev, sizeof(ev) );
+    if ( epoll_ctl(poller->fd,EPOLL_CTL_DEL,sock->sock,&ev) )
+    {
+        return NBIOT_ERR_SOCKET;
+    }
+
+    return NBIOT_ERR_OK;
+}
+
+int nbiot_poller_wait( nbiot_poller_t *poller,
+                       void          **ready,
+                       size_t          size,
+                       size_t         *count,
+                       int             milliseconds )
+{
+    int i;
+    int ret;
+    struct epoll_event evs[64];
+
+    if ( NULL == poller ||
+         NULL == ready ||
+         NULL == count )
+    {
+        return NBIOT_ERR_BADPARAM;
+    }
+
+    *count = 0;
+    if ( size > sizeof(evs) / sizeof(evs[0]) )
+    {
+        size = sizeof(evs) / sizeof(evs[0]);
+    }
+
+    ret = epoll_wait( poller->fd,
+                      evs,
+                      (int)size,
+                      milliseconds < 0 ? -1 : milliseconds );
+    if ( ret < 0 )
+    {
+        return (EINTR == errno ? NBIOT_ERR_OK : NBIOT_ERR_SOCKET);
+    }
+
+    for ( i = 0; i < ret; ++i )
+    {
+        ready[i] = evs[i].data.ptr;
+    }
+
+    *count = ret;
+    return NBIOT_ERR_OK;
+}
+#else
+struct nbiot_poller_t
+{
+    struct pollfd *fds;
+    void         **data;
+    size_t         num;
+    size_t         size;
+};
+
+int nbiot_poller_create( nbiot_poller_t **poller )
+{
+    if ( NULL == poller )
+    {
+        return NBIOT_ERR_BADPARAM;
+    }
+
+    *poller = (nbiot_poller_t*)nbiot_malloc( sizeof(nbiot_poller_t) );
+    if ( NULL == *poller )
+    {
+        return NBIOT_ERR_NO_MEMORY;
+    }
+
+    nbiot_memzero( *poller, sizeof(nbiot_poller_t) );
+    return NBIOT_ERR_OK;
+}
+
+int nbiot_poller_close( nbiot_poller_t *poller )
+{
+    if ( NULL == poller )
+    {
+        return NBIOT_ERR_BADPARAM;
+    }
+
+    nbiot_free( poller->fds );
+    nbiot_free( poller->data );
+    nbiot_free( poller );
+
+    return NBIOT_ERR_OK;
+}
+
+int nbiot_poller_add( nbiot_poller_t *poller,
+                      nbiot_socket_t *sock,
+                      void           *data )
+{
+    if ( NULL == poller ||
+         NULL == sock )
+    {
+        return NBIOT_ERR_BADPARAM;
+    }
+
+    if ( poller->num == poller->size )
+    {
+        size_t size;
+        void **tmp_data;
+        struct pollfd *tmp_fds;
+
+        size = poller->size ? poller->size * 2 : 16;
+        tmp_fds = (struct pollfd*)nbiot_malloc( sizeof(struct pollfd) * size );
+        tmp_data = (void**)nbiot_malloc( sizeof(void*) * size );
+        if ( NULL == tmp_fds ||
+             NULL == tmp_data )
+        {
+            nbiot_free( tmp_fds );
+            nbiot_free( tmp_data );
+
+            return NBIOT_ERR_NO_MEMORY;
+        }
+
+        if ( poller->num )
+        {
+            nbiot_memmove( tmp_fds, poller->fds, sizeof(struct pollfd) * poller->num );
+            nbiot_memmove( tmp_data, poller->data, sizeof(void*) * poller->num );
+        }
+
+        nbiot_free( poller->fds );
+        nbiot_free( poller->data );
+        poller->fds = tmp_fds;
+        poller->data = tmp_data;
+        poller->size = size;
+    }
+
+    poller->fds[poller->num].fd = sock->sock;
+    poller->fds[poller->num].events = POLLIN;
+    poller->fds[poller->num].revents = 0;
+    poller->data[poller->num] = data;
+    poller->num++;
+
+    return NBIOT_ERR_OK;
+}
+
+int nbiot_poller_remove( nbiot_poller_t *poller,
+                         nbiot_socket_t *sock )
+{
+    size_t i;
+
+    if ( NULL == poller ||
+         NULL == sock )
+    {
+        return NBIOT_ERR_BADPARAM;
+    }
+
+    for ( i = 0; i < poller->num; ++i )
+    {
+        if ( poller->fds[i].fd == sock->sock )
+        {
+            poller->num--;
+            poller->fds[i] = poller->fds[poller->num];
+            poller->data[i] = poller->data[poller->num];
+
+            return NBIOT_ERR_OK;
+        }
+    }
+
+    return NBIOT_ERR_BADPARAM;
+}
+
+int nbiot_poller_wait( nbiot_poller_t *poller,
+                       void          **ready,
+                       size_t          size,
+                       size_t         *count,
+                       int             milliseconds )
+{
+    int ret;
+    size_t i;
+
+    if ( NULL == poller ||
+         NULL == ready ||
+         NULL == count )
+    {
+        return NBIOT_ERR_BADPARAM;
+    }
+
+    *count = 0;
+    ret = poll( poller->fds,
+                poller->num,
+                milliseconds < 0 ? -1 : milliseconds );
+    if ( ret < 0 )
+    {
+        return (EINTR == errno ? NBIOT_ERR_OK : NBIOT_ERR_SOCKET);
+    }
+
+    for ( i = 0; i < poller->num && *count < size; ++i )
+    {
+        if ( poller->fds[i].revents & POLLIN )
+        {
+            ready[(*count)++] = poller->data[i];
+        }
+    }
+
+    return NBIOT_ERR_OK;
+}
+#endif
+
 size_t nbiot_sockaddr_size( const nbiot_sockaddr_t *addr )
 {
     return sizeof(addr->addr);
@@ -6,28 +6,21 @@
 #include <platform.h>
 #include <time.h>
 #include <unistd.h>
-#include <sys/time.h>
 
 time_t nbiot_time( void )
 {
     return time( NULL );
 }
 
-#ifdef HAVE_DTLS
 clock_t nbiot_tick( void )
 {
-    static clock_t clock_offset = 0;
-    struct timeval tv;
+    struct timespec ts;
 
-    if ( 0 == clock_offset )
-    {
-        clock_offset = time(NULL);
-    }
-    gettimeofday( &tv, NULL );
+    /* 单调时钟，不受系统时间调整影响 */
+    clock_gettime( CLOCK_MONOTONIC, &ts );
 
-    return (tv.tv_sec-clock_offset)*CLOCK_PER_SECOND + tv.tv_usec*CLOCK_PER_SECOND/1000;
+    return (clock_t)ts.tv_sec*CLOCK_PER_SECOND + ts.tv_nsec/(1000000000/CLOCK_PER_SECOND);
 }
-#endif
 
 void nbiot_sleep( int milliseconds )
 {
@@ -5,6 +5,18 @@
 
 #include <platform.h>
 #include <winsock2.h>
+#include <windows.h>
+
+static SRWLOCK _nbiot_global_lock = SRWLOCK_INIT;
+void nbiot_global_lock( void )
+{
+    AcquireSRWLockExclusive( &_nbiot_global_lock );
+}
+
+void nbiot_global_unlock( void )
+{
+    ReleaseSRWLockExclusive( &_nbiot_global_lock );
+}
 
 static bool _nbiot_init_state = false;
 void nbiot_init_environment( void )
@@ -14,6 +26,9 @@ void nbiot_init_environment( void )
         WSADATA wsa;
 
         WSAStartup( MAKEWORD(2,2), &wsa );
+#ifdef NBIOT_MEMORY_POOL
+        nbiot_memory_init();
+#endif
         _nbiot_init_state = true;
     }
 }
@@ -22,6 +37,9 @@ void nbiot_clear_environment( void )
 {
     if ( _nbiot_init_state )
     {
+#ifdef NBIOT_MEMORY_POOL
+        nbiot_memory_clear();
+#endif
         WSACleanup();
         _nbiot_init_state = false;
     }
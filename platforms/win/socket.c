@@ -337,6 +337,248 @@ int nbiot_udp_recv( nbiot_socket_t    *sock,
     return NBIOT_ERR_OK;
 }
 
+int nbiot_udp_send_batch( nbiot_socket_t   *sock,
+                          nbiot_datagram_t *msgs,
+                          size_t            num,
+                          size_t           *count )
+{
+    int ret;
+
+    if ( NULL == sock ||
+         NULL == msgs ||
+         NULL == count )
+    {
+        return NBIOT_ERR_BADPARAM;
+    }
+
+    /* winsock没有批量接口，逐个发送 */
+    for ( *count = 0; *count < num; ++(*count) )
+    {
+        ret = nbiot_udp_send( sock,
+                              msgs[*count].buff,
+                              msgs[*count].size,
+                              &msgs[*count].len,
+                              msgs[*count].addr );
+        if ( ret )
+        {
+            return ret;
+        }
+
+        if ( 0 == msgs[*count].len )
+        {
+            break;
+        }
+    }
+
+    return NBIOT_ERR_OK;
+}
+
+int nbiot_udp_recv_batch( nbiot_socket_t   *sock,
+                          nbiot_datagram_t *msgs,
+                          size_t            num,
+                          size_t           *count )
+{
+    int ret;
+
+    if ( NULL == sock ||
+         NULL == msgs ||
+         NULL == count )
+    {
+        return NBIOT_ERR_BADPARAM;
+    }
+
+    /* winsock没有批量接口，逐个接收 */
+    for ( *count = 0; *count < num; ++(*count) )
+    {
+        ret = nbiot_udp_recv( sock,
+                              msgs[*count].buff,
+                              msgs[*count].size,
+                              &msgs[*count].len,
+                              &msgs[*count].addr );
+        if ( ret )
+        {
+            return ret;
+        }
+
+        if ( 0 == msgs[*count].len )
+        {
+            break;
+        }
+    }
+
+    return NBIOT_ERR_OK;
+}
+
+int nbiot_udp_wait( nbiot_socket_t *sock,
+                    int             milliseconds )
+{
+    int ret;
+    fd_set rfds;
+    struct timeval tv;
+
+    if ( NULL == sock )
+    {
+        return NBIOT_ERR_BADPARAM;
+    }
+
+    FD_ZERO( &rfds );
+    FD_SET( sock->sock, &rfds );
+    tv.tv_sec = milliseconds / 1000;
+    tv.tv_usec = (milliseconds % 1000) * 1000;
+    ret = select( 0,
+                  &rfds,
+                  NULL,
+                  NULL,
+                  milliseconds < 0 ? NULL : &tv );
+    if ( SOCKET_ERROR == ret )
+    {
+        return NBIOT_ERR_SOCKET;
+    }
+
+    return NBIOT_ERR_OK;
+}
+
+struct nbiot_poller_t
+{
+    SOCKET socks[FD_SETSIZE];
+    void  *data[FD_SETSIZE];
+    size_t num;
+};
+
+int nbiot_poller_create( nbiot_poller_t **poller )
+{
+    if ( NULL == poller )
+    {
+        return NBIOT_ERR_BADPARAM;
+    }
+
+    *poller = (nbiot_poller_t*)nbiot_malloc( sizeof(nbiot_poller_t) );
+    if ( NULL == *poller )
+    {
+        return NBIOT_ERR_NO_MEMORY;
+    }
+
+    nbiot_memzero( *poller, sizeof(nbiot_poller_t) );
+    return NBIOT_ERR_OK;
+}
+
+int nbiot_poller_close( nbiot_poller_t *poller )
+{
+    if ( NULL == poller )
+    {
+        return NBIOT_ERR_BADPARAM;
+    }
+
+    nbiot_free( poller );
+    return NBIOT_ERR_OK;
+}
+
+int nbiot_poller_add( nbiot_poller_t *poller,
+                      nbiot_socket_t *sock,
+                      void           *data )
+{
+    if ( NULL == poller ||
+         NULL == sock )
+    {
+        return NBIOT_ERR_BADPARAM;
+    }
+
+    if ( poller->num >= FD_SETSIZE )
+    {
+        return NBIOT_ERR_NO_MEMORY;
+    }
+
+    poller->socks[poller->num] = sock->sock;
+    poller->data[poller->num] = data;
+    poller->num++;
+
+    return NBIOT_ERR_OK;
+}
+
+int nbiot_poller_remove( nbiot_poller_t *poller,
+                         nbiot_socket_t *sock )
+{
+    size_t i;
+
+    if ( NULL == poller ||
+         NULL == sock )
+    {
+        return NBIOT_ERR_BADPARAM;
+    }
+
+    for ( i = 0; i < poller->num; ++i )
+    {
+        if ( poller->socks[i] == sock->sock )
+        {
+            poller->num--;
+            poller->socks[i] = poller->socks[poller->num];
+            poller->data[i] = poller->data[poller->num];
+
+            return NBIOT_ERR_OK;
+        }
+    }
+
+    return NBIOT_ERR_BADPARAM;
+}
+
+int nbiot_poller_wait( nbiot_poller_t *poller,
+                       void          **ready,
+                       size_t          size,
+                       size_t         *count,
+                       int             milliseconds )
+{
+    int ret;
+    size_t i;
+    fd_set rfds;
+    struct timeval tv;
+
+    if ( NULL == poller ||
+         NULL == ready ||
+         NULL == count )
+    {
+        return NBIOT_ERR_BADPARAM;
+    }
+
+    *count = 0;
+    if ( 0 == poller->num )
+    {
+        if ( milliseconds > 0 )
+        {
+            Sleep( milliseconds );
+        }
+
+        return NBIOT_ERR_OK;
+    }
+
+    FD_ZERO( &rfds );
+    for ( i = 0; i < poller->num; ++i )
+    {
+        FD_SET( poller->socks[i], &rfds );
+    }
+
+    tv.tv_sec = milliseconds / 1000;
+    tv.tv_usec = (milliseconds % 1000) * 1000;
+    ret = select( 0,
+                  &rfds,
+                  NULL,
+                  NULL,
+                  milliseconds < 0 ? NULL : &tv );
+    if ( SOCKET_ERROR == ret )
+    {
+        return NBIOT_ERR_SOCKET;
+    }
+
+    for ( i = 0; i < poller->num && *count < size; ++i )
+    {
+        if ( FD_ISSET(poller->socks[i],&rfds) )
+        {
+            ready[(*count)++] = poller->data[i];
+        }
+    }
+
+    return NBIOT_ERR_OK;
+}
+
 bool nbiot_sockaddr_equal( const nbiot_sockaddr_t *addr1,
                            const nbiot_sockaddr_t *addr2 )
 {
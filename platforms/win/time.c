@@ -11,12 +11,10 @@ time_t nbiot_time( void )
     return time( NULL );
 }
 
-#ifdef HAVE_DTLS
 clock_t nbiot_tick( void )
 {
     return GetTickCount();
 }
-#endif
 
 void nbiot_sleep( int milliseconds )
 {
@@ -74,6 +74,20 @@ void execute_callback( nbiot_resource_t *res,
     }
 }
 
+/* drive the device for about one second, sleeping until data or a timer is due */
+int device_wait( nbiot_device_t *dev )
+{
+    int ret;
+    time_t curr = nbiot_time();
+
+    do
+    {
+        ret = nbiot_device_wait( dev, 1000 );
+    } while ( !ret && nbiot_time() == curr );
+
+    return ret;
+}
+
 int main( int argc, char *argv[] )
 {
     int life_time = 300;
@@ -269,24 +283,10 @@ int main( int argc, char *argv[] )
         i = 0;
         while ( i < life_time/10 )
         {
-            int j = 100;
-            while ( j > 0 )
-            {
-                ret = nbiot_device_step( dev, 1 );
-                if ( ret )
-                {
-                    nbiot_printf( "device step error, code = %d.\r\n", ret );
-                    break;
-                }
-                else
-                {
-                    --j;
-                    nbiot_sleep( 10 );
-                }
-            }
-
-            if ( j > 0 )
+            ret = device_wait( dev );
+            if ( ret )
             {
+                nbiot_printf( "device step error, code = %d.\r\n", ret );
                 break;
             }
             else
@@ -299,8 +299,6 @@ int main( int argc, char *argv[] )
         {
             while ( i < life_time )
             {
-                int j = 100;
-
                 /* ipso digital input - digital input state */
                 dis.value.as_bool = rand()%2 > 0;
                 nbiot_device_notify( dev,
@@ -340,23 +338,10 @@ int main( int argc, char *argv[] )
                                      aicv.instid,
                                      aicv.resid );
 
-                while ( j > 0 )
-                {
-                    ret = nbiot_device_step( dev, 1 );
-                    if ( ret )
-                    {
-                        nbiot_printf( "device step error, code = %d.\r\n", ret );
-                        break;
-                    }
-                    else
-                    {
-                        --j;
-                        nbiot_sleep( 10 );
-                    }
-                }
-
-                if ( j > 0 )
+                ret = device_wait( dev );
+                if ( ret )
                 {
+                    nbiot_printf( "device step error, code = %d.\r\n", ret );
                     break;
                 }
                 else
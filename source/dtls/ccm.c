@@ -128,7 +128,7 @@ static inline void encrypt( rijndael_ctx  *ctx,
                             unsigned char  S[DTLS_CCM_BLOCKSIZE] )
 {
 
-    static unsigned long counter_tmp;
+    unsigned long counter_tmp;
 
     SET_COUNTER( A, L, counter, counter_tmp );
     rijndael_encrypt( ctx, A, S );
@@ -16,18 +16,6 @@
 if ( Seed ) \
     dtls_hmac_update( Context, (Seed), (Length) )
 
-static dtls_cipher_context_t cipher_context;
-
-static inline dtls_cipher_context_t *dtls_cipher_context_get( void )
-{
-    return &cipher_context;
-}
-
-static inline void dtls_cipher_context_release( void )
-{
-    /* nothing */
-}
-
 static inline dtls_handshake_parameters_t* dtls_handshake_malloc( void )
 {
     return (dtls_handshake_parameters_t*)nbiot_malloc( sizeof(dtls_handshake_parameters_t) );
@@ -514,9 +502,9 @@ int dtls_encrypt( const unsigned char *src,
                   size_t               la )
 {
     int ret;
-    dtls_cipher_context_t *ctx = dtls_cipher_context_get();
+    dtls_cipher_context_t ctx; /* per call, keeps encryption reentrant */
 
-    ret = rijndael_set_key_enc_only( &ctx->data.ctx, key, 8 * keylen );
+    ret = rijndael_set_key_enc_only( &ctx.data.ctx, key, 8 * keylen );
     if ( ret < 0 )
     {
         /* cleanup everything in case the key has the wrong size */
@@ -526,10 +514,10 @@ int dtls_encrypt( const unsigned char *src,
 
     if ( src != buf )
         nbiot_memmove( buf, src, length );
-    ret = dtls_ccm_encrypt( &ctx->data, src, length, buf, nounce, aad, la );
+    ret = dtls_ccm_encrypt( &ctx.data, src, length, buf, nounce, aad, la );
 
 error:
-    dtls_cipher_context_release();
+    nbiot_memzero( &ctx, sizeof(ctx) );
     return ret;
 }
 
@@ -543,9 +531,9 @@ int dtls_decrypt( const unsigned char *src,
                   size_t               la )
 {
     int ret;
-    dtls_cipher_context_t *ctx = dtls_cipher_context_get();
+    dtls_cipher_context_t ctx; /* per call, keeps encryption reentrant */
 
-    ret = rijndael_set_key_enc_only( &ctx->data.ctx, key, 8 * keylen );
+    ret = rijndael_set_key_enc_only( &ctx.data.ctx, key, 8 * keylen );
     if ( ret < 0 )
     {
         /* cleanup everything in case the key has the wrong size */
@@ -555,9 +543,9 @@ int dtls_decrypt( const unsigned char *src,
 
     if ( src != buf )
         nbiot_memmove( buf, src, length );
-    ret = dtls_ccm_decrypt( &ctx->data, src, length, buf, nounce, aad, la );
+    ret = dtls_ccm_decrypt( &ctx.data, src, length, buf, nounce, aad, la );
 
 error:
-    dtls_cipher_context_release();
+    nbiot_memzero( &ctx, sizeof(ctx) );
     return ret;
 }
\ No newline at end of file
@@ -0,0 +1,721 @@
+﻿/**
+ * Copyright (c) 2017 China Mobile IOT.
+ * All rights reserved.
+**/
+
+#include "m2m.h"
+#include "struct.h"
+
+/* firmware object resources */
+#define RES_PACKAGE         0
+#define RES_PACKAGE_URI     1
+#define RES_UPDATE          2
+#define RES_STATE           3
+#define RES_UPDATE_RESULT   5
+#define RES_DELIVERY_METHOD 9
+
+/* delivery method: pull and push */
+#define DELIVERY_BOTH       2
+
+#ifdef HAVE_DTLS
+#define FIRMWARE_SCHEME     "coaps://"
+#define FIRMWARE_PORT       5684
+#else
+#define FIRMWARE_SCHEME     "coap://"
+#define FIRMWARE_PORT       5683
+#endif
+
+typedef struct _firmware_t
+{
+    lwm2m_list_t      inst;   /* instance 0, must be the first member */
+    nbiot_device_t   *dev;
+    nbiot_firmware_t *fw;
+    connection_t     *conn;   /* 下载连接（非服务连接时由固件对象释放） */
+    char             *uri;
+    uint8_t           state;
+    uint8_t           result;
+    size_t            size;   /* 已接收字节数 */
+    uint32_t          crc;
+}firmware_t;
+
+/* CRC-32 (reflected 0xEDB88320), one nibble at a time */
+static const uint32_t prv_crc_table[16] =
+{
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+    0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+    0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+static uint32_t prv_crc_update( uint32_t       crc,
+                                const uint8_t *buffer,
+                                size_t         length )
+{
+    size_t i;
+
+    for ( i = 0; i < length; ++i )
+    {
+        crc ^= buffer[i];
+        crc = (crc >> 4) ^ prv_crc_table[crc & 0x0F];
+        crc = (crc >> 4) ^ prv_crc_table[crc & 0x0F];
+    }
+
+    return crc;
+}
+
+static void prv_changed( firmware_t *fw,
+                         uint16_t    resid )
+{
+    lwm2m_uri_t uri;
+
+    uri.objectId = LWM2M_FIRMWARE_UPDATE_OBJECT_ID;
+    uri.instanceId = 0;
+    uri.resourceId = resid;
+    uri.flag = LWM2M_URI_FLAG_OBJECT_ID |
+               LWM2M_URI_FLAG_INSTANCE_ID |
+               LWM2M_URI_FLAG_RESOURCE_ID;
+    lwm2m_resource_value_changed( &fw->dev->lwm2m, &uri );
+}
+
+static void prv_set_state( firmware_t *fw,
+                           uint8_t     state,
+                           uint8_t     result )
+{
+    if ( fw->state != state )
+    {
+        fw->state = state;
+        prv_changed( fw, RES_STATE );
+    }
+
+    if ( fw->result != result )
+    {
+        fw->result = result;
+        prv_changed( fw, RES_UPDATE_RESULT );
+    }
+}
+
+static void prv_release_conn( firmware_t *fw )
+{
+    connection_t *conn;
+
+    if ( NULL == fw->conn )
+    {
+        return;
+    }
+
+    /* nbiot_device_close()已销毁全部连接时不再释放 */
+    for ( conn = fw->dev->connlist; NULL != conn; conn = conn->next )
+    {
+        if ( conn == fw->conn )
+        {
+            lwm2m_close_connection( conn, fw->dev );
+            break;
+        }
+    }
+
+    fw->conn = NULL;
+}
+
+/* 终止下载并回到初始状态 */
+static void prv_reset( firmware_t *fw,
+                       uint8_t     result )
+{
+    if ( NBIOT_FIRMWARE_DOWNLOADING == fw->state )
+    {
+        lwm2m_download_stop( &fw->dev->lwm2m );
+    }
+    prv_release_conn( fw );
+    prv_set_state( fw, NBIOT_FIRMWARE_IDLE, result );
+}
+
+static void prv_begin( firmware_t *fw )
+{
+    fw->size = 0;
+    fw->crc = 0xFFFFFFFF;
+    prv_set_state( fw, NBIOT_FIRMWARE_DOWNLOADING, NBIOT_FIRMWARE_RESULT_INITIAL );
+}
+
+static bool prv_chunk( firmware_t    *fw,
+                       size_t         offset,
+                       const uint8_t *buffer,
+                       size_t         length )
+{
+    if ( NBIOT_FIRMWARE_DOWNLOADING != fw->state ||
+         offset != fw->size )
+    {
+        return false;
+    }
+
+    if ( length > 0 &&
+         NBIOT_ERR_OK != fw->fw->write(fw->fw, offset, buffer, length) )
+    {
+        prv_reset( fw, NBIOT_FIRMWARE_RESULT_NO_STORAGE );
+        return false;
+    }
+
+    fw->crc = prv_crc_update( fw->crc, buffer, length );
+    fw->size += length;
+
+    return true;
+}
+
+static void prv_finish( firmware_t *fw )
+{
+    uint32_t crc;
+
+    prv_release_conn( fw );
+
+    crc = ~fw->crc;
+    if ( NULL != fw->fw->verify &&
+         NBIOT_ERR_OK != fw->fw->verify(fw->fw, fw->size, crc) )
+    {
+        prv_set_state( fw, NBIOT_FIRMWARE_IDLE, NBIOT_FIRMWARE_RESULT_CRC_FAILED );
+    }
+    else
+    {
+        prv_set_state( fw, NBIOT_FIRMWARE_DOWNLOADED, NBIOT_FIRMWARE_RESULT_INITIAL );
+    }
+}
+
+static bool prv_download( uint8_t  status,
+                          uint32_t offset,
+                          uint8_t *buffer,
+                          size_t   length,
+                          void    *userdata )
+{
+    firmware_t *fw;
+
+    fw = (firmware_t*)userdata;
+    if ( NULL == buffer )
+    {
+        prv_release_conn( fw );
+        prv_set_state( fw,
+                       NBIOT_FIRMWARE_IDLE,
+                       COAP_404_NOT_FOUND == status ? NBIOT_FIRMWARE_RESULT_INVALID_URI :
+                                                      NBIOT_FIRMWARE_RESULT_CONNECTION_LOST );
+        return false;
+    }
+
+    if ( !prv_chunk(fw,offset,buffer,length) )
+    {
+        /* the download ends when false is returned */
+        if ( NBIOT_FIRMWARE_DOWNLOADING == fw->state )
+        {
+            prv_release_conn( fw );
+            prv_set_state( fw, NBIOT_FIRMWARE_IDLE, NBIOT_FIRMWARE_RESULT_CONNECTION_LOST );
+        }
+
+        return false;
+    }
+
+    if ( COAP_205_CONTENT == status )
+    {
+        prv_finish( fw );
+    }
+
+    return true;
+}
+
+/* 解析"coap://host[:port]/path"并开始下载 */
+static uint8_t prv_start( firmware_t *fw,
+                          const char *uri,
+                          size_t      length )
+{
+    char *host;
+    const char *addr;
+    const char *port;
+    const char *path;
+    const char *end;
+    connection_t *conn;
+    int ret;
+
+    end = uri + length;
+    if ( length <= sizeof(FIRMWARE_SCHEME) - 1 ||
+         nbiot_strncmp(uri,FIRMWARE_SCHEME,sizeof(FIRMWARE_SCHEME) - 1) )
+    {
+        return NBIOT_FIRMWARE_RESULT_PROTOCOL;
+    }
+
+    addr = uri + sizeof(FIRMWARE_SCHEME) - 1;
+    for ( path = addr; path < end && '/' != *path; ++path );
+    for ( port = addr; port < path && ':' != *port; ++port );
+    if ( port == addr )
+    {
+        return NBIOT_FIRMWARE_RESULT_INVALID_URI;
+    }
+
+    ret = FIRMWARE_PORT;
+    if ( port < path )
+    {
+        const char *ch;
+
+        ret = 0;
+        for ( ch = port + 1; ch < path && ret <= 0xFFFF; ++ch )
+        {
+            if ( *ch < '0' || *ch > '9' )
+            {
+                return NBIOT_FIRMWARE_RESULT_INVALID_URI;
+            }
+
+            ret = ret * 10 + (*ch - '0');
+        }
+
+        if ( 0 == ret || ret > 0xFFFF )
+        {
+            return NBIOT_FIRMWARE_RESULT_INVALID_URI;
+        }
+    }
+
+    /* host和path共用一块内存 */
+    if ( path < end )
+    {
+        ++path;
+    }
+    host = (char*)nbiot_malloc( (port - addr) + (end - path) + 2 );
+    if ( NULL == host )
+    {
+        return NBIOT_FIRMWARE_RESULT_NO_MEMORY;
+    }
+
+    nbiot_memmove( host, addr, port - addr );
+    host[port - addr] = '\0';
+    nbiot_memmove( host + (port - addr) + 1, path, end - path );
+    host[(port - addr) + 1 + (end - path)] = '\0';
+
+    conn = connection_create( fw->dev->connlist,
+                              fw->dev->sock,
+                              host,
+                              (uint16_t)ret );
+    if ( conn == fw->dev->connlist )
+    {
+        nbiot_free( host );
+        return NBIOT_FIRMWARE_RESULT_INVALID_URI;
+    }
+
+    /* 与服务连接地址相同时复用服务连接 */
+    fw->dev->connlist = conn;
+    fw->conn = connection_find( conn->next, conn->addr );
+    if ( NULL != fw->conn )
+    {
+        fw->dev->connlist = connection_remove( conn, conn );
+        conn = fw->conn;
+        fw->conn = NULL;
+    }
+    else
+    {
+        fw->conn = conn;
+    }
+
+    prv_begin( fw );
+    ret = lwm2m_download_start( &fw->dev->lwm2m,
+                                conn,
+                                host + (port - addr) + 1,
+                                prv_download,
+                                fw );
+    nbiot_free( host );
+    if ( ret )
+    {
+        prv_release_conn( fw );
+        return NBIOT_FIRMWARE_RESULT_CONNECTION_LOST;
+    }
+
+    return NBIOT_FIRMWARE_RESULT_INITIAL;
+}
+
+static uint8_t prv_write_uri( firmware_t   *fw,
+                              lwm2m_data_t *data )
+{
+    uint8_t result;
+
+    if ( LWM2M_TYPE_STRING != data->type &&
+         LWM2M_TYPE_OPAQUE != data->type )
+    {
+        return COAP_400_BAD_REQUEST;
+    }
+
+    prv_reset( fw, NBIOT_FIRMWARE_RESULT_INITIAL );
+    nbiot_free( fw->uri );
+    fw->uri = NULL;
+
+    /* 空URI表示取消 */
+    if ( 0 == data->value.asBuffer.length )
+    {
+        return COAP_204_CHANGED;
+    }
+
+    fw->uri = (char*)nbiot_malloc( data->value.asBuffer.length + 1 );
+    if ( NULL == fw->uri )
+    {
+        return COAP_500_INTERNAL_SERVER_ERROR;
+    }
+    nbiot_memmove( fw->uri, data->value.asBuffer.buffer, data->value.asBuffer.length );
+    fw->uri[data->value.asBuffer.length] = '\0';
+
+    result = prv_start( fw, fw->uri, data->value.asBuffer.length );
+    if ( NBIOT_FIRMWARE_RESULT_INITIAL != result )
+    {
+        prv_set_state( fw, NBIOT_FIRMWARE_IDLE, result );
+    }
+
+    return COAP_204_CHANGED;
+}
+
+static uint8_t prv_write_package( firmware_t   *fw,
+                                  lwm2m_data_t *data )
+{
+    if ( LWM2M_TYPE_STRING != data->type &&
+         LWM2M_TYPE_OPAQUE != data->type )
+    {
+        return COAP_400_BAD_REQUEST;
+    }
+
+    prv_reset( fw, NBIOT_FIRMWARE_RESULT_INITIAL );
+
+    /* 空固件包表示取消 */
+    if ( 0 == data->value.asBuffer.length )
+    {
+        return COAP_204_CHANGED;
+    }
+
+    prv_begin( fw );
+    if ( !prv_chunk(fw,
+                    0,
+                    data->value.asBuffer.buffer,
+                    data->value.asBuffer.length) )
+    {
+        return COAP_500_INTERNAL_SERVER_ERROR;
+    }
+    prv_finish( fw );
+
+    return COAP_204_CHANGED;
+}
+
+static uint8_t prv_firmware_read( uint16_t        instid,
+                                  int            *num,
+                                  lwm2m_data_t  **data,
+                                  lwm2m_object_t *obj )
+{
+    int i;
+    firmware_t *fw;
+
+    fw = (firmware_t*)obj->userData;
+    if ( 0 != instid )
+    {
+        return COAP_404_NOT_FOUND;
+    }
+
+    /* is the server asking for the full instance ? */
+    if ( 0 == *num )
+    {
+        *data = lwm2m_data_new_arena( obj->dataArena, 4 );
+        if ( NULL == *data )
+        {
+            return COAP_500_INTERNAL_SERVER_ERROR;
+        }
+
+        *num = 4;
+        (*data)[0].id = RES_PACKAGE_URI;
+        (*data)[1].id = RES_STATE;
+        (*data)[2].id = RES_UPDATE_RESULT;
+        (*data)[3].id = RES_DELIVERY_METHOD;
+    }
+
+    for ( i = 0; i < *num; ++i )
+    {
+        switch ( (*data)[i].id )
+        {
+            case RES_PACKAGE_URI:
+            {
+                lwm2m_data_encode_string( NULL != fw->uri ? fw->uri : "", (*data) + i );
+            }
+            break;
+
+            case RES_STATE:
+            {
+                lwm2m_data_encode_int( fw->state, (*data) + i );
+            }
+            break;
+
+            case RES_UPDATE_RESULT:
+            {
+                lwm2m_data_encode_int( fw->result, (*data) + i );
+            }
+            break;
+
+            case RES_DELIVERY_METHOD:
+            {
+                lwm2m_data_encode_int( DELIVERY_BOTH, (*data) + i );
+            }
+            break;
+
+            case RES_PACKAGE:
+            case RES_UPDATE:
+            {
+                return COAP_405_METHOD_NOT_ALLOWED;
+            }
+            break;
+
+            default:
+            {
+                return COAP_404_NOT_FOUND;
+            }
+            break;
+        }
+    }
+
+    return COAP_205_CONTENT;
+}
+
+static uint8_t prv_firmware_write( uint16_t        instid,
+                                   int             num,
+                                   lwm2m_data_t   *data,
+                                   lwm2m_object_t *obj )
+{
+    int i;
+    uint8_t ret;
+    firmware_t *fw;
+
+    fw = (firmware_t*)obj->userData;
+    if ( 0 != instid )
+    {
+        return COAP_404_NOT_FOUND;
+    }
+
+    ret = COAP_204_CHANGED;
+    for ( i = 0; i < num && COAP_204_CHANGED == ret; ++i )
+    {
+        switch ( data[i].id )
+        {
+            case RES_PACKAGE:
+            {
+                ret = prv_write_package( fw, data + i );
+            }
+            break;
+
+            case RES_PACKAGE_URI:
+            {
+                ret = prv_write_uri( fw, data + i );
+            }
+            break;
+
+            case RES_UPDATE:
+            case RES_STATE:
+            case RES_UPDATE_RESULT:
+            case RES_DELIVERY_METHOD:
+            {
+                ret = COAP_405_METHOD_NOT_ALLOWED;
+            }
+            break;
+
+            default:
+            {
+                ret = COAP_404_NOT_FOUND;
+            }
+            break;
+        }
+    }
+
+    return ret;
+}
+
+static uint8_t prv_firmware_execute( uint16_t        instid,
+                                     uint16_t        resid,
+                                     uint8_t        *buffer,
+                                     int             length,
+                                     lwm2m_object_t *obj )
+{
+    firmware_t *fw;
+
+    fw = (firmware_t*)obj->userData;
+    if ( 0 != instid )
+    {
+        return COAP_404_NOT_FOUND;
+    }
+
+    if ( RES_UPDATE != resid ||
+         NBIOT_FIRMWARE_DOWNLOADED != fw->state )
+    {
+        return COAP_405_METHOD_NOT_ALLOWED;
+    }
+
+    prv_set_state( fw, NBIOT_FIRMWARE_UPDATING, NBIOT_FIRMWARE_RESULT_INITIAL );
+    if ( NBIOT_ERR_OK != fw->fw->update(fw->fw) )
+    {
+        prv_set_state( fw, NBIOT_FIRMWARE_DOWNLOADED, NBIOT_FIRMWARE_RESULT_UPDATE_FAILED );
+    }
+
+    return COAP_204_CHANGED;
+}
+
+static uint8_t prv_firmware_block( uint16_t        instid,
+                                   uint16_t        resid,
+                                   bool            execute,
+                                   uint32_t        offset,
+                                   uint8_t        *buffer,
+                                   int             length,
+                                   bool            more,
+                                   lwm2m_object_t *obj )
+{
+    firmware_t *fw;
+
+    fw = (firmware_t*)obj->userData;
+    if ( 0 != instid )
+    {
+        return COAP_404_NOT_FOUND;
+    }
+
+    if ( RES_PACKAGE != resid )
+    {
+        /* reassembled and passed to write/execute */
+        return COAP_IGNORE;
+    }
+
+    if ( execute )
+    {
+        return COAP_405_METHOD_NOT_ALLOWED;
+    }
+
+    /* 分块直接写入，不做整体缓存 */
+    if ( 0 == offset )
+    {
+        prv_reset( fw, NBIOT_FIRMWARE_RESULT_INITIAL );
+        prv_begin( fw );
+    }
+
+    if ( !prv_chunk(fw,offset,buffer,length) )
+    {
+        if ( NBIOT_FIRMWARE_DOWNLOADING == fw->state )
+        {
+            prv_set_state( fw, NBIOT_FIRMWARE_IDLE, NBIOT_FIRMWARE_RESULT_CONNECTION_LOST );
+        }
+
+        return COAP_500_INTERNAL_SERVER_ERROR;
+    }
+
+    if ( !more )
+    {
+        prv_finish( fw );
+    }
+
+    return COAP_204_CHANGED;
+}
+
+static uint8_t prv_firmware_discover( uint16_t        instid,
+                                      int            *num,
+                                      lwm2m_data_t  **data,
+                                      lwm2m_object_t *obj )
+{
+    if ( 0 != instid )
+    {
+        return COAP_404_NOT_FOUND;
+    }
+
+    /* is the server asking for the full instance ? */
+    if ( 0 == *num )
+    {
+        *data = lwm2m_data_new( 6 );
+        if ( NULL == *data )
+        {
+            return COAP_500_INTERNAL_SERVER_ERROR;
+        }
+
+        *num = 6;
+        (*data)[0].id = RES_PACKAGE;
+        (*data)[1].id = RES_PACKAGE_URI;
+        (*data)[2].id = RES_UPDATE;
+        (*data)[3].id = RES_STATE;
+        (*data)[4].id = RES_UPDATE_RESULT;
+        (*data)[5].id = RES_DELIVERY_METHOD;
+    }
+
+    return COAP_205_CONTENT;
+}
+
+int create_firmware_object( lwm2m_object_t   *obj,
+                            nbiot_device_t   *dev,
+                            nbiot_firmware_t *fw )
+{
+    firmware_t *tmp;
+
+    if ( NULL == obj ||
+         NULL == dev ||
+         NULL == fw ||
+         NULL == fw->write ||
+         NULL == fw->update )
+    {
+        return NBIOT_ERR_BADPARAM;
+    }
+
+    tmp = (firmware_t*)nbiot_malloc( sizeof(firmware_t) );
+    if ( NULL == tmp )
+    {
+        return NBIOT_ERR_NO_MEMORY;
+    }
+
+    nbiot_memzero( tmp, sizeof(firmware_t) );
+    tmp->dev = dev;
+    tmp->fw = fw;
+
+    obj->objID        = LWM2M_FIRMWARE_UPDATE_OBJECT_ID;
+    obj->instanceList = &tmp->inst;
+    obj->readFunc     = prv_firmware_read;
+    obj->writeFunc    = prv_firmware_write;
+    obj->executeFunc  = prv_firmware_execute;
+    obj->blockFunc    = prv_firmware_block;
+    obj->discoverFunc = prv_firmware_discover;
+    obj->userData     = tmp;
+
+    return NBIOT_ERR_OK;
+}
+
+int result_firmware_object( lwm2m_object_t *obj,
+                            uint8_t         result )
+{
+    firmware_t *fw;
+
+    if ( NULL == obj ||
+         NULL == obj->userData ||
+         result > NBIOT_FIRMWARE_RESULT_PROTOCOL )
+    {
+        return NBIOT_ERR_BADPARAM;
+    }
+
+    /* 升级失败时固件包仍然可用 */
+    fw = (firmware_t*)obj->userData;
+    if ( NBIOT_FIRMWARE_UPDATING == fw->state &&
+         NBIOT_FIRMWARE_RESULT_SUCCESS != result )
+    {
+        prv_set_state( fw, NBIOT_FIRMWARE_DOWNLOADED, result );
+    }
+    else
+    {
+        prv_reset( fw, result );
+    }
+
+    return NBIOT_ERR_OK;
+}
+
+void clear_firmware_object( lwm2m_object_t *obj )
+{
+    firmware_t *fw;
+
+    if ( NULL == obj ||
+         NULL == obj->userData )
+    {
+        return;
+    }
+
+    fw = (firmware_t*)obj->userData;
+    if ( NBIOT_FIRMWARE_DOWNLOADING == fw->state &&
+         NULL != fw->dev->lwm2m.downloadP )
+    {
+        lwm2m_download_stop( &fw->dev->lwm2m );
+    }
+    prv_release_conn( fw );
+
+    lwm2m_list_index_clear( &obj->instanceIndex );
+    nbiot_free( fw->uri );
+    nbiot_free( fw );
+    obj->instanceList = NULL;
+    obj->userData = NULL;
+}
@@ -0,0 +1,330 @@
+﻿/**
+ * Copyright (c) 2017 China Mobile IOT.
+ * All rights reserved.
+**/
+
+#include <nbiot.h>
+#include "struct.h"
+
+/* 单轮最多处理的可读设备数 */
+#define NBIOT_LOOP_EVENTS      64
+/* 设备空闲时的最长定时（毫秒） */
+#define NBIOT_LOOP_MAX_TIMEOUT (3600 * CLOCK_PER_SECOND)
+
+struct nbiot_loop_t
+{
+    nbiot_poller_t       *poller;
+    nbiot_device_t      **heap; /* 按deadline排列的最小堆 */
+    size_t                num;
+    size_t                size;
+    void                **ready; /* nbiot_loop_run正在分发的可读设备 */
+    size_t                ready_num;
+    nbiot_loop_callback_t callback;
+};
+
+static void nbiot_loop_swap( nbiot_loop_t *loop,
+                             size_t        i,
+                             size_t        j )
+{
+    nbiot_device_t *tmp;
+
+    tmp = loop->heap[i];
+    loop->heap[i] = loop->heap[j];
+    loop->heap[j] = tmp;
+    loop->heap[i]->loop_index = i;
+    loop->heap[j]->loop_index = j;
+}
+
+static void nbiot_loop_sift_up( nbiot_loop_t *loop,
+                                size_t        i )
+{
+    while ( i > 0 )
+    {
+        size_t parent = (i - 1) / 2;
+
+        if ( !NBIOT_TICK_BEFORE(loop->heap[i]->deadline,
+                                loop->heap[parent]->deadline) )
+        {
+            break;
+        }
+
+        nbiot_loop_swap( loop, i, parent );
+        i = parent;
+    }
+}
+
+static void nbiot_loop_sift_down( nbiot_loop_t *loop,
+                                  size_t        i )
+{
+    while ( 1 )
+    {
+        size_t min = i;
+        size_t left = i * 2 + 1;
+        size_t right = left + 1;
+
+        if ( left < loop->num &&
+             NBIOT_TICK_BEFORE(loop->heap[left]->deadline,
+                               loop->heap[min]->deadline) )
+        {
+            min = left;
+        }
+
+        if ( right < loop->num &&
+             NBIOT_TICK_BEFORE(loop->heap[right]->deadline,
+                               loop->heap[min]->deadline) )
+        {
+            min = right;
+        }
+
+        if ( min == i )
+        {
+            break;
+        }
+
+        nbiot_loop_swap( loop, i, min );
+        i = min;
+    }
+}
+
+static void nbiot_loop_schedule( nbiot_loop_t   *loop,
+                                 nbiot_device_t *dev,
+                                 clock_t         deadline )
+{
+    clock_t prev = dev->deadline;
+
+    dev->deadline = deadline;
+    if ( NBIOT_TICK_BEFORE(deadline,prev) )
+    {
+        nbiot_loop_sift_up( loop, dev->loop_index );
+    }
+    else
+    {
+        nbiot_loop_sift_down( loop, dev->loop_index );
+    }
+}
+
+static void nbiot_loop_dispatch( nbiot_loop_t   *loop,
+                                 nbiot_device_t *dev )
+{
+    int ret;
+    clock_t next = NBIOT_LOOP_MAX_TIMEOUT;
+
+    ret = nbiot_device_process( dev, &next );
+    if ( ret )
+    {
+        /* 出错后延迟重试，避免空转 */
+        next = CLOCK_PER_SECOND;
+    }
+    else if ( next < 0 )
+    {
+        next = 0;
+    }
+
+    nbiot_loop_schedule( loop, dev, NBIOT_TICK_ADD(nbiot_tick(),next) );
+    if ( ret && NULL != loop->callback )
+    {
+        loop->callback( dev, ret );
+    }
+}
+
+int nbiot_loop_create( nbiot_loop_t        **loop,
+                       nbiot_loop_callback_t callback )
+{
+    nbiot_loop_t *tmp;
+
+    if ( NULL == loop )
+    {
+        return NBIOT_ERR_BADPARAM;
+    }
+
+    tmp = (nbiot_loop_t*)nbiot_malloc( sizeof(nbiot_loop_t) );
+    if ( NULL == tmp )
+    {
+        return NBIOT_ERR_NO_MEMORY;
+    }
+
+    nbiot_memzero( tmp, sizeof(nbiot_loop_t) );
+    if ( nbiot_poller_create(&tmp->poller) )
+    {
+        nbiot_free( tmp );
+
+        return NBIOT_ERR_SOCKET;
+    }
+
+    tmp->callback = callback;
+    *loop = tmp;
+
+    return NBIOT_ERR_OK;
+}
+
+void nbiot_loop_destroy( nbiot_loop_t *loop )
+{
+    if ( NULL != loop )
+    {
+        while ( loop->num > 0 )
+        {
+            nbiot_loop_remove( loop, loop->heap[loop->num - 1] );
+        }
+
+        nbiot_poller_close( loop->poller );
+        nbiot_free( loop->heap );
+        nbiot_free( loop );
+    }
+}
+
+int nbiot_loop_add( nbiot_loop_t   *loop,
+                    nbiot_device_t *dev )
+{
+    int ret;
+
+    if ( NULL == loop ||
+         NULL == dev ||
+         NULL == dev->sock ||
+         NULL != dev->loop )
+    {
+        return NBIOT_ERR_BADPARAM;
+    }
+
+    if ( loop->num == loop->size )
+    {
+        size_t size;
+        nbiot_device_t **heap;
+
+        size = loop->size ? loop->size * 2 : 16;
+        heap = (nbiot_device_t**)nbiot_malloc( sizeof(nbiot_device_t*) * size );
+        if ( NULL == heap )
+        {
+            return NBIOT_ERR_NO_MEMORY;
+        }
+
+        if ( loop->num )
+        {
+            nbiot_memmove( heap, loop->heap, sizeof(nbiot_device_t*) * loop->num );
+        }
+
+        nbiot_free( loop->heap );
+        loop->heap = heap;
+        loop->size = size;
+    }
+
+    ret = nbiot_poller_add( loop->poller, dev->sock, dev );
+    if ( ret )
+    {
+        return ret;
+    }
+
+    /* 加入后立即驱动一次 */
+    dev->loop = loop;
+    dev->deadline = nbiot_tick();
+    dev->loop_index = loop->num;
+    loop->heap[loop->num++] = dev;
+    nbiot_loop_sift_up( loop, dev->loop_index );
+
+    return NBIOT_ERR_OK;
+}
+
+int nbiot_loop_remove( nbiot_loop_t   *loop,
+                       nbiot_device_t *dev )
+{
+    size_t i;
+
+    if ( NULL == loop ||
+         NULL == dev ||
+         loop != dev->loop )
+    {
+        return NBIOT_ERR_BADPARAM;
+    }
+
+    nbiot_poller_remove( loop->poller, dev->sock );
+
+    /* 回调中移出（或销毁）的设备不再分发 */
+    for ( i = 0; i < loop->ready_num; ++i )
+    {
+        if ( loop->ready[i] == dev )
+        {
+            loop->ready[i] = NULL;
+        }
+    }
+
+    i = dev->loop_index;
+    loop->num--;
+    if ( i != loop->num )
+    {
+        loop->heap[i] = loop->heap[loop->num];
+        loop->heap[i]->loop_index = i;
+        nbiot_loop_sift_up( loop, i );
+        nbiot_loop_sift_down( loop, loop->heap[i]->loop_index );
+    }
+
+    dev->loop = NULL;
+    dev->loop_index = 0;
+
+    return NBIOT_ERR_OK;
+}
+
+int nbiot_loop_run( nbiot_loop_t *loop,
+                    int           timeout )
+{
+    int ret;
+    size_t i;
+    size_t count;
+    clock_t now;
+    void *ready[NBIOT_LOOP_EVENTS];
+
+    if ( NULL == loop ||
+         timeout < 0 )
+    {
+        return NBIOT_ERR_BADPARAM;
+    }
+
+    /* 等待至最近的定时时刻 */
+    now = nbiot_tick();
+    if ( loop->num > 0 )
+    {
+        long wait = NBIOT_TICK_DIFF(loop->heap[0]->deadline,now);
+
+        if ( wait <= 0 )
+        {
+            timeout = 0;
+        }
+        else if ( wait < timeout )
+        {
+            timeout = (int)wait;
+        }
+    }
+
+    ret = nbiot_poller_wait( loop->poller,
+                             ready,
+                             NBIOT_LOOP_EVENTS,
+                             &count,
+                             timeout );
+    if ( ret )
+    {
+        return ret;
+    }
+
+    /* 可读设备（回调可能移出或销毁后面的设备，分发前再检查） */
+    loop->ready = ready;
+    loop->ready_num = count;
+    for ( i = 0; i < count; ++i )
+    {
+        if ( NULL != ready[i] )
+        {
+            nbiot_loop_dispatch( loop, (nbiot_device_t*)ready[i] );
+        }
+    }
+    loop->ready = NULL;
+    loop->ready_num = 0;
+
+    /* 定时到期设备（每轮最多驱动num次，避免立即到期的设备空转） */
+    now = nbiot_tick();
+    count = loop->num;
+    while ( count-- > 0 &&
+            loop->num > 0 &&
+            !NBIOT_TICK_BEFORE(now,loop->heap[0]->deadline) )
+    {
+        nbiot_loop_dispatch( loop, loop->heap[0] );
+    }
+
+    return NBIOT_ERR_OK;
+}
@@ -7,8 +7,8 @@
 
 #include "internals.h"
 
-/* the maximum payload transfered by block1 we accumulate per server */
-#define MAX_BLOCK1_SIZE 4096
+/* how long a block2 representation is kept after the last block request */
+#define BLOCK2_LIFETIME ((clock_t)(COAP_MAX_TRANSMIT_WAIT * CLOCK_PER_SECOND))
 
 coap_status_t coap_block1_handler( lwm2m_block1_data_t ** pBlock1Data,
                                    uint16_t mid,
@@ -17,14 +17,24 @@ coap_status_t coap_block1_handler( lwm2m_block1_data_t ** pBlock1Data,
                                    uint16_t blockSize,
                                    uint32_t blockNum,
                                    bool blockMore,
+                                   uint32_t totalSize,
                                    uint8_t ** outputBuffer,
                                    size_t * outputLength )
 {
-    lwm2m_block1_data_t * block1Data = *pBlock1Data;;
+    lwm2m_block1_data_t * block1Data = *pBlock1Data;
 
     /* manage new block1 transfer */
     if ( blockNum == 0 )
     {
+        size_t capacity;
+
+        /* Size1 announces the whole payload, allocate it once */
+        if ( totalSize > MAX_BLOCK1_SIZE || length > MAX_BLOCK1_SIZE )
+        {
+            return COAP_413_ENTITY_TOO_LARGE;
+        }
+        capacity = totalSize > length ? totalSize : length;
+
         /* we already have block1 data for this server, clear it */
         if ( block1Data != NULL )
         {
@@ -36,8 +46,13 @@ coap_status_t coap_block1_handler( lwm2m_block1_data_t ** pBlock1Data,
             *pBlock1Data = block1Data;
             if ( NULL == block1Data ) return COAP_500_INTERNAL_SERVER_ERROR;
         }
+        block1Data->streaming = false;
+        block1Data->block1bufferSize = 0;
+        block1Data->block1bufferCapacity = 0;
 
-        block1Data->block1buffer = nbiot_malloc( length );
+        block1Data->block1buffer = nbiot_malloc( capacity );
+        if ( NULL == block1Data->block1buffer && capacity > 0 ) return COAP_500_INTERNAL_SERVER_ERROR;
+        block1Data->block1bufferCapacity = capacity;
         block1Data->block1bufferSize = length;
 
         /* write new block in buffer */
@@ -47,7 +62,7 @@ coap_status_t coap_block1_handler( lwm2m_block1_data_t ** pBlock1Data,
     /* manage already started block1 transfer */
     else
     {
-        if ( block1Data == NULL )
+        if ( block1Data == NULL || block1Data->streaming )
         {
             /* we never receive the first block */
             /* TODO should we clean block1 data for this server ? */
@@ -57,8 +72,7 @@ coap_status_t coap_block1_handler( lwm2m_block1_data_t ** pBlock1Data,
         /* If this is a retransmission, we already did that. */
         if ( block1Data->lastmid != mid )
         {
-            uint8_t * oldBuffer;
-            size_t oldSize;
+            size_t size;
 
             if ( block1Data->block1bufferSize != blockSize * blockNum )
             {
@@ -68,22 +82,33 @@ coap_status_t coap_block1_handler( lwm2m_block1_data_t ** pBlock1Data,
             }
 
             /* is it too large? */
-            if ( block1Data->block1bufferSize + length >= MAX_BLOCK1_SIZE )
+            size = block1Data->block1bufferSize + length;
+            if ( size > MAX_BLOCK1_SIZE )
             {
                 return COAP_413_ENTITY_TOO_LARGE;
             }
 
-            /* re-alloc new buffer */
-            oldBuffer = block1Data->block1buffer;
-            oldSize = block1Data->block1bufferSize;
-            block1Data->block1bufferSize = oldSize + length;
-            block1Data->block1buffer = nbiot_malloc( block1Data->block1bufferSize );
-            if ( NULL == block1Data->block1buffer ) return COAP_500_INTERNAL_SERVER_ERROR;
-            nbiot_memmove( block1Data->block1buffer, oldBuffer, oldSize );
-            nbiot_free( oldBuffer );
+            /* grow geometrically, each byte is copied a bounded number of times */
+            if ( size > block1Data->block1bufferCapacity )
+            {
+                uint8_t * newBuffer;
+                size_t capacity;
+
+                capacity = block1Data->block1bufferCapacity * 2;
+                if ( capacity < size ) capacity = size;
+                if ( capacity > MAX_BLOCK1_SIZE ) capacity = MAX_BLOCK1_SIZE;
+
+                newBuffer = nbiot_malloc( capacity );
+                if ( NULL == newBuffer ) return COAP_500_INTERNAL_SERVER_ERROR;
+                nbiot_memmove( newBuffer, block1Data->block1buffer, block1Data->block1bufferSize );
+                nbiot_free( block1Data->block1buffer );
+                block1Data->block1buffer = newBuffer;
+                block1Data->block1bufferCapacity = capacity;
+            }
 
             /* write new block in buffer */
-            nbiot_memmove( block1Data->block1buffer + oldSize, buffer, length );
+            nbiot_memmove( block1Data->block1buffer + block1Data->block1bufferSize, buffer, length );
+            block1Data->block1bufferSize = size;
             block1Data->lastmid = mid;
         }
     }
@@ -104,6 +129,120 @@ coap_status_t coap_block1_handler( lwm2m_block1_data_t ** pBlock1Data,
     }
 }
 
+coap_status_t coap_block1_stream( lwm2m_context_t * contextP,
+                                  lwm2m_block1_data_t ** pBlock1Data,
+                                  coap_packet_t * message,
+                                  uint16_t blockSize,
+                                  uint32_t blockNum,
+                                  bool blockMore )
+{
+    lwm2m_block1_data_t * block1Data = *pBlock1Data;
+    lwm2m_uri_t * uriP;
+    coap_status_t result;
+
+    /* only the raw value of a single resource can be handed over as it comes */
+    if ( message->code != COAP_PUT && message->code != COAP_POST ) return COAP_IGNORE;
+    if ( message->code == COAP_PUT
+         && (IS_OPTION( message, COAP_OPTION_URI_QUERY )
+             || (message->content_type != LWM2M_CONTENT_TEXT
+                 && message->content_type != LWM2M_CONTENT_OPAQUE)) )
+    {
+        return COAP_IGNORE;
+    }
+
+    uriP = uri_decode( NULL, message->uri_path );
+    if ( uriP == NULL ) return COAP_IGNORE;
+
+    if ( blockNum == 0 )
+    {
+        /* If this is a retransmission, the object already has it. */
+        if ( block1Data != NULL
+             && block1Data->streaming
+             && block1Data->lastmid == message->mid
+             && block1Data->block1bufferSize == message->payload_len )
+        {
+            nbiot_free( uriP );
+            return block1Data->lastResult;
+        }
+
+        if ( (uriP->flag & LWM2M_URI_MASK_TYPE) != LWM2M_URI_FLAG_DM
+             || !LWM2M_URI_IS_SET_RESOURCE( uriP ) )
+        {
+            nbiot_free( uriP );
+            return COAP_IGNORE;
+        }
+
+        /* a new transfer replaces the previous one */
+        if ( block1Data != NULL )
+        {
+            nbiot_free( block1Data->block1buffer );
+        }
+        else
+        {
+            block1Data = nbiot_malloc( sizeof(lwm2m_block1_data_t) );
+            *pBlock1Data = block1Data;
+            if ( NULL == block1Data )
+            {
+                nbiot_free( uriP );
+                return COAP_500_INTERNAL_SERVER_ERROR;
+            }
+        }
+        block1Data->block1buffer = NULL;
+        block1Data->block1bufferSize = 0;
+        block1Data->block1bufferCapacity = 0;
+        block1Data->execute = message->code == COAP_POST;
+        block1Data->uri = *uriP;
+        block1Data->streaming = false;
+        nbiot_free( uriP );
+
+        result = object_writeBlock( contextP, &block1Data->uri, block1Data->execute, 0, message->payload, message->payload_len, blockMore );
+        if ( result == COAP_IGNORE ) return COAP_IGNORE;
+        block1Data->streaming = true;
+    }
+    else
+    {
+        bool match;
+
+        if ( block1Data == NULL || !block1Data->streaming )
+        {
+            nbiot_free( uriP );
+            return COAP_IGNORE;
+        }
+
+        match = uriP->flag == block1Data->uri.flag
+             && uriP->objectId == block1Data->uri.objectId
+             && uriP->instanceId == block1Data->uri.instanceId
+             && uriP->resourceId == block1Data->uri.resourceId
+             && (message->code == COAP_POST) == block1Data->execute;
+        nbiot_free( uriP );
+
+        /* If this is a retransmission, the object already has it. */
+        if ( match && block1Data->lastmid == message->mid ) return block1Data->lastResult;
+
+        if ( !match || block1Data->block1bufferSize != blockSize * blockNum )
+        {
+            return COAP_408_REQ_ENTITY_INCOMPLETE;
+        }
+
+        result = object_writeBlock( contextP, &block1Data->uri, block1Data->execute, block1Data->block1bufferSize, message->payload, message->payload_len, blockMore );
+    }
+
+    if ( result == COAP_204_CHANGED && blockMore ) result = COAP_231_CONTINUE;
+    if ( result != COAP_231_CONTINUE && result != COAP_204_CHANGED )
+    {
+        /* the object gave up, later blocks are incomplete */
+        free_block1_buffer( block1Data );
+        *pBlock1Data = NULL;
+        return result;
+    }
+
+    block1Data->block1bufferSize += message->payload_len;
+    block1Data->lastmid = message->mid;
+    block1Data->lastResult = result;
+
+    return result;
+}
+
 void free_block1_buffer( lwm2m_block1_data_t * block1Data )
 {
     if ( block1Data != NULL )
@@ -116,3 +255,91 @@ void free_block1_buffer( lwm2m_block1_data_t * block1Data )
         nbiot_free( block1Data );
     }
 }
+
+static int prv_getAccept( coap_packet_t * message )
+{
+    if ( IS_OPTION( message, COAP_OPTION_ACCEPT ) && message->accept_num > 0 )
+    {
+        return message->accept[0];
+    }
+
+    return -1;
+}
+
+lwm2m_block2_data_t * coap_block2_find( lwm2m_block2_data_t ** pBlock2Data,
+                                        coap_packet_t * message )
+{
+    lwm2m_block2_data_t * block2Data = *pBlock2Data;
+    lwm2m_uri_t * uriP;
+    bool match;
+
+    if ( block2Data == NULL ) return NULL;
+
+    /* the server gave up on this transfer */
+    if ( NBIOT_TICK_DIFF( nbiot_tick(), block2Data->lastTime ) > BLOCK2_LIFETIME )
+    {
+        free_block2_buffer( block2Data );
+        *pBlock2Data = NULL;
+        return NULL;
+    }
+
+    uriP = uri_decode( NULL, message->uri_path );
+    if ( uriP == NULL ) return NULL;
+
+    match = uriP->flag == block2Data->uri.flag
+         && uriP->objectId == block2Data->uri.objectId
+         && uriP->instanceId == block2Data->uri.instanceId
+         && uriP->resourceId == block2Data->uri.resourceId
+         && prv_getAccept( message ) == block2Data->accept;
+    nbiot_free( uriP );
+    if ( !match ) return NULL;
+
+    block2Data->lastTime = nbiot_tick();
+
+    return block2Data;
+}
+
+lwm2m_block2_data_t * coap_block2_store( lwm2m_block2_data_t ** pBlock2Data,
+                                         coap_packet_t * message,
+                                         coap_packet_t * response,
+                                         uint32_t etag )
+{
+    lwm2m_block2_data_t * block2Data;
+    lwm2m_uri_t * uriP;
+
+    /* one transfer per server, a new read replaces the previous one */
+    free_block2_buffer( *pBlock2Data );
+    *pBlock2Data = NULL;
+
+    uriP = uri_decode( NULL, message->uri_path );
+    if ( uriP == NULL ) return NULL;
+
+    block2Data = (lwm2m_block2_data_t *)nbiot_malloc( sizeof(lwm2m_block2_data_t) );
+    if ( block2Data == NULL )
+    {
+        nbiot_free( uriP );
+        return NULL;
+    }
+
+    /* the response payload is handed over to the cache */
+    block2Data->uri = *uriP;
+    block2Data->accept = prv_getAccept( message );
+    block2Data->contentType = response->content_type;
+    block2Data->etag = etag;
+    block2Data->lastTime = nbiot_tick();
+    block2Data->buffer = response->payload;
+    block2Data->length = response->payload_len;
+    nbiot_free( uriP );
+    *pBlock2Data = block2Data;
+
+    return block2Data;
+}
+
+void free_block2_buffer( lwm2m_block2_data_t * block2Data )
+{
+    if ( block2Data != NULL )
+    {
+        nbiot_free( block2Data->buffer );
+        nbiot_free( block2Data );
+    }
+}
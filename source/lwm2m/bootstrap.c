@@ -99,7 +99,12 @@ static void prv_requestBootstrap( lwm2m_context_t * context,
         coap_set_header_uri_query( transaction->message, query );
         transaction->callback = prv_handleBootstrapReply;
         transaction->userData = (void *)bootstrapServer;
-        context->transactionList = (lwm2m_transaction_t *)LWM2M_LIST_ADD( context->transactionList, transaction );
+        if ( transaction_add( context, transaction ) != 0 )
+        {
+            transaction_free( context, transaction );
+            bootstrapServer->status = STATE_BS_FAILED;
+            return;
+        }
         if ( transaction_send( context, transaction ) == 0 )
         {
             LOG( "CI bootstrap requested to BS server" );
@@ -114,8 +119,8 @@ static void prv_requestBootstrap( lwm2m_context_t * context,
 }
 
 void bootstrap_step( lwm2m_context_t * contextP,
-                     uint32_t currentTime,
-                     time_t* timeoutP )
+                     clock_t currentTime,
+                     clock_t* timeoutP )
 {
     lwm2m_server_t * targetP;
 
@@ -127,12 +132,12 @@ void bootstrap_step( lwm2m_context_t * contextP,
         switch ( targetP->status )
         {
             case STATE_DEREGISTERED:
-            targetP->registration = currentTime + targetP->lifetime;
+            targetP->registration = NBIOT_TICK_ADD( currentTime, (clock_t)targetP->lifetime * CLOCK_PER_SECOND );
             targetP->status = STATE_BS_HOLD_OFF;
             prv_requestBootstrap( contextP, targetP );
-            if ( *timeoutP > targetP->lifetime )
+            if ( *timeoutP > (clock_t)targetP->lifetime * CLOCK_PER_SECOND )
             {
-                *timeoutP = targetP->lifetime;
+                *timeoutP = (clock_t)targetP->lifetime * CLOCK_PER_SECOND;
             }
             break;
 
@@ -0,0 +1,577 @@
+﻿/**
+ * Copyright (c) 2017 China Mobile IOT.
+ * All rights reserved.
+ * Reference:
+ *  wakaama - https://github.com/eclipse/wakaama
+ *  RFC 8428 - Sensor Measurement Lists (SenML)
+**/
+
+#include "internals.h"
+
+#define _PRV_CBOR_MAX_DEPTH 8
+
+#define _PRV_CBOR_UNSIGNED  0
+#define _PRV_CBOR_NEGATIVE  1
+#define _PRV_CBOR_BYTES     2
+#define _PRV_CBOR_TEXT      3
+#define _PRV_CBOR_ARRAY     4
+#define _PRV_CBOR_MAP       5
+#define _PRV_CBOR_TAG       6
+#define _PRV_CBOR_SIMPLE    7
+
+#define _PRV_CBOR_FALSE     20
+#define _PRV_CBOR_TRUE      21
+#define _PRV_CBOR_HALF      25
+#define _PRV_CBOR_SINGLE    26
+#define _PRV_CBOR_DOUBLE    27
+
+/* SenML integer labels */
+#define _PRV_SENML_BASE_NAME   -2
+#define _PRV_SENML_BASE_TIME   -3
+#define _PRV_SENML_NAME         0
+#define _PRV_SENML_VALUE        2
+#define _PRV_SENML_STRING       3
+#define _PRV_SENML_BOOLEAN      4
+#define _PRV_SENML_TIME         6
+#define _PRV_SENML_DATA         8
+#define _PRV_SENML_OBJLNK_STR   "vlo"
+
+#define _PRV_CBOR_NUMBER_LEN 24
+
+typedef struct
+{
+    uint8_t         major;
+    uint8_t         info;   /* additional information of the initial byte */
+    uint64_t        value;  /* argument, or raw bits of a float */
+    const uint8_t * data;   /* payload of byte and text strings */
+} _item_t;
+
+/*
+ * Parser
+*/
+
+/* Returns the index following the item header and payload, 0 on error. */
+static size_t prv_readItem( const uint8_t * buffer,
+                            size_t bufferLen,
+                            size_t index,
+                            _item_t * itemP )
+{
+    size_t length;
+    size_t i;
+
+    if ( index >= bufferLen ) return 0;
+    itemP->major = buffer[index] >> 5;
+    itemP->info = buffer[index] & 0x1F;
+    itemP->data = NULL;
+    index++;
+
+    if ( itemP->info < 24 )
+    {
+        itemP->value = itemP->info;
+        length = 0;
+    }
+    else if ( itemP->info <= 27 )
+    {
+        /* indefinite lengths are not used by SenML producers we talk to */
+        length = (size_t)1 << (itemP->info - 24);
+    }
+    else
+    {
+        return 0;
+    }
+
+    if ( length > 0 )
+    {
+        if ( bufferLen - index < length ) return 0;
+        itemP->value = 0;
+        for ( i = 0; i < length; i++ )
+        {
+            itemP->value = (itemP->value << 8) | buffer[index++];
+        }
+    }
+
+    if ( itemP->major == _PRV_CBOR_BYTES || itemP->major == _PRV_CBOR_TEXT )
+    {
+        if ( itemP->value > bufferLen - index ) return 0;
+        itemP->data = buffer + index;
+        index += (size_t)itemP->value;
+    }
+
+    return index;
+}
+
+static size_t prv_skipItem( const uint8_t * buffer,
+                            size_t bufferLen,
+                            size_t index,
+                            int depth )
+{
+    _item_t item;
+    uint64_t count;
+
+    if ( depth > _PRV_CBOR_MAX_DEPTH ) return 0;
+
+    index = prv_readItem( buffer, bufferLen, index, &item );
+    if ( index == 0 ) return 0;
+
+    switch ( item.major )
+    {
+        case _PRV_CBOR_ARRAY:
+        count = item.value;
+        break;
+
+        case _PRV_CBOR_MAP:
+        count = item.value * 2;
+        break;
+
+        case _PRV_CBOR_TAG:
+        count = 1;
+        break;
+
+        default:
+        return index;
+    }
+
+    while ( count-- > 0 && index != 0 )
+    {
+        index = prv_skipItem( buffer, bufferLen, index, depth + 1 );
+    }
+
+    return index;
+}
+
+static bool prv_readFloat( const _item_t * itemP,
+                           double * valueP )
+{
+    switch ( itemP->info )
+    {
+        case _PRV_CBOR_HALF:
+        {
+            int exponent = (int)((itemP->value >> 10) & 0x1F);
+            double value = (double)(itemP->value & 0x3FF);
+
+            if ( exponent == 0x1F ) return false;
+            if ( exponent == 0 )
+            {
+                exponent = 1;
+            }
+            else
+            {
+                value += 1024;
+            }
+
+            /* value * 2^(exponent - 25) */
+            for ( exponent -= 25; exponent < 0; exponent++ ) value /= 2;
+            for ( ; exponent > 0; exponent-- ) value *= 2;
+            *valueP = (itemP->value & 0x8000) ? -value : value;
+        }
+        return true;
+
+        case _PRV_CBOR_SINGLE:
+        {
+            uint32_t bits = (uint32_t)itemP->value;
+            float value;
+
+            nbiot_memmove( &value, &bits, sizeof(value) );
+            *valueP = value;
+        }
+        return true;
+
+        case _PRV_CBOR_DOUBLE:
+        nbiot_memmove( valueP, &itemP->value, sizeof(double) );
+        return true;
+
+        default:
+        return false;
+    }
+}
+
+static bool prv_convertValue( int64_t label,
+                              const _item_t * itemP,
+                              lwm2m_data_t * dataP )
+{
+    switch ( label )
+    {
+        case _PRV_SENML_VALUE:
+        if ( itemP->major == _PRV_CBOR_UNSIGNED )
+        {
+            if ( itemP->value > INT64_MAX ) return false;
+            lwm2m_data_encode_int( (int64_t)itemP->value, dataP );
+        }
+        else if ( itemP->major == _PRV_CBOR_NEGATIVE )
+        {
+            if ( itemP->value > INT64_MAX ) return false;
+            lwm2m_data_encode_int( -1 - (int64_t)itemP->value, dataP );
+        }
+        else if ( itemP->major == _PRV_CBOR_SIMPLE )
+        {
+            double value;
+
+            if ( !prv_readFloat( itemP, &value ) ) return false;
+            lwm2m_data_encode_float( value, dataP );
+        }
+        else
+        {
+            return false;
+        }
+        return true;
+
+        case _PRV_SENML_BOOLEAN:
+        if ( itemP->major != _PRV_CBOR_SIMPLE ) return false;
+        if ( itemP->info == _PRV_CBOR_TRUE )
+        {
+            lwm2m_data_encode_bool( true, dataP );
+        }
+        else if ( itemP->info == _PRV_CBOR_FALSE )
+        {
+            lwm2m_data_encode_bool( false, dataP );
+        }
+        else
+        {
+            return false;
+        }
+        return true;
+
+        case _PRV_SENML_STRING:
+        case _PRV_SENML_DATA:
+        if ( itemP->major != (label == _PRV_SENML_STRING ? _PRV_CBOR_TEXT : _PRV_CBOR_BYTES) ) return false;
+        dataP->type = label == _PRV_SENML_STRING ? LWM2M_TYPE_STRING : LWM2M_TYPE_OPAQUE;
+        dataP->value.asBuffer.length = (size_t)itemP->value;
+        dataP->value.asBuffer.buffer = NULL;
+        if ( itemP->value > 0 )
+        {
+            dataP->value.asBuffer.buffer = (uint8_t *)nbiot_malloc( (size_t)itemP->value );
+            if ( dataP->value.asBuffer.buffer == NULL ) return false;
+            nbiot_memmove( dataP->value.asBuffer.buffer, itemP->data, (size_t)itemP->value );
+        }
+        return true;
+
+        default:
+        return false;
+    }
+}
+
+static size_t prv_parseRecord( const uint8_t * buffer,
+                               size_t bufferLen,
+                               size_t index,
+                               const uint8_t ** baseNameP,
+                               size_t * baseNameLenP,
+                               senml_record_t * recordP )
+{
+    const uint8_t * name = NULL;
+    size_t nameLen = 0;
+    _item_t item;
+    uint64_t count;
+
+    nbiot_memzero( recordP, sizeof(senml_record_t) );
+    index = prv_readItem( buffer, bufferLen, index, &item );
+    if ( index == 0 || item.major != _PRV_CBOR_MAP ) return 0;
+
+    for ( count = item.value; count > 0; count-- )
+    {
+        _item_t key;
+        int64_t label;
+
+        index = prv_readItem( buffer, bufferLen, index, &key );
+        if ( index == 0 ) return 0;
+        if ( key.major == _PRV_CBOR_UNSIGNED && key.value <= INT16_MAX )
+        {
+            label = (int64_t)key.value;
+        }
+        else if ( key.major == _PRV_CBOR_NEGATIVE && key.value < INT16_MAX )
+        {
+            label = -1 - (int64_t)key.value;
+        }
+        else if ( key.major == _PRV_CBOR_TEXT
+                  && key.value == sizeof(_PRV_SENML_OBJLNK_STR) - 1
+                  && 0 == nbiot_strncmp( (const char *)key.data, _PRV_SENML_OBJLNK_STR, (size_t)key.value ) )
+        {
+            if ( recordP->data.type != LWM2M_TYPE_UNDEFINED ) return 0;
+            index = prv_readItem( buffer, bufferLen, index, &item );
+            if ( index == 0 || item.major != _PRV_CBOR_TEXT ) return 0;
+            if ( !senml_parseObjLink( item.data, (size_t)item.value, &recordP->data ) ) return 0;
+            continue;
+        }
+        else
+        {
+            /* unknown label, skip its value */
+            index = prv_skipItem( buffer, bufferLen, index, 1 );
+            if ( index == 0 ) return 0;
+            continue;
+        }
+
+        switch ( label )
+        {
+            case _PRV_SENML_BASE_NAME:
+            case _PRV_SENML_NAME:
+            index = prv_readItem( buffer, bufferLen, index, &item );
+            if ( index == 0 || item.major != _PRV_CBOR_TEXT ) return 0;
+            if ( label == _PRV_SENML_NAME )
+            {
+                name = item.data;
+                nameLen = (size_t)item.value;
+            }
+            else
+            {
+                /* the base name applies to this and all following records */
+                *baseNameP = item.data;
+                *baseNameLenP = (size_t)item.value;
+            }
+            break;
+
+            case _PRV_SENML_VALUE:
+            case _PRV_SENML_STRING:
+            case _PRV_SENML_BOOLEAN:
+            case _PRV_SENML_DATA:
+            if ( recordP->data.type != LWM2M_TYPE_UNDEFINED ) return 0;
+            index = prv_readItem( buffer, bufferLen, index, &item );
+            if ( index == 0 ) return 0;
+            if ( !prv_convertValue( label, &item, &recordP->data ) ) return 0;
+            break;
+
+            default:
+            /* times have no place in lwm2m_data_t, skip them like other labels */
+            index = prv_skipItem( buffer, bufferLen, index, 1 );
+            if ( index == 0 ) return 0;
+            break;
+        }
+    }
+    if ( recordP->data.type == LWM2M_TYPE_UNDEFINED ) return 0;
+
+    if ( !senml_parsePath( *baseNameP, *baseNameLenP, name, nameLen, recordP ) ) return 0;
+
+    return index;
+}
+
+int cbor_parse( lwm2m_uri_t * uriP,
+                uint8_t * buffer,
+                size_t bufferLen,
+                lwm2m_data_t ** dataP )
+{
+    const uint8_t * baseName = NULL;
+    size_t baseNameLen = 0;
+    senml_record_t * recordArray;
+    _item_t item;
+    size_t index;
+    int count;
+    int size;
+    int i;
+
+    LOG_ARG( "bufferLen: %d", bufferLen );
+
+    *dataP = NULL;
+    if ( uriP == NULL ) return 0;
+
+    index = prv_readItem( buffer, bufferLen, 0, &item );
+    if ( index == 0
+         || item.major != _PRV_CBOR_ARRAY
+         || item.value == 0
+         || item.value > bufferLen - index )
+    {
+        return 0;
+    }
+    count = (int)item.value;
+
+    recordArray = (senml_record_t *)nbiot_malloc( count * sizeof(senml_record_t) );
+    if ( recordArray == NULL ) return 0;
+
+    for ( i = 0; i < count; i++ )
+    {
+        index = prv_parseRecord( buffer, bufferLen, index, &baseName, &baseNameLen, recordArray + i );
+        if ( index == 0 ) break;
+    }
+    if ( index != bufferLen )
+    {
+        senml_freeRecords( recordArray, i < count ? i + 1 : count );
+        nbiot_free( recordArray );
+        return 0;
+    }
+
+    size = senml_convertRecords( uriP, recordArray, count, dataP );
+    nbiot_free( recordArray );
+
+    return size;
+}
+
+/*
+ * Serializer
+*/
+
+static void prv_writeHead( senml_writer_t * writerP,
+                           uint8_t major,
+                           uint64_t value )
+{
+    uint8_t head[9];
+    size_t length;
+    size_t i;
+
+    if ( value < 24 )
+    {
+        head[0] = (uint8_t)((major << 5) | value);
+        senml_write( writerP, head, 1 );
+        return;
+    }
+
+    if ( value <= 0xFF ) length = 1;
+    else if ( value <= 0xFFFF ) length = 2;
+    else if ( value <= 0xFFFFFFFF ) length = 4;
+    else length = 8;
+
+    head[0] = (uint8_t)((major << 5) | (24 + (length == 1 ? 0 : length == 2 ? 1 : length == 4 ? 2 : 3)));
+    for ( i = 0; i < length; i++ )
+    {
+        head[length - i] = (uint8_t)(value >> (8 * i));
+    }
+    senml_write( writerP, head, length + 1 );
+}
+
+static void prv_writeLabel( senml_writer_t * writerP,
+                            int label )
+{
+    if ( label < 0 )
+    {
+        prv_writeHead( writerP, _PRV_CBOR_NEGATIVE, (uint64_t)(-1 - label) );
+    }
+    else
+    {
+        prv_writeHead( writerP, _PRV_CBOR_UNSIGNED, (uint64_t)label );
+    }
+}
+
+static void prv_writeFloat( senml_writer_t * writerP,
+                            double value )
+{
+    uint8_t head[9];
+    float single = (float)value;
+    uint64_t bits;
+    size_t length;
+    size_t i;
+
+    /* use single precision when it is lossless */
+    if ( (double)single == value )
+    {
+        uint32_t singleBits;
+
+        nbiot_memmove( &singleBits, &single, sizeof(single) );
+        bits = singleBits;
+        length = 4;
+        head[0] = (_PRV_CBOR_SIMPLE << 5) | _PRV_CBOR_SINGLE;
+    }
+    else
+    {
+        nbiot_memmove( &bits, &value, sizeof(value) );
+        length = 8;
+        head[0] = (_PRV_CBOR_SIMPLE << 5) | _PRV_CBOR_DOUBLE;
+    }
+
+    for ( i = 0; i < length; i++ )
+    {
+        head[length - i] = (uint8_t)(bits >> (8 * i));
+    }
+    senml_write( writerP, head, length + 1 );
+}
+
+static void prv_writeHeader( senml_writer_t * writerP,
+                             const uint8_t * baseName,
+                             size_t baseNameLen,
+                             size_t count )
+{
+    prv_writeHead( writerP, _PRV_CBOR_ARRAY, count );
+}
+
+static bool prv_writeRecord( senml_writer_t * writerP,
+                             const uint8_t * baseName,
+                             size_t baseNameLen,
+                             const uint8_t * name,
+                             size_t nameLen,
+                             size_t index,
+                             lwm2m_data_t * dataP )
+{
+    uint8_t number[_PRV_CBOR_NUMBER_LEN];
+    uint8_t simple;
+    size_t length;
+
+    /* only the first record carries the base name */
+    prv_writeHead( writerP, _PRV_CBOR_MAP, index == 0 ? 3 : 2 );
+    if ( index == 0 )
+    {
+        prv_writeLabel( writerP, _PRV_SENML_BASE_NAME );
+        prv_writeHead( writerP, _PRV_CBOR_TEXT, baseNameLen );
+        senml_write( writerP, baseName, baseNameLen );
+    }
+    prv_writeLabel( writerP, _PRV_SENML_NAME );
+    prv_writeHead( writerP, _PRV_CBOR_TEXT, nameLen );
+    senml_write( writerP, name, nameLen );
+
+    switch ( dataP->type )
+    {
+        case LWM2M_TYPE_STRING:
+        prv_writeLabel( writerP, _PRV_SENML_STRING );
+        prv_writeHead( writerP, _PRV_CBOR_TEXT, dataP->value.asBuffer.length );
+        senml_write( writerP, dataP->value.asBuffer.buffer, dataP->value.asBuffer.length );
+        break;
+
+        case LWM2M_TYPE_OPAQUE:
+        prv_writeLabel( writerP, _PRV_SENML_DATA );
+        prv_writeHead( writerP, _PRV_CBOR_BYTES, dataP->value.asBuffer.length );
+        senml_write( writerP, dataP->value.asBuffer.buffer, dataP->value.asBuffer.length );
+        break;
+
+        case LWM2M_TYPE_INTEGER:
+        prv_writeLabel( writerP, _PRV_SENML_VALUE );
+        if ( dataP->value.asInteger < 0 )
+        {
+            prv_writeHead( writerP, _PRV_CBOR_NEGATIVE, (uint64_t)(-1 - dataP->value.asInteger) );
+        }
+        else
+        {
+            prv_writeHead( writerP, _PRV_CBOR_UNSIGNED, (uint64_t)dataP->value.asInteger );
+        }
+        break;
+
+        case LWM2M_TYPE_FLOAT:
+        prv_writeLabel( writerP, _PRV_SENML_VALUE );
+        prv_writeFloat( writerP, dataP->value.asFloat );
+        break;
+
+        case LWM2M_TYPE_BOOLEAN:
+        prv_writeLabel( writerP, _PRV_SENML_BOOLEAN );
+        simple = (_PRV_CBOR_SIMPLE << 5) | (dataP->value.asBoolean ? _PRV_CBOR_TRUE : _PRV_CBOR_FALSE);
+        senml_write( writerP, &simple, 1 );
+        break;
+
+        case LWM2M_TYPE_OBJECT_LINK:
+        prv_writeHead( writerP, _PRV_CBOR_TEXT, sizeof(_PRV_SENML_OBJLNK_STR) - 1 );
+        senml_write( writerP, _PRV_SENML_OBJLNK_STR, sizeof(_PRV_SENML_OBJLNK_STR) - 1 );
+        length = utils_intToText( dataP->value.asObjLink.objectId, number, _PRV_CBOR_NUMBER_LEN );
+        number[length++] = ':';
+        length += utils_intToText( dataP->value.asObjLink.objectInstanceId, number + length, _PRV_CBOR_NUMBER_LEN - length );
+        prv_writeHead( writerP, _PRV_CBOR_TEXT, length );
+        senml_write( writerP, number, length );
+        break;
+
+        default:
+        return false;
+    }
+
+    return true;
+}
+
+static void prv_writeFooter( senml_writer_t * writerP )
+{
+    /* definite length array, nothing to close */
+}
+
+static const senml_format_t prv_cborFormat =
+{
+    prv_writeHeader,
+    prv_writeRecord,
+    prv_writeFooter
+};
+
+size_t cbor_serialize( lwm2m_uri_t * uriP,
+                       int size,
+                       lwm2m_data_t * dataP,
+                       uint8_t ** bufferP )
+{
+    return senml_serialize( uriP, size, dataP, &prv_cborFormat, bufferP );
+}
@@ -16,77 +16,29 @@
 
 /* Option format serialization*/
 #define COAP_SERIALIZE_INT_OPTION(number, field, text) \
-if ( IS_OPTION( coap_pkt, number ) ) \
+if ( number > first && number <= last && IS_OPTION( coap_pkt, number ) ) \
 { \
     PRINTF( text" [%u]\n", coap_pkt->field ); \
-    option += coap_serialize_int_option( number, \
-                                         current_number, \
-                                         option, \
-                                         coap_pkt->field ); \
-    current_number = number; \
+    coap_write_int_option( writer, number, coap_pkt->field ); \
 }
 #define COAP_SERIALIZE_BYTE_OPTION(number, field, text) \
-if ( IS_OPTION( coap_pkt, number ) ) \
+if ( number > first && number <= last && IS_OPTION( coap_pkt, number ) ) \
 { \
-    /*FIXME always prints 8 bytes */ \
-    PRINTF( text" %u [0x%02X%02X%02X%02X%02X%02X%02X%02X]\n", \
-            coap_pkt->field##_len, \
-            coap_pkt->field[0], \
-            coap_pkt->field[1], \
-            coap_pkt->field[2], \
-            coap_pkt->field[3], \
-            coap_pkt->field[4], \
-            coap_pkt->field[5], \
-            coap_pkt->field[6], \
-            coap_pkt->field[7] ); \
-    option += coap_serialize_array_option( number, \
-                                           current_number, \
-                                           option, \
-                                           coap_pkt->field, \
-                                           coap_pkt->field##_len, \
-                                           '\0' ); \
-    current_number = number; \
-}
-#define COAP_SERIALIZE_STRING_OPTION(number, field, splitter, text) \
-if ( IS_OPTION( coap_pkt, number ) ) \
-{ \
-    PRINTF( text" [%.*s]\n", \
-            coap_pkt->field##_len, \
-            coap_pkt->field ); \
-    option += coap_serialize_array_option( number, \
-                                           current_number, \
-                                           option, \
-                                           (uint8_t *)coap_pkt->field, \
-                                           coap_pkt->field##_len, \
-                                           splitter ); \
-    current_number = number; \
+    PRINTF( text" (len %u)\n", coap_pkt->field##_len ); \
+    coap_write_option( writer, number, coap_pkt->field, coap_pkt->field##_len ); \
 }
 #define COAP_SERIALIZE_MULTI_OPTION(number, field, text) \
-if ( IS_OPTION( coap_pkt, number ) ) \
-{ \
-        PRINTF( text ); \
-        option += coap_serialize_multi_option( number, \
-                                               current_number, \
-                                               option, \
-                                               coap_pkt->field ); \
-        current_number = number; \
-}
-#define COAP_SERIALIZE_ACCEPT_OPTION(number, field, text) \
-if ( IS_OPTION( coap_pkt, number ) ) \
+if ( number > first && number <= last && IS_OPTION( coap_pkt, number ) ) \
 { \
-    int i; \
-    for ( i = 0; i < coap_pkt->field##_num; ++i ) \
+    multi_option_t *optP; \
+    PRINTF( text ); \
+    for ( optP = coap_pkt->field; optP != NULL; optP = optP->next ) \
     { \
-        PRINTF( text" [%u]\n", coap_pkt->field[i] ); \
-        option += coap_serialize_int_option( number, \
-                                             current_number, \
-                                             option, \
-                                             coap_pkt->field[i] ); \
-        current_number = number; \
+        coap_write_option( writer, number, optP->data, optP->len ); \
     } \
 }
 #define COAP_SERIALIZE_BLOCK_OPTION(number, field, text) \
-if ( IS_OPTION( coap_pkt, number ) ) \
+if ( number > first && number <= last && IS_OPTION( coap_pkt, number ) ) \
 { \
     uint32_t block; \
     PRINTF( text" [%lu%s (%u B/blk)]\n", \
@@ -100,18 +52,22 @@ if ( IS_OPTION( coap_pkt, number ) ) \
     } \
     block |= 0xF & coap_log_2( coap_pkt->field##_size / 16 ); \
     PRINTF( text" encoded: 0x%lX\n", block ); \
-    option += coap_serialize_int_option( number, \
-                                         current_number, \
-                                         option, \
-                                         block ); \
-    current_number = number; \
+    coap_write_int_option( writer, number, block ); \
 }
 
+/* Bounded output, keeps counting once the buffer is full */
+typedef struct
+{
+    uint8_t     *buffer;
+    size_t       size;
+    size_t       length;
+    unsigned int number; /* of the last option written */
+} coap_writer_t;
+
 typedef enum
 {
     COAP_OPTION_IF_MATCH       = 1,  /* 0-8 B */
     COAP_OPTION_URI_HOST       = 3,  /* 1-255 B */
-    COAP_OPTION_ETAG           = 4,  /* 1-8 B */
     COAP_OPTION_IF_NONE_MATCH  = 5,  /* 0 B */
     COAP_OPTION_URI_PORT       = 7,  /* 0-2 B */
     COAP_OPTION_MAX_AGE        = 14, /* 0-4 B */
@@ -120,9 +76,6 @@ typedef enum
     COAP_OPTION_PROXY_URI      = 35  /* 1-270 B */
 } coap_option_ignore_t;
 
-const char *coap_error_message = "";
-coap_status_t coap_error_code = NO_ERROR;
-
 uint16_t coap_log_2( uint16_t value )
 {
     uint16_t result = 0;
@@ -195,47 +148,107 @@ static size_t coap_set_option_header( unsigned int delta,
     return ++written;
 }
 
-static size_t coap_serialize_int_option( unsigned int number,
-                                         unsigned int current_number,
-                                         uint8_t     *buffer,
-                                         uint32_t     value )
+/* Returns where to write length bytes, NULL once the buffer is full */
+static uint8_t * coap_reserve( coap_writer_t *writer,
+                               size_t         length )
 {
-    size_t i = 0;
+    uint8_t *position = NULL;
 
-    if ( 0xFF000000 & value ) ++i;
-    if ( 0xFFFF0000 & value ) ++i;
-    if ( 0xFFFFFF00 & value ) ++i;
-    if ( 0xFFFFFFFF & value ) ++i;
+    if ( writer->length + length <= writer->size )
+    {
+        position = writer->buffer + writer->length;
+    }
+    writer->length += length;
 
-    PRINTF( "OPTION %u (delta %u, len %u)\n", number, number - current_number, i );
+    return position;
+}
 
-    i = coap_set_option_header( number - current_number, i, buffer );
+static void coap_write( coap_writer_t *writer,
+                        const uint8_t *data,
+                        size_t         length )
+{
+    uint8_t *position = coap_reserve( writer, length );
 
-    if ( 0xFF000000 & value ) buffer[i++] = (uint8_t)(value >> 24);
-    if ( 0xFFFF0000 & value ) buffer[i++] = (uint8_t)(value >> 16);
-    if ( 0xFFFFFF00 & value ) buffer[i++] = (uint8_t)(value >> 8);
-    if ( 0xFFFFFFFF & value ) buffer[i++] = (uint8_t)(value);
+    if ( position != NULL )
+    {
+        nbiot_memmove( position, data, length );
+    }
+}
 
-    return i;
+static size_t coap_option_header_len( unsigned int delta,
+                                      size_t       length )
+{
+    size_t header_len = 1;
+
+    if ( delta > 268 ) header_len += 2;
+    else if ( delta > 12 ) header_len += 1;
+    if ( length > 268 ) header_len += 2;
+    else if ( length > 12 ) header_len += 1;
+
+    return header_len;
+}
+
+static void coap_write_option( coap_writer_t *writer,
+                               unsigned int   number,
+                               const uint8_t *value,
+                               size_t         length )
+{
+    unsigned int delta = number - writer->number;
+    uint8_t *position;
+
+    PRINTF( "OPTION %u (delta %u, len %u)\n", number, delta, length );
+
+    position = coap_reserve( writer, coap_option_header_len( delta, length ) + length );
+    if ( position != NULL )
+    {
+        position += coap_set_option_header( delta, length, position );
+        nbiot_memmove( position, value, length );
+    }
+    writer->number = number;
 }
 
-static  size_t coap_serialize_multi_option( unsigned int    number,
-                                            unsigned int    current_number,
-                                            uint8_t        *buffer,
-                                            multi_option_t *array )
+static void coap_write_int_option( coap_writer_t *writer,
+                                   unsigned int   number,
+                                   uint32_t       value )
 {
+    unsigned int delta = number - writer->number;
+    uint8_t *position;
     size_t i = 0;
-    multi_option_t * j;
 
-    for ( j = array; j != NULL; j = j->next )
+    if ( 0xFF000000 & value ) ++i;
+    if ( 0xFFFF0000 & value ) ++i;
+    if ( 0xFFFFFF00 & value ) ++i;
+    if ( 0xFFFFFFFF & value ) ++i;
+
+    PRINTF( "OPTION %u (delta %u, len %u)\n", number, delta, i );
+
+    position = coap_reserve( writer, coap_option_header_len( delta, i ) + i );
+    if ( position != NULL )
     {
-        i += coap_set_option_header( number - current_number, j->len, &buffer[i] );
-        current_number = number;
-        nbiot_memmove( &buffer[i], j->data, j->len );
-        i += j->len;
-    } /* for */
+        position += coap_set_option_header( delta, i, position );
+        while ( i > 0 )
+        {
+            *position++ = (uint8_t)(value >> (--i * 8));
+        }
+    }
+    writer->number = number;
+}
 
-    return i;
+/* Writes the options numbered in (first, last], in the order of their number */
+static void coap_write_options( coap_writer_t *writer,
+                                coap_packet_t *coap_pkt,
+                                unsigned int   first,
+                                unsigned int   last )
+{
+    COAP_SERIALIZE_BYTE_OPTION(   COAP_OPTION_ETAG,          etag,          "ETag" );
+    COAP_SERIALIZE_INT_OPTION(    COAP_OPTION_OBSERVE,       observe,       "Observe" );
+    COAP_SERIALIZE_MULTI_OPTION(  COAP_OPTION_LOCATION_PATH, location_path, "Location-Path" );
+    COAP_SERIALIZE_MULTI_OPTION(  COAP_OPTION_URI_PATH,      uri_path,      "Uri-Path" );
+    COAP_SERIALIZE_INT_OPTION(    COAP_OPTION_CONTENT_TYPE,  content_type,  "Content-Format" );
+    COAP_SERIALIZE_MULTI_OPTION(  COAP_OPTION_URI_QUERY,     uri_query,     "Uri-Query" );
+    COAP_SERIALIZE_BLOCK_OPTION(  COAP_OPTION_BLOCK2,        block2,        "Block2" );
+    COAP_SERIALIZE_BLOCK_OPTION(  COAP_OPTION_BLOCK1,        block1,        "Block1" );
+    COAP_SERIALIZE_INT_OPTION(    COAP_OPTION_SIZE1,         size1,         "Size1" );
 }
 
 char* coap_get_multi_option_as_string( multi_option_t * option )
@@ -312,18 +325,53 @@ static void coap_add_multi_option( multi_option_t **dst,
     }
 }
 
-static void free_multi_option( multi_option_t *dst )
+/* Appends a view of an option of the datagram. Options come sorted by number, */
+/* so the views of one multi option are adjacent and the last view is its tail. */
+static int coap_add_option_view( coap_packet_t   *coap_pkt,
+                                 multi_option_t **dst,
+                                 uint8_t         *option,
+                                 size_t           option_len )
+{
+    multi_option_t *opt;
+
+    if ( coap_pkt->option_view_num >= COAP_MAX_OPTION_VIEWS ) return 0;
+
+    opt = &coap_pkt->option_views[coap_pkt->option_view_num++];
+    opt->next = NULL;
+    opt->is_static = 1;
+    opt->len = (uint8_t)option_len;
+    opt->data = option;
+
+    if ( *dst )
+    {
+        coap_pkt->option_views[coap_pkt->option_view_num - 2].next = opt;
+    }
+    else
+    {
+        *dst = opt;
+    }
+
+    return 1;
+}
+
+static void free_multi_option( coap_packet_t  *coap_pkt,
+                               multi_option_t *dst )
 {
-    if ( dst )
+    while ( dst )
     {
         multi_option_t *n = dst->next;
-        dst->next = NULL;
-        if ( dst->is_static == 0 )
+
+        /* views belong to the packet */
+        if ( dst < coap_pkt->option_views
+             || dst >= coap_pkt->option_views + COAP_MAX_OPTION_VIEWS )
         {
-            nbiot_free( dst->data );
+            if ( dst->is_static == 0 )
+            {
+                nbiot_free( dst->data );
+            }
+            nbiot_free( dst );
         }
-        nbiot_free( dst );
-        free_multi_option( n );
+        dst = n;
     }
 }
 
@@ -334,151 +382,111 @@ void coap_init_message( void               *packet,
 {
     coap_packet_t *const coap_pkt = (coap_packet_t *)packet;
 
-    /* Important thing */
-    nbiot_memzero( coap_pkt, sizeof(coap_packet_t) );
+    /* Important thing, the option views are unused until parsed */
+    nbiot_memzero( coap_pkt, offsetof(coap_packet_t, option_views) );
 
     coap_pkt->type = type;
     coap_pkt->code = code;
     coap_pkt->mid = mid;
 }
 
-size_t coap_serialize_get_size( void *packet )
+int coap_set_option_template( void                   *packet,
+                              coap_option_template_t *tmpl,
+                              unsigned int            after )
 {
     coap_packet_t *const coap_pkt = (coap_packet_t *)packet;
-    size_t length = 0;
+    coap_writer_t writer;
+
+    writer.buffer = tmpl->options;
+    writer.size = sizeof(tmpl->options);
+    writer.length = 0;
+    writer.number = after;
+    coap_write_options( &writer, coap_pkt, after, COAP_OPTION_SIZE1 );
+
+    coap_pkt->option_template = NULL;
+    if ( writer.length > writer.size ) return 0;
 
-    length = COAP_HEADER_LEN + coap_pkt->payload_len + coap_pkt->token_len;
+    tmpl->after = after;
+    tmpl->length = (uint8_t)writer.length;
+    coap_pkt->option_template = tmpl;
 
-    if ( IS_OPTION( coap_pkt, COAP_OPTION_OBSERVE ) )
+    return 1;
+}
+
+size_t coap_serialize_message( void    *packet,
+                               uint8_t *buffer,
+                               size_t   buffer_len )
+{
+    coap_packet_t *const coap_pkt = (coap_packet_t *)packet;
+    const coap_option_template_t *tmpl = coap_pkt->option_template;
+    coap_writer_t writer;
+    uint8_t *header;
+
+    writer.buffer = buffer;
+    writer.size = buffer_len;
+    writer.length = 0;
+    writer.number = 0;
+
+    PRINTF( "-Serializing MID %u to %p, ", coap_pkt->mid, buffer );
+
+    /* set header fields */
+    header = coap_reserve( &writer, COAP_HEADER_LEN );
+    if ( header != NULL )
     {
-        /* can be stored in extended fields */
-        length += COAP_MAX_OPTION_HEADER_LEN;
+        header[0] = COAP_HEADER_VERSION_MASK & 1 << COAP_HEADER_VERSION_POSITION;
+        header[0] |= COAP_HEADER_TYPE_MASK & (coap_pkt->type) << COAP_HEADER_TYPE_POSITION;
+        header[0] |= COAP_HEADER_TOKEN_LEN_MASK & (coap_pkt->token_len) << COAP_HEADER_TOKEN_LEN_POSITION;
+        header[1] = coap_pkt->code;
+        header[2] = (uint8_t)((coap_pkt->mid) >> 8);
+        header[3] = (uint8_t)(coap_pkt->mid);
     }
-    if ( IS_OPTION( coap_pkt, COAP_OPTION_LOCATION_PATH ) )
-    {
-        multi_option_t * optP;
 
-        for ( optP = coap_pkt->location_path; optP != NULL; optP = optP->next )
-        {
-            length += COAP_MAX_OPTION_HEADER_LEN + optP->len;
-        }
-    }
-    if ( IS_OPTION( coap_pkt, COAP_OPTION_URI_PATH ) )
-    {
-        multi_option_t * optP;
+    /* set Token */
+    PRINTF( "Token (len %u)\n", coap_pkt->token_len );
+    coap_write( &writer, coap_pkt->token, coap_pkt->token_len );
 
-        for ( optP = coap_pkt->uri_path; optP != NULL; optP = optP->next )
+    /* Serialize options, the template holds the encoded tail when it follows the last option written */
+    if ( tmpl != NULL )
+    {
+        coap_write_options( &writer, coap_pkt, 0, tmpl->after );
+        if ( writer.number == tmpl->after )
         {
-            length += COAP_MAX_OPTION_HEADER_LEN + optP->len;
+            coap_write( &writer, tmpl->options, tmpl->length );
         }
-    }
-    if ( IS_OPTION( coap_pkt, COAP_OPTION_CONTENT_TYPE ) )
-    {
-        /* can be stored in extended fields */
-        length += COAP_MAX_OPTION_HEADER_LEN;
-    }
-    if ( IS_OPTION( coap_pkt, COAP_OPTION_URI_QUERY ) )
-    {
-        multi_option_t * optP;
-
-        for ( optP = coap_pkt->uri_query; optP != NULL; optP = optP->next )
+        else
         {
-            length += COAP_MAX_OPTION_HEADER_LEN + optP->len;
+            coap_write_options( &writer, coap_pkt, tmpl->after, COAP_OPTION_SIZE1 );
         }
     }
-    if ( IS_OPTION( coap_pkt, COAP_OPTION_BLOCK2 ) )
+    else
     {
-        /* can be stored in extended fields */
-        length += COAP_MAX_OPTION_HEADER_LEN;
+        coap_write_options( &writer, coap_pkt, 0, COAP_OPTION_SIZE1 );
     }
-    if ( IS_OPTION( coap_pkt, COAP_OPTION_BLOCK1 ) )
+
+    /* Pack payload */
+    if ( coap_pkt->payload_len )
     {
-        /* can be stored in extended fields */
-        length += COAP_MAX_OPTION_HEADER_LEN;
+        header = coap_reserve( &writer, 1 );
+        if ( header != NULL ) *header = 0xFF;
+        coap_write( &writer, coap_pkt->payload, coap_pkt->payload_len );
     }
-    if ( IS_OPTION( coap_pkt, COAP_OPTION_SIZE ) )
+
+    /* leave the packet untouched so that it can be serialized again into a larger buffer */
+    if ( writer.length > buffer_len )
     {
-        /* can be stored in extended fields */
-        length += COAP_MAX_OPTION_HEADER_LEN;
+        PRINTF( "-Overflow %u B into %u B-\n", writer.length, buffer_len );
+        return writer.length;
     }
 
-    return length;
-}
-
-size_t coap_serialize_message( void    *packet,
-                               uint8_t *buffer )
-{
-  coap_packet_t *const coap_pkt = (coap_packet_t *) packet;
-  uint8_t *option;
-  unsigned int current_number = 0;
-
-  /* Initialize */
-  coap_pkt->buffer = buffer;
-  coap_pkt->version = 1;
-
-  PRINTF("-Serializing MID %u to %p, ", coap_pkt->mid, coap_pkt->buffer);
-
-  /* set header fields */
-  coap_pkt->buffer[0]  = 0x00;
-  coap_pkt->buffer[0] |= COAP_HEADER_VERSION_MASK & (coap_pkt->version)<<COAP_HEADER_VERSION_POSITION;
-  coap_pkt->buffer[0] |= COAP_HEADER_TYPE_MASK & (coap_pkt->type)<<COAP_HEADER_TYPE_POSITION;
-  coap_pkt->buffer[0] |= COAP_HEADER_TOKEN_LEN_MASK & (coap_pkt->token_len)<<COAP_HEADER_TOKEN_LEN_POSITION;
-  coap_pkt->buffer[1] = coap_pkt->code;
-  coap_pkt->buffer[2] = (uint8_t) ((coap_pkt->mid)>>8);
-  coap_pkt->buffer[3] = (uint8_t) (coap_pkt->mid);
-
-  /* set Token */
-  PRINTF("Token (len %u)", coap_pkt->token_len);
-  option = coap_pkt->buffer + COAP_HEADER_LEN;
-  for (current_number=0; current_number<coap_pkt->token_len; ++current_number)
-  {
-    PRINTF(" %02X", coap_pkt->token[current_number]);
-    *option = coap_pkt->token[current_number];
-    ++option;
-  }
-  PRINTF("-\n");
-
-  /* Serialize options */
-  current_number = 0;
-  PRINTF("-Serializing options at %p-\n", option);
-
-  /* The options must be serialized in the order of their number */
-  COAP_SERIALIZE_INT_OPTION(    COAP_OPTION_OBSERVE,       observe,       "Observe" );
-  COAP_SERIALIZE_MULTI_OPTION(  COAP_OPTION_LOCATION_PATH, location_path, "Location-Path" );
-  COAP_SERIALIZE_MULTI_OPTION(  COAP_OPTION_URI_PATH,      uri_path,      "Uri-Path" )
-  COAP_SERIALIZE_INT_OPTION(    COAP_OPTION_CONTENT_TYPE,  content_type,  "Content-Format" );
-  COAP_SERIALIZE_MULTI_OPTION(  COAP_OPTION_URI_QUERY,     uri_query,     "Uri-Query" );
-  COAP_SERIALIZE_BLOCK_OPTION(  COAP_OPTION_BLOCK2,        block2,        "Block2" );
-  COAP_SERIALIZE_BLOCK_OPTION(  COAP_OPTION_BLOCK1,        block1,        "Block1" );
-
-  PRINTF("-Done serializing at %p----\n", option);
-  /* Free allocated header fields */
-  coap_free_header(packet);
-
-  /* Pack payload */
-  /* Payload marker */
-  if (coap_pkt->payload_len)
-  {
-    *option = 0xFF;
-    ++option;
-  }
+    coap_pkt->buffer = buffer;
+    coap_pkt->version = 1;
 
-  nbiot_memmove(option, coap_pkt->payload, coap_pkt->payload_len);
+    /* Free allocated header fields */
+    coap_free_header( packet );
 
-  PRINTF("-Done %u B (header len %u, payload len %u)-\n", coap_pkt->payload_len + option - buffer, option - buffer, coap_pkt->payload_len);
+    PRINTF( "-Done %u B (payload len %u)-\n", writer.length, coap_pkt->payload_len );
 
-  PRINTF("Dump [0x%02X %02X %02X %02X  %02X %02X %02X %02X]\n",
-      coap_pkt->buffer[0],
-      coap_pkt->buffer[1],
-      coap_pkt->buffer[2],
-      coap_pkt->buffer[3],
-      coap_pkt->buffer[4],
-      coap_pkt->buffer[5],
-      coap_pkt->buffer[6],
-      coap_pkt->buffer[7]
-    );
-
-  return (option - buffer) + coap_pkt->payload_len; /* packet length */
+    return writer.length; /* packet length */
 }
 
 coap_status_t coap_parse_message( void    *request,
@@ -491,12 +499,37 @@ coap_status_t coap_parse_message( void    *request,
   size_t option_length;
   coap_packet_t *const coap_pkt = (coap_packet_t *)request;
 
-  /* Initialize packet */
-  nbiot_memzero(coap_pkt, sizeof(coap_packet_t));
+  /* Initialize what is read without checking the options bitmap, */
+  /* the other fields are only valid when their option is set */
+  nbiot_memzero(coap_pkt->options, sizeof(coap_pkt->options));
+  coap_pkt->content_type = 0;
+  coap_pkt->auth_code_len = 0;
+  coap_pkt->auth_code = NULL;
+  coap_pkt->location_path = NULL;
+  coap_pkt->uri_path = NULL;
+  coap_pkt->uri_query = NULL;
+  coap_pkt->accept_num = 0;
+  coap_pkt->block2_more = 0;
+  coap_pkt->payload_len = 0;
+  coap_pkt->payload = NULL;
+  coap_pkt->error_message = NULL;
+  coap_pkt->option_template = NULL;
+  coap_pkt->option_view_num = 0;
 
   /* pointer to packet bytes */
   coap_pkt->buffer = data;
 
+  if (data_len < COAP_HEADER_LEN)
+  {
+    coap_pkt->version = 0;
+    coap_pkt->type = COAP_TYPE_CON;
+    coap_pkt->code = 0;
+    coap_pkt->mid = 0;
+    coap_pkt->token_len = 0;
+    coap_pkt->error_message = "Truncated header";
+    return BAD_REQUEST_4_00;
+  }
+
   /* parse header fields */
   coap_pkt->version = (COAP_HEADER_VERSION_MASK & coap_pkt->buffer[0])>>COAP_HEADER_VERSION_POSITION;
   coap_pkt->type = (COAP_HEADER_TYPE_MASK & coap_pkt->buffer[0])>>COAP_HEADER_TYPE_POSITION;
@@ -506,11 +539,17 @@ coap_status_t coap_parse_message( void    *request,
 
   if (coap_pkt->version != 1)
   {
-    coap_error_message = "CoAP version must be 1";
+    coap_pkt->error_message = "CoAP version must be 1";
     return BAD_REQUEST_4_00;
   }
 
   current_option = data + COAP_HEADER_LEN;
+  if (coap_pkt->token_len > data_len - COAP_HEADER_LEN)
+  {
+    coap_pkt->token_len = 0;
+    coap_pkt->error_message = "Truncated token";
+    return BAD_REQUEST_4_00;
+  }
 
   if (coap_pkt->token_len != 0)
   {
@@ -553,6 +592,13 @@ coap_status_t coap_parse_message( void    *request,
     option_length = current_option[0] & 0x0F;
     ++current_option;
 
+    /* views point into the datagram, the whole option must be inside */
+    if (option_length == 15 || current_option + (option_delta == 14 ? 2 : option_delta == 13) + (option_length == 14 ? 2 : option_length == 13) > data + data_len)
+    {
+      coap_pkt->error_message = "Truncated option";
+      return BAD_REQUEST_4_00;
+    }
+
     /* avoids code duplication without function overhead */
     x = &option_delta;
     do
@@ -575,15 +621,24 @@ coap_status_t coap_parse_message( void    *request,
 
     option_number += option_delta;
 
+    if (option_length > (size_t)(data + data_len - current_option))
+    {
+      coap_pkt->error_message = "Truncated option";
+      return BAD_REQUEST_4_00;
+    }
+
     PRINTF("OPTION %u (delta %u, len %u): ", option_number, option_delta, option_length);
 
-    SET_OPTION(coap_pkt, option_number);
+    /* the bitmap only covers the options we know */
+    if ( option_number <= COAP_OPTION_SIZE1 )
+    {
+        SET_OPTION(coap_pkt, option_number);
+    }
 
     switch ( option_number )
     {
         case COAP_OPTION_IF_MATCH:
         case COAP_OPTION_URI_HOST:
-        case COAP_OPTION_ETAG:
         case COAP_OPTION_IF_NONE_MATCH:
         case COAP_OPTION_URI_PORT:
         case COAP_OPTION_MAX_AGE:
@@ -610,21 +665,35 @@ coap_status_t coap_parse_message( void    *request,
         break;
 
         case COAP_OPTION_URI_PATH:
-            /* coap_merge_multi_option() operates in-place on the IPBUF, but final packet field should be const string -> cast to string */
-            /* coap_merge_multi_option( (char **) &(coap_pkt->uri_path), &(coap_pkt->uri_path_len), current_option, option_length, 0); */
-            coap_add_multi_option( &(coap_pkt->uri_path), current_option, option_length, 1 );
+            if ( !coap_add_option_view( coap_pkt, &(coap_pkt->uri_path), current_option, option_length ) )
+            {
+                coap_pkt->error_message = "Too many options";
+                return BAD_REQUEST_4_00;
+            }
             PRINTF( "Uri-Path [%.*s]\n", option_length, current_option );
         break;
 
         case COAP_OPTION_URI_QUERY:
-            /* coap_merge_multi_option() operates in-place on the IPBUF, but final packet field should be const string -> cast to string */
-            /* coap_merge_multi_option( (char **) &(coap_pkt->uri_query), &(coap_pkt->uri_query_len), current_option, option_length, '&'); */
-            coap_add_multi_option( &(coap_pkt->uri_query), current_option, option_length, 1 );
+            if ( !coap_add_option_view( coap_pkt, &(coap_pkt->uri_query), current_option, option_length ) )
+            {
+                coap_pkt->error_message = "Too many options";
+                return BAD_REQUEST_4_00;
+            }
             PRINTF( "Uri-Query [%.*s]\n", option_length, current_option );
         break;
 
         case COAP_OPTION_LOCATION_PATH:
-            coap_add_multi_option( &(coap_pkt->location_path), current_option, option_length, 1 );
+            if ( !coap_add_option_view( coap_pkt, &(coap_pkt->location_path), current_option, option_length ) )
+            {
+                coap_pkt->error_message = "Too many options";
+                return BAD_REQUEST_4_00;
+            }
+        break;
+
+        case COAP_OPTION_ETAG:
+            coap_pkt->etag_len = (uint8_t)(MIN( COAP_ETAG_LEN, option_length ));
+            nbiot_memmove( coap_pkt->etag, current_option, coap_pkt->etag_len );
+            PRINTF( "ETag (len %u)\n", coap_pkt->etag_len );
         break;
 
         case COAP_OPTION_OBSERVE:
@@ -650,12 +719,17 @@ coap_status_t coap_parse_message( void    *request,
             PRINTF( "Block1 [%lu%s (%u B/blk)]\n", coap_pkt->block1_num, coap_pkt->block1_more ? "+" : "", coap_pkt->block1_size );
         break;
 
+        case COAP_OPTION_SIZE1:
+            coap_pkt->size1 = coap_parse_int_option( current_option, option_length );
+            PRINTF( "Size1 [%lu]\n", coap_pkt->size1 );
+        break;
+
         default:
             PRINTF( "unknown (%u)\n", option_number );
             /* Check if critical (odd) */
             if ( option_number & 1 )
             {
-                coap_error_message = "Unsupported critical option";
+                coap_pkt->error_message = "Unsupported critical option";
                 return BAD_OPTION_4_02;
             }
         break;
@@ -672,9 +746,9 @@ void coap_free_header( void *packet )
 {
     coap_packet_t *const coap_pkt = (coap_packet_t *)packet;
 
-    free_multi_option( coap_pkt->uri_path );
-    free_multi_option( coap_pkt->uri_query );
-    free_multi_option( coap_pkt->location_path );
+    free_multi_option( coap_pkt, coap_pkt->uri_path );
+    free_multi_option( coap_pkt, coap_pkt->uri_query );
+    free_multi_option( coap_pkt, coap_pkt->location_path );
     coap_pkt->uri_path = NULL;
     coap_pkt->uri_query = NULL;
     coap_pkt->location_path = NULL;
@@ -734,7 +808,7 @@ int coap_set_header_uri_path( void       *packet,
     coap_packet_t *coap_pkt = (coap_packet_t *)packet;
     int length = 0;
 
-    free_multi_option( coap_pkt->uri_path );
+    free_multi_option( coap_pkt, coap_pkt->uri_path );
     coap_pkt->uri_path = NULL;
 
     if ( path[0] == '/' ) ++path;
@@ -783,7 +857,7 @@ int coap_set_header_uri_query( void       *packet,
     int length = 0;
     coap_packet_t *const coap_pkt = (coap_packet_t *)packet;
 
-    free_multi_option( coap_pkt->uri_query );
+    free_multi_option( coap_pkt, coap_pkt->uri_query );
     coap_pkt->uri_query = NULL;
 
     if ( query[0] == '?' ) ++query;
@@ -811,7 +885,7 @@ int coap_set_header_location_path( void       *packet,
     coap_packet_t *coap_pkt = (coap_packet_t *)packet;
     int length = 0;
 
-    free_multi_option( coap_pkt->location_path );
+    free_multi_option( coap_pkt, coap_pkt->location_path );
     coap_pkt->location_path = NULL;
 
     if ( path[0] == '/' ) ++path;
@@ -833,6 +907,29 @@ int coap_set_header_location_path( void       *packet,
     return length;
 }
 
+int coap_get_header_etag( void           *packet,
+                          const uint8_t **etag )
+{
+    coap_packet_t *const coap_pkt = (coap_packet_t *)packet;
+
+    if ( !IS_OPTION( coap_pkt, COAP_OPTION_ETAG ) ) return 0;
+
+    *etag = coap_pkt->etag;
+    return coap_pkt->etag_len;
+}
+
+int coap_set_header_etag( void          *packet,
+                          const uint8_t *etag,
+                          size_t         etag_len )
+{
+    coap_packet_t *const coap_pkt = (coap_packet_t *)packet;
+
+    coap_pkt->etag_len = (uint8_t)(MIN( COAP_ETAG_LEN, etag_len ));
+    nbiot_memmove( coap_pkt->etag, etag, coap_pkt->etag_len );
+    SET_OPTION( coap_pkt, COAP_OPTION_ETAG );
+    return coap_pkt->etag_len;
+}
+
 int coap_get_header_observe( void     *packet,
                              uint32_t *observe )
 {
@@ -930,6 +1027,27 @@ int coap_set_header_block1( void    *packet,
     return 1;
 }
 
+int coap_get_header_size1( void     *packet,
+                           uint32_t *size )
+{
+    coap_packet_t *const coap_pkt = (coap_packet_t *)packet;
+
+    if ( !IS_OPTION( coap_pkt, COAP_OPTION_SIZE1 ) ) return 0;
+
+    *size = coap_pkt->size1;
+    return 1;
+}
+
+int coap_set_header_size1( void    *packet,
+                           uint32_t size )
+{
+    coap_packet_t *const coap_pkt = (coap_packet_t *)packet;
+
+    coap_pkt->size1 = size;
+    SET_OPTION( coap_pkt, COAP_OPTION_SIZE1 );
+    return 1;
+}
+
 int coap_set_payload( void       *packet,
                       const void *payload,
                       size_t      length )
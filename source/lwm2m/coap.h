@@ -30,7 +30,11 @@ extern "C" {
 #define COAP_ETAG_LEN                           8 /* The maximum number of bytes for the ETag */
 #define COAP_TOKEN_LEN                          8 /* The maximum number of bytes for the Token */
 #define COAP_MAX_ACCEPT_NUM                     2 /* The maximum number of accept preferences to parse/store */
+#define COAP_MAX_URI_PATH_NUM                   4  /* An alternate path and /object/instance/resource */
+#define COAP_MAX_URI_QUERY_NUM                  5  /* Every attribute of a Write-Attributes: pmin, pmax, gt, lt and stp */
+#define COAP_MAX_OPTION_VIEWS                   (COAP_MAX_URI_PATH_NUM + COAP_MAX_URI_QUERY_NUM) /* The maximum number of Uri-Path, Uri-Query and Location-Path options to parse */
 #define COAP_MAX_OPTION_HEADER_LEN              5
+#define COAP_MAX_OPTION_TEMPLATE_LEN            16 /* The maximum number of bytes for the encoded options of a template */
 
 #define COAP_HEADER_VERSION_MASK                0xC0
 #define COAP_HEADER_VERSION_POSITION            6
@@ -120,6 +124,7 @@ typedef enum
 /* CoAP header options */
 typedef enum
 {
+    COAP_OPTION_ETAG           = 4,  /* 1-8 B */
     COAP_OPTION_OBSERVE        = 6,  /* 0-3 B */
     COAP_OPTION_LOCATION_PATH  = 8,  /* 0-255 B */
     COAP_OPTION_URI_PATH       = 11, /* 0-255 B */
@@ -128,7 +133,8 @@ typedef enum
     COAP_OPTION_ACCEPT         = 17, /* 0-2 B */
     COAP_OPTION_TOKEN          = 19, /* 1-8 B */
     COAP_OPTION_BLOCK2         = 23, /* 1-3 B */
-    COAP_OPTION_BLOCK1         = 27 /* 1-3 B */
+    COAP_OPTION_BLOCK1         = 27, /* 1-3 B */
+    COAP_OPTION_SIZE1          = 60  /* 0-4 B */
 } coap_option_t;
 
 /* CoAP Content-Types */
@@ -161,11 +167,19 @@ typedef enum
 typedef struct _multi_option_t
 {
     struct _multi_option_t *next;
-    uint8_t                 is_static;
+    uint8_t                 is_static; /* data is not owned */
     uint8_t                 len;
     uint8_t                *data;
 } multi_option_t;
 
+/* Options encoded once for messages sent repeatedly, see coap_set_option_template() */
+typedef struct
+{
+    uint16_t            after; /* options up to this number are serialized per message */
+    uint8_t             length;
+    uint8_t             options[COAP_MAX_OPTION_TEMPLATE_LEN];
+} coap_option_template_t;
+
 /* Parsed message struct */
 typedef struct
 {
@@ -176,13 +190,15 @@ typedef struct
     uint8_t             code;
     uint16_t            mid;
 
-    uint8_t             options[COAP_OPTION_BLOCK1 / OPTION_MAP_SIZE + 1]; /* Bitmap to check if option is set */
+    uint8_t             options[COAP_OPTION_SIZE1 / OPTION_MAP_SIZE + 1]; /* Bitmap to check if option is set */
 
     int					content_type; /* Parse options once and store; allows setting options in random order  */
     size_t              auth_code_len;
     const uint8_t      *auth_code;
     multi_option_t     *location_path;
     multi_option_t     *uri_path;
+    uint8_t             etag_len;
+    uint8_t             etag[COAP_ETAG_LEN];
     uint32_t            observe;
     uint8_t             token_len;
     uint8_t             token[COAP_TOKEN_LEN];
@@ -196,13 +212,17 @@ typedef struct
     uint8_t             block1_more;
     uint16_t            block1_size;
     uint32_t            block1_offset;
+    uint32_t            size1;
     multi_option_t     *uri_query;
     uint16_t            payload_len;
     uint8_t            *payload;
-} coap_packet_t;
+    const char         *error_message; /* human-readable payload for parsing errors */
+    const coap_option_template_t *option_template;
 
-/* To store error code and human-readable payload */
-extern const char *coap_error_message;
+    /* parsed multi options point into the datagram, no allocation */
+    uint8_t             option_view_num;
+    multi_option_t      option_views[COAP_MAX_OPTION_VIEWS];
+} coap_packet_t;
 
 /* Functions */
 char* coap_get_multi_option_as_string( multi_option_t * option );
@@ -212,10 +232,24 @@ void coap_init_message( void               *packet,
                         uint8_t             code,
                         uint16_t            mid );
 
-size_t coap_serialize_get_size( void *packet );
+/*
+ * Encodes the options numbered above after into tmpl and attaches it to the packet, so that
+ * serializing only writes the header, the token and the options up to after (e.g. Observe for
+ * notifications). The template must be set again whenever those options change.
+ * Returns 0 when they do not fit in the template.
+*/
+int coap_set_option_template( void                   *packet,
+                              coap_option_template_t *tmpl,
+                              unsigned int            after );
 
+/*
+ * Serializes in a single pass and returns the packet length. When it exceeds buffer_len the
+ * content of buffer is undefined and the packet is left untouched: serialize it again into a
+ * buffer of at least the returned length.
+*/
 size_t coap_serialize_message( void    *packet,
-                               uint8_t *buffer );
+                               uint8_t *buffer,
+                               size_t   buffer_len );
 
 coap_status_t coap_parse_message( void    *request,
                                   uint8_t *data,
@@ -248,6 +282,13 @@ int coap_set_header_uri_query( void       *packet,
 int coap_set_header_location_path( void       *packet,
                                    const char *path ); /* Also splits optional query into Location-Query option. */
 
+int coap_get_header_etag( void           *packet,
+                          const uint8_t **etag );
+
+int coap_set_header_etag( void          *packet,
+                          const uint8_t *etag,
+                          size_t         etag_len );
+
 int coap_get_header_observe( void     *packet,
                              uint32_t *observe );
 
@@ -276,6 +317,12 @@ int coap_set_header_block1( void    *packet,
                             uint8_t  more,
                             uint16_t size );
 
+int coap_get_header_size1( void     *packet,
+                           uint32_t *size );
+
+int coap_set_header_size1( void    *packet,
+                           uint32_t size );
+
 int coap_set_payload( void       *packet,
                       const void *payload,
                       size_t      length );
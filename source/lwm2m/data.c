@@ -46,14 +46,73 @@ static size_t prv_textSerialize( lwm2m_data_t * dataP,
     }
 }
 
+#define PRV_ARENA_ALIGN( size ) (((size) + 7) & ~(size_t)7)
+
+/* NULL unless a read of the owning context is in progress and size fits */
+static void * prv_arenaAlloc( lwm2m_arena_t * arenaP,
+                              size_t size )
+{
+    void * pointer;
+
+    if ( arenaP == NULL || arenaP->depth == 0 || arenaP->buffer == NULL ) return NULL;
+    if ( size > LWM2M_DATA_ARENA_SIZE - arenaP->used ) return NULL;
+
+    pointer = arenaP->buffer + arenaP->used;
+    arenaP->used += PRV_ARENA_ALIGN( size );
+    if ( arenaP->used > LWM2M_DATA_ARENA_SIZE ) arenaP->used = LWM2M_DATA_ARENA_SIZE;
+
+    return pointer;
+}
+
+void data_arenaBegin( lwm2m_context_t * contextP )
+{
+    lwm2m_arena_t * arenaP = &contextP->dataArena;
+
+    if ( arenaP->depth++ == 0 )
+    {
+        if ( arenaP->buffer == NULL )
+        {
+            /* without it everything simply goes to the heap */
+            arenaP->buffer = (uint8_t *)nbiot_malloc( LWM2M_DATA_ARENA_SIZE );
+        }
+        arenaP->used = 0;
+    }
+}
+
+void data_arenaEnd( lwm2m_context_t * contextP )
+{
+    lwm2m_arena_t * arenaP = &contextP->dataArena;
+
+    if ( arenaP->depth == 0 ) return;
+    if ( --arenaP->depth == 0 )
+    {
+        /* trees read during the step are dead, drop them all at once */
+        arenaP->used = 0;
+    }
+}
+
+void data_arenaClose( lwm2m_context_t * contextP )
+{
+    lwm2m_arena_t * arenaP = &contextP->dataArena;
+
+    if ( arenaP->buffer != NULL )
+    {
+        nbiot_free( arenaP->buffer );
+        arenaP->buffer = NULL;
+    }
+    arenaP->used = 0;
+    arenaP->depth = 0;
+}
+
 static int prv_setBuffer( lwm2m_data_t * dataP,
                           uint8_t * buffer,
                           size_t bufferLen )
 {
+    dataP->flag &= ~LWM2M_DATA_FLAG_BORROWED;
     dataP->value.asBuffer.buffer = (uint8_t *)nbiot_malloc( bufferLen );
     if ( dataP->value.asBuffer.buffer == NULL )
     {
-        lwm2m_data_free( 1, dataP );
+        dataP->value.asBuffer.length = 0;
         return 0;
     }
     dataP->value.asBuffer.length = bufferLen;
@@ -62,6 +121,68 @@ static int prv_setBuffer( lwm2m_data_t * dataP,
     return 1;
 }
 
+/* a single text or opaque value for the resource in uriP */
+static int prv_parseValue( lwm2m_uri_t * uriP,
+                           uint8_t * buffer,
+                           size_t bufferLen,
+                           lwm2m_data_type_t type,
+                           bool borrow,
+                           lwm2m_data_t ** dataP )
+{
+    if ( !LWM2M_URI_IS_SET_RESOURCE( uriP ) ) return 0;
+    *dataP = lwm2m_data_new( 1 );
+    if ( *dataP == NULL ) return 0;
+    (*dataP)->id = uriP->resourceId;
+    (*dataP)->type = type;
+
+    if ( borrow && bufferLen > 0 )
+    {
+        (*dataP)->flag |= LWM2M_DATA_FLAG_BORROWED;
+        (*dataP)->value.asBuffer.buffer = buffer;
+        (*dataP)->value.asBuffer.length = bufferLen;
+    }
+    else if ( !prv_setBuffer( *dataP, buffer, bufferLen ) )
+    {
+        lwm2m_data_free( 1, *dataP );
+        *dataP = NULL;
+        return 0;
+    }
+
+    return 1;
+}
+
+static int prv_parse( lwm2m_uri_t * uriP,
+                      uint8_t * buffer,
+                      size_t bufferLen,
+                      lwm2m_media_type_t format,
+                      bool borrow,
+                      lwm2m_data_t ** dataP )
+{
+    LOG_ARG( "format: %s, bufferLen: %d", STR_MEDIA_TYPE( format ), bufferLen );
+    LOG_URI( uriP );
+    switch ( format )
+    {
+        case LWM2M_CONTENT_TEXT:
+        return prv_parseValue( uriP, buffer, bufferLen, LWM2M_TYPE_STRING, borrow, dataP );
+
+        case LWM2M_CONTENT_OPAQUE:
+        return prv_parseValue( uriP, buffer, bufferLen, LWM2M_TYPE_OPAQUE, borrow, dataP );
+
+        case LWM2M_CONTENT_TLV:
+        return tlv_parse( buffer, bufferLen, borrow, dataP );
+
+        /* values are unescaped or decoded, so they are always copied */
+        case LWM2M_CONTENT_JSON:
+        return json_parse( uriP, buffer, bufferLen, dataP );
+
+        case LWM2M_CONTENT_SENML_CBOR:
+        return cbor_parse( uriP, buffer, bufferLen, dataP );
+
+        default:
+        return 0;
+    }
+}
+
 lwm2m_data_t * lwm2m_data_new( int size )
 {
     lwm2m_data_t * dataP;
@@ -79,6 +200,27 @@ lwm2m_data_t * lwm2m_data_new( int size )
     return dataP;
 }
 
+lwm2m_data_t * lwm2m_data_new_arena( lwm2m_arena_t * arenaP,
+                                    int size )
+{
+    lwm2m_data_t * dataP;
+    int i;
+
+    LOG_ARG( "size: %d", size );
+    if ( size <= 0 ) return NULL;
+
+    dataP = (lwm2m_data_t *)prv_arenaAlloc( arenaP, size * sizeof(lwm2m_data_t) );
+    if ( dataP == NULL ) return lwm2m_data_new( size );
+
+    nbiot_memzero( dataP, size * sizeof(lwm2m_data_t) );
+    for ( i = 0; i < size; i++ )
+    {
+        dataP[i].flag = LWM2M_DATA_FLAG_ARENA;
+    }
+
+    return dataP;
+}
+
 void lwm2m_data_free( int size,
                       lwm2m_data_t * dataP )
 {
@@ -99,7 +241,8 @@ void lwm2m_data_free( int size,
 
             case LWM2M_TYPE_STRING:
             case LWM2M_TYPE_OPAQUE:
-            if ( dataP[i].value.asBuffer.buffer != NULL )
+            if ( dataP[i].value.asBuffer.buffer != NULL
+                 && !(dataP[i].flag & LWM2M_DATA_FLAG_BORROWED) )
             {
                 nbiot_free( dataP[i].value.asBuffer.buffer );
             }
@@ -109,7 +252,9 @@ void lwm2m_data_free( int size,
             break;
         }
     }
-    nbiot_free( dataP );
+
+    /* arena arrays go away with data_arenaEnd() */
+    if ( !(dataP[0].flag & LWM2M_DATA_FLAG_ARENA) ) nbiot_free( dataP );
 }
 
 void lwm2m_data_encode_string( const char * string,
@@ -190,6 +335,26 @@ void lwm2m_data_encode_nstring( const char * string,
     }
 }
 
+void lwm2m_data_encode_view( lwm2m_data_type_t type,
+                             uint8_t * buffer,
+                             size_t length,
+                             lwm2m_data_t * dataP )
+{
+    LOG_ARG( "length: %d", length );
+    dataP->type = type;
+    dataP->value.asBuffer.length = length;
+    if ( length == 0 )
+    {
+        dataP->flag &= ~LWM2M_DATA_FLAG_BORROWED;
+        dataP->value.asBuffer.buffer = NULL;
+    }
+    else
+    {
+        dataP->flag |= LWM2M_DATA_FLAG_BORROWED;
+        dataP->value.asBuffer.buffer = buffer;
+    }
+}
+
 void lwm2m_data_encode_int( int64_t value,
                             lwm2m_data_t * dataP )
 {
@@ -408,32 +573,16 @@ int lwm2m_data_parse( lwm2m_uri_t * uriP,
                       lwm2m_media_type_t format,
                       lwm2m_data_t ** dataP )
 {
-    LOG_ARG( "format: %s, bufferLen: %d", STR_MEDIA_TYPE( format ), bufferLen );
-    LOG_URI( uriP );
-    switch ( format )
-    {
-        case LWM2M_CONTENT_TEXT:
-        if ( !LWM2M_URI_IS_SET_RESOURCE( uriP ) ) return 0;
-        *dataP = lwm2m_data_new( 1 );
-        if ( *dataP == NULL ) return 0;
-        (*dataP)->id = uriP->resourceId;
-        (*dataP)->type = LWM2M_TYPE_STRING;
-        return prv_setBuffer( *dataP, buffer, bufferLen );
-
-        case LWM2M_CONTENT_OPAQUE:
-        if ( !LWM2M_URI_IS_SET_RESOURCE( uriP ) ) return 0;
-        *dataP = lwm2m_data_new( 1 );
-        if ( *dataP == NULL ) return 0;
-        (*dataP)->id = uriP->resourceId;
-        (*dataP)->type = LWM2M_TYPE_OPAQUE;
-        return prv_setBuffer( *dataP, buffer, bufferLen );
-
-        case LWM2M_CONTENT_TLV:
-        return tlv_parse( buffer, bufferLen, dataP );
+    return prv_parse( uriP, buffer, bufferLen, format, false, dataP );
+}
 
-        default:
-        return 0;
-    }
+int lwm2m_data_parse_view( lwm2m_uri_t * uriP,
+                           uint8_t * buffer,
+                           size_t bufferLen,
+                           lwm2m_media_type_t format,
+                           lwm2m_data_t ** dataP )
+{
+    return prv_parse( uriP, buffer, bufferLen, format, true, dataP );
 }
 
 size_t lwm2m_data_serialize( lwm2m_uri_t * uriP,
@@ -498,6 +647,12 @@ size_t lwm2m_data_serialize( lwm2m_uri_t * uriP,
             return tlv_serialize( isResourceInstance, size, dataP, bufferP );
         }
 
+        case LWM2M_CONTENT_JSON:
+        return json_serialize( uriP, size, dataP, bufferP );
+
+        case LWM2M_CONTENT_SENML_CBOR:
+        return cbor_serialize( uriP, size, dataP, bufferP );
+
         case LWM2M_CONTENT_LINK:
         return discover_serialize( NULL, uriP, size, dataP, bufferP );
 
@@ -0,0 +1,205 @@
+﻿/**
+ * Copyright (c) 2017 China Mobile IOT.
+ * All rights reserved.
+ * Reference:
+ *  wakaama - https://github.com/eclipse/wakaama
+**/
+
+#include "internals.h"
+
+/* room taken in a response datagram by the CoAP header, token and options */
+#define PRV_BLOCK_OVERHEAD 32
+
+/* largest block size whose response still fits the receive buffer */
+static uint16_t prv_blockSize( void )
+{
+    uint16_t size = REST_MAX_CHUNK_SIZE;
+
+    while ( size > 16 && size + PRV_BLOCK_OVERHEAD > NBIOT_SOCK_RECV_BUF_SIZE )
+    {
+        size >>= 1;
+    }
+
+    return size;
+}
+
+static void prv_free( lwm2m_context_t * contextP )
+{
+    lwm2m_download_t * downloadP = contextP->downloadP;
+
+    contextP->downloadP = NULL;
+    nbiot_free( downloadP->path );
+    nbiot_free( downloadP );
+}
+
+static void prv_fail( lwm2m_context_t * contextP,
+                      uint8_t status )
+{
+    lwm2m_download_t * downloadP = contextP->downloadP;
+
+    LOG_ARG( "Download failed: %u.%02u", status >> 5, status & 0x1F );
+    downloadP->callback( status, downloadP->blockNum * downloadP->blockSize, NULL, 0, downloadP->userData );
+    if ( contextP->downloadP == downloadP ) prv_free( contextP );
+}
+
+static void prv_handleResponse( lwm2m_transaction_t * transacP,
+                                void * message );
+
+static int prv_request( lwm2m_context_t * contextP )
+{
+    lwm2m_download_t * downloadP = contextP->downloadP;
+    lwm2m_transaction_t * transacP;
+
+    transacP = transaction_new( COAP_TYPE_CON, COAP_GET, NULL, NULL, contextP->nextMID++, 4, NULL, ENDPOINT_UNKNOWN, downloadP->sessionH );
+    if ( transacP == NULL ) return -1;
+
+    if ( downloadP->path[0] != 0 )
+    {
+        coap_set_header_uri_path( transacP->message, downloadP->path );
+    }
+    coap_set_header_block2( transacP->message, downloadP->blockNum, 0, downloadP->blockSize );
+
+    transacP->callback = prv_handleResponse;
+    transacP->userData = (void *)contextP;
+
+    if ( transaction_add( contextP, transacP ) != 0 )
+    {
+        transaction_free( contextP, transacP );
+        return -1;
+    }
+
+    /* a failed send removes the transaction, prv_handleResponse() ignores it until it is ours */
+    if ( transaction_send( contextP, transacP ) != 0 ) return -1;
+    downloadP->transacP = transacP;
+
+    return 0;
+}
+
+static void prv_handleResponse( lwm2m_transaction_t * transacP,
+                                void * message )
+{
+    lwm2m_context_t * contextP = (lwm2m_context_t *)transacP->userData;
+    lwm2m_download_t * downloadP = contextP->downloadP;
+    coap_packet_t * packet = (coap_packet_t *)message;
+    uint32_t num = 0;
+    uint8_t more = 0;
+    uint16_t size = downloadP != NULL ? downloadP->blockSize : 0;
+    const uint8_t *etag;
+    int etagLen;
+
+    if ( downloadP == NULL || downloadP->transacP != transacP ) return;
+    downloadP->transacP = NULL;
+
+    if ( packet == NULL )
+    {
+        prv_fail( contextP, COAP_503_SERVICE_UNAVAILABLE );
+        return;
+    }
+    if ( packet->code != COAP_205_CONTENT )
+    {
+        /* a reset or an empty answer ends the download as well */
+        prv_fail( contextP, packet->code >= COAP_400_BAD_REQUEST ? packet->code : COAP_503_SERVICE_UNAVAILABLE );
+        return;
+    }
+
+    /* the peer may answer with smaller blocks than requested */
+    if ( coap_get_header_block2( packet, &num, &more, &size, NULL )
+         && num * size != downloadP->blockNum * downloadP->blockSize )
+    {
+        prv_fail( contextP, COAP_408_REQ_ENTITY_INCOMPLETE );
+        return;
+    }
+    if ( more && packet->payload_len != size )
+    {
+        prv_fail( contextP, COAP_408_REQ_ENTITY_INCOMPLETE );
+        return;
+    }
+
+    /* the representation must not change between blocks */
+    etagLen = coap_get_header_etag( packet, &etag );
+    if ( etagLen > 0 )
+    {
+        if ( downloadP->etagLen == 0 )
+        {
+            nbiot_memmove( downloadP->etag, etag, etagLen );
+            downloadP->etagLen = (uint8_t)etagLen;
+        }
+        else if ( downloadP->etagLen != etagLen
+                  || nbiot_memcmp( downloadP->etag, etag, etagLen ) )
+        {
+            prv_fail( contextP, COAP_408_REQ_ENTITY_INCOMPLETE );
+            return;
+        }
+    }
+
+    if ( !downloadP->callback( more ? COAP_231_CONTINUE : COAP_205_CONTENT,
+                               num * size,
+                               packet->payload,
+                               packet->payload_len,
+                               downloadP->userData )
+         || !more )
+    {
+        if ( contextP->downloadP == downloadP ) prv_free( contextP );
+        return;
+    }
+    /* stopped, maybe restarted, from the callback */
+    if ( contextP->downloadP != downloadP ) return;
+
+    downloadP->blockSize = size;
+    downloadP->blockNum = num + 1;
+    if ( prv_request( contextP ) != 0 )
+    {
+        prv_fail( contextP, COAP_500_INTERNAL_SERVER_ERROR );
+    }
+}
+
+int lwm2m_download_start( lwm2m_context_t * contextP,
+                          void * sessionH,
+                          const char * path,
+                          lwm2m_download_callback_t callback,
+                          void * userData )
+{
+    lwm2m_download_t * downloadP;
+
+    LOG_ARG( "path: \"%s\"", path );
+    if ( sessionH == NULL || path == NULL || callback == NULL ) return -1;
+
+    lwm2m_download_stop( contextP );
+
+    downloadP = (lwm2m_download_t *)nbiot_malloc( sizeof(lwm2m_download_t) );
+    if ( downloadP == NULL ) return -1;
+    nbiot_memzero( downloadP, sizeof(lwm2m_download_t) );
+
+    downloadP->path = nbiot_strdup( path );
+    if ( downloadP->path == NULL )
+    {
+        nbiot_free( downloadP );
+        return -1;
+    }
+    downloadP->sessionH = sessionH;
+    downloadP->blockSize = prv_blockSize();
+    downloadP->callback = callback;
+    downloadP->userData = userData;
+    contextP->downloadP = downloadP;
+
+    if ( prv_request( contextP ) != 0 )
+    {
+        lwm2m_download_stop( contextP );
+        return -1;
+    }
+
+    return 0;
+}
+
+void lwm2m_download_stop( lwm2m_context_t * contextP )
+{
+    lwm2m_download_t * downloadP = contextP->downloadP;
+
+    if ( downloadP == NULL ) return;
+
+    if ( downloadP->transacP != NULL )
+    {
+        transaction_remove( contextP, downloadP->transacP );
+    }
+    prv_free( contextP );
+}
@@ -59,7 +59,8 @@ extern "C" {
     ((M) == LWM2M_CONTENT_OPAQUE ? "LWM2M_CONTENT_OPAQUE" : \
     ((M) == LWM2M_CONTENT_TLV ? "LWM2M_CONTENT_TLV" : \
     ((M) == LWM2M_CONTENT_JSON ? "LWM2M_CONTENT_JSON" : \
-    "Unknown")))))
+    ((M) == LWM2M_CONTENT_SENML_CBOR ? "LWM2M_CONTENT_SENML_CBOR" : \
+    "Unknown"))))))
 
 #define STR_STATE(S)    \
     ((S) == STATE_INITIAL ? "STATE_INITIAL" : \
@@ -188,9 +189,25 @@ int uri_toString( lwm2m_uri_t *uriP,
                   size_t       bufferLen,
                   uri_depth_t *depthP );
 
+/*
+ * defined in data.c
+*/
+#ifndef LWM2M_DATA_ARENA_SIZE
+#define LWM2M_DATA_ARENA_SIZE 512
+#endif
+
+/* lwm2m_data_new_arena() on contextP->dataArena allocates from it until the matching end */
+void data_arenaBegin( lwm2m_context_t *contextP );
+void data_arenaEnd( lwm2m_context_t *contextP );
+void data_arenaClose( lwm2m_context_t *contextP );
+
 /*
  * defined in objects.c
 */
+lwm2m_object_t * object_find( lwm2m_context_t *contextP,
+                              uint16_t         objectId );
+lwm2m_list_t * object_findInstance( lwm2m_object_t *objectP,
+                                    uint16_t        instanceId );
 coap_status_t object_readData( lwm2m_context_t *contextP,
                                lwm2m_uri_t     *uriP,
                                int             *sizeP,
@@ -205,6 +222,13 @@ coap_status_t object_write( lwm2m_context_t   *contextP,
                             lwm2m_media_type_t format,
                             uint8_t           *buffer,
                             size_t             length );
+coap_status_t object_writeBlock( lwm2m_context_t *contextP,
+                                 lwm2m_uri_t     *uriP,
+                                 bool             execute,
+                                 uint32_t         offset,
+                                 uint8_t         *buffer,
+                                 size_t           length,
+                                 bool             more );
 coap_status_t object_execute( lwm2m_context_t *contextP,
                               lwm2m_uri_t     *uriP,
                               uint8_t         *buffer,
@@ -228,8 +252,7 @@ bool object_isInstanceNew( lwm2m_context_t *contextP,
                            uint16_t         objectId,
                            uint16_t         instanceId );
 int object_getRegisterPayload( lwm2m_context_t *contextP,
-                               uint8_t         *buffer,
-                               size_t           length);
+                               const uint8_t  **payloadP );
 int object_getServers(lwm2m_context_t *contextP);
 coap_status_t object_createInstance( lwm2m_context_t *contextP,
                                      lwm2m_uri_t     *uriP,
@@ -250,18 +273,25 @@ lwm2m_transaction_t* transaction_new( coap_message_type_t   type,
                                       uint8_t              *token,
                                       lwm2m_endpoint_type_t peerType,
                                       void                 *peerP );
+/*
+ * Sends or retransmits an added transaction. On any non-zero return the transaction has
+ * been removed and freed: after the callback when it ended (acknowledged or retries
+ * exhausted), without it when it could not be sent at all. Do not touch it afterwards.
+*/
 int transaction_send( lwm2m_context_t     *contextP,
                       lwm2m_transaction_t *transacP );
-void transaction_free( lwm2m_transaction_t *transacP );
+int transaction_add( lwm2m_context_t     *contextP,
+                     lwm2m_transaction_t *transacP );
+void transaction_free( lwm2m_context_t     *contextP,
+                       lwm2m_transaction_t *transacP );
+void transaction_clearIndex( lwm2m_context_t *contextP );
+void transaction_clearBuffers( lwm2m_context_t *contextP );
 void transaction_remove( lwm2m_context_t     *contextP,
                          lwm2m_transaction_t *transacP);
 bool transaction_handleResponse( lwm2m_context_t *contextP,
                                  void            *fromSessionH,
                                  coap_packet_t   *message,
                                  coap_packet_t   *response );
-void transaction_step( lwm2m_context_t *contextP,
-                       time_t           currentTime,
-                       time_t          *timeoutP );
 
 /*
  * defined in management.c
@@ -289,9 +319,12 @@ coap_status_t observe_setParameters( lwm2m_context_t    *contextP,
                                      lwm2m_uri_t        *uriP,
                                      lwm2m_server_t     *serverP,
                                      lwm2m_attributes_t *attrP );
+void observe_timerExpired( lwm2m_context_t  *contextP,
+                           lwm2m_observed_t *observedP );
+void observe_wakeUp( lwm2m_context_t *contextP,
+                     lwm2m_server_t  *serverP );
 void observe_step( lwm2m_context_t *contextP,
-                   time_t           currentTime,
-                   time_t          *timeoutP );
+                   clock_t          currentTime );
 lwm2m_observed_t* observe_findByUri( lwm2m_context_t *contextP,
                                      lwm2m_uri_t     *uriP );
 
@@ -301,11 +334,31 @@ lwm2m_observed_t* observe_findByUri( lwm2m_context_t *contextP,
 void registration_deregister( lwm2m_context_t *contextP,
                               lwm2m_server_t  *serverP );
 uint8_t registration_start( lwm2m_context_t *contextP );
+void registration_refresh( lwm2m_context_t *contextP,
+                           lwm2m_server_t  *serverP );
+void registration_keepAwake( lwm2m_context_t *contextP,
+                             lwm2m_server_t  *serverP );
+void registration_sleep( lwm2m_context_t *contextP,
+                         lwm2m_server_t  *serverP );
 void registration_step( lwm2m_context_t *contextP,
-                        time_t           currentTime,
-                        time_t          *timeoutP );
+                        clock_t          currentTime );
 lwm2m_status_t registration_getStatus( lwm2m_context_t * contextP );
 
+/*
+ * defined in timer.c
+*/
+bool timer_schedule( lwm2m_context_t *contextP,
+                     lwm2m_timer_t   *timerP,
+                     clock_t          deadline );
+void timer_cancel( lwm2m_context_t *contextP,
+                   lwm2m_timer_t   *timerP );
+lwm2m_timer_t* timer_pop( lwm2m_context_t *contextP,
+                          clock_t          currentTime );
+void timer_timeout( lwm2m_context_t *contextP,
+                    clock_t          currentTime,
+                    clock_t         *timeoutP );
+void timer_clear( lwm2m_context_t *contextP );
+
 /*
  * defined in packet.c
 */
@@ -317,8 +370,8 @@ coap_status_t message_send( lwm2m_context_t *contextP,
  * defined in bootstrap.c
 */
 void bootstrap_step( lwm2m_context_t *contextP,
-                     uint32_t         currentTime,
-                     time_t          *timeoutP );
+                     clock_t          currentTime,
+                     clock_t         *timeoutP );
 coap_status_t bootstrap_handleCommand( lwm2m_context_t *contextP,
                                        lwm2m_uri_t     *uriP,
                                        lwm2m_server_t  *serverP,
@@ -336,11 +389,99 @@ lwm2m_status_t bootstrap_getStatus( lwm2m_context_t * contextP );
 */
 int tlv_parse( uint8_t       *buffer,
                size_t         bufferLen,
+               bool           borrow,
                lwm2m_data_t **dataP );
 size_t tlv_serialize( bool          isResourceInstance,
                       int           size,
                       lwm2m_data_t *dataP,
                       uint8_t     **bufferP );
+/* no allocation, returns 0 when the records do not fit in bufferLen */
+size_t tlv_serializeBuffer( bool          isResourceInstance,
+                            int           size,
+                            lwm2m_data_t *dataP,
+                            uint8_t      *buffer,
+                            size_t        bufferLen );
+
+/*
+ * defined in senml.c
+*/
+#define SENML_MAX_LEVEL 4
+
+typedef struct
+{
+    uint16_t     ids[SENML_MAX_LEVEL];
+    uint8_t      depth;
+    lwm2m_data_t data;
+} senml_record_t;
+
+typedef struct
+{
+    uint8_t *buffer; /* NULL while measuring */
+    size_t   length;
+} senml_writer_t;
+
+typedef struct
+{
+    void (*header)( senml_writer_t *writerP,
+                    const uint8_t  *baseName,
+                    size_t          baseNameLen,
+                    size_t          count );
+    bool (*record)( senml_writer_t *writerP,
+                    const uint8_t  *baseName,
+                    size_t          baseNameLen,
+                    const uint8_t  *name,
+                    size_t          nameLen,
+                    size_t          index,
+                    lwm2m_data_t   *dataP );
+    void (*footer)( senml_writer_t *writerP );
+} senml_format_t;
+
+void senml_write( senml_writer_t *writerP,
+                  const void     *data,
+                  size_t          length );
+bool senml_parsePath( const uint8_t  *baseName,
+                      size_t          baseNameLen,
+                      const uint8_t  *name,
+                      size_t          nameLen,
+                      senml_record_t *recordP );
+bool senml_parseObjLink( const uint8_t *value,
+                         size_t         valueLen,
+                         lwm2m_data_t  *dataP );
+void senml_freeRecords( senml_record_t *recordArray,
+                        int             count );
+int senml_convertRecords( lwm2m_uri_t    *uriP,
+                          senml_record_t *recordArray,
+                          int             count,
+                          lwm2m_data_t  **dataP );
+size_t senml_serialize( lwm2m_uri_t          *uriP,
+                        int                   size,
+                        lwm2m_data_t         *dataP,
+                        const senml_format_t *formatP,
+                        uint8_t             **bufferP );
+
+/*
+ * defined in json.c
+*/
+int json_parse( lwm2m_uri_t   *uriP,
+                uint8_t       *buffer,
+                size_t         bufferLen,
+                lwm2m_data_t **dataP );
+size_t json_serialize( lwm2m_uri_t   *uriP,
+                       int            size,
+                       lwm2m_data_t  *dataP,
+                       uint8_t      **bufferP );
+
+/*
+ * defined in cbor.c
+*/
+int cbor_parse( lwm2m_uri_t   *uriP,
+                uint8_t       *buffer,
+                size_t         bufferLen,
+                lwm2m_data_t **dataP );
+size_t cbor_serialize( lwm2m_uri_t   *uriP,
+                       int            size,
+                       lwm2m_data_t  *dataP,
+                       uint8_t      **bufferP );
 
 /*
 * defined in discover.c
@@ -352,8 +493,11 @@ int discover_serialize( lwm2m_context_t *contextP,
                         uint8_t        **bufferP );
 
 /*
- * defined in block1.c
+ * defined in block.c
 */
+/* the maximum payload transfered by block1 we accumulate per server */
+#define MAX_BLOCK1_SIZE NBIOT_BLOCK1_MAX_SIZE
+
 coap_status_t coap_block1_handler( lwm2m_block1_data_t **block1Data,
                                    uint16_t              mid,
                                    uint8_t              *buffer,
@@ -361,9 +505,23 @@ coap_status_t coap_block1_handler( lwm2m_block1_data_t **block1Data,
                                    uint16_t              blockSize,
                                    uint32_t              blockNum,
                                    bool                  blockMore,
+                                   uint32_t              totalSize,
                                    uint8_t             **outputBuffer,
                                    size_t               *outputLength );
+coap_status_t coap_block1_stream( lwm2m_context_t      *contextP,
+                                  lwm2m_block1_data_t **block1Data,
+                                  coap_packet_t        *message,
+                                  uint16_t              blockSize,
+                                  uint32_t              blockNum,
+                                  bool                  blockMore );
 void free_block1_buffer( lwm2m_block1_data_t *block1Data );
+lwm2m_block2_data_t* coap_block2_find( lwm2m_block2_data_t **block2Data,
+                                       coap_packet_t        *message );
+lwm2m_block2_data_t* coap_block2_store( lwm2m_block2_data_t **block2Data,
+                                        coap_packet_t        *message,
+                                        coap_packet_t        *response,
+                                        uint32_t              etag );
+void free_block2_buffer( lwm2m_block2_data_t *block2Data );
 
 /*
  * defined in utils.c
@@ -0,0 +1,679 @@
+﻿/**
+ * Copyright (c) 2017 China Mobile IOT.
+ * All rights reserved.
+ * Reference:
+ *  wakaama - https://github.com/eclipse/wakaama
+**/
+
+#include "internals.h"
+
+#define _PRV_JSON_MAX_DEPTH   8
+#define _PRV_JSON_NUMBER_LEN  64
+#define _PRV_JSON_MAX_EXPONENT 400
+
+#define PRV_WRITE_CONST(W, S) senml_write( (W), (S), sizeof(S) - 1 )
+
+static const char prv_base64Alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/*
+ * Parser
+*/
+
+static size_t prv_skipSpace( const uint8_t * buffer,
+                             size_t bufferLen,
+                             size_t index )
+{
+    while ( index < bufferLen
+            && (buffer[index] == ' '
+                || buffer[index] == '\t'
+                || buffer[index] == '\r'
+                || buffer[index] == '\n') )
+    {
+        index++;
+    }
+
+    return index;
+}
+
+/* Returns the index following the closing quote, 0 on error. */
+static size_t prv_parseString( const uint8_t * buffer,
+                               size_t bufferLen,
+                               size_t index,
+                               const uint8_t ** stringP,
+                               size_t * lengthP )
+{
+    size_t start;
+
+    if ( index >= bufferLen || buffer[index] != '"' ) return 0;
+    index++;
+    start = index;
+
+    while ( index < bufferLen && buffer[index] != '"' )
+    {
+        if ( buffer[index] == '\\' ) index++;
+        index++;
+    }
+    if ( index >= bufferLen ) return 0;
+
+    *stringP = buffer + start;
+    *lengthP = index - start;
+
+    return index + 1;
+}
+
+static size_t prv_parseLiteral( const uint8_t * buffer,
+                                size_t bufferLen,
+                                size_t index )
+{
+    while ( index < bufferLen
+            && ((buffer[index] >= '0' && buffer[index] <= '9')
+                || (buffer[index] >= 'a' && buffer[index] <= 'z')
+                || buffer[index] == '-'
+                || buffer[index] == '+'
+                || buffer[index] == '.'
+                || buffer[index] == 'E') )
+    {
+        index++;
+    }
+
+    return index;
+}
+
+static size_t prv_skipValue( const uint8_t * buffer,
+                             size_t bufferLen,
+                             size_t index,
+                             int depth )
+{
+    const uint8_t * string;
+    size_t length;
+    uint8_t close;
+
+    if ( index >= bufferLen || depth > _PRV_JSON_MAX_DEPTH ) return 0;
+
+    switch ( buffer[index] )
+    {
+        case '"':
+        return prv_parseString( buffer, bufferLen, index, &string, &length );
+
+        case '{':
+        close = '}';
+        break;
+
+        case '[':
+        close = ']';
+        break;
+
+        default:
+        length = prv_parseLiteral( buffer, bufferLen, index );
+        return length == index ? 0 : length;
+    }
+
+    index = prv_skipSpace( buffer, bufferLen, index + 1 );
+    if ( index < bufferLen && buffer[index] == close ) return index + 1;
+
+    while ( index < bufferLen )
+    {
+        if ( close == '}' )
+        {
+            index = prv_parseString( buffer, bufferLen, index, &string, &length );
+            if ( index == 0 ) return 0;
+            index = prv_skipSpace( buffer, bufferLen, index );
+            if ( index >= bufferLen || buffer[index] != ':' ) return 0;
+            index = prv_skipSpace( buffer, bufferLen, index + 1 );
+        }
+
+        index = prv_skipValue( buffer, bufferLen, index, depth + 1 );
+        if ( index == 0 ) return 0;
+        index = prv_skipSpace( buffer, bufferLen, index );
+        if ( index >= bufferLen ) return 0;
+        if ( buffer[index] == close ) return index + 1;
+        if ( buffer[index] != ',' ) return 0;
+        index = prv_skipSpace( buffer, bufferLen, index + 1 );
+    }
+
+    return 0;
+}
+
+static bool prv_isKey( const uint8_t * key,
+                       size_t keyLen,
+                       const char * name )
+{
+    size_t i;
+
+    for ( i = 0; i < keyLen && name[i] != 0; i++ )
+    {
+        if ( key[i] != (uint8_t)name[i] ) return false;
+    }
+
+    return i == keyLen && name[i] == 0;
+}
+
+static int prv_hexValue( uint8_t c )
+{
+    if ( c >= '0' && c <= '9' ) return c - '0';
+    if ( c >= 'a' && c <= 'f' ) return c - 'a' + 10;
+    if ( c >= 'A' && c <= 'F' ) return c - 'A' + 10;
+    return -1;
+}
+
+/* When dst is NULL, only the unescaped length is computed. Returns -1 on error. */
+static int prv_unescape( const uint8_t * src,
+                         size_t srcLen,
+                         uint8_t * dst )
+{
+    size_t i;
+    int length = 0;
+
+    for ( i = 0; i < srcLen; i++ )
+    {
+        uint8_t c = src[i];
+
+        if ( c == '\\' )
+        {
+            if ( ++i >= srcLen ) return -1;
+            switch ( src[i] )
+            {
+                case '"':
+                case '\\':
+                case '/':
+                c = src[i];
+                break;
+                case 'b':
+                c = '\b';
+                break;
+                case 'f':
+                c = '\f';
+                break;
+                case 'n':
+                c = '\n';
+                break;
+                case 'r':
+                c = '\r';
+                break;
+                case 't':
+                c = '\t';
+                break;
+                case 'u':
+                {
+                    uint32_t code = 0;
+                    int k;
+
+                    if ( i + 4 >= srcLen ) return -1;
+                    for ( k = 1; k <= 4; k++ )
+                    {
+                        int hex = prv_hexValue( src[i + k] );
+                        if ( hex < 0 ) return -1;
+                        code = (code << 4) | hex;
+                    }
+                    i += 4;
+
+                    /* encode the code point as UTF-8 */
+                    if ( code < 0x80 )
+                    {
+                        c = (uint8_t)code;
+                        break;
+                    }
+                    if ( code < 0x800 )
+                    {
+                        if ( dst != NULL )
+                        {
+                            dst[length] = (uint8_t)(0xC0 | (code >> 6));
+                            dst[length + 1] = (uint8_t)(0x80 | (code & 0x3F));
+                        }
+                        length += 2;
+                    }
+                    else
+                    {
+                        if ( dst != NULL )
+                        {
+                            dst[length] = (uint8_t)(0xE0 | (code >> 12));
+                            dst[length + 1] = (uint8_t)(0x80 | ((code >> 6) & 0x3F));
+                            dst[length + 2] = (uint8_t)(0x80 | (code & 0x3F));
+                        }
+                        length += 3;
+                    }
+                    continue;
+                }
+                default:
+                return -1;
+            }
+        }
+
+        if ( dst != NULL ) dst[length] = c;
+        length++;
+    }
+
+    return length;
+}
+
+/* JSON numbers may carry an exponent, utils_plainTextToFloat64() does not take one */
+static bool prv_textToFloat( const uint8_t * value,
+                             size_t valueLen,
+                             double * floatP )
+{
+    int64_t exponent = 0;
+    size_t i;
+
+    for ( i = 0; i < valueLen && value[i] != 'e' && value[i] != 'E'; i++ );
+    if ( i < valueLen )
+    {
+        size_t start = i + 1;
+
+        if ( start < valueLen && value[start] == '+' ) start++;
+        if ( !utils_plainTextToInt64( (uint8_t *)value + start, valueLen - start, &exponent )
+             || exponent > _PRV_JSON_MAX_EXPONENT
+             || exponent < -_PRV_JSON_MAX_EXPONENT )
+        {
+            return false;
+        }
+    }
+    if ( !utils_plainTextToFloat64( (uint8_t *)value, i, floatP ) ) return false;
+
+    for ( ; exponent > 0; exponent-- ) *floatP *= 10;
+    for ( ; exponent < 0; exponent++ ) *floatP /= 10;
+
+    return true;
+}
+
+static bool prv_convertValue( const uint8_t * key,
+                              size_t keyLen,
+                              const uint8_t * value,
+                              size_t valueLen,
+                              lwm2m_data_t * dataP )
+{
+    if ( prv_isKey( key, keyLen, "v" ) )
+    {
+        int64_t intValue;
+        double floatValue;
+
+        if ( utils_plainTextToInt64( (uint8_t *)value, valueLen, &intValue ) )
+        {
+            lwm2m_data_encode_int( intValue, dataP );
+        }
+        else if ( prv_textToFloat( value, valueLen, &floatValue ) )
+        {
+            lwm2m_data_encode_float( floatValue, dataP );
+        }
+        else
+        {
+            return false;
+        }
+    }
+    else if ( prv_isKey( key, keyLen, "bv" ) )
+    {
+        if ( prv_isKey( value, valueLen, "true" ) )
+        {
+            lwm2m_data_encode_bool( true, dataP );
+        }
+        else if ( prv_isKey( value, valueLen, "false" ) )
+        {
+            lwm2m_data_encode_bool( false, dataP );
+        }
+        else
+        {
+            return false;
+        }
+    }
+    else if ( prv_isKey( key, keyLen, "sv" ) )
+    {
+        int length;
+
+        length = prv_unescape( value, valueLen, NULL );
+        if ( length < 0 ) return false;
+
+        dataP->type = LWM2M_TYPE_STRING;
+        dataP->value.asBuffer.length = length;
+        dataP->value.asBuffer.buffer = NULL;
+        if ( length > 0 )
+        {
+            dataP->value.asBuffer.buffer = (uint8_t *)nbiot_malloc( length );
+            if ( dataP->value.asBuffer.buffer == NULL ) return false;
+            prv_unescape( value, valueLen, dataP->value.asBuffer.buffer );
+        }
+    }
+    else
+    {
+        return senml_parseObjLink( value, valueLen, dataP );
+    }
+
+    return true;
+}
+
+static size_t prv_parseRecord( const uint8_t * buffer,
+                               size_t bufferLen,
+                               size_t index,
+                               const uint8_t * baseName,
+                               size_t baseNameLen,
+                               senml_record_t * recordP )
+{
+    const uint8_t * name = NULL;
+    size_t nameLen = 0;
+
+    nbiot_memzero( recordP, sizeof(senml_record_t) );
+    if ( index >= bufferLen || buffer[index] != '{' ) return 0;
+    index = prv_skipSpace( buffer, bufferLen, index + 1 );
+
+    while ( index < bufferLen && buffer[index] != '}' )
+    {
+        const uint8_t * key;
+        const uint8_t * value;
+        size_t keyLen;
+        size_t valueLen;
+        size_t next;
+
+        index = prv_parseString( buffer, bufferLen, index, &key, &keyLen );
+        if ( index == 0 ) return 0;
+        index = prv_skipSpace( buffer, bufferLen, index );
+        if ( index >= bufferLen || buffer[index] != ':' ) return 0;
+        index = prv_skipSpace( buffer, bufferLen, index + 1 );
+
+        if ( prv_isKey( key, keyLen, "n" ) )
+        {
+            next = prv_parseString( buffer, bufferLen, index, &name, &nameLen );
+        }
+        else if ( prv_isKey( key, keyLen, "v" )
+                  || prv_isKey( key, keyLen, "bv" )
+                  || prv_isKey( key, keyLen, "sv" )
+                  || prv_isKey( key, keyLen, "ov" ) )
+        {
+            if ( recordP->data.type != LWM2M_TYPE_UNDEFINED ) return 0;
+            if ( index < bufferLen && buffer[index] == '"' )
+            {
+                next = prv_parseString( buffer, bufferLen, index, &value, &valueLen );
+            }
+            else
+            {
+                next = prv_parseLiteral( buffer, bufferLen, index );
+                value = buffer + index;
+                valueLen = next - index;
+            }
+            if ( next == 0 || next == index ) return 0;
+            if ( !prv_convertValue( key, keyLen, value, valueLen, &recordP->data ) ) return 0;
+        }
+        else
+        {
+            next = prv_skipValue( buffer, bufferLen, index, 1 );
+        }
+        if ( next == 0 ) return 0;
+
+        index = prv_skipSpace( buffer, bufferLen, next );
+        if ( index < bufferLen && buffer[index] == ',' )
+        {
+            index = prv_skipSpace( buffer, bufferLen, index + 1 );
+        }
+    }
+    if ( index >= bufferLen || recordP->data.type == LWM2M_TYPE_UNDEFINED ) return 0;
+
+    if ( !senml_parsePath( baseName, baseNameLen, name, nameLen, recordP ) ) return 0;
+
+    return index + 1;
+}
+
+int json_parse( lwm2m_uri_t * uriP,
+                uint8_t * buffer,
+                size_t bufferLen,
+                lwm2m_data_t ** dataP )
+{
+    const uint8_t * baseName = NULL;
+    size_t baseNameLen = 0;
+    size_t recordsIndex = 0;
+    size_t index;
+    senml_record_t * recordArray;
+    int count;
+    int size;
+    int i;
+
+    LOG_ARG( "bufferLen: %d", bufferLen );
+
+    *dataP = NULL;
+    if ( uriP == NULL ) return 0;
+
+    /* the base name may follow the records, locate both first */
+    index = prv_skipSpace( buffer, bufferLen, 0 );
+    if ( index >= bufferLen || buffer[index] != '{' ) return 0;
+    index = prv_skipSpace( buffer, bufferLen, index + 1 );
+    while ( index < bufferLen && buffer[index] != '}' )
+    {
+        const uint8_t * key;
+        size_t keyLen;
+
+        index = prv_parseString( buffer, bufferLen, index, &key, &keyLen );
+        if ( index == 0 ) return 0;
+        index = prv_skipSpace( buffer, bufferLen, index );
+        if ( index >= bufferLen || buffer[index] != ':' ) return 0;
+        index = prv_skipSpace( buffer, bufferLen, index + 1 );
+
+        if ( prv_isKey( key, keyLen, "bn" ) )
+        {
+            index = prv_parseString( buffer, bufferLen, index, &baseName, &baseNameLen );
+        }
+        else
+        {
+            if ( prv_isKey( key, keyLen, "e" ) )
+            {
+                if ( index >= bufferLen || buffer[index] != '[' ) return 0;
+                recordsIndex = index;
+            }
+            index = prv_skipValue( buffer, bufferLen, index, 0 );
+        }
+        if ( index == 0 ) return 0;
+
+        index = prv_skipSpace( buffer, bufferLen, index );
+        if ( index < bufferLen && buffer[index] == ',' )
+        {
+            index = prv_skipSpace( buffer, bufferLen, index + 1 );
+        }
+    }
+    if ( index >= bufferLen || recordsIndex == 0 ) return 0;
+    if ( prv_skipSpace( buffer, bufferLen, index + 1 ) != bufferLen ) return 0;
+
+    /* count the records, the array was validated above */
+    count = 0;
+    index = prv_skipSpace( buffer, bufferLen, recordsIndex + 1 );
+    while ( buffer[index] != ']' )
+    {
+        index = prv_skipValue( buffer, bufferLen, index, 1 );
+        index = prv_skipSpace( buffer, bufferLen, index );
+        if ( buffer[index] == ',' ) index = prv_skipSpace( buffer, bufferLen, index + 1 );
+        count++;
+    }
+    if ( count == 0 ) return 0;
+
+    recordArray = (senml_record_t *)nbiot_malloc( count * sizeof(senml_record_t) );
+    if ( recordArray == NULL ) return 0;
+
+    index = prv_skipSpace( buffer, bufferLen, recordsIndex + 1 );
+    for ( i = 0; i < count; i++ )
+    {
+        index = prv_parseRecord( buffer, bufferLen, index, baseName, baseNameLen, recordArray + i );
+        if ( index == 0 )
+        {
+            senml_freeRecords( recordArray, i + 1 );
+            nbiot_free( recordArray );
+            return 0;
+        }
+        index = prv_skipSpace( buffer, bufferLen, index );
+        if ( buffer[index] == ',' ) index = prv_skipSpace( buffer, bufferLen, index + 1 );
+    }
+
+    size = senml_convertRecords( uriP, recordArray, count, dataP );
+    nbiot_free( recordArray );
+
+    return size;
+}
+
+/*
+ * Serializer
+*/
+
+static void prv_writeEscaped( senml_writer_t * writerP,
+                              const uint8_t * string,
+                              size_t length )
+{
+    size_t i;
+    size_t start = 0;
+
+    for ( i = 0; i < length; i++ )
+    {
+        uint8_t escape[6];
+
+        if ( string[i] >= 0x20 && string[i] != '"' && string[i] != '\\' ) continue;
+
+        senml_write( writerP, string + start, i - start );
+        start = i + 1;
+        escape[0] = '\\';
+        switch ( string[i] )
+        {
+            case '"':
+            case '\\':
+            escape[1] = string[i];
+            break;
+            case '\n':
+            escape[1] = 'n';
+            break;
+            case '\r':
+            escape[1] = 'r';
+            break;
+            case '\t':
+            escape[1] = 't';
+            break;
+            default:
+            escape[1] = 'u';
+            escape[2] = '0';
+            escape[3] = '0';
+            escape[4] = "0123456789ABCDEF"[string[i] >> 4];
+            escape[5] = "0123456789ABCDEF"[string[i] & 0x0F];
+            senml_write( writerP, escape, 6 );
+            continue;
+        }
+        senml_write( writerP, escape, 2 );
+    }
+    senml_write( writerP, string + start, length - start );
+}
+
+static void prv_writeBase64( senml_writer_t * writerP,
+                             const uint8_t * data,
+                             size_t length )
+{
+    size_t i;
+
+    for ( i = 0; i < length; i += 3 )
+    {
+        uint8_t quad[4];
+        uint32_t value;
+
+        value = (uint32_t)data[i] << 16;
+        if ( i + 1 < length ) value |= (uint32_t)data[i + 1] << 8;
+        if ( i + 2 < length ) value |= data[i + 2];
+
+        quad[0] = prv_base64Alphabet[(value >> 18) & 0x3F];
+        quad[1] = prv_base64Alphabet[(value >> 12) & 0x3F];
+        quad[2] = i + 1 < length ? prv_base64Alphabet[(value >> 6) & 0x3F] : '=';
+        quad[3] = i + 2 < length ? prv_base64Alphabet[value & 0x3F] : '=';
+        senml_write( writerP, quad, 4 );
+    }
+}
+
+static void prv_writeHeader( senml_writer_t * writerP,
+                             const uint8_t * baseName,
+                             size_t baseNameLen,
+                             size_t count )
+{
+    PRV_WRITE_CONST( writerP, "{\"bn\":\"" );
+    senml_write( writerP, baseName, baseNameLen );
+    PRV_WRITE_CONST( writerP, "\",\"e\":[" );
+}
+
+static bool prv_writeRecord( senml_writer_t * writerP,
+                             const uint8_t * baseName,
+                             size_t baseNameLen,
+                             const uint8_t * name,
+                             size_t nameLen,
+                             size_t index,
+                             lwm2m_data_t * dataP )
+{
+    uint8_t number[_PRV_JSON_NUMBER_LEN];
+    size_t length;
+
+    if ( index > 0 ) PRV_WRITE_CONST( writerP, "," );
+    PRV_WRITE_CONST( writerP, "{\"n\":\"" );
+    senml_write( writerP, name, nameLen );
+    PRV_WRITE_CONST( writerP, "\"," );
+
+    switch ( dataP->type )
+    {
+        case LWM2M_TYPE_STRING:
+        PRV_WRITE_CONST( writerP, "\"sv\":\"" );
+        prv_writeEscaped( writerP, dataP->value.asBuffer.buffer, dataP->value.asBuffer.length );
+        PRV_WRITE_CONST( writerP, "\"" );
+        break;
+
+        case LWM2M_TYPE_OPAQUE:
+        PRV_WRITE_CONST( writerP, "\"sv\":\"" );
+        prv_writeBase64( writerP, dataP->value.asBuffer.buffer, dataP->value.asBuffer.length );
+        PRV_WRITE_CONST( writerP, "\"" );
+        break;
+
+        case LWM2M_TYPE_INTEGER:
+        length = utils_intToText( dataP->value.asInteger, number, _PRV_JSON_NUMBER_LEN );
+        if ( length == 0 ) return false;
+        PRV_WRITE_CONST( writerP, "\"v\":" );
+        senml_write( writerP, number, length );
+        break;
+
+        case LWM2M_TYPE_FLOAT:
+        length = utils_floatToText( dataP->value.asFloat, number, _PRV_JSON_NUMBER_LEN );
+        if ( length == 0 ) return false;
+        PRV_WRITE_CONST( writerP, "\"v\":" );
+        senml_write( writerP, number, length );
+        break;
+
+        case LWM2M_TYPE_BOOLEAN:
+        if ( dataP->value.asBoolean )
+        {
+            PRV_WRITE_CONST( writerP, "\"bv\":true" );
+        }
+        else
+        {
+            PRV_WRITE_CONST( writerP, "\"bv\":false" );
+        }
+        break;
+
+        case LWM2M_TYPE_OBJECT_LINK:
+        PRV_WRITE_CONST( writerP, "\"ov\":\"" );
+        length = utils_intToText( dataP->value.asObjLink.objectId, number, _PRV_JSON_NUMBER_LEN );
+        senml_write( writerP, number, length );
+        PRV_WRITE_CONST( writerP, ":" );
+        length = utils_intToText( dataP->value.asObjLink.objectInstanceId, number, _PRV_JSON_NUMBER_LEN );
+        senml_write( writerP, number, length );
+        PRV_WRITE_CONST( writerP, "\"" );
+        break;
+
+        default:
+        return false;
+    }
+
+    PRV_WRITE_CONST( writerP, "}" );
+
+    return true;
+}
+
+static void prv_writeFooter( senml_writer_t * writerP )
+{
+    PRV_WRITE_CONST( writerP, "]}" );
+}
+
+static const senml_format_t prv_jsonFormat =
+{
+    prv_writeHeader,
+    prv_writeRecord,
+    prv_writeFooter
+};
+
+size_t json_serialize( lwm2m_uri_t * uriP,
+                       int size,
+                       lwm2m_data_t * dataP,
+                       uint8_t ** bufferP )
+{
+    return senml_serialize( uriP, size, dataP, &prv_jsonFormat, bufferP );
+}
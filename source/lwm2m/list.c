@@ -112,3 +112,72 @@ void lwm2m_list_free( lwm2m_list_t * head )
         lwm2m_list_free( nextP );
     }
 }
+
+int lwm2m_list_index_build( lwm2m_list_index_t * indexP,
+                            lwm2m_list_t * head )
+{
+    lwm2m_list_t * target;
+    uint16_t count;
+
+    lwm2m_list_index_clear( indexP );
+
+    count = 0;
+    for ( target = head; target != NULL; target = target->next )
+    {
+        count++;
+    }
+    if ( 0 == count ) return 0;
+
+    indexP->array = (lwm2m_list_t **)nbiot_malloc( count * sizeof(lwm2m_list_t *) );
+    if ( NULL == indexP->array ) return -1;
+
+    /* the list is sorted, so is the array */
+    for ( target = head; target != NULL; target = target->next )
+    {
+        indexP->array[indexP->count++] = target;
+    }
+
+    return 0;
+}
+
+lwm2m_list_t * lwm2m_list_index_find( const lwm2m_list_index_t * indexP,
+                                      lwm2m_list_t * head,
+                                      uint16_t id )
+{
+    uint16_t low;
+    uint16_t high;
+
+    if ( NULL == indexP->array ) return lwm2m_list_find( head, id );
+
+    low = 0;
+    high = indexP->count;
+    while ( low < high )
+    {
+        uint16_t mid = low + (high - low) / 2;
+
+        if ( indexP->array[mid]->id < id )
+        {
+            low = mid + 1;
+        }
+        else if ( indexP->array[mid]->id > id )
+        {
+            high = mid;
+        }
+        else
+        {
+            return indexP->array[mid];
+        }
+    }
+
+    return NULL;
+}
+
+void lwm2m_list_index_clear( lwm2m_list_index_t * indexP )
+{
+    if ( NULL != indexP->array )
+    {
+        nbiot_free( indexP->array );
+    }
+    indexP->array = NULL;
+    indexP->count = 0;
+}
@@ -19,6 +19,7 @@ int lwm2m_init( lwm2m_context_t *contextP,
     nbiot_memzero( contextP, sizeof(lwm2m_context_t) );
     contextP->userData = userData;
     contextP->nextMID = nbiot_rand();
+    contextP->nextETag = nbiot_rand();
 
     return 0;
 }
@@ -35,14 +36,22 @@ void lwm2m_deregister( lwm2m_context_t *context )
     }
 }
 
-static void prv_deleteServer( lwm2m_server_t * serverP )
+static void prv_deleteServer( lwm2m_context_t * contextP,
+                              lwm2m_server_t * serverP )
 {
     /* TODO parse transaction and observation to remove the ones related to this server */
     if ( NULL != serverP->location )
     {
         nbiot_free( serverP->location );
     }
+    if ( NULL != serverP->query )
+    {
+        nbiot_free( serverP->query );
+    }
+    timer_cancel( contextP, &serverP->timer );
+    timer_cancel( contextP, &serverP->queueTimer );
     free_block1_buffer( serverP->block1Data );
+    free_block2_buffer( serverP->block2Data );
     nbiot_free( serverP );
 }
 
@@ -53,7 +62,7 @@ static void prv_deleteServerList( lwm2m_context_t * context )
         lwm2m_server_t * server;
         server = context->serverList;
         context->serverList = server->next;
-        prv_deleteServer( server );
+        prv_deleteServer( context, server );
     }
 }
 
@@ -61,7 +70,12 @@ static void prv_deleteBootstrapServer( lwm2m_server_t * serverP )
 {
     /* TODO should we free location as in prv_deleteServer ? */
     /* TODO should we parse transaction and observation to remove the ones related to this server ? */
+    if ( NULL != serverP->query )
+    {
+        nbiot_free( serverP->query );
+    }
     free_block1_buffer( serverP->block1Data );
+    free_block2_buffer( serverP->block2Data );
     nbiot_free( serverP );
 }
 
@@ -88,12 +102,22 @@ static void prv_deleteObservedList( lwm2m_context_t * contextP )
 
         for ( watcherP = targetP->watcherList; watcherP != NULL; watcherP = watcherP->next )
         {
+            timer_cancel( contextP, &watcherP->timer );
             if ( watcherP->parameters != NULL ) nbiot_free( watcherP->parameters );
         }
         LWM2M_LIST_FREE( targetP->watcherList );
 
         nbiot_free( targetP );
     }
+
+    if ( NULL != contextP->observedHash )
+    {
+        nbiot_free( contextP->observedHash );
+        contextP->observedHash = NULL;
+    }
+    contextP->observedHashSize = 0;
+    contextP->observedCount = 0;
+    contextP->observedReady = NULL;
 }
 
 void prv_deleteTransactionList( lwm2m_context_t * context )
@@ -104,8 +128,10 @@ void prv_deleteTransactionList( lwm2m_context_t * context )
 
         transaction = context->transactionList;
         context->transactionList = context->transactionList->next;
-        transaction_free( transaction );
+        transaction_free( context, transaction );
     }
+    transaction_clearIndex( context );
+    transaction_clearBuffers( context );
 }
 
 void lwm2m_close( lwm2m_context_t *contextP )
@@ -115,7 +141,17 @@ void lwm2m_close( lwm2m_context_t *contextP )
     prv_deleteServerList( contextP );
     prv_deleteBootstrapServerList( contextP );
     prv_deleteObservedList( contextP );
+    lwm2m_download_stop( contextP );
     prv_deleteTransactionList( contextP );
+    lwm2m_list_index_clear( &contextP->objectIndex );
+    timer_clear( contextP );
+    if ( NULL != contextP->registerPayload )
+    {
+        nbiot_free( contextP->registerPayload );
+        contextP->registerPayload = NULL;
+    }
+    contextP->registerPayloadSize = 0;
+    data_arenaClose( contextP );
 }
 
 static int prv_refreshServerList( lwm2m_context_t * contextP )
@@ -137,7 +173,7 @@ static int prv_refreshServerList( lwm2m_context_t * contextP )
         }
         else
         {
-            prv_deleteServer( targetP );
+            prv_deleteServer( contextP, targetP );
         }
         targetP = nextP;
     }
@@ -154,7 +190,7 @@ static int prv_refreshServerList( lwm2m_context_t * contextP )
         }
         else
         {
-            prv_deleteServer( targetP );
+            prv_deleteServer( contextP, targetP );
         }
         targetP = nextP;
     }
@@ -193,6 +229,14 @@ int lwm2m_configure( lwm2m_context_t *contextP,
     contextP->endpointName = endpointName;
     contextP->objectList = objectList;
 
+    /* objects and instances are looked up on every request, index them once */
+    (void)LWM2M_INDEX_BUILD( &contextP->objectIndex, contextP->objectList );
+    for ( ; objectList != NULL; objectList = objectList->next )
+    {
+        objectList->dataArena = &contextP->dataArena;
+        (void)LWM2M_INDEX_BUILD( &objectList->instanceIndex, objectList->instanceList );
+    }
+
     return COAP_NO_ERROR;
 }
 
@@ -202,11 +246,15 @@ int lwm2m_add_object( lwm2m_context_t * contextP,
     lwm2m_object_t * targetP;
 
     LOG_ARG( "ID: %d", objectP->objID );
-    targetP = (lwm2m_object_t *)LWM2M_LIST_FIND( contextP->objectList, objectP->objID );
+    targetP = object_find( contextP, objectP->objID );
     if ( targetP != NULL ) return COAP_406_NOT_ACCEPTABLE;
     objectP->next = NULL;
+    objectP->dataArena = &contextP->dataArena;
 
     contextP->objectList = (lwm2m_object_t *)LWM2M_LIST_ADD( contextP->objectList, objectP );
+    contextP->objectsGeneration++;
+    (void)LWM2M_INDEX_BUILD( &contextP->objectIndex, contextP->objectList );
+    (void)LWM2M_INDEX_BUILD( &objectP->instanceIndex, objectP->instanceList );
 
     if ( contextP->state == STATE_READY )
     {
@@ -226,6 +274,9 @@ int lwm2m_remove_object( lwm2m_context_t * contextP,
     contextP->objectList = (lwm2m_object_t *)LWM2M_LIST_RM( contextP->objectList, id, &targetP );
 
     if ( targetP == NULL ) return COAP_404_NOT_FOUND;
+    targetP->dataArena = NULL;
+    contextP->objectsGeneration++;
+    (void)LWM2M_INDEX_BUILD( &contextP->objectIndex, contextP->objectList );
 
     if ( contextP->state == STATE_READY )
     {
@@ -235,15 +286,50 @@ int lwm2m_remove_object( lwm2m_context_t * contextP,
     return 0;
 }
 
+static void prv_dispatchTimers( lwm2m_context_t * contextP,
+                                clock_t currentTime )
+{
+    lwm2m_timer_t * timerP;
+    uint16_t count;
+
+    /* timers rescheduled as already expired wait for the next step */
+    count = contextP->timerCount;
+    while ( count-- > 0
+            && NULL != (timerP = timer_pop( contextP, currentTime )) )
+    {
+        switch ( timerP->type )
+        {
+            case LWM2M_TIMER_TRANSACTION:
+            /* transaction_send() may remove the transaction */
+            (void)transaction_send( contextP, (lwm2m_transaction_t *)timerP->ownerP );
+            break;
+
+            case LWM2M_TIMER_REGISTRATION:
+            registration_refresh( contextP, (lwm2m_server_t *)timerP->ownerP );
+            break;
+
+            case LWM2M_TIMER_OBSERVE:
+            observe_timerExpired( contextP, (lwm2m_observed_t *)timerP->ownerP );
+            break;
+
+            case LWM2M_TIMER_QUEUE:
+            registration_sleep( contextP, (lwm2m_server_t *)timerP->ownerP );
+            break;
+
+            default:
+            break;
+        }
+    }
+}
+
 int lwm2m_step( lwm2m_context_t * contextP,
-                time_t * timeoutP )
+                clock_t * timeoutP )
 {
-    time_t tv_sec;
+    clock_t tv_sec;
     int result;
 
-    LOG_ARG( "timeoutP: %" PRId64, *timeoutP );
-    tv_sec = nbiot_time();
-    if ( tv_sec < 0 ) return COAP_500_INTERNAL_SERVER_ERROR;
+    LOG_ARG( "timeoutP: %ld", (long)*timeoutP );
+    tv_sec = nbiot_tick();
 
     LOG_ARG( "State: %s", STR_STATE( contextP->state ) );
     /* state can also be modified in bootstrap_handleCommand(). */
@@ -270,7 +356,7 @@ next_step:
         {
             bootstrap_start( contextP );
             contextP->state = STATE_BOOTSTRAPPING;
-            bootstrap_step( contextP, (uint32_t)tv_sec, timeoutP );
+            bootstrap_step( contextP, tv_sec, timeoutP );
         }
         else
 #endif
@@ -293,7 +379,7 @@ next_step:
 
             default:
             /* keep on waiting */
-            bootstrap_step( contextP, (uint32_t)tv_sec, timeoutP );
+            bootstrap_step( contextP, tv_sec, timeoutP );
             break;
         }
         break;
@@ -341,11 +427,12 @@ next_step:
         break;
     }
 
-    observe_step( contextP, tv_sec, timeoutP );
-    registration_step( contextP, tv_sec, timeoutP );
-    transaction_step( contextP, tv_sec, timeoutP );
+    prv_dispatchTimers( contextP, tv_sec );
+    observe_step( contextP, tv_sec );
+    registration_step( contextP, tv_sec );
+    timer_timeout( contextP, tv_sec, timeoutP );
 
-    LOG_ARG( "Final timeoutP: %" PRId64, *timeoutP );
+    LOG_ARG( "Final timeoutP: %ld", (long)*timeoutP );
     LOG_ARG( "Final state: %s", STR_STATE( contextP->state ) );
     return 0;
 }
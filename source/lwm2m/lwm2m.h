@@ -9,6 +9,7 @@
 #define NBIOT_SOURCE_LWM2M_LWM2M_H_
 
 #include <platform.h>
+#include "coap.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -44,7 +45,7 @@ extern "C" {
 #define LWM2M_ACL_OBJECT_ID                 2 /* not supported */
 #define LWM2M_DEVICE_OBJECT_ID              3 /* only supported */
 #define LWM2M_CONN_MONITOR_OBJECT_ID        4 /* not supported */
-#define LWM2M_FIRMWARE_UPDATE_OBJECT_ID     5 /* not supported */
+#define LWM2M_FIRMWARE_UPDATE_OBJECT_ID     5
 #define LWM2M_LOCATION_OBJECT_ID            6 /* not supported */
 #define LWM2M_CONN_STATS_OBJECT_ID          7 /* not supported */
 
@@ -130,6 +131,39 @@ void lwm2m_list_free( lwm2m_list_t * head );
 #define LWM2M_LIST_FIND(H,I)            lwm2m_list_find((lwm2m_list_t *)H, I)
 #define LWM2M_LIST_FREE(H)              lwm2m_list_free((lwm2m_list_t *)H)
 
+/*
+ * Sorted array index over a list for binary search lookups.
+ * It must be rebuilt or cleared whenever the list changes. A cleared index
+ * falls back to a linear scan of the list.
+*/
+typedef struct
+{
+    lwm2m_list_t **array;
+    uint16_t       count;
+} lwm2m_list_index_t;
+
+/*
+ * Build (or rebuild) 'indexP' from the sorted list 'head'
+ * Return 0 on success, -1 if the index could not be allocated (it is left cleared)
+*/
+int lwm2m_list_index_build( lwm2m_list_index_t *indexP,
+                            lwm2m_list_t       *head );
+
+/*
+ * Return the node with ID 'id' using 'indexP', or the list 'head' if the index is cleared
+*/
+lwm2m_list_t * lwm2m_list_index_find( const lwm2m_list_index_t *indexP,
+                                      lwm2m_list_t             *head,
+                                      uint16_t                  id );
+
+/*
+ * Free the index, lookups fall back to the list
+*/
+void lwm2m_list_index_clear( lwm2m_list_index_t *indexP );
+
+#define LWM2M_INDEX_BUILD(X,H)          lwm2m_list_index_build(X, (lwm2m_list_t *)H)
+#define LWM2M_INDEX_FIND(X,H,I)         lwm2m_list_index_find(X, (lwm2m_list_t *)H, I)
+
 /*
  * URI
  *
@@ -173,7 +207,14 @@ int lwm2m_stringToUri( const char  *buffer,
  * - LWM2M_TYPE_BOOLEAN: value.asBoolean
  *
  * LWM2M_TYPE_STRING is also used when the data is in text format.
+ *
+ * With LWM2M_DATA_FLAG_BORROWED, value.asBuffer points into the received
+ * message instead of a private copy. It is only valid until the callback
+ * returns and is not freed by lwm2m_data_free().
 */
+#define LWM2M_DATA_FLAG_BORROWED 0x01
+#define LWM2M_DATA_FLAG_ARENA    0x02 /* the array holding this node is arena memory */
+
 typedef enum
 {
     LWM2M_TYPE_UNDEFINED = 0,
@@ -195,6 +236,7 @@ struct _lwm2m_data_t
 {
     lwm2m_data_type_t     type;
     uint16_t              id;
+    uint8_t               flag;
     union
     {
         bool              asBoolean;
@@ -220,23 +262,46 @@ struct _lwm2m_data_t
 
 typedef enum
 {
-    LWM2M_CONTENT_TEXT     = 0,     /* Also used as undefined */
-    LWM2M_CONTENT_LINK     = 40,
-    LWM2M_CONTENT_OPAQUE   = 42,
-    LWM2M_CONTENT_TLV_OLD  = 1542,
-    LWM2M_CONTENT_JSON_OLD = 1543,
-    LWM2M_CONTENT_TLV      = 11542,
-    LWM2M_CONTENT_JSON     = 11543
+    LWM2M_CONTENT_TEXT       = 0,     /* Also used as undefined */
+    LWM2M_CONTENT_LINK       = 40,
+    LWM2M_CONTENT_OPAQUE     = 42,
+    LWM2M_CONTENT_SENML_CBOR = 112,
+    LWM2M_CONTENT_TLV_OLD    = 1542,
+    LWM2M_CONTENT_JSON_OLD   = 1543,
+    LWM2M_CONTENT_TLV        = 11542,
+    LWM2M_CONTENT_JSON       = 11543
 } lwm2m_media_type_t;
 
 lwm2m_data_t *lwm2m_data_new( int size );
 
+/*
+ * Bump allocator for the lwm2m_data_t arrays of one read or observe step,
+ * reset at once when the step is over instead of freed node by node
+*/
+typedef struct
+{
+    uint8_t *buffer;  /* LWM2M_DATA_ARENA_SIZE bytes, allocated on first use */
+    size_t   used;
+    uint8_t  depth;   /* nested data_arenaBegin() */
+} lwm2m_arena_t;
+
+/* from arenaP while its context reads, from the heap otherwise or when it is full */
+lwm2m_data_t *lwm2m_data_new_arena( lwm2m_arena_t *arenaP,
+                                    int            size );
+
 int lwm2m_data_parse( lwm2m_uri_t       *uriP,
                       uint8_t           *buffer,
                       size_t             bufferLen,
                       lwm2m_media_type_t format,
                       lwm2m_data_t     **dataP );
 
+/* same as lwm2m_data_parse() but strings and opaques may be borrowed from buffer */
+int lwm2m_data_parse_view( lwm2m_uri_t       *uriP,
+                           uint8_t           *buffer,
+                           size_t             bufferLen,
+                           lwm2m_media_type_t format,
+                           lwm2m_data_t     **dataP );
+
 size_t lwm2m_data_serialize( lwm2m_uri_t        *uriP,
                              int                 size,
                              lwm2m_data_t       *dataP,
@@ -257,6 +322,12 @@ void lwm2m_data_encode_opaque( uint8_t      *buffer,
                                size_t        length,
                                lwm2m_data_t *dataP );
 
+/* borrows buffer (no copy), it must stay valid as long as dataP is used */
+void lwm2m_data_encode_view( lwm2m_data_type_t type,
+                             uint8_t          *buffer,
+                             size_t            length,
+                             lwm2m_data_t     *dataP );
+
 void lwm2m_data_encode_int( int64_t       value,
                             lwm2m_data_t *dataP );
 
@@ -304,6 +375,12 @@ int lwm2m_decode_TLV( const uint8_t     *buffer,
  * For the read callback, if *numDataP is not zero, *dataArrayP is pre-allocated
  * and contains the list of resources to read.
  *
+ * For the write callback, string and opaque values may be borrowed from the
+ * request (LWM2M_DATA_FLAG_BORROWED) and must be copied to be kept.
+ *
+ * The read callback may allocate its array with lwm2m_data_new_arena() on
+ * objectP->dataArena, the array is then only valid until the read completes.
+ *
 */
 typedef struct _lwm2m_object_t lwm2m_object_t;
 typedef uint8_t(*lwm2m_read_callback_t)( uint16_t        instanceId,
@@ -329,17 +406,33 @@ typedef uint8_t(*lwm2m_discover_callback_t)( uint16_t        instanceId,
                                              int            *numDataP,
                                              lwm2m_data_t  **dataArrayP,
                                              lwm2m_object_t *objectP );
+/*
+ * Receives the raw value of a block1 write or execute one block at a time,
+ * in order, instead of the reassembled payload. Returns COAP_IGNORE to have
+ * the transfer reassembled and passed to writeFunc or executeFunc instead.
+*/
+typedef uint8_t(*lwm2m_block_callback_t)( uint16_t        instanceId,
+                                          uint16_t        resourceId,
+                                          bool            execute,
+                                          uint32_t        offset,
+                                          uint8_t        *buffer,
+                                          int             length,
+                                          bool            more,
+                                          lwm2m_object_t *objectP );
 struct _lwm2m_object_t
 {
     lwm2m_object_t           *next;  /* matches lwm2m_list_t::next */
     uint16_t                  objID; /* matches lwm2m_list_t::id */
     lwm2m_list_t             *instanceList;
+    lwm2m_list_index_t        instanceIndex; /* built at lwm2m_configure() */
     lwm2m_read_callback_t     readFunc;
     lwm2m_write_callback_t    writeFunc;
     lwm2m_execute_callback_t  executeFunc;
     lwm2m_create_callback_t   createFunc;
     lwm2m_delete_callback_t   deleteFunc;
     lwm2m_discover_callback_t discoverFunc;
+    lwm2m_block_callback_t    blockFunc;
+    lwm2m_arena_t            *dataArena; /* of the context the object is added to */
     void                     *userData;
 };
 
@@ -362,7 +455,7 @@ typedef enum
 typedef enum
 {
     BINDING_UNKNOWN = 0,
-    BINDING_U,   /* UDP - only supported */
+    BINDING_U,   /* UDP */
     BINDING_UQ,  /* UDP queue mode */
     BINDING_S,   /* SMS */
     BINDING_SQ,  /* SMS queue mode */
@@ -372,24 +465,68 @@ typedef enum
 
 typedef struct _lwm2m_block1_data_t
 {
-    uint8_t *block1buffer;     /* data buffer */
-    size_t   block1bufferSize; /* buffer size */
-    uint16_t lastmid;          /* mid of the last message received */
+    uint8_t    *block1buffer;         /* data buffer */
+    size_t      block1bufferSize;     /* bytes received so far */
+    size_t      block1bufferCapacity; /* allocated size of block1buffer */
+    uint16_t    lastmid;              /* mid of the last message received */
+    bool        streaming;            /* blocks go to the object's blockFunc, nothing is buffered */
+    bool        execute;              /* streaming: execute rather than write */
+    uint8_t     lastResult;           /* streaming: answer to the last block, repeated on retransmission */
+    lwm2m_uri_t uri;                  /* streaming: target resource */
 } lwm2m_block1_data_t;
 
+typedef struct _lwm2m_block2_data_t
+{
+    lwm2m_uri_t uri;          /* resource being transferred */
+    int         accept;       /* Accept option of the request, -1 if absent */
+    int         contentType;  /* format of the cached representation */
+    uint32_t    etag;         /* ETag sent with every block of this representation */
+    clock_t     lastTime;     /* tick of the last block request */
+    uint8_t    *buffer;       /* serialized representation */
+    size_t      length;
+} lwm2m_block2_data_t;
+
+/*
+ * Millisecond timers (nbiot_tick() based), kept in a min-heap per context.
+ * A zeroed timer is not scheduled.
+*/
+typedef enum
+{
+    LWM2M_TIMER_TRANSACTION = 0,
+    LWM2M_TIMER_REGISTRATION,
+    LWM2M_TIMER_OBSERVE,
+    LWM2M_TIMER_QUEUE
+} lwm2m_timer_type_t;
+
+typedef struct
+{
+    clock_t            deadline;
+    void              *ownerP;
+    uint16_t           index;    /* position in lwm2m_context_t::timerHeap plus one, 0 when not scheduled */
+    lwm2m_timer_type_t type;
+} lwm2m_timer_t;
+
 typedef struct _lwm2m_server_t
 {
     struct _lwm2m_server_t *next;         /* matches lwm2m_list_t::next */
     uint16_t                secObjInstID; /* matches lwm2m_list_t::id */
     uint16_t                shortID;      /* servers short ID, may be 0 for bootstrap server */
     time_t                  lifetime;     /* lifetime of the registration in sec or 0 if default value (86400 sec), also used as hold off time for bootstrap servers */
-    time_t                  registration; /* date of the last registration in sec or end of client hold off time for bootstrap servers */
+    clock_t                 registration; /* tick of the last registration in ms or end of client hold off time for bootstrap servers */
     lwm2m_binding_t         binding;      /* client connection mode with this server */
     void *                  sessionH;
     lwm2m_status_t          status;
     char *                  location;
     bool                    dirty;
     lwm2m_block1_data_t    *block1Data;   /* buffer to handle block1 data, should be replace by a list to support several block1 transfer by server. */
+    lwm2m_block2_data_t    *block2Data;   /* representation of the ongoing block2 read, sliced into the following blocks */
+    lwm2m_timer_t           timer;        /* registration update */
+    time_t                  awake;        /* queue mode: time in sec the client stays reachable after an exchange */
+    bool                    sleeping;     /* queue mode: receive path is down, notifications wait for the next update */
+    lwm2m_timer_t           queueTimer;   /* queue mode: end of the awake period */
+    char *                  query;        /* registration query, built on the first registration */
+    uint32_t                objectsGeneration; /* object list the server acknowledged */
+    uint32_t                pendingGeneration; /* object list the registration in flight leaves the server with */
 } lwm2m_server_t;
 
 /*
@@ -438,17 +575,45 @@ struct _lwm2m_transaction_t
     uint8_t                      ack_received;     /* indicates, that the ACK was received */
     time_t                       response_timeout; /* timeout to wait for response, if token is used. When 0, use calculated acknowledge timeout. */
     uint8_t                      retrans_counter;
-    time_t                       retrans_time;
+    clock_t                      retrans_timeout;  /* next retransmission interval in ms */
+    lwm2m_timer_t                timer;
     char                         objStringID[LWM2M_STRING_ID_MAX_LEN];
     char                         instanceStringID[LWM2M_STRING_ID_MAX_LEN];
     char                         resourceStringID[LWM2M_STRING_ID_MAX_LEN];
     void                        *message;
     uint16_t                     buffer_len;
     uint8_t                     *buffer;
+    bool                         buffer_pooled;    /* buffer was taken from lwm2m_context_t::bufferPool */
     lwm2m_transaction_callback_t callback;
     void                        *userData;
 };
 
+/*
+ * Block-wise download (Block2) of a resource from any CoAP peer, one at a time per context.
+ * The callback receives each block in order as soon as it arrives: status is COAP_231_CONTINUE
+ * while more blocks follow and COAP_205_CONTENT for the last one. On failure it is called once
+ * with a NULL buffer and the error code (COAP_503_SERVICE_UNAVAILABLE when the peer went silent).
+ * Returning false from the callback aborts the download.
+*/
+typedef bool(*lwm2m_download_callback_t)( uint8_t  status,
+                                          uint32_t offset,
+                                          uint8_t *buffer,
+                                          size_t   length,
+                                          void    *userData );
+
+typedef struct _lwm2m_download_t
+{
+    void                     *sessionH;
+    char                     *path;
+    uint32_t                  blockNum;  /* next block to request */
+    uint16_t                  blockSize;
+    uint8_t                   etagLen;   /* 0 until a block carried an ETag */
+    uint8_t                   etag[COAP_ETAG_LEN]; /* of the first block, later blocks must match */
+    lwm2m_transaction_t      *transacP;  /* request in flight */
+    lwm2m_download_callback_t callback;
+    void                     *userData;
+} lwm2m_download_t;
+
 /*
  * LWM2M observed resources
 */
@@ -462,9 +627,11 @@ typedef struct _lwm2m_watcher_t
     lwm2m_attributes_t      *parameters;
     uint8_t                  token[8];
     size_t                   tokenLen;
-    time_t                   lastTime;
+    clock_t                  lastTime; /* tick of the last notification in ms */
+    lwm2m_timer_t            timer;    /* next pmin/pmax expiry, owned by the observation */
     uint32_t                 counter;
     uint16_t                 lastMid;
+    lwm2m_media_type_t       format; /* requested by the Accept option */
     union
     {
         int64_t              asInteger;
@@ -478,8 +645,19 @@ typedef struct _lwm2m_observed_t
 
     lwm2m_uri_t               uri;
     lwm2m_watcher_t          *watcherList;
+    struct _lwm2m_observed_t *hashNext; /* bucket chain in lwm2m_context_t::observedHash */
+    struct _lwm2m_observed_t *readyNext; /* chain in lwm2m_context_t::observedReady */
+    bool                      ready;
 } lwm2m_observed_t;
 
+/*
+ * Free retained transaction buffer (COAP_MAX_PACKET_SIZE bytes)
+*/
+typedef struct _lwm2m_buffer_t
+{
+    struct _lwm2m_buffer_t *next;
+} lwm2m_buffer_t;
+
 typedef enum
 {
     STATE_INITIAL = 0,
@@ -498,10 +676,35 @@ typedef struct
     lwm2m_server_t            *bootstrapServerList;
     lwm2m_server_t            *serverList;
     lwm2m_object_t            *objectList;
+    lwm2m_list_index_t         objectIndex;
     lwm2m_observed_t          *observedList;
+    lwm2m_observed_t         **observedHash; /* observedList indexed by URI */
+    uint16_t                   observedHashSize;
+    uint16_t                   observedCount;
+    lwm2m_observed_t          *observedReady;    /* observations with tagged or expired watchers */
+    lwm2m_timer_t            **timerHeap;        /* scheduled timers, earliest first */
+    uint16_t                   timerCount;
+    uint16_t                   timerSize;
     uint16_t                   nextMID;
+    uint32_t                   nextETag;
     lwm2m_transaction_t       *transactionList;
+    lwm2m_transaction_t      **transactionMid;   /* transactionList indexed by message ID, open addressing */
+    lwm2m_transaction_t      **transactionToken; /* transactionList indexed by token, open addressing */
+    uint16_t                   transactionSize;
+    uint16_t                   transactionCount;
     void                      *userData;
+    coap_packet_t              message[1];  /* inbound packet being handled */
+    coap_packet_t              response[1]; /* response to the inbound packet */
+    uint8_t                    sendBuffer[COAP_MAX_PACKET_SIZE]; /* scratch for outbound packets */
+    lwm2m_buffer_t            *bufferPool;  /* free retained transaction buffers */
+    uint8_t                    bufferCount;
+    lwm2m_download_t          *downloadP;   /* block-wise download in progress */
+    uint32_t                   objectsGeneration;  /* bumped whenever objects or instances change */
+    uint8_t                   *registerPayload;    /* link format of objectList at registerGeneration */
+    size_t                     registerPayloadLen;
+    size_t                     registerPayloadSize;
+    uint32_t                   registerGeneration;
+    lwm2m_arena_t              dataArena;          /* lwm2m_data_t trees of the current read */
 } lwm2m_context_t;
 
 typedef enum
@@ -519,6 +722,7 @@ typedef struct
 #endif
     uint24_t    lifetime;
     uint8_t     flag;
+    uint16_t    awake_time; /* queue mode (UQ) awake time in sec, 0 if always online */
 } lwm2m_userdata_t;
 
 #define LWM2M_UINT32(x)   (((uint32_t)(x)[0]<<16)| \
@@ -540,10 +744,10 @@ int lwm2m_init( lwm2m_context_t *contextP,
 void lwm2m_close( lwm2m_context_t *contextP );
 
 /*
- * perform any required pending operation and adjust timeoutP to the maximal time interval to wait in seconds.
+ * perform any required pending operation and adjust timeoutP to the maximal time interval to wait in milliseconds.
 */
 int lwm2m_step( lwm2m_context_t *contextP,
-                time_t          *timeoutP );
+                clock_t         *timeoutP );
 
 /*
  * dispatch received data to liblwm2m
@@ -576,6 +780,28 @@ int lwm2m_update_registration( lwm2m_context_t *contextP,
 void lwm2m_resource_value_changed( lwm2m_context_t *contextP,
                                    lwm2m_uri_t     *uriP );
 
+/*
+ * Returns true when every server is in queue mode and its awake period is over:
+ * nothing is expected from the servers until the next registration update.
+*/
+bool lwm2m_is_sleeping( lwm2m_context_t *contextP );
+
+/*
+ * Start downloading path from the peer identified by sessionH (see lwm2m_download_callback_t).
+ * sessionH is used as is and is not closed at the end. A download in progress is aborted first.
+ * Returns 0 once the first block was requested.
+*/
+int lwm2m_download_start( lwm2m_context_t          *contextP,
+                          void                     *sessionH,
+                          const char               *path,
+                          lwm2m_download_callback_t callback,
+                          void                     *userData );
+
+/*
+ * Abort the download in progress, if any, without calling its callback.
+*/
+void lwm2m_download_stop( lwm2m_context_t *contextP );
+
 /*
  * Returns a session handle that MUST uniquely identify a peer.
  * secObjInstID: ID of the Securty Object instance to open a connection to
@@ -147,11 +147,18 @@ coap_status_t dm_handleRequest( lwm2m_context_t * contextP,
             uint8_t * buffer = NULL;
             size_t length = 0;
 
+            if ( IS_OPTION( message, COAP_OPTION_ACCEPT )
+                 && message->accept_num == 1 )
+            {
+                format = utils_convertMediaType( message->accept[0] );
+            }
+
             if ( IS_OPTION( message, COAP_OPTION_OBSERVE ) )
             {
                 lwm2m_data_t * dataP = NULL;
                 int size = 0;
 
+                data_arenaBegin( contextP );
                 result = object_readData( contextP, uriP, &size, &dataP );
                 if ( COAP_205_CONTENT == result )
                 {
@@ -170,6 +177,7 @@ coap_status_t dm_handleRequest( lwm2m_context_t * contextP,
                     }
                     lwm2m_data_free( size, dataP );
                 }
+                data_arenaEnd( contextP );
             }
             else if ( IS_OPTION( message, COAP_OPTION_ACCEPT )
                       && message->accept_num == 1
@@ -7,6 +7,20 @@
 
 #include "internals.h"
 
+#define PRV_REGISTER_PAYLOAD_SIZE 256
+
+lwm2m_object_t * object_find( lwm2m_context_t * contextP,
+                              uint16_t objectId )
+{
+    return (lwm2m_object_t *)LWM2M_INDEX_FIND( &contextP->objectIndex, contextP->objectList, objectId );
+}
+
+lwm2m_list_t * object_findInstance( lwm2m_object_t * objectP,
+                                    uint16_t instanceId )
+{
+    return LWM2M_INDEX_FIND( &objectP->instanceIndex, objectP->instanceList, instanceId );
+}
+
 uint8_t object_checkReadable( lwm2m_context_t * contextP,
                               lwm2m_uri_t * uriP )
 {
@@ -16,13 +30,13 @@ uint8_t object_checkReadable( lwm2m_context_t * contextP,
     int size;
 
     LOG_URI( uriP );
-    targetP = (lwm2m_object_t *)LWM2M_LIST_FIND( contextP->objectList, uriP->objectId );
+    targetP = object_find( contextP, uriP->objectId );
     if ( NULL == targetP ) return COAP_404_NOT_FOUND;
     if ( NULL == targetP->readFunc ) return COAP_405_METHOD_NOT_ALLOWED;
 
     if ( !LWM2M_URI_IS_SET_INSTANCE( uriP ) ) return COAP_205_CONTENT;
 
-    if ( NULL == lwm2m_list_find( targetP->instanceList, uriP->instanceId ) ) return COAP_404_NOT_FOUND;
+    if ( NULL == object_findInstance( targetP, uriP->instanceId ) ) return COAP_404_NOT_FOUND;
 
     if ( !LWM2M_URI_IS_SET_RESOURCE( uriP ) ) return COAP_205_CONTENT;
 
@@ -49,7 +63,7 @@ uint8_t object_checkNumeric( lwm2m_context_t * contextP,
     LOG_URI( uriP );
     if ( !LWM2M_URI_IS_SET_RESOURCE( uriP ) ) return COAP_405_METHOD_NOT_ALLOWED;
 
-    targetP = (lwm2m_object_t *)LWM2M_LIST_FIND( contextP->objectList, uriP->objectId );
+    targetP = object_find( contextP, uriP->objectId );
     if ( NULL == targetP ) return COAP_404_NOT_FOUND;
     if ( NULL == targetP->readFunc ) return COAP_405_METHOD_NOT_ALLOWED;
 
@@ -86,20 +100,20 @@ coap_status_t object_readData( lwm2m_context_t * contextP,
     lwm2m_object_t * targetP;
 
     LOG_URI( uriP );
-    targetP = (lwm2m_object_t *)LWM2M_LIST_FIND( contextP->objectList, uriP->objectId );
+    targetP = object_find( contextP, uriP->objectId );
     if ( NULL == targetP ) return COAP_404_NOT_FOUND;
     if ( NULL == targetP->readFunc ) return COAP_405_METHOD_NOT_ALLOWED;
     if ( targetP->instanceList == NULL ) return COAP_404_NOT_FOUND;
 
     if ( LWM2M_URI_IS_SET_INSTANCE( uriP ) )
     {
-        if ( NULL == lwm2m_list_find( targetP->instanceList, uriP->instanceId ) ) return COAP_404_NOT_FOUND;
+        if ( NULL == object_findInstance( targetP, uriP->instanceId ) ) return COAP_404_NOT_FOUND;
 
         /* single instance read */
         if ( LWM2M_URI_IS_SET_RESOURCE( uriP ) )
         {
             *sizeP = 1;
-            *dataP = lwm2m_data_new( *sizeP );
+            *dataP = lwm2m_data_new_arena( &contextP->dataArena, *sizeP );
             if ( *dataP == NULL ) return COAP_500_INTERNAL_SERVER_ERROR;
 
             (*dataP)->id = uriP->resourceId;
@@ -119,7 +133,7 @@ coap_status_t object_readData( lwm2m_context_t * contextP,
             (*sizeP)++;
         }
 
-        *dataP = lwm2m_data_new( *sizeP );
+        *dataP = lwm2m_data_new_arena( &contextP->dataArena, *sizeP );
         if ( *dataP == NULL ) return COAP_500_INTERNAL_SERVER_ERROR;
 
         result = COAP_205_CONTENT;
@@ -150,6 +164,7 @@ coap_status_t object_read( lwm2m_context_t * contextP,
     int size = 0;
 
     LOG_URI( uriP );
+    data_arenaBegin( contextP );
     result = object_readData( contextP, uriP, &size, &dataP );
 
     if ( result == COAP_205_CONTENT )
@@ -167,6 +182,7 @@ coap_status_t object_read( lwm2m_context_t * contextP,
         }
     }
     lwm2m_data_free( size, dataP );
+    data_arenaEnd( contextP );
 
     LOG_ARG( "result: %u.%2u, length: %d", (result & 0xFF) >> 5, (result & 0x1F), *lengthP );
 
@@ -185,7 +201,7 @@ coap_status_t object_write( lwm2m_context_t * contextP,
     int size = 0;
 
     LOG_URI( uriP );
-    targetP = (lwm2m_object_t *)LWM2M_LIST_FIND( contextP->objectList, uriP->objectId );
+    targetP = object_find( contextP, uriP->objectId );
     if ( NULL == targetP )
     {
         result = COAP_404_NOT_FOUND;
@@ -196,7 +212,8 @@ coap_status_t object_write( lwm2m_context_t * contextP,
     }
     else
     {
-        size = lwm2m_data_parse( uriP, buffer, length, format, &dataP );
+        /* buffer outlives writeFunc, so values are not copied out of it */
+        size = lwm2m_data_parse_view( uriP, buffer, length, format, &dataP );
         if ( size == 0 )
         {
             result = COAP_406_NOT_ACCEPTABLE;
@@ -221,13 +238,30 @@ coap_status_t object_execute( lwm2m_context_t * contextP,
     lwm2m_object_t * targetP;
 
     LOG_URI( uriP );
-    targetP = (lwm2m_object_t *)LWM2M_LIST_FIND( contextP->objectList, uriP->objectId );
+    targetP = object_find( contextP, uriP->objectId );
     if ( NULL == targetP ) return COAP_404_NOT_FOUND;
     if ( NULL == targetP->executeFunc ) return COAP_405_METHOD_NOT_ALLOWED;
 
     return targetP->executeFunc( uriP->instanceId, uriP->resourceId, buffer, length, targetP );
 }
 
+coap_status_t object_writeBlock( lwm2m_context_t * contextP,
+                                 lwm2m_uri_t * uriP,
+                                 bool execute,
+                                 uint32_t offset,
+                                 uint8_t * buffer,
+                                 size_t length,
+                                 bool more )
+{
+    lwm2m_object_t * targetP;
+
+    LOG_URI( uriP );
+    targetP = object_find( contextP, uriP->objectId );
+    if ( NULL == targetP || NULL == targetP->blockFunc ) return COAP_IGNORE;
+
+    return targetP->blockFunc( uriP->instanceId, uriP->resourceId, execute, offset, buffer, length, more, targetP );
+}
+
 coap_status_t object_create( lwm2m_context_t * contextP,
                              lwm2m_uri_t * uriP,
                              lwm2m_media_type_t format,
@@ -247,7 +281,7 @@ coap_status_t object_create( lwm2m_context_t * contextP,
 
     if ( uriP->objectId != 0 )
     {
-        targetP = (lwm2m_object_t *)LWM2M_LIST_FIND( contextP->objectList, uriP->objectId );
+        targetP = object_find( contextP, uriP->objectId );
         if ( NULL == targetP ) return COAP_404_NOT_FOUND;
         if ( NULL == targetP->createFunc ) return COAP_405_METHOD_NOT_ALLOWED;
     }
@@ -269,12 +303,14 @@ coap_status_t object_create( lwm2m_context_t * contextP,
         }
         if ( uriP->objectId != 0 )
         {
-            if ( NULL != lwm2m_list_find( targetP->instanceList, dataP[0].id ) )
+            if ( NULL != object_findInstance( targetP, dataP[0].id ) )
             {
                 /* Instance already exists */
                 result = COAP_406_NOT_ACCEPTABLE;
                 goto exit;
             }
+            lwm2m_list_index_clear( &targetP->instanceIndex );
+            contextP->objectsGeneration++;
             result = targetP->createFunc( dataP[0].id, dataP[0].value.asChildren.count, dataP[0].value.asChildren.array, targetP );
             uriP->instanceId = dataP[0].id;
             uriP->flag |= LWM2M_URI_FLAG_INSTANCE_ID;
@@ -325,6 +361,8 @@ coap_status_t object_create( lwm2m_context_t * contextP,
         {
             uriP->instanceId = lwm2m_list_newId( targetP->instanceList );
             uriP->flag |= LWM2M_URI_FLAG_INSTANCE_ID;
+            lwm2m_list_index_clear( &targetP->instanceIndex );
+            contextP->objectsGeneration++;
             result = targetP->createFunc( uriP->instanceId, size, dataP, targetP );
         }
         break;
@@ -345,11 +383,13 @@ coap_status_t object_delete( lwm2m_context_t * contextP,
     coap_status_t result;
 
     LOG_URI( uriP );
-    objectP = (lwm2m_object_t *)LWM2M_LIST_FIND( contextP->objectList, uriP->objectId );
+    objectP = object_find( contextP, uriP->objectId );
     if ( NULL == objectP ) return COAP_404_NOT_FOUND;
     if ( NULL == objectP->deleteFunc ) return COAP_405_METHOD_NOT_ALLOWED;
 
     LOG( "Entering" );
+    lwm2m_list_index_clear( &objectP->instanceIndex );
+    contextP->objectsGeneration++;
 
     if ( LWM2M_URI_IS_SET_INSTANCE( uriP ) )
     {
@@ -385,14 +425,14 @@ coap_status_t object_discover( lwm2m_context_t * contextP,
     int size = 0;
 
     LOG_URI( uriP );
-    targetP = (lwm2m_object_t *)LWM2M_LIST_FIND( contextP->objectList, uriP->objectId );
+    targetP = object_find( contextP, uriP->objectId );
     if ( NULL == targetP ) return COAP_404_NOT_FOUND;
     if ( NULL == targetP->discoverFunc ) return COAP_501_NOT_IMPLEMENTED;
     if ( targetP->instanceList == NULL ) return COAP_404_NOT_FOUND;
 
     if ( LWM2M_URI_IS_SET_INSTANCE( uriP ) )
     {
-        if ( NULL == lwm2m_list_find( targetP->instanceList, uriP->instanceId ) ) return COAP_404_NOT_FOUND;
+        if ( NULL == object_findInstance( targetP, uriP->instanceId ) ) return COAP_404_NOT_FOUND;
 
         /* single instance read */
         if ( LWM2M_URI_IS_SET_RESOURCE( uriP ) )
@@ -457,10 +497,10 @@ bool object_isInstanceNew( lwm2m_context_t * contextP,
     lwm2m_object_t * targetP;
 
     LOG( "Entering" );
-    targetP = (lwm2m_object_t *)LWM2M_LIST_FIND( contextP->objectList, objectId );
+    targetP = object_find( contextP, objectId );
     if ( targetP != NULL )
     {
-        if ( NULL != lwm2m_list_find( targetP->instanceList, instanceId ) )
+        if ( NULL != object_findInstance( targetP, instanceId ) )
         {
             return false;
         }
@@ -493,9 +533,9 @@ static int prv_getObjectTemplate( uint8_t * buffer,
     return index;
 }
 
-int object_getRegisterPayload( lwm2m_context_t * contextP,
-                               uint8_t * buffer,
-                               size_t bufferLen )
+static int prv_writeRegisterPayload( lwm2m_context_t * contextP,
+                                     uint8_t * buffer,
+                                     size_t bufferLen )
 {
     size_t index;
     int result;
@@ -572,6 +612,57 @@ int object_getRegisterPayload( lwm2m_context_t * contextP,
     return index;
 }
 
+/* the link format is only rebuilt when objects or instances changed */
+int object_getRegisterPayload( lwm2m_context_t * contextP,
+                               const uint8_t ** payloadP )
+{
+    if ( contextP->registerPayload == NULL
+         || contextP->registerGeneration != contextP->objectsGeneration )
+    {
+        size_t size;
+        int length;
+
+        size = contextP->registerPayloadSize;
+        if ( size == 0 ) size = PRV_REGISTER_PAYLOAD_SIZE;
+        contextP->registerPayloadLen = 0;
+        while ( true )
+        {
+            if ( contextP->registerPayload == NULL )
+            {
+                contextP->registerPayload = (uint8_t *)nbiot_malloc( size );
+                if ( contextP->registerPayload == NULL )
+                {
+                    contextP->registerPayloadSize = 0;
+                    return 0;
+                }
+                contextP->registerPayloadSize = size;
+            }
+
+            length = prv_writeRegisterPayload( contextP, contextP->registerPayload, contextP->registerPayloadSize );
+            if ( length > 0 ) break;
+
+            /* too small, payloads are bounded by coap_packet_t::payload_len */
+            nbiot_free( contextP->registerPayload );
+            contextP->registerPayload = NULL;
+            size = contextP->registerPayloadSize * 2;
+            if ( size > 0xFFFF ) break;
+        }
+        if ( contextP->registerPayload == NULL )
+        {
+            contextP->registerPayloadSize = 0;
+            return 0;
+        }
+
+        contextP->registerPayloadLen = length;
+        contextP->registerGeneration = contextP->objectsGeneration;
+        LOG_ARG( "Register payload rebuilt: %d bytes", length );
+    }
+
+    *payloadP = contextP->registerPayload;
+
+    return (int)contextP->registerPayloadLen;
+}
+
 int object_getServers( lwm2m_context_t *contextP )
 {
     lwm2m_server_t *targetP;
@@ -597,7 +688,8 @@ int object_getServers( lwm2m_context_t *contextP )
     }
 
     nbiot_memzero( targetP, sizeof(lwm2m_server_t) );
-    targetP->binding = BINDING_U; /* 目前只支持UDP */
+    targetP->binding = userData->awake_time ? BINDING_UQ : BINDING_U; /* 目前只支持UDP */
+    targetP->awake = userData->awake_time;
     targetP->lifetime = LWM2M_UINT32(userData->lifetime);
 #ifdef LWM2M_BOOTSTRAP
     if ( NULL == userData->svr_uri &&
@@ -624,7 +716,7 @@ coap_status_t object_createInstance( lwm2m_context_t * contextP,
     lwm2m_object_t * targetP;
 
     LOG_URI( uriP );
-    targetP = (lwm2m_object_t *)LWM2M_LIST_FIND( contextP->objectList, uriP->objectId );
+    targetP = object_find( contextP, uriP->objectId );
     if ( NULL == targetP ) return COAP_404_NOT_FOUND;
 
     if ( NULL == targetP->createFunc )
@@ -632,6 +724,8 @@ coap_status_t object_createInstance( lwm2m_context_t * contextP,
         return COAP_405_METHOD_NOT_ALLOWED;
     }
 
+    lwm2m_list_index_clear( &targetP->instanceIndex );
+    contextP->objectsGeneration++;
     return targetP->createFunc( lwm2m_list_newId( targetP->instanceList ), dataP->value.asChildren.count, dataP->value.asChildren.array, targetP );
 }
 
@@ -642,7 +736,7 @@ coap_status_t object_writeInstance( lwm2m_context_t * contextP,
     lwm2m_object_t * targetP;
 
     LOG_URI( uriP );
-    targetP = (lwm2m_object_t *)LWM2M_LIST_FIND( contextP->objectList, uriP->objectId );
+    targetP = object_find( contextP, uriP->objectId );
     if ( NULL == targetP ) return COAP_404_NOT_FOUND;
 
     if ( NULL == targetP->writeFunc )
@@ -7,17 +7,57 @@
 
 #include "internals.h"
 
+/*
+ * Initial number of buckets of lwm2m_context_t::observedHash (power of 2).
+ * The table doubles when it holds more observations than buckets.
+*/
+#ifndef LWM2M_OBSERVE_HASH_SIZE
+#define LWM2M_OBSERVE_HASH_SIZE 8
+#endif
+
+static uint16_t prv_hashUri( const lwm2m_uri_t * uriP )
+{
+    uint32_t key;
+
+    key = uriP->objectId;
+    key = key * 31 + (LWM2M_URI_IS_SET_INSTANCE( uriP ) ? uriP->instanceId : LWM2M_MAX_ID);
+    key = key * 31 + (LWM2M_URI_IS_SET_RESOURCE( uriP ) ? uriP->resourceId : LWM2M_MAX_ID);
+
+    return (uint16_t)(key ^ (key >> 16));
+}
+
+static bool prv_matchUri( const lwm2m_uri_t * uriP,
+                          const lwm2m_uri_t * targetP )
+{
+    if ( uriP->objectId != targetP->objectId ) return false;
+    if ( LWM2M_URI_IS_SET_INSTANCE( uriP ) != LWM2M_URI_IS_SET_INSTANCE( targetP ) ) return false;
+    if ( LWM2M_URI_IS_SET_INSTANCE( uriP ) && uriP->instanceId != targetP->instanceId ) return false;
+    if ( LWM2M_URI_IS_SET_RESOURCE( uriP ) != LWM2M_URI_IS_SET_RESOURCE( targetP ) ) return false;
+    if ( LWM2M_URI_IS_SET_RESOURCE( uriP ) && uriP->resourceId != targetP->resourceId ) return false;
+
+    return true;
+}
+
 static lwm2m_observed_t * prv_findObserved( lwm2m_context_t * contextP,
                                             lwm2m_uri_t * uriP )
 {
     lwm2m_observed_t * targetP;
 
+    if ( contextP->observedHash != NULL )
+    {
+        targetP = contextP->observedHash[prv_hashUri( uriP ) & (contextP->observedHashSize - 1)];
+        while ( targetP != NULL
+                && !prv_matchUri( uriP, &targetP->uri ) )
+        {
+            targetP = targetP->hashNext;
+        }
+
+        return targetP;
+    }
+
     targetP = contextP->observedList;
     while ( targetP != NULL
-            && (targetP->uri.objectId != uriP->objectId
-            || targetP->uri.flag != uriP->flag
-            || (LWM2M_URI_IS_SET_INSTANCE( uriP ) && targetP->uri.instanceId != uriP->instanceId)
-            || (LWM2M_URI_IS_SET_RESOURCE( uriP ) && targetP->uri.resourceId != uriP->resourceId)) )
+            && !prv_matchUri( uriP, &targetP->uri ) )
     {
         targetP = targetP->next;
     }
@@ -25,6 +65,55 @@ static lwm2m_observed_t * prv_findObserved( lwm2m_context_t * contextP,
     return targetP;
 }
 
+static bool prv_rehashObserved( lwm2m_context_t * contextP )
+{
+    lwm2m_observed_t ** hashP;
+    lwm2m_observed_t * targetP;
+    uint16_t size;
+
+    if ( contextP->observedHashSize >= 0x8000 ) return false;
+
+    size = contextP->observedHashSize ? contextP->observedHashSize * 2 : LWM2M_OBSERVE_HASH_SIZE;
+    hashP = (lwm2m_observed_t **)nbiot_malloc( size * sizeof(lwm2m_observed_t *) );
+    if ( hashP == NULL ) return false;
+    nbiot_memzero( hashP, size * sizeof(lwm2m_observed_t *) );
+
+    for ( targetP = contextP->observedList; targetP != NULL; targetP = targetP->next )
+    {
+        uint16_t index = prv_hashUri( &targetP->uri ) & (size - 1);
+
+        targetP->hashNext = hashP[index];
+        hashP[index] = targetP;
+    }
+
+    if ( contextP->observedHash != NULL ) nbiot_free( contextP->observedHash );
+    contextP->observedHash = hashP;
+    contextP->observedHashSize = size;
+
+    return true;
+}
+
+static void prv_linkObserved( lwm2m_context_t * contextP,
+                              lwm2m_observed_t * observedP )
+{
+    observedP->next = contextP->observedList;
+    contextP->observedList = observedP;
+    contextP->observedCount++;
+
+    /* a rehash indexes the whole list, the new entry included */
+    if ( contextP->observedCount <= contextP->observedHashSize
+         || !prv_rehashObserved( contextP ) )
+    {
+        if ( contextP->observedHash != NULL )
+        {
+            uint16_t index = prv_hashUri( &observedP->uri ) & (contextP->observedHashSize - 1);
+
+            observedP->hashNext = contextP->observedHash[index];
+            contextP->observedHash[index] = observedP;
+        }
+    }
+}
+
 static void prv_unlinkObserved( lwm2m_context_t * contextP,
                                 lwm2m_observed_t * observedP )
 {
@@ -47,8 +136,57 @@ static void prv_unlinkObserved( lwm2m_context_t * contextP,
             parentP->next = parentP->next->next;
         }
     }
+
+    if ( contextP->observedHash != NULL )
+    {
+        lwm2m_observed_t ** linkP;
+
+        linkP = &contextP->observedHash[prv_hashUri( &observedP->uri ) & (contextP->observedHashSize - 1)];
+        while ( *linkP != NULL
+                && *linkP != observedP )
+        {
+            linkP = &(*linkP)->hashNext;
+        }
+        if ( *linkP != NULL )
+        {
+            *linkP = observedP->hashNext;
+        }
+    }
+    if ( observedP->ready )
+    {
+        lwm2m_observed_t ** linkP;
+
+        linkP = &contextP->observedReady;
+        while ( *linkP != NULL
+                && *linkP != observedP )
+        {
+            linkP = &(*linkP)->readyNext;
+        }
+        if ( *linkP != NULL )
+        {
+            *linkP = observedP->readyNext;
+        }
+        observedP->ready = false;
+    }
+    contextP->observedCount--;
+}
+
+static void prv_queueObserved( lwm2m_context_t * contextP,
+                               lwm2m_observed_t * targetP )
+{
+    /* queue it for the next observe_step() */
+    if ( !targetP->ready )
+    {
+        targetP->ready = true;
+        targetP->readyNext = contextP->observedReady;
+        contextP->observedReady = targetP;
+    }
 }
 
+static void prv_scheduleWatcher( lwm2m_context_t * contextP,
+                                 lwm2m_observed_t * targetP,
+                                 lwm2m_watcher_t * watcherP );
+
 static lwm2m_watcher_t * prv_findWatcher( lwm2m_observed_t * observedP,
                                           lwm2m_server_t * serverP )
 {
@@ -82,8 +220,6 @@ static lwm2m_watcher_t * prv_getWatcher( lwm2m_context_t * contextP,
         allocatedObserver = true;
         nbiot_memzero( observedP, sizeof(lwm2m_observed_t) );
         nbiot_memmove( &(observedP->uri), uriP, sizeof(lwm2m_uri_t) );
-        observedP->next = contextP->observedList;
-        contextP->observedList = observedP;
     }
 
     watcherP = prv_findWatcher( observedP, serverP );
@@ -105,6 +241,12 @@ static lwm2m_watcher_t * prv_getWatcher( lwm2m_context_t * contextP,
         observedP->watcherList = watcherP;
     }
 
+    /* link only once it has a watcher */
+    if ( allocatedObserver == true )
+    {
+        prv_linkObserved( contextP, observedP );
+    }
+
     return watcherP;
 }
 
@@ -136,7 +278,13 @@ coap_status_t observe_handleRequest( lwm2m_context_t * contextP,
         watcherP->tokenLen = message->token_len;
         nbiot_memmove( watcherP->token, message->token, message->token_len );
         watcherP->active = true;
-        watcherP->lastTime = nbiot_time();
+        watcherP->lastTime = nbiot_tick();
+        watcherP->format = LWM2M_CONTENT_TEXT;
+        if ( IS_OPTION( message, COAP_OPTION_ACCEPT ) && message->accept_num == 1 )
+        {
+            watcherP->format = utils_convertMediaType( message->accept[0] );
+        }
+        prv_scheduleWatcher( contextP, prv_findObserved( contextP, uriP ), watcherP );
 
         if ( LWM2M_URI_IS_SET_RESOURCE( uriP ) )
         {
@@ -206,6 +354,7 @@ void observe_cancel( lwm2m_context_t * contextP,
         }
         if ( targetP != NULL )
         {
+            timer_cancel( contextP, &targetP->timer );
             nbiot_free( targetP );
             if ( observedP->watcherList == NULL )
             {
@@ -310,8 +459,11 @@ coap_status_t observe_setParameters( lwm2m_context_t * contextP,
         {
             watcherP->parameters->step = attrP->step;
         }
+        watcherP->parameters->toSet |= attrP->toSet;
     }
 
+    prv_scheduleWatcher( contextP, prv_findObserved( contextP, uriP ), watcherP );
+
     LOG_ARG( "Final toSet: %08X, minPeriod: %d, maxPeriod: %d, greaterThan: %f, lessThan: %f, step: %f",
              watcherP->parameters->toSet, watcherP->parameters->minPeriod, watcherP->parameters->maxPeriod, watcherP->parameters->greaterThan, watcherP->parameters->lessThan, watcherP->parameters->step );
 
@@ -324,36 +476,70 @@ lwm2m_observed_t * observe_findByUri( lwm2m_context_t * contextP,
     lwm2m_observed_t * targetP;
 
     LOG_URI( uriP );
-    targetP = contextP->observedList;
-    while ( targetP != NULL )
+    targetP = prv_findObserved( contextP, uriP );
+    if ( targetP != NULL )
     {
-        if ( targetP->uri.objectId == uriP->objectId )
-        {
-            if ( (!LWM2M_URI_IS_SET_INSTANCE( uriP ) && !LWM2M_URI_IS_SET_INSTANCE( &(targetP->uri) ))
-                 || (LWM2M_URI_IS_SET_INSTANCE( uriP ) && LWM2M_URI_IS_SET_INSTANCE( &(targetP->uri) ) && (uriP->instanceId == targetP->uri.instanceId)) )
-            {
-                if ( (!LWM2M_URI_IS_SET_RESOURCE( uriP ) && !LWM2M_URI_IS_SET_RESOURCE( &(targetP->uri) ))
-                     || (LWM2M_URI_IS_SET_RESOURCE( uriP ) && LWM2M_URI_IS_SET_RESOURCE( &(targetP->uri) ) && (uriP->resourceId == targetP->uri.resourceId)) )
-                {
-                    LOG_ARG( "Found one with%s observers.", targetP->watcherList ? "" : " no" );
-                    LOG_URI( &(targetP->uri) );
-                    return targetP;
-                }
-            }
-        }
-        targetP = targetP->next;
+        LOG_ARG( "Found one with%s observers.", targetP->watcherList ? "" : " no" );
+        LOG_URI( &(targetP->uri) );
+        return targetP;
     }
 
     LOG( "Found nothing" );
     return NULL;
 }
 
+static void prv_tagObserved( lwm2m_context_t * contextP,
+                             lwm2m_observed_t * targetP )
+{
+    lwm2m_watcher_t * watcherP;
+    bool tagged = false;
+
+    LOG( "Found an observation" );
+    LOG_URI( &(targetP->uri) );
+
+    /* a timer or a wake up may have queued it already, the watchers still need the tag */
+    for ( watcherP = targetP->watcherList; watcherP != NULL; watcherP = watcherP->next )
+    {
+        if ( watcherP->active == true )
+        {
+            LOG( "Tagging a watcher" );
+            watcherP->update = true;
+            tagged = true;
+        }
+    }
+
+    if ( tagged ) prv_queueObserved( contextP, targetP );
+}
+
 void lwm2m_resource_value_changed( lwm2m_context_t * contextP,
                                    lwm2m_uri_t * uriP )
 {
     lwm2m_observed_t * targetP;
 
     LOG_URI( uriP );
+    if ( contextP->observedHash != NULL
+         && LWM2M_URI_IS_SET_INSTANCE( uriP )
+         && LWM2M_URI_IS_SET_RESOURCE( uriP ) )
+    {
+        lwm2m_uri_t uri;
+
+        /* only the object, the instance and the resource itself can be observed */
+        uri = *uriP;
+        uri.flag = LWM2M_URI_FLAG_OBJECT_ID;
+        targetP = prv_findObserved( contextP, &uri );
+        if ( targetP != NULL ) prv_tagObserved( contextP, targetP );
+
+        uri.flag |= LWM2M_URI_FLAG_INSTANCE_ID;
+        targetP = prv_findObserved( contextP, &uri );
+        if ( targetP != NULL ) prv_tagObserved( contextP, targetP );
+
+        uri.flag |= LWM2M_URI_FLAG_RESOURCE_ID;
+        targetP = prv_findObserved( contextP, &uri );
+        if ( targetP != NULL ) prv_tagObserved( contextP, targetP );
+
+        return;
+    }
+
     targetP = contextP->observedList;
     while ( targetP != NULL )
     {
@@ -367,19 +553,7 @@ void lwm2m_resource_value_changed( lwm2m_context_t * contextP,
                      || (targetP->uri.flag & LWM2M_URI_FLAG_RESOURCE_ID) == 0
                      || uriP->resourceId == targetP->uri.resourceId )
                 {
-                    lwm2m_watcher_t * watcherP;
-
-                    LOG( "Found an observation" );
-                    LOG_URI( &(targetP->uri) );
-
-                    for ( watcherP = targetP->watcherList; watcherP != NULL; watcherP = watcherP->next )
-                    {
-                        if ( watcherP->active == true )
-                        {
-                            LOG( "Tagging a watcher" );
-                            watcherP->update = true;
-                        }
-                    }
+                    prv_tagObserved( contextP, targetP );
                 }
             }
         }
@@ -387,254 +561,397 @@ void lwm2m_resource_value_changed( lwm2m_context_t * contextP,
     }
 }
 
-void observe_step( lwm2m_context_t * contextP,
-                   time_t currentTime,
-                   time_t * timeoutP )
+/* pmin/pmax are kept in seconds, watcher times in ms */
+#define PRV_MIN_PERIOD(W) NBIOT_TICK_ADD( (W)->lastTime, (clock_t)(W)->parameters->minPeriod * CLOCK_PER_SECOND )
+#define PRV_MAX_PERIOD(W) NBIOT_TICK_ADD( (W)->lastTime, (clock_t)(W)->parameters->maxPeriod * CLOCK_PER_SECOND )
+/* deadline P is reached at T, also across a tick wrap */
+#define PRV_ELAPSED(P, T) (!NBIOT_TICK_BEFORE( (T), (P) ))
+
+static bool prv_watcherDeadline( lwm2m_watcher_t * watcherP,
+                                 clock_t * deadlineP )
 {
-    lwm2m_observed_t * targetP;
+    bool found = false;
 
-    LOG( "Entering" );
-    for ( targetP = contextP->observedList; targetP != NULL; targetP = targetP->next )
+    /* a sleeping server gets everything at its next registration update */
+    if ( watcherP->server->sleeping ) return false;
+
+    if ( watcherP->active == true && watcherP->parameters != NULL )
     {
-        lwm2m_watcher_t * watcherP;
-        uint8_t * buffer = NULL;
-        size_t length = 0;
-        lwm2m_data_t * dataP = NULL;
-        int size = 0;
-        double floatValue = 0;
-        int64_t integerValue = 0;
-        bool storeValue = false;
-        lwm2m_media_type_t format = LWM2M_CONTENT_TEXT;
-        coap_packet_t message[1];
-        time_t interval;
+        if ( watcherP->update == true
+             && (watcherP->parameters->toSet & LWM2M_ATTR_FLAG_MIN_PERIOD) != 0 )
+        {
+            *deadlineP = PRV_MIN_PERIOD( watcherP );
+            found = true;
+        }
+        if ( (watcherP->parameters->toSet & LWM2M_ATTR_FLAG_MAX_PERIOD) != 0
+             && (found == false || NBIOT_TICK_BEFORE( PRV_MAX_PERIOD( watcherP ), *deadlineP )) )
+        {
+            *deadlineP = PRV_MAX_PERIOD( watcherP );
+            found = true;
+        }
+    }
 
-        LOG_URI( &(targetP->uri) );
-        if ( LWM2M_URI_IS_SET_RESOURCE( &targetP->uri ) )
+    return found;
+}
+
+static void prv_scheduleWatcher( lwm2m_context_t * contextP,
+                                 lwm2m_observed_t * targetP,
+                                 lwm2m_watcher_t * watcherP )
+{
+    clock_t deadline;
+
+    if ( !prv_watcherDeadline( watcherP, &deadline ) )
+    {
+        timer_cancel( contextP, &watcherP->timer );
+        return;
+    }
+
+    watcherP->timer.ownerP = targetP;
+    watcherP->timer.type = LWM2M_TIMER_OBSERVE;
+    if ( !timer_schedule( contextP, &watcherP->timer, deadline ) )
+    {
+        /* no room in the heap, check it again on the next step */
+        prv_queueObserved( contextP, targetP );
+    }
+}
+
+static bool prv_watcherDue( lwm2m_watcher_t * watcherP,
+                            clock_t currentTime )
+{
+    if ( watcherP->active == false ) return false;
+    if ( watcherP->server->sleeping ) return false;
+
+    /* value changed and the minimum period elapsed */
+    if ( watcherP->update == true
+         && (watcherP->parameters == NULL
+         || (watcherP->parameters->toSet & LWM2M_ATTR_FLAG_MIN_PERIOD) == 0
+         || PRV_ELAPSED( PRV_MIN_PERIOD( watcherP ), currentTime )) )
+    {
+        return true;
+    }
+
+    /* maximum period reached */
+    if ( watcherP->parameters != NULL
+         && (watcherP->parameters->toSet & LWM2M_ATTR_FLAG_MAX_PERIOD) != 0
+         && PRV_ELAPSED( PRV_MAX_PERIOD( watcherP ), currentTime ) )
+    {
+        return true;
+    }
+
+    return false;
+}
+
+static void prv_stepObserved( lwm2m_context_t * contextP,
+                              lwm2m_observed_t * targetP,
+                              clock_t currentTime )
+{
+    lwm2m_watcher_t * watcherP;
+    uint8_t * buffer = NULL;
+    size_t length = 0;
+    lwm2m_data_t * dataP = NULL;
+    int size = 0;
+    double floatValue = 0;
+    int64_t integerValue = 0;
+    bool storeValue = false;
+    lwm2m_media_type_t format = LWM2M_CONTENT_TEXT;
+    lwm2m_media_type_t bufferFormat = LWM2M_CONTENT_TEXT;
+    coap_packet_t message[1];
+    coap_option_template_t optionTemplate;
+
+    LOG_URI( &(targetP->uri) );
+    data_arenaBegin( contextP );
+    if ( LWM2M_URI_IS_SET_RESOURCE( &targetP->uri ) )
+    {
+        if ( COAP_205_CONTENT != object_readData( contextP, &targetP->uri, &size, &dataP ) ) goto exit;
+        switch ( dataP->type )
         {
-            if ( COAP_205_CONTENT != object_readData( contextP, &targetP->uri, &size, &dataP ) ) continue;
-            switch ( dataP->type )
-            {
-                case LWM2M_TYPE_INTEGER:
-                if ( 1 != lwm2m_data_decode_int( dataP, &integerValue ) ) continue;
-                storeValue = true;
-                break;
-                case LWM2M_TYPE_FLOAT:
-                if ( 1 != lwm2m_data_decode_float( dataP, &floatValue ) ) continue;
-                storeValue = true;
-                break;
-                default:
-                break;
-            }
+            case LWM2M_TYPE_INTEGER:
+            if ( 1 != lwm2m_data_decode_int( dataP, &integerValue ) ) goto exit;
+            storeValue = true;
+            break;
+            case LWM2M_TYPE_FLOAT:
+            if ( 1 != lwm2m_data_decode_float( dataP, &floatValue ) ) goto exit;
+            storeValue = true;
+            break;
+            default:
+            break;
         }
-        for ( watcherP = targetP->watcherList; watcherP != NULL; watcherP = watcherP->next )
+    }
+    for ( watcherP = targetP->watcherList; watcherP != NULL; watcherP = watcherP->next )
+    {
+        if ( watcherP->active == true && !watcherP->server->sleeping )
         {
-            if ( watcherP->active == true )
+            bool notify = false;
+
+            if ( watcherP->update == true )
             {
-                bool notify = false;
+                /* value changed, should we notify the server ? */
 
-                if ( watcherP->update == true )
+                if ( watcherP->parameters == NULL || watcherP->parameters->toSet == 0 )
                 {
-                    /* value changed, should we notify the server ? */
+                    /* no conditions */
+                    notify = true;
+                    LOG( "Notify with no conditions" );
+                    LOG_URI( &(targetP->uri) );
+                }
 
-                    if ( watcherP->parameters == NULL || watcherP->parameters->toSet == 0 )
+                if ( notify == false
+                     && watcherP->parameters != NULL
+                     && (watcherP->parameters->toSet & ATTR_FLAG_NUMERIC) != 0 )
+                {
+                    if ( (watcherP->parameters->toSet & LWM2M_ATTR_FLAG_LESS_THAN) != 0 )
                     {
-                        /* no conditions */
-                        notify = true;
-                        LOG( "Notify with no conditions" );
-                        LOG_URI( &(targetP->uri) );
+                        LOG( "Checking lower treshold" );
+                        /* Did we cross the lower treshold ? */
+                        switch ( dataP->type )
+                        {
+                            case LWM2M_TYPE_INTEGER:
+                            if ( (integerValue <= watcherP->parameters->lessThan
+                                && watcherP->lastValue.asInteger > watcherP->parameters->lessThan)
+                                || (integerValue >= watcherP->parameters->lessThan
+                                && watcherP->lastValue.asInteger < watcherP->parameters->lessThan) )
+                            {
+                                LOG( "Notify on lower treshold crossing" );
+                                notify = true;
+                            }
+                            break;
+                            case LWM2M_TYPE_FLOAT:
+                            if ( (floatValue <= watcherP->parameters->lessThan
+                                && watcherP->lastValue.asFloat > watcherP->parameters->lessThan)
+                                || (floatValue >= watcherP->parameters->lessThan
+                                && watcherP->lastValue.asFloat < watcherP->parameters->lessThan) )
+                            {
+                                LOG( "Notify on lower treshold crossing" );
+                                notify = true;
+                            }
+                            break;
+                            default:
+                            break;
+                        }
                     }
-
-                    if ( notify == false
-                         && watcherP->parameters != NULL
-                         && (watcherP->parameters->toSet & ATTR_FLAG_NUMERIC) != 0 )
+                    if ( (watcherP->parameters->toSet & LWM2M_ATTR_FLAG_GREATER_THAN) != 0 )
                     {
-                        if ( (watcherP->parameters->toSet & LWM2M_ATTR_FLAG_LESS_THAN) != 0 )
+                        LOG( "Checking upper treshold" );
+                        /* Did we cross the upper treshold ? */
+                        switch ( dataP->type )
                         {
-                            LOG( "Checking lower treshold" );
-                            /* Did we cross the lower treshold ? */
-                            switch ( dataP->type )
+                            case LWM2M_TYPE_INTEGER:
+                            if ( (integerValue <= watcherP->parameters->greaterThan
+                                && watcherP->lastValue.asInteger > watcherP->parameters->greaterThan)
+                                || (integerValue >= watcherP->parameters->greaterThan
+                                && watcherP->lastValue.asInteger < watcherP->parameters->greaterThan) )
                             {
-                                case LWM2M_TYPE_INTEGER:
-                                if ( (integerValue <= watcherP->parameters->lessThan
-                                    && watcherP->lastValue.asInteger > watcherP->parameters->lessThan)
-                                    || (integerValue >= watcherP->parameters->lessThan
-                                    && watcherP->lastValue.asInteger < watcherP->parameters->lessThan) )
-                                {
-                                    LOG( "Notify on lower treshold crossing" );
-                                    notify = true;
-                                }
-                                break;
-                                case LWM2M_TYPE_FLOAT:
-                                if ( (floatValue <= watcherP->parameters->lessThan
-                                    && watcherP->lastValue.asFloat > watcherP->parameters->lessThan)
-                                    || (floatValue >= watcherP->parameters->lessThan
-                                    && watcherP->lastValue.asFloat < watcherP->parameters->lessThan) )
-                                {
-                                    LOG( "Notify on lower treshold crossing" );
-                                    notify = true;
-                                }
-                                break;
-                                default:
-                                break;
+                                LOG( "Notify on lower upper crossing" );
+                                notify = true;
                             }
+                            break;
+                            case LWM2M_TYPE_FLOAT:
+                            if ( (floatValue <= watcherP->parameters->greaterThan
+                                && watcherP->lastValue.asFloat > watcherP->parameters->greaterThan)
+                                || (floatValue >= watcherP->parameters->greaterThan
+                                && watcherP->lastValue.asFloat < watcherP->parameters->greaterThan) )
+                            {
+                                LOG( "Notify on lower upper crossing" );
+                                notify = true;
+                            }
+                            break;
+                            default:
+                            break;
                         }
-                        if ( (watcherP->parameters->toSet & LWM2M_ATTR_FLAG_GREATER_THAN) != 0 )
+                    }
+                    if ( (watcherP->parameters->toSet & LWM2M_ATTR_FLAG_STEP) != 0 )
+                    {
+                        LOG( "Checking step" );
+
+                        switch ( dataP->type )
                         {
-                            LOG( "Checking upper treshold" );
-                            /* Did we cross the upper treshold ? */
-                            switch ( dataP->type )
+                            case LWM2M_TYPE_INTEGER:
                             {
-                                case LWM2M_TYPE_INTEGER:
-                                if ( (integerValue <= watcherP->parameters->greaterThan
-                                    && watcherP->lastValue.asInteger > watcherP->parameters->greaterThan)
-                                    || (integerValue >= watcherP->parameters->greaterThan
-                                    && watcherP->lastValue.asInteger < watcherP->parameters->greaterThan) )
-                                {
-                                    LOG( "Notify on lower upper crossing" );
-                                    notify = true;
-                                }
-                                break;
-                                case LWM2M_TYPE_FLOAT:
-                                if ( (floatValue <= watcherP->parameters->greaterThan
-                                    && watcherP->lastValue.asFloat > watcherP->parameters->greaterThan)
-                                    || (floatValue >= watcherP->parameters->greaterThan
-                                    && watcherP->lastValue.asFloat < watcherP->parameters->greaterThan) )
+                                int64_t diff;
+
+                                diff = integerValue - watcherP->lastValue.asInteger;
+                                if ( (diff < 0 && (0 - diff) >= watcherP->parameters->step)
+                                     || (diff >= 0 && diff >= watcherP->parameters->step) )
                                 {
-                                    LOG( "Notify on lower upper crossing" );
+                                    LOG( "Notify on step condition" );
                                     notify = true;
                                 }
-                                break;
-                                default:
-                                break;
                             }
-                        }
-                        if ( (watcherP->parameters->toSet & LWM2M_ATTR_FLAG_STEP) != 0 )
-                        {
-                            LOG( "Checking step" );
-
-                            switch ( dataP->type )
+                            break;
+                            case LWM2M_TYPE_FLOAT:
                             {
-                                case LWM2M_TYPE_INTEGER:
-                                {
-                                    int64_t diff;
-
-                                    diff = integerValue - watcherP->lastValue.asInteger;
-                                    if ( (diff < 0 && (0 - diff) >= watcherP->parameters->step)
-                                         || (diff >= 0 && diff >= watcherP->parameters->step) )
-                                    {
-                                        LOG( "Notify on step condition" );
-                                        notify = true;
-                                    }
-                                }
-                                break;
-                                case LWM2M_TYPE_FLOAT:
+                                double diff;
+
+                                diff = floatValue - watcherP->lastValue.asFloat;
+                                if ( (diff < 0 && (0 - diff) >= watcherP->parameters->step)
+                                     || (diff >= 0 && diff >= watcherP->parameters->step) )
                                 {
-                                    double diff;
-
-                                    diff = floatValue - watcherP->lastValue.asFloat;
-                                    if ( (diff < 0 && (0 - diff) >= watcherP->parameters->step)
-                                         || (diff >= 0 && diff >= watcherP->parameters->step) )
-                                    {
-                                        LOG( "Notify on step condition" );
-                                        notify = true;
-                                    }
+                                    LOG( "Notify on step condition" );
+                                    notify = true;
                                 }
-                                break;
-                                default:
-                                break;
                             }
-                        }
-                    }
-
-                    if ( watcherP->parameters != NULL
-                         && (watcherP->parameters->toSet & LWM2M_ATTR_FLAG_MIN_PERIOD) != 0 )
-                    {
-                        LOG_ARG( "Checking minimal period (%d s)", watcherP->parameters->minPeriod );
-
-                        if ( watcherP->lastTime + watcherP->parameters->minPeriod > currentTime )
-                        {
-                            /* Minimum Period did not elapse yet */
-                            interval = watcherP->lastTime + watcherP->parameters->minPeriod - currentTime;
-                            if ( *timeoutP > interval ) *timeoutP = interval;
-                            notify = false;
-                        }
-                        else
-                        {
-                            LOG( "Notify on minimal period" );
-                            notify = true;
+                            break;
+                            default:
+                            break;
                         }
                     }
                 }
 
-                /* Is the Maximum Period reached ? */
-                if ( notify == false
-                     && watcherP->parameters != NULL
-                     && (watcherP->parameters->toSet & LWM2M_ATTR_FLAG_MAX_PERIOD) != 0 )
+                if ( watcherP->parameters != NULL
+                     && (watcherP->parameters->toSet & LWM2M_ATTR_FLAG_MIN_PERIOD) != 0 )
                 {
-                    LOG_ARG( "Checking maximal period (%d s)", watcherP->parameters->minPeriod );
+                    LOG_ARG( "Checking minimal period (%d s)", watcherP->parameters->minPeriod );
 
-                    if ( watcherP->lastTime + watcherP->parameters->maxPeriod <= currentTime )
+                    if ( !PRV_ELAPSED( PRV_MIN_PERIOD( watcherP ), currentTime ) )
+                    {
+                        /* Minimum Period did not elapse yet */
+                        notify = false;
+                    }
+                    else
                     {
-                        LOG( "Notify on maximal period" );
+                        LOG( "Notify on minimal period" );
                         notify = true;
                     }
                 }
+            }
+
+            /* Is the Maximum Period reached ? */
+            if ( notify == false
+                 && watcherP->parameters != NULL
+                 && (watcherP->parameters->toSet & LWM2M_ATTR_FLAG_MAX_PERIOD) != 0 )
+            {
+                LOG_ARG( "Checking maximal period (%d s)", watcherP->parameters->minPeriod );
 
-                if ( notify == true )
+                if ( PRV_ELAPSED( PRV_MAX_PERIOD( watcherP ), currentTime ) )
                 {
-                    if ( buffer == NULL )
-                    {
-                        if ( dataP != NULL )
-                        {
-                            length = lwm2m_data_serialize( &targetP->uri, size, dataP, &format, &buffer );
-                            if ( length == 0 ) break;
-                        }
-                        else
-                        {
-                            if ( COAP_205_CONTENT != object_read( contextP, &targetP->uri, &format, &buffer, &length ) )
-                            {
-                                buffer = NULL;
-                                break;
-                            }
-                        }
-                        coap_init_message( message, COAP_TYPE_NON, COAP_205_CONTENT, 0 );
-                        coap_set_header_content_type( message, format );
-                        coap_set_payload( message, buffer, length );
-                    }
-                    watcherP->lastTime = currentTime;
-                    watcherP->lastMid = contextP->nextMID++;
-                    message->mid = watcherP->lastMid;
-                    coap_set_header_token( message, watcherP->token, watcherP->tokenLen );
-                    coap_set_header_observe( message, watcherP->counter++ );
-                    (void)message_send( contextP, message, watcherP->server->sessionH );
-                    watcherP->update = false;
+                    LOG( "Notify on maximal period" );
+                    notify = true;
                 }
+            }
 
-                /* Store this value */
-                if ( notify == true && storeValue == true )
+            if ( notify == true )
+            {
+                if ( buffer != NULL && bufferFormat != watcherP->format )
+                {
+                    /* watchers of the same target may ask for different formats */
+                    nbiot_free( buffer );
+                    buffer = NULL;
+                }
+                if ( buffer == NULL )
                 {
-                    switch ( dataP->type )
+                    format = watcherP->format;
+                    bufferFormat = format;
+                    if ( dataP != NULL )
+                    {
+                        length = lwm2m_data_serialize( &targetP->uri, size, dataP, &format, &buffer );
+                        if ( length == 0 ) break;
+                    }
+                    else
                     {
-                        case LWM2M_TYPE_INTEGER:
-                        watcherP->lastValue.asInteger = integerValue;
-                        break;
-                        case LWM2M_TYPE_FLOAT:
-                        watcherP->lastValue.asFloat = floatValue;
-                        break;
-                        default:
-                        break;
+                        if ( COAP_205_CONTENT != object_read( contextP, &targetP->uri, &format, &buffer, &length ) )
+                        {
+                            buffer = NULL;
+                            break;
+                        }
                     }
+                    coap_init_message( message, COAP_TYPE_NON, COAP_205_CONTENT, 0 );
+                    coap_set_header_content_type( message, format );
+                    coap_set_payload( message, buffer, length );
+                    /* watchers only differ by MID, token and Observe, encode the rest once */
+                    coap_set_option_template( message, &optionTemplate, COAP_OPTION_OBSERVE );
                 }
+                watcherP->lastTime = currentTime;
+                watcherP->lastMid = contextP->nextMID++;
+                message->mid = watcherP->lastMid;
+                coap_set_header_token( message, watcherP->token, watcherP->tokenLen );
+                coap_set_header_observe( message, watcherP->counter++ );
+                (void)message_send( contextP, message, watcherP->server->sessionH );
+                watcherP->update = false;
+            }
 
-                if ( watcherP->parameters != NULL && (watcherP->parameters->toSet & LWM2M_ATTR_FLAG_MAX_PERIOD) != 0 )
+            /* Store this value */
+            if ( notify == true && storeValue == true )
+            {
+                switch ( dataP->type )
                 {
-                    /* update timers */
-                    interval = watcherP->lastTime + watcherP->parameters->maxPeriod - currentTime;
-                    if ( *timeoutP > interval ) *timeoutP = interval;
+                    case LWM2M_TYPE_INTEGER:
+                    watcherP->lastValue.asInteger = integerValue;
+                    break;
+                    case LWM2M_TYPE_FLOAT:
+                    watcherP->lastValue.asFloat = floatValue;
+                    break;
+                    default:
+                    break;
                 }
             }
         }
-        if ( dataP != NULL ) lwm2m_data_free( size, dataP );
-        if ( buffer != NULL ) nbiot_free( buffer );
     }
-}
\ No newline at end of file
+exit:
+    if ( dataP != NULL ) lwm2m_data_free( size, dataP );
+    if ( buffer != NULL ) nbiot_free( buffer );
+    data_arenaEnd( contextP );
+}
+
+void observe_timerExpired( lwm2m_context_t * contextP,
+                           lwm2m_observed_t * targetP )
+{
+    LOG_URI( &(targetP->uri) );
+    prv_queueObserved( contextP, targetP );
+}
+
+/*
+ * Watchers of a server in queue mode get no timer while it sleeps.
+ * Called once per registration update that woke it up.
+ */
+void observe_wakeUp( lwm2m_context_t * contextP,
+                     lwm2m_server_t * serverP )
+{
+    lwm2m_observed_t * targetP;
+
+    for ( targetP = contextP->observedList; targetP != NULL; targetP = targetP->next )
+    {
+        lwm2m_watcher_t * watcherP;
+
+        watcherP = prv_findWatcher( targetP, serverP );
+        if ( watcherP != NULL && watcherP->active == true )
+        {
+            prv_queueObserved( contextP, targetP );
+        }
+    }
+}
+
+void observe_step( lwm2m_context_t * contextP,
+                   clock_t currentTime )
+{
+    lwm2m_observed_t * targetP;
+
+    LOG( "Entering" );
+
+    /* only tagged observations and expired watcher timers are processed */
+    targetP = contextP->observedReady;
+    contextP->observedReady = NULL;
+
+    while ( targetP != NULL )
+    {
+        lwm2m_observed_t * nextP;
+        lwm2m_watcher_t * watcherP;
+        bool due = false;
+
+        nextP = targetP->readyNext;
+        targetP->ready = false;
+        targetP->readyNext = NULL;
+
+        for ( watcherP = targetP->watcherList; watcherP != NULL; watcherP = watcherP->next )
+        {
+            if ( prv_watcherDue( watcherP, currentTime ) ) due = true;
+        }
+        if ( due ) prv_stepObserved( contextP, targetP, currentTime );
+
+        for ( watcherP = targetP->watcherList; watcherP != NULL; watcherP = watcherP->next )
+        {
+            prv_scheduleWatcher( contextP, targetP, watcherP );
+        }
+
+        targetP = nextP;
+    }
+}
@@ -38,6 +38,7 @@ static coap_status_t handle_request( lwm2m_context_t * contextP,
             serverP = utils_findServer( contextP, fromSessionH );
             if ( serverP != NULL )
             {
+                registration_keepAwake( contextP, serverP );
                 result = dm_handleRequest( contextP, uriP, serverP, message, response );
             }
 #ifdef LWM2M_BOOTSTRAP
@@ -99,8 +100,9 @@ void lwm2m_handle_packet( lwm2m_context_t * contextP,
                           void * fromSessionH )
 {
     coap_status_t coap_error_code = NO_ERROR;
-    static coap_packet_t message[1];
-    static coap_packet_t response[1];
+    coap_packet_t * message = contextP->message;
+    coap_packet_t * response = contextP->response;
+    const char * error_message;
 
     LOG( "Entering" );
     coap_error_code = coap_parse_message( message, buffer, (uint16_t)length );
@@ -115,6 +117,9 @@ void lwm2m_handle_packet( lwm2m_context_t * contextP,
             uint16_t block_size = REST_MAX_CHUNK_SIZE;
             uint32_t block_offset = 0;
             int64_t new_offset = 0;
+            uint8_t * payload = NULL;
+            lwm2m_server_t * serverP;
+            lwm2m_block2_data_t * block2Data = NULL;
 
             /* prepare response */
             if ( message->type == COAP_TYPE_CON )
@@ -142,18 +147,32 @@ void lwm2m_handle_packet( lwm2m_context_t * contextP,
                 new_offset = block_offset;
             }
 
-            /* handle block1 option */
-            if ( IS_OPTION( message, COAP_OPTION_BLOCK1 ) )
-            {
-                /* get server */
-                lwm2m_server_t * serverP;
-                serverP = utils_findServer( contextP, fromSessionH );
+            serverP = utils_findServer( contextP, fromSessionH );
 #ifdef LWM2M_BOOTSTRAP
-                if ( serverP == NULL )
+            if ( serverP == NULL )
+            {
+                serverP = utils_findBootstrapServer( contextP, fromSessionH );
+            }
+#endif
+
+            if ( serverP != NULL )
+            {
+                if ( message->code == COAP_GET && block_num > 0 )
                 {
-                    serverP = utils_findBootstrapServer( contextP, fromSessionH );
+                    /* next block of a representation already serialized */
+                    block2Data = coap_block2_find( &serverP->block2Data, message );
                 }
-#endif
+                else if ( message->code != COAP_GET && serverP->block2Data != NULL )
+                {
+                    /* the cached representation may be stale now */
+                    free_block2_buffer( serverP->block2Data );
+                    serverP->block2Data = NULL;
+                }
+            }
+
+            /* handle block1 option */
+            if ( IS_OPTION( message, COAP_OPTION_BLOCK1 ) )
+            {
                 if ( serverP == NULL )
                 {
                     coap_error_code = COAP_500_INTERNAL_SERVER_ERROR;
@@ -170,8 +189,18 @@ void lwm2m_handle_packet( lwm2m_context_t * contextP,
                     coap_get_header_block1( message, &block1_num, &block1_more, &block1_size, NULL );
                     LOG_ARG( "Blockwise: block1 request NUM %u (SZX %u/ SZX Max%u) MORE %u", block1_num, block1_size, REST_MAX_CHUNK_SIZE, block1_more );
 
-                    /* handle block 1 */
-                    coap_error_code = coap_block1_handler( &serverP->block1Data, message->mid, message->payload, message->payload_len, block1_size, block1_num, block1_more, &complete_buffer, &complete_buffer_size );
+                    registration_keepAwake( contextP, serverP );
+
+                    /* resources taking the value block by block need no reassembly */
+                    coap_error_code = coap_block1_stream( contextP, &serverP->block1Data, message, block1_size, block1_num, block1_more );
+                    if ( coap_error_code == COAP_IGNORE )
+                    {
+                        uint32_t size1 = 0;
+
+                        /* handle block 1 */
+                        coap_get_header_size1( message, &size1 );
+                        coap_error_code = coap_block1_handler( &serverP->block1Data, message->mid, message->payload, message->payload_len, block1_size, block1_num, block1_more, size1, &complete_buffer, &complete_buffer_size );
+                    }
 
                     /* if payload is complete, replace it in the coap message. */
                     if ( coap_error_code == NO_ERROR )
@@ -179,16 +208,31 @@ void lwm2m_handle_packet( lwm2m_context_t * contextP,
                         message->payload = complete_buffer;
                         message->payload_len = complete_buffer_size;
                     }
-                    else if ( coap_error_code == COAP_231_CONTINUE )
+                    else if ( coap_error_code == COAP_231_CONTINUE || coap_error_code == COAP_204_CHANGED )
                     {
                         block1_size = MIN( block1_size, REST_MAX_CHUNK_SIZE );
                         coap_set_header_block1( response, block1_num, block1_more, block1_size );
                     }
+                    else if ( coap_error_code == COAP_413_ENTITY_TOO_LARGE )
+                    {
+                        /* tell the server how much we can take */
+                        coap_set_header_size1( response, MAX_BLOCK1_SIZE );
+                    }
                 }
             }
             if ( coap_error_code == NO_ERROR )
             {
-                coap_error_code = handle_request( contextP, fromSessionH, message, response );
+                if ( block2Data != NULL )
+                {
+                    coap_set_header_content_type( response, block2Data->contentType );
+                    coap_set_payload( response, block2Data->buffer, block2Data->length );
+                    registration_keepAwake( contextP, serverP );
+                }
+                else
+                {
+                    coap_error_code = handle_request( contextP, fromSessionH, message, response );
+                    payload = response->payload;
+                }
             }
             if ( coap_error_code == NO_ERROR )
             {
@@ -207,7 +251,27 @@ void lwm2m_handle_packet( lwm2m_context_t * contextP,
                         }
                         else
                         {
-                            coap_set_header_block2( response, block_num, response->payload_len - block_offset > block_size, block_size );
+                            bool more = response->payload_len - block_offset > block_size;
+
+                            /* keep the representation for the following blocks instead of serializing it again */
+                            if ( more && block2Data == NULL && message->code == COAP_GET && serverP != NULL )
+                            {
+                                if ( contextP->nextETag == 0 ) contextP->nextETag++;
+                                block2Data = coap_block2_store( &serverP->block2Data, message, response, contextP->nextETag++ );
+                                if ( block2Data != NULL ) payload = NULL;
+                            }
+                            if ( block2Data != NULL )
+                            {
+                                uint8_t etag[4];
+
+                                etag[0] = (uint8_t)(block2Data->etag >> 24);
+                                etag[1] = (uint8_t)(block2Data->etag >> 16);
+                                etag[2] = (uint8_t)(block2Data->etag >> 8);
+                                etag[3] = (uint8_t)block2Data->etag;
+                                coap_set_header_etag( response, etag, sizeof(etag) );
+                            }
+
+                            coap_set_header_block2( response, block_num, more, block_size );
                             coap_set_payload( response, response->payload + block_offset, MIN( response->payload_len - block_offset, block_size ) );
                         } /* if (valid offset) */
                     }
@@ -229,7 +293,15 @@ void lwm2m_handle_packet( lwm2m_context_t * contextP,
 
                 coap_error_code = message_send( contextP, response, fromSessionH );
 
-                nbiot_free( response->payload );
+                /* the last block ends the transfer */
+                if ( block2Data != NULL && !response->block2_more )
+                {
+                    free_block2_buffer( serverP->block2Data );
+                    serverP->block2Data = NULL;
+                }
+
+                /* the response payload may point inside the serialized buffer */
+                nbiot_free( payload );
                 response->payload = NULL;
                 response->payload_len = 0;
             }
@@ -282,7 +354,8 @@ void lwm2m_handle_packet( lwm2m_context_t * contextP,
 
     if ( coap_error_code != NO_ERROR && coap_error_code != COAP_IGNORE )
     {
-        LOG_ARG( "ERROR %u: %s", coap_error_code, coap_error_message );
+        error_message = message->error_message ? message->error_message : "";
+        LOG_ARG( "ERROR %u: %s", coap_error_code, error_message );
 
         /* Set to sendable error code. */
         if ( coap_error_code >= 192 )
@@ -291,7 +364,7 @@ void lwm2m_handle_packet( lwm2m_context_t * contextP,
         }
         /* Reuse input buffer for error message. */
         coap_init_message( message, COAP_TYPE_ACK, coap_error_code, message->mid );
-        coap_set_payload( message, coap_error_message, nbiot_strlen( coap_error_message ) );
+        coap_set_payload( message, error_message, nbiot_strlen( error_message ) );
         message_send( contextP, message, fromSessionH );
     }
 }
@@ -303,23 +376,27 @@ coap_status_t message_send( lwm2m_context_t * contextP,
 {
     coap_status_t result = COAP_500_INTERNAL_SERVER_ERROR;
     uint8_t * pktBuffer;
-    size_t pktBufferLen = 0;
-    size_t allocLen;
+    size_t pktBufferLen;
 
     LOG( "Entering" );
-    allocLen = coap_serialize_get_size( message );
-    LOG_ARG( "Size to allocate: %d", allocLen );
-    if ( allocLen == 0 ) return COAP_500_INTERNAL_SERVER_ERROR;
 
-    pktBuffer = (uint8_t *)nbiot_malloc( allocLen );
-    if ( pktBuffer != NULL )
+    /* serialize into the context scratch buffer, only oversized packets allocate */
+    pktBuffer = contextP->sendBuffer;
+    pktBufferLen = coap_serialize_message( message, pktBuffer, sizeof(contextP->sendBuffer) );
+    LOG_ARG( "coap_serialize_message() returned %d", pktBufferLen );
+    if ( pktBufferLen > sizeof(contextP->sendBuffer) )
+    {
+        pktBuffer = (uint8_t *)nbiot_malloc( pktBufferLen );
+        if ( pktBuffer == NULL ) return COAP_500_INTERNAL_SERVER_ERROR;
+        pktBufferLen = coap_serialize_message( message, pktBuffer, pktBufferLen );
+    }
+
+    if ( 0 != pktBufferLen )
+    {
+        result = lwm2m_buffer_send( sessionH, pktBuffer, pktBufferLen, contextP->userData );
+    }
+    if ( pktBuffer != contextP->sendBuffer )
     {
-        pktBufferLen = coap_serialize_message( message, pktBuffer );
-        LOG_ARG( "coap_serialize_message() returned %d", pktBufferLen );
-        if ( 0 != pktBufferLen )
-        {
-            result = lwm2m_buffer_send( sessionH, pktBuffer, pktBufferLen, contextP->userData );
-        }
         nbiot_free( pktBuffer );
     }
 
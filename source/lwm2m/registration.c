@@ -51,6 +51,14 @@ static int prv_getRegistrationQuery( lwm2m_context_t * contextP,
     return index + res;
 }
 
+/* queue mode: the receive path is up from a registration request until the awake period after its reply */
+static void prv_wakeUp( lwm2m_context_t * contextP,
+                        lwm2m_server_t * serverP )
+{
+    serverP->sleeping = false;
+    timer_cancel( contextP, &serverP->queueTimer );
+}
+
 static void prv_handleRegistrationReply( lwm2m_transaction_t * transacP,
                                          void * message )
 {
@@ -59,19 +67,17 @@ static void prv_handleRegistrationReply( lwm2m_transaction_t * transacP,
 
     if ( targetP->status == STATE_REG_PENDING )
     {
-        time_t tv_sec = nbiot_time();
-        if ( tv_sec >= 0 )
-        {
-            targetP->registration = tv_sec;
-        }
+        targetP->registration = nbiot_tick();
         if ( packet != NULL && packet->code == COAP_201_CREATED )
         {
             targetP->status = STATE_REGISTERED;
+            targetP->objectsGeneration = targetP->pendingGeneration;
             if ( NULL != targetP->location )
             {
                 nbiot_free( targetP->location );
             }
             targetP->location = coap_get_multi_option_as_string( packet->location_path );
+            registration_keepAwake( (lwm2m_context_t *)transacP->userData, targetP );
 
             LOG( "Registration successful" );
         }
@@ -85,35 +91,50 @@ static void prv_handleRegistrationReply( lwm2m_transaction_t * transacP,
 
 #define PRV_QUERY_BUFFER_LENGTH 64
 
-/* send the registration for a single server */
-static uint8_t prv_register( lwm2m_context_t * contextP,
-                             lwm2m_server_t * server )
+/* endpoint, binding and lifetime do not change once the server is known, build the query once */
+static const char * prv_getQuery( lwm2m_context_t * contextP,
+                                  lwm2m_server_t * server )
 {
-    char query[64];
+    char query[PRV_QUERY_BUFFER_LENGTH];
     int query_length;
-    uint8_t payload[256];
-    int payload_length;
-    lwm2m_transaction_t * transaction;
 
-    payload_length = object_getRegisterPayload( contextP, payload, sizeof(payload) );
-    if ( payload_length == 0 ) return COAP_500_INTERNAL_SERVER_ERROR;
+    if ( server->query != NULL ) return server->query;
 
     query_length = prv_getRegistrationQuery( contextP, server, query, sizeof(query) );
-
-    if ( query_length == 0 ) return COAP_500_INTERNAL_SERVER_ERROR;
+    if ( query_length == 0 ) return NULL;
 
     if ( 0 != server->lifetime )
     {
         int res;
 
         res = utils_stringCopy( query + query_length, PRV_QUERY_BUFFER_LENGTH - query_length, QUERY_DELIMITER QUERY_LIFETIME );
-        if ( res < 0 ) return COAP_500_INTERNAL_SERVER_ERROR;
+        if ( res < 0 ) return NULL;
         query_length += res;
         res = utils_intCopy( query + query_length, PRV_QUERY_BUFFER_LENGTH - query_length, (int32_t)server->lifetime );
-        if ( res < 0 ) return COAP_500_INTERNAL_SERVER_ERROR;
+        if ( res < 0 ) return NULL;
         query_length += res;
     }
 
+    server->query = nbiot_strdup( query );
+
+    return server->query;
+}
+
+/* send the registration for a single server */
+static uint8_t prv_register( lwm2m_context_t * contextP,
+                             lwm2m_server_t * server )
+{
+    const char * query;
+    const uint8_t * payload;
+    int payload_length;
+    lwm2m_transaction_t * transaction;
+
+    payload_length = object_getRegisterPayload( contextP, &payload );
+    if ( payload_length == 0 ) return COAP_500_INTERNAL_SERVER_ERROR;
+
+    query = prv_getQuery( contextP, server );
+    if ( query == NULL ) return COAP_500_INTERNAL_SERVER_ERROR;
+
     if ( server->sessionH == NULL )
     {
         server->sessionH = lwm2m_connect_server( server->secObjInstID, contextP->userData );
@@ -130,9 +151,15 @@ static uint8_t prv_register( lwm2m_context_t * contextP,
     coap_set_payload( transaction->message, payload, payload_length );
 
     transaction->callback = prv_handleRegistrationReply;
-    transaction->userData = (void *)server;
+    transaction->userData = (void *)contextP;
+    server->pendingGeneration = contextP->registerGeneration;
 
-    contextP->transactionList = (lwm2m_transaction_t *)LWM2M_LIST_ADD( contextP->transactionList, transaction );
+    if ( transaction_add( contextP, transaction ) != 0 )
+    {
+        transaction_free( contextP, transaction );
+        return COAP_500_INTERNAL_SERVER_ERROR;
+    }
+    prv_wakeUp( contextP, server );
     if ( transaction_send( contextP, transaction ) != 0 ) return COAP_500_INTERNAL_SERVER_ERROR;
 
     server->status = STATE_REG_PENDING;
@@ -148,14 +175,16 @@ static void prv_handleRegistrationUpdateReply( lwm2m_transaction_t * transacP,
 
     if ( targetP->status == STATE_REG_UPDATE_PENDING )
     {
-        time_t tv_sec = nbiot_time();
-        if ( tv_sec >= 0 )
-        {
-            targetP->registration = tv_sec;
-        }
+        targetP->registration = nbiot_tick();
         if ( packet != NULL && packet->code == COAP_204_CHANGED )
         {
+            lwm2m_context_t * contextP = (lwm2m_context_t *)transacP->userData;
+
             targetP->status = STATE_REGISTERED;
+            targetP->objectsGeneration = targetP->pendingGeneration;
+            registration_keepAwake( contextP, targetP );
+            /* queue mode: flush what was held back while sleeping */
+            if ( targetP->awake != 0 ) observe_wakeUp( contextP, targetP );
             LOG( "Registration update successful" );
         }
         else
@@ -171,7 +200,7 @@ static int prv_updateRegistration( lwm2m_context_t * contextP,
                                    bool withObjects )
 {
     lwm2m_transaction_t * transaction;
-    uint8_t payload[256];
+    const uint8_t * payload;
     int payload_length;
 
     if ( contextP->endpointName == NULL )
@@ -184,22 +213,32 @@ static int prv_updateRegistration( lwm2m_context_t * contextP,
 
     coap_set_header_uri_path( transaction->message, server->location );
 
-    if ( withObjects == true )
+    /* only resend the object list when it changed since the server last acknowledged it */
+    server->pendingGeneration = server->objectsGeneration;
+    if ( withObjects == true
+         && server->objectsGeneration != contextP->objectsGeneration )
     {
-        payload_length = object_getRegisterPayload( contextP, payload, sizeof(payload) );
+        payload_length = object_getRegisterPayload( contextP, &payload );
         if ( payload_length == 0 )
         {
-            transaction_free( transaction );
+            transaction_free( contextP, transaction );
             return COAP_500_INTERNAL_SERVER_ERROR;
         }
+        coap_set_header_content_type( transaction->message, LWM2M_CONTENT_LINK );
         coap_set_payload( transaction->message, payload, payload_length );
+        server->pendingGeneration = contextP->registerGeneration;
     }
 
     transaction->callback = prv_handleRegistrationUpdateReply;
-    transaction->userData = (void *)server;
+    transaction->userData = (void *)contextP;
 
-    contextP->transactionList = (lwm2m_transaction_t *)LWM2M_LIST_ADD( contextP->transactionList, transaction );
+    if ( transaction_add( contextP, transaction ) != 0 )
+    {
+        transaction_free( contextP, transaction );
+        return COAP_500_INTERNAL_SERVER_ERROR;
+    }
 
+    prv_wakeUp( contextP, server );
     if ( transaction_send( contextP, transaction ) == 0 )
     {
         server->status = STATE_REG_UPDATE_PENDING;
@@ -379,18 +418,76 @@ void registration_deregister( lwm2m_context_t * contextP,
     transaction->callback = prv_handleDeregistrationReply;
     transaction->userData = (void *)contextP;
 
-    contextP->transactionList = (lwm2m_transaction_t *)LWM2M_LIST_ADD( contextP->transactionList, transaction );
+    if ( transaction_add( contextP, transaction ) != 0 )
+    {
+        transaction_free( contextP, transaction );
+        return;
+    }
     if ( transaction_send( contextP, transaction ) == 0 )
     {
         serverP->status = STATE_DEREG_PENDING;
     }
 }
 
+/* called when the registration timer of a server expires */
+void registration_refresh( lwm2m_context_t * contextP,
+                           lwm2m_server_t * serverP )
+{
+    if ( serverP->status == STATE_REGISTERED )
+    {
+        LOG( "Updating registration" );
+        prv_updateRegistration( contextP, serverP, false );
+    }
+}
+
+/* queue mode: (re)start the awake period after an exchange with the server */
+void registration_keepAwake( lwm2m_context_t * contextP,
+                             lwm2m_server_t * serverP )
+{
+    if ( serverP->awake == 0 ) return;
+
+    serverP->sleeping = false;
+    serverP->queueTimer.ownerP = serverP;
+    serverP->queueTimer.type = LWM2M_TIMER_QUEUE;
+    if ( !timer_schedule( contextP, &serverP->queueTimer, NBIOT_TICK_ADD( nbiot_tick(), (clock_t)serverP->awake * CLOCK_PER_SECOND ) ) )
+    {
+        /* stay reachable rather than miss requests */
+        LOG( "Scheduling queue mode timer failed" );
+    }
+}
+
+/* called when the awake period of a queue mode server expires */
+void registration_sleep( lwm2m_context_t * contextP,
+                         lwm2m_server_t * serverP )
+{
+    (void)contextP;
+    if ( serverP->status == STATE_REGISTERED )
+    {
+        LOG( "Entering queue mode sleep" );
+        serverP->sleeping = true;
+    }
+}
+
+bool lwm2m_is_sleeping( lwm2m_context_t * contextP )
+{
+    lwm2m_server_t * targetP;
+
+    if ( contextP->serverList == NULL ) return false;
+    /* the download peer is not a server, keep receiving its blocks */
+    if ( contextP->downloadP != NULL ) return false;
+
+    for ( targetP = contextP->serverList; targetP != NULL; targetP = targetP->next )
+    {
+        if ( !targetP->sleeping ) return false;
+    }
+
+    return true;
+}
+
 /* for each server update the registration if needed */
-/* for each client check if the registration expired */
+/* for each client arm the timer of the next registration update */
 void registration_step( lwm2m_context_t * contextP,
-                        time_t currentTime,
-                        time_t * timeoutP )
+                        clock_t currentTime )
 {
     lwm2m_server_t * targetP = contextP->serverList;
 
@@ -403,8 +500,8 @@ void registration_step( lwm2m_context_t * contextP,
         {
             case STATE_REGISTERED:
             {
-                time_t nextUpdate;
-                int    interval;
+                time_t  nextUpdate;
+                clock_t deadline;
 
                 nextUpdate = targetP->lifetime;
                 if ( COAP_MAX_TRANSMIT_WAIT < nextUpdate )
@@ -416,24 +513,32 @@ void registration_step( lwm2m_context_t * contextP,
                     nextUpdate = nextUpdate >> 1;
                 }
 
-                interval = targetP->registration + nextUpdate - currentTime;
-                if ( 0 >= interval )
+                deadline = NBIOT_TICK_ADD( targetP->registration, (clock_t)nextUpdate * CLOCK_PER_SECOND );
+                if ( 0 >= NBIOT_TICK_DIFF( deadline, currentTime ) )
                 {
-                    LOG( "Updating registration" );
-                    prv_updateRegistration( contextP, targetP, false );
+                    timer_cancel( contextP, &targetP->timer );
+                    registration_refresh( contextP, targetP );
                 }
-                else if ( interval < *timeoutP )
+                else if ( 0 == targetP->timer.index
+                          || deadline != targetP->timer.deadline )
                 {
-                    *timeoutP = interval;
+                    targetP->timer.ownerP = targetP;
+                    targetP->timer.type = LWM2M_TIMER_REGISTRATION;
+                    if ( !timer_schedule( contextP, &targetP->timer, deadline ) )
+                    {
+                        LOG( "Scheduling registration update failed" );
+                    }
                 }
             }
             break;
 
             case STATE_REG_UPDATE_NEEDED:
+            timer_cancel( contextP, &targetP->timer );
             prv_updateRegistration( contextP, targetP, true );
             break;
 
             case STATE_REG_FAILED:
+            timer_cancel( contextP, &targetP->timer );
             if ( targetP->sessionH != NULL )
             {
                 lwm2m_close_connection( targetP->sessionH, contextP->userData );
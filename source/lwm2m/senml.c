@@ -0,0 +1,343 @@
+﻿/**
+ * Copyright (c) 2017 China Mobile IOT.
+ * All rights reserved.
+ * Reference:
+ *  wakaama - https://github.com/eclipse/wakaama
+**/
+
+#include "internals.h"
+
+void senml_write( senml_writer_t * writerP,
+                  const void * data,
+                  size_t length )
+{
+    if ( writerP->buffer != NULL )
+    {
+        nbiot_memmove( writerP->buffer + writerP->length, data, length );
+    }
+    writerP->length += length;
+}
+
+/* Parses the concatenation of the base name and the name as one path. */
+bool senml_parsePath( const uint8_t * baseName,
+                      size_t baseNameLen,
+                      const uint8_t * name,
+                      size_t nameLen,
+                      senml_record_t * recordP )
+{
+    uint32_t value = 0;
+    bool digit = false;
+    size_t i;
+
+    recordP->depth = 0;
+    for ( i = 0; i < baseNameLen + nameLen; i++ )
+    {
+        uint8_t c = i < baseNameLen ? baseName[i] : name[i - baseNameLen];
+
+        if ( c >= '0' && c <= '9' )
+        {
+            value = value * 10 + (c - '0');
+            if ( value > LWM2M_MAX_ID ) return false;
+            digit = true;
+        }
+        else if ( c == '/' )
+        {
+            if ( digit )
+            {
+                if ( recordP->depth >= SENML_MAX_LEVEL ) return false;
+                recordP->ids[recordP->depth++] = (uint16_t)value;
+            }
+            else if ( i != 0 )
+            {
+                return false;
+            }
+            value = 0;
+            digit = false;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    if ( digit )
+    {
+        if ( recordP->depth >= SENML_MAX_LEVEL ) return false;
+        recordP->ids[recordP->depth++] = (uint16_t)value;
+    }
+
+    return true;
+}
+
+bool senml_parseObjLink( const uint8_t * value,
+                         size_t valueLen,
+                         lwm2m_data_t * dataP )
+{
+    int64_t objectId;
+    int64_t instanceId;
+    size_t i;
+
+    for ( i = 0; i < valueLen && value[i] != ':'; i++ );
+    if ( i == valueLen ) return false;
+    if ( !utils_plainTextToInt64( (uint8_t *)value, i, &objectId )
+         || !utils_plainTextToInt64( (uint8_t *)value + i + 1, valueLen - i - 1, &instanceId )
+         || objectId < 0 || objectId > LWM2M_MAX_ID
+         || instanceId < 0 || instanceId > LWM2M_MAX_ID )
+    {
+        return false;
+    }
+
+    dataP->type = LWM2M_TYPE_OBJECT_LINK;
+    dataP->value.asObjLink.objectId = (uint16_t)objectId;
+    dataP->value.asObjLink.objectInstanceId = (uint16_t)instanceId;
+
+    return true;
+}
+
+void senml_freeRecords( senml_record_t * recordArray,
+                        int count )
+{
+    int i;
+
+    for ( i = 0; i < count; i++ )
+    {
+        if ( (recordArray[i].data.type == LWM2M_TYPE_STRING
+              || recordArray[i].data.type == LWM2M_TYPE_OPAQUE)
+             && recordArray[i].data.value.asBuffer.buffer != NULL )
+        {
+            nbiot_free( recordArray[i].data.value.asBuffer.buffer );
+        }
+        recordArray[i].data.type = LWM2M_TYPE_UNDEFINED;
+    }
+}
+
+static int prv_compareRecords( const senml_record_t * firstP,
+                               const senml_record_t * secondP )
+{
+    int i;
+
+    for ( i = 0; i < firstP->depth && i < secondP->depth; i++ )
+    {
+        if ( firstP->ids[i] != secondP->ids[i] )
+        {
+            return firstP->ids[i] < secondP->ids[i] ? -1 : 1;
+        }
+    }
+
+    return firstP->depth - secondP->depth;
+}
+
+/* recordArray is sorted, so records sharing ids[level] are adjacent. */
+static int prv_convertRecords( senml_record_t * recordArray,
+                               int count,
+                               int level,
+                               lwm2m_data_t ** dataP )
+{
+    int size;
+    int index;
+    int i;
+
+    size = 0;
+    for ( i = 0; i < count; i++ )
+    {
+        if ( i == 0 || recordArray[i].ids[level] != recordArray[i - 1].ids[level] ) size++;
+    }
+
+    *dataP = lwm2m_data_new( size );
+    if ( *dataP == NULL ) return 0;
+
+    i = 0;
+    for ( index = 0; index < size; index++ )
+    {
+        lwm2m_data_t * targetP = *dataP + index;
+        int last;
+
+        for ( last = i + 1; last < count && recordArray[last].ids[level] == recordArray[i].ids[level]; last++ );
+
+        if ( recordArray[i].depth == level + 1 )
+        {
+            /* a value can be neither duplicated nor mixed with children */
+            if ( last - i != 1 ) break;
+            *targetP = recordArray[i].data;
+            recordArray[i].data.type = LWM2M_TYPE_UNDEFINED;
+        }
+        else
+        {
+            int childCount;
+
+            childCount = prv_convertRecords( recordArray + i, last - i, level + 1, &targetP->value.asChildren.array );
+            if ( childCount == 0 ) break;
+            targetP->value.asChildren.count = childCount;
+            switch ( level )
+            {
+                case 0:
+                targetP->type = LWM2M_TYPE_OBJECT;
+                break;
+                case 1:
+                targetP->type = LWM2M_TYPE_OBJECT_INSTANCE;
+                break;
+                default:
+                targetP->type = LWM2M_TYPE_MULTIPLE_RESOURCE;
+                break;
+            }
+        }
+        targetP->id = recordArray[i].ids[level];
+        i = last;
+    }
+
+    if ( index < size )
+    {
+        lwm2m_data_free( size, *dataP );
+        *dataP = NULL;
+        return 0;
+    }
+
+    return size;
+}
+
+int senml_convertRecords( lwm2m_uri_t * uriP,
+                          senml_record_t * recordArray,
+                          int count,
+                          lwm2m_data_t ** dataP )
+{
+    int size = 0;
+    int i;
+
+    *dataP = NULL;
+    if ( uriP == NULL || count <= 0 ) goto exit;
+
+    for ( i = 0; i < count; i++ )
+    {
+        senml_record_t record;
+        int j;
+
+        /* every record must name a resource below the target URI */
+        record = recordArray[i];
+        if ( record.depth < 3
+             || record.ids[0] != uriP->objectId
+             || (LWM2M_URI_IS_SET_INSTANCE( uriP ) && record.ids[1] != uriP->instanceId)
+             || (LWM2M_URI_IS_SET_RESOURCE( uriP ) && record.ids[2] != uriP->resourceId) )
+        {
+            goto exit;
+        }
+
+        /* insertion sort, payloads only hold a handful of records */
+        for ( j = i; j > 0 && prv_compareRecords( recordArray + j - 1, &record ) > 0; j-- )
+        {
+            recordArray[j] = recordArray[j - 1];
+        }
+        recordArray[j] = record;
+    }
+
+    size = prv_convertRecords( recordArray,
+                               count,
+                               LWM2M_URI_IS_SET_INSTANCE( uriP ) ? 2 : 1,
+                               dataP );
+
+exit:
+    /* values not moved into the tree */
+    senml_freeRecords( recordArray, count );
+
+    return size;
+}
+
+static bool prv_writeData( const senml_format_t * formatP,
+                           senml_writer_t * writerP,
+                           const uint8_t * baseName,
+                           size_t baseNameLen,
+                           const uint8_t * parent,
+                           size_t parentLen,
+                           int size,
+                           lwm2m_data_t * dataP,
+                           size_t * countP )
+{
+    uint8_t name[URI_MAX_STRING_LEN];
+    size_t nameLen;
+    int i;
+
+    for ( i = 0; i < size; i++ )
+    {
+        nbiot_memmove( name, parent, parentLen );
+        nameLen = utils_intToText( dataP[i].id, name + parentLen, URI_MAX_STRING_LEN - parentLen );
+        if ( nameLen == 0 ) return false;
+        nameLen += parentLen;
+
+        switch ( dataP[i].type )
+        {
+            case LWM2M_TYPE_OBJECT:
+            case LWM2M_TYPE_OBJECT_INSTANCE:
+            case LWM2M_TYPE_MULTIPLE_RESOURCE:
+            if ( nameLen >= URI_MAX_STRING_LEN ) return false;
+            name[nameLen++] = '/';
+            if ( !prv_writeData( formatP,
+                                 writerP,
+                                 baseName,
+                                 baseNameLen,
+                                 name,
+                                 nameLen,
+                                 dataP[i].value.asChildren.count,
+                                 dataP[i].value.asChildren.array,
+                                 countP ) )
+            {
+                return false;
+            }
+            break;
+
+            default:
+            if ( !formatP->record( writerP, baseName, baseNameLen, name, nameLen, *countP, dataP + i ) ) return false;
+            (*countP)++;
+            break;
+        }
+    }
+
+    return true;
+}
+
+size_t senml_serialize( lwm2m_uri_t * uriP,
+                        int size,
+                        lwm2m_data_t * dataP,
+                        const senml_format_t * formatP,
+                        uint8_t ** bufferP )
+{
+    uint8_t baseName[URI_MAX_STRING_LEN];
+    int baseNameLen;
+    lwm2m_uri_t baseUri;
+    senml_writer_t writer;
+    size_t length;
+    size_t count;
+
+    LOG_ARG( "size: %d", size );
+    LOG_URI( uriP );
+
+    *bufferP = NULL;
+    if ( uriP == NULL || size <= 0 ) return 0;
+
+    /* resources are named relative to their instance */
+    baseUri = *uriP;
+    baseUri.flag &= ~LWM2M_URI_FLAG_RESOURCE_ID;
+    baseNameLen = uri_toString( &baseUri, baseName, URI_MAX_STRING_LEN, NULL );
+    if ( baseNameLen <= 0 ) return 0;
+
+    /* measure, then write straight into a buffer of the exact length */
+    writer.buffer = NULL;
+    writer.length = 0;
+    count = 0;
+    if ( !prv_writeData( formatP, &writer, baseName, baseNameLen, NULL, 0, size, dataP, &count ) ) return 0;
+    formatP->header( &writer, baseName, baseNameLen, count );
+    formatP->footer( &writer );
+
+    length = writer.length;
+    *bufferP = (uint8_t *)nbiot_malloc( length );
+    if ( *bufferP == NULL ) return 0;
+
+    writer.buffer = *bufferP;
+    writer.length = 0;
+    formatP->header( &writer, baseName, baseNameLen, count );
+    count = 0;
+    prv_writeData( formatP, &writer, baseName, baseNameLen, NULL, 0, size, dataP, &count );
+    formatP->footer( &writer );
+
+    LOG_ARG( "length: %d", length );
+
+    return length;
+}
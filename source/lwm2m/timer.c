@@ -0,0 +1,180 @@
+﻿/**
+ * Copyright (c) 2017 China Mobile IOT.
+ * All rights reserved.
+**/
+
+#include "internals.h"
+
+/*
+ * Initial number of slots of the timer heap, doubled when full.
+*/
+#ifndef LWM2M_TIMER_HEAP_SIZE
+#define LWM2M_TIMER_HEAP_SIZE 8
+#endif
+
+static void prv_timerSet( lwm2m_context_t * contextP,
+                          uint16_t pos,
+                          lwm2m_timer_t * timerP )
+{
+    contextP->timerHeap[pos] = timerP;
+    timerP->index = pos + 1;
+}
+
+static void prv_timerUp( lwm2m_context_t * contextP,
+                         uint16_t pos )
+{
+    lwm2m_timer_t * timerP = contextP->timerHeap[pos];
+
+    while ( pos > 0 )
+    {
+        uint16_t parent = (pos - 1) / 2;
+
+        if ( !NBIOT_TICK_BEFORE( timerP->deadline, contextP->timerHeap[parent]->deadline ) ) break;
+
+        prv_timerSet( contextP, pos, contextP->timerHeap[parent] );
+        pos = parent;
+    }
+    prv_timerSet( contextP, pos, timerP );
+}
+
+static void prv_timerDown( lwm2m_context_t * contextP,
+                           uint16_t pos )
+{
+    lwm2m_timer_t * timerP = contextP->timerHeap[pos];
+
+    while ( 1 )
+    {
+        uint16_t child = pos * 2 + 1;
+
+        if ( child >= contextP->timerCount ) break;
+        if ( child + 1 < contextP->timerCount
+          && NBIOT_TICK_BEFORE( contextP->timerHeap[child + 1]->deadline, contextP->timerHeap[child]->deadline ) )
+        {
+            child++;
+        }
+        if ( !NBIOT_TICK_BEFORE( contextP->timerHeap[child]->deadline, timerP->deadline ) ) break;
+
+        prv_timerSet( contextP, pos, contextP->timerHeap[child] );
+        pos = child;
+    }
+    prv_timerSet( contextP, pos, timerP );
+}
+
+bool timer_schedule( lwm2m_context_t * contextP,
+                     lwm2m_timer_t * timerP,
+                     clock_t deadline )
+{
+    if ( 0 != timerP->index )
+    {
+        clock_t prev = timerP->deadline;
+
+        timerP->deadline = deadline;
+        if ( NBIOT_TICK_BEFORE( deadline, prev ) )
+        {
+            prv_timerUp( contextP, timerP->index - 1 );
+        }
+        else
+        {
+            prv_timerDown( contextP, timerP->index - 1 );
+        }
+
+        return true;
+    }
+
+    if ( contextP->timerCount == contextP->timerSize )
+    {
+        lwm2m_timer_t ** heapP;
+        uint16_t size;
+
+        size = contextP->timerSize ? contextP->timerSize * 2 : LWM2M_TIMER_HEAP_SIZE;
+        if ( size <= contextP->timerSize ) return false;
+
+        heapP = (lwm2m_timer_t **)nbiot_malloc( size * sizeof(lwm2m_timer_t *) );
+        if ( NULL == heapP ) return false;
+
+        if ( contextP->timerCount )
+        {
+            nbiot_memmove( heapP, contextP->timerHeap, contextP->timerCount * sizeof(lwm2m_timer_t *) );
+        }
+        if ( NULL != contextP->timerHeap ) nbiot_free( contextP->timerHeap );
+        contextP->timerHeap = heapP;
+        contextP->timerSize = size;
+    }
+
+    timerP->deadline = deadline;
+    prv_timerSet( contextP, contextP->timerCount++, timerP );
+    prv_timerUp( contextP, timerP->index - 1 );
+
+    return true;
+}
+
+void timer_cancel( lwm2m_context_t * contextP,
+                   lwm2m_timer_t * timerP )
+{
+    uint16_t pos;
+
+    if ( 0 == timerP->index ) return;
+
+    pos = timerP->index - 1;
+    timerP->index = 0;
+    contextP->timerCount--;
+    if ( pos != contextP->timerCount )
+    {
+        prv_timerSet( contextP, pos, contextP->timerHeap[contextP->timerCount] );
+        prv_timerUp( contextP, pos );
+        prv_timerDown( contextP, contextP->timerHeap[pos]->index - 1 );
+    }
+}
+
+lwm2m_timer_t * timer_pop( lwm2m_context_t * contextP,
+                           clock_t currentTime )
+{
+    lwm2m_timer_t * timerP;
+
+    if ( 0 == contextP->timerCount ) return NULL;
+
+    timerP = contextP->timerHeap[0];
+    if ( NBIOT_TICK_BEFORE( currentTime, timerP->deadline ) ) return NULL;
+
+    timer_cancel( contextP, timerP );
+
+    return timerP;
+}
+
+void timer_timeout( lwm2m_context_t * contextP,
+                    clock_t currentTime,
+                    clock_t * timeoutP )
+{
+    long interval;
+
+    /* observations tagged after observe_step() must be handled by the next step */
+    if ( NULL != contextP->observedReady )
+    {
+        *timeoutP = 0;
+        return;
+    }
+
+    if ( 0 == contextP->timerCount ) return;
+
+    /* deadlines are compared through the unsigned difference so that a wrapping tick still orders correctly */
+    interval = NBIOT_TICK_DIFF( contextP->timerHeap[0]->deadline, currentTime );
+    if ( interval < 0 ) interval = 0;
+    if ( *timeoutP > (clock_t)interval )
+    {
+        *timeoutP = interval;
+    }
+}
+
+void timer_clear( lwm2m_context_t * contextP )
+{
+    while ( 0 < contextP->timerCount )
+    {
+        contextP->timerHeap[--contextP->timerCount]->index = 0;
+    }
+    if ( NULL != contextP->timerHeap )
+    {
+        nbiot_free( contextP->timerHeap );
+        contextP->timerHeap = NULL;
+    }
+    contextP->timerSize = 0;
+}
@@ -9,6 +9,7 @@
 
 #define _PRV_TLV_TYPE_MASK 0xC0
 #define _PRV_TLV_HEADER_MAX_LENGTH 6
+#define _PRV_TLV_SCRATCH_SIZE 128
 
 #define _PRV_TLV_TYPE_UNKNOWN           (uint8_t)0xFF
 #define _PRV_TLV_TYPE_OBJECT            (uint8_t)0x10
@@ -223,176 +224,136 @@ int lwm2m_decode_TLV( const uint8_t * buffer,
 
 int tlv_parse( uint8_t * buffer,
                size_t bufferLen,
+               bool borrow,
                lwm2m_data_t ** dataP )
 {
     lwm2m_data_type_t type;
     uint16_t id;
     size_t dataIndex;
     size_t dataLen;
-    int index = 0;
+    int index;
     int result;
-    int size = 0;
+    int size;
+    int i;
 
-    LOG_ARG( "bufferLen: %d", bufferLen );
+    LOG_ARG( "bufferLen: %d, borrow: %s", bufferLen, borrow ? "true" : "false" );
 
     *dataP = NULL;
 
-    while ( 0 != (result = lwm2m_decode_TLV( (uint8_t*)buffer + index, bufferLen - index, &type, &id, &dataIndex, &dataLen )) )
+    /* count the records first so each level is a single allocation */
+    size = 0;
+    index = 0;
+    while ( 0 != (result = lwm2m_decode_TLV( buffer + index, bufferLen - index, &type, &id, &dataIndex, &dataLen )) )
     {
-        lwm2m_data_t * newTlvP;
+        size++;
+        index += result;
+    }
+    if ( size == 0 ) return 0;
 
-        newTlvP = lwm2m_data_new( size + 1 );
-        if ( size >= 1 )
-        {
-            if ( newTlvP == NULL )
-            {
-                lwm2m_data_free( size, *dataP );
-                return 0;
-            }
-            else
-            {
-                nbiot_memmove( newTlvP, *dataP, size * sizeof(lwm2m_data_t) );
-                nbiot_free( *dataP );
-            }
-        }
-        *dataP = newTlvP;
+    *dataP = lwm2m_data_new( size );
+    if ( *dataP == NULL ) return 0;
+
+    index = 0;
+    for ( i = 0; i < size; i++ )
+    {
+        lwm2m_data_t * targetP = *dataP + i;
 
-        (*dataP)[size].type = type;
-        (*dataP)[size].id = id;
+        result = lwm2m_decode_TLV( buffer + index, bufferLen - index, &type, &id, &dataIndex, &dataLen );
+        targetP->type = type;
+        targetP->id = id;
         if ( type == LWM2M_TYPE_OBJECT_INSTANCE || type == LWM2M_TYPE_MULTIPLE_RESOURCE )
         {
-            (*dataP)[size].value.asChildren.count = tlv_parse( buffer + index + dataIndex,
-                                                               dataLen,
-                                                               &((*dataP)[size].value.asChildren.array) );
-            if ( (*dataP)[size].value.asChildren.count == 0 )
-            {
-                lwm2m_data_free( size + 1, *dataP );
-                return 0;
-            }
+            targetP->value.asChildren.count = tlv_parse( buffer + index + dataIndex,
+                                                         dataLen,
+                                                         borrow,
+                                                         &targetP->value.asChildren.array );
+            if ( targetP->value.asChildren.count == 0 ) break;
+        }
+        else if ( borrow )
+        {
+            targetP->type = LWM2M_TYPE_OPAQUE;
+            targetP->flag |= LWM2M_DATA_FLAG_BORROWED;
+            targetP->value.asBuffer.length = dataLen;
+            targetP->value.asBuffer.buffer = dataLen == 0 ? NULL : buffer + index + dataIndex;
         }
         else
         {
-            lwm2m_data_encode_opaque( buffer + index + dataIndex, dataLen, (*dataP) + size );
+            lwm2m_data_encode_opaque( buffer + index + dataIndex, dataLen, targetP );
+            if ( targetP->type == LWM2M_TYPE_UNDEFINED ) break;
         }
-        size++;
         index += result;
     }
 
+    if ( i < size )
+    {
+        lwm2m_data_free( size, *dataP );
+        *dataP = NULL;
+        return 0;
+    }
+
     return size;
 }
 
 
-static size_t prv_getLength( int size,
-                             lwm2m_data_t * dataP )
+/* Output of the encoder, a fixed caller buffer or a heap buffer grown on demand */
+typedef struct
 {
-    int length;
-    int i;
-
-    length = 0;
-
-    for ( i = 0; i < size && length != -1; i++ )
-    {
-        switch ( dataP[i].type )
-        {
-            case LWM2M_TYPE_OBJECT_INSTANCE:
-            case LWM2M_TYPE_MULTIPLE_RESOURCE:
-            {
-                                                 int subLength;
-
-                                                 subLength = prv_getLength( dataP[i].value.asChildren.count, dataP[i].value.asChildren.array );
-                                                 if ( subLength == -1 )
-                                                 {
-                                                     length = -1;
-                                                 }
-                                                 else
-                                                 {
-                                                     length += prv_getHeaderLength( dataP[i].id, subLength ) + subLength;
-                                                 }
-            }
-            break;
+    uint8_t * buffer;
+    size_t    size;
+    size_t    length;
+    bool      growable;
+    bool      owned;    /* buffer was allocated by the writer */
+} tlv_writer_t;
+
+static bool prv_reserve( tlv_writer_t * writerP,
+                         size_t length )
+{
+    uint8_t * buffer;
+    size_t size;
 
-            case LWM2M_TYPE_STRING:
-            case LWM2M_TYPE_OPAQUE:
-            length += prv_getHeaderLength( dataP[i].id, dataP[i].value.asBuffer.length ) + dataP[i].value.asBuffer.length;
-            break;
+    if ( writerP->length + length <= writerP->size ) return true;
+    if ( !writerP->growable ) return false;
 
-            case LWM2M_TYPE_INTEGER:
-            {
-                                       size_t data_len;
-                                       uint8_t unused_buffer[_PRV_64BIT_BUFFER_SIZE];
+    /* large payloads only leave the scratch buffer once in most cases */
+    size = writerP->size * 4;
+    if ( size < writerP->length + length ) size = writerP->length + length;
+    buffer = (uint8_t *)nbiot_malloc( size );
+    if ( buffer == NULL ) return false;
 
-                                       data_len = utils_encodeInt( dataP[i].value.asInteger, unused_buffer );
-                                       length += prv_getHeaderLength( dataP[i].id, data_len ) + data_len;
-            }
-            break;
+    nbiot_memmove( buffer, writerP->buffer, writerP->length );
+    if ( writerP->owned ) nbiot_free( writerP->buffer );
+    writerP->buffer = buffer;
+    writerP->size = size;
+    writerP->owned = true;
 
-            case LWM2M_TYPE_FLOAT:
-            {
-                                     size_t data_len;
-
-                                     if ( (dataP[i].value.asFloat < 0.0 - (double)FLT_MAX)
-                                          || (dataP[i].value.asFloat >( double )FLT_MAX) )
-                                     {
-                                         data_len = 8;
-                                     }
-                                     else
-                                     {
-                                         data_len = 4;
-                                     }
-
-                                     length += prv_getHeaderLength( dataP[i].id, data_len ) + data_len;
-            }
-            break;
+    return true;
+}
 
-            case LWM2M_TYPE_BOOLEAN:
-            /* Booleans are always encoded on one byte */
-            length += prv_getHeaderLength( dataP[i].id, 1 ) + 1;
-            break;
+static bool prv_writeRecord( tlv_writer_t * writerP,
+                             bool isInstance,
+                             lwm2m_data_type_t type,
+                             uint16_t id,
+                             const uint8_t * data,
+                             size_t dataLen )
+{
+    if ( !prv_reserve( writerP, prv_getHeaderLength( id, dataLen ) + dataLen ) ) return false;
 
-            case LWM2M_TYPE_OBJECT_LINK:
-            /* Object Link are always encoded on four bytes */
-            length += prv_getHeaderLength( dataP[i].id, 4 ) + 4;
-            break;
+    writerP->length += prv_createHeader( writerP->buffer + writerP->length, isInstance, type, id, dataLen );
+    nbiot_memmove( writerP->buffer + writerP->length, data, dataLen );
+    writerP->length += dataLen;
 
-            default:
-            length = -1;
-            break;
-        }
-    }
-
-    if ( length < 0 )
-    {
-        return 0;
-    }
-    else
-    {
-        return (size_t)length;
-    }
+    return true;
 }
 
-
-size_t tlv_serialize( bool isResourceInstance,
-                      int size,
-                      lwm2m_data_t * dataP,
-                      uint8_t ** bufferP )
+static bool prv_writeData( tlv_writer_t * writerP,
+                           bool isResourceInstance,
+                           int size,
+                           lwm2m_data_t * dataP )
 {
-    size_t length;
-    int index;
     int i;
 
-    LOG_ARG( "isResourceInstance: %s, size: %d", isResourceInstance ? "true" : "false", size );
-
-    *bufferP = NULL;
-    length = prv_getLength( size, dataP );
-    if ( length <= 0 ) return length;
-
-    *bufferP = (uint8_t *)nbiot_malloc( length );
-    if ( *bufferP == NULL ) return 0;
-
-    index = 0;
-    for ( i = 0; i < size && length != 0; i++ )
+    for ( i = 0; i < size; i++ )
     {
-        int headerLen;
         bool isInstance;
 
         isInstance = isResourceInstance;
@@ -403,133 +364,154 @@ size_t tlv_serialize( bool isResourceInstance,
             /* fall throught */
             case LWM2M_TYPE_OBJECT_INSTANCE:
             {
-                uint8_t * tmpBuffer;
-                size_t tmpLength;
-
-                tmpLength = tlv_serialize( isInstance, dataP[i].value.asChildren.count, dataP[i].value.asChildren.array, &tmpBuffer );
-                if ( tmpLength == 0 )
-                {
-                    length = 0;
-                }
-                else
+                size_t start;
+                size_t headerLen;
+                size_t dataLen;
+                size_t finalLen;
+
+                /* reserve the shortest header, the children are written after it */
+                start = writerP->length;
+                headerLen = prv_getHeaderLength( dataP[i].id, 0 );
+                if ( !prv_reserve( writerP, headerLen ) ) return false;
+                writerP->length += headerLen;
+
+                if ( !prv_writeData( writerP, isInstance, dataP[i].value.asChildren.count, dataP[i].value.asChildren.array ) ) return false;
+                dataLen = writerP->length - start - headerLen;
+                if ( dataLen == 0 ) return false;
+
+                /* then make room for the length field when it does not fit in the type byte */
+                finalLen = prv_getHeaderLength( dataP[i].id, dataLen );
+                if ( finalLen > headerLen )
                 {
-                    headerLen = prv_createHeader( *bufferP + index, false, dataP[i].type, dataP[i].id, tmpLength );
-                    index += headerLen;
-                    nbiot_memmove( *bufferP + index, tmpBuffer, tmpLength );
-                    index += tmpLength;
-                    nbiot_free( tmpBuffer );
+                    uint8_t * data;
+                    size_t k;
+
+                    if ( !prv_reserve( writerP, finalLen - headerLen ) ) return false;
+
+                    /* the ranges overlap and nbiot_memmove() may copy forward */
+                    data = writerP->buffer + start + headerLen;
+                    for ( k = dataLen; k > 0; k-- )
+                    {
+                        data[k - 1 + finalLen - headerLen] = data[k - 1];
+                    }
+                    writerP->length += finalLen - headerLen;
                 }
+                prv_createHeader( writerP->buffer + start, false, dataP[i].type, dataP[i].id, dataLen );
             }
             break;
 
             case LWM2M_TYPE_OBJECT_LINK:
             {
-                                           int k;
-                                           uint8_t buf[4];
-                                           uint32_t v = dataP[i].value.asObjLink.objectId;
-                                           v <<= 16;
-                                           v |= dataP[i].value.asObjLink.objectInstanceId;
-                                           for ( k = 3; k >= 0; --k )
-                                           {
-                                               buf[k] = (uint8_t)(v & 0xFF);
-                                               v >>= 8;
-                                           }
-                                           /* keep encoding as buffer */
-                                           headerLen = prv_createHeader( *bufferP + index, isInstance, dataP[i].type, dataP[i].id, 4 );
-                                           if ( headerLen == 0 )
-                                           {
-                                               length = 0;
-                                           }
-                                           else
-                                           {
-                                               index += headerLen;
-                                               nbiot_memmove( *bufferP + index, buf, 4 );
-                                               index += 4;
-                                           }
+                uint8_t buf[4];
+
+                buf[0] = (uint8_t)(dataP[i].value.asObjLink.objectId >> 8);
+                buf[1] = (uint8_t)dataP[i].value.asObjLink.objectId;
+                buf[2] = (uint8_t)(dataP[i].value.asObjLink.objectInstanceId >> 8);
+                buf[3] = (uint8_t)dataP[i].value.asObjLink.objectInstanceId;
+                /* keep encoding as buffer */
+                if ( !prv_writeRecord( writerP, isInstance, dataP[i].type, dataP[i].id, buf, 4 ) ) return false;
             }
             break;
 
             case LWM2M_TYPE_STRING:
             case LWM2M_TYPE_OPAQUE:
-            headerLen = prv_createHeader( *bufferP + index, isInstance, dataP[i].type, dataP[i].id, dataP[i].value.asBuffer.length );
-            if ( headerLen == 0 )
-            {
-                length = 0;
-            }
-            else
-            {
-                index += headerLen;
-                nbiot_memmove( *bufferP + index, dataP[i].value.asBuffer.buffer, dataP[i].value.asBuffer.length );
-                index += dataP[i].value.asBuffer.length;
-            }
+            if ( !prv_writeRecord( writerP, isInstance, dataP[i].type, dataP[i].id, dataP[i].value.asBuffer.buffer, dataP[i].value.asBuffer.length ) ) return false;
             break;
 
             case LWM2M_TYPE_INTEGER:
             {
-                                       size_t data_len;
-                                       uint8_t data_buffer[_PRV_64BIT_BUFFER_SIZE];
-
-                                       data_len = utils_encodeInt( dataP[i].value.asInteger, data_buffer );
-                                       headerLen = prv_createHeader( *bufferP + index, isInstance, dataP[i].type, dataP[i].id, data_len );
-                                       if ( headerLen == 0 )
-                                       {
-                                           length = 0;
-                                       }
-                                       else
-                                       {
-                                           index += headerLen;
-                                           nbiot_memmove( *bufferP + index, data_buffer, data_len );
-                                           index += data_len;
-                                       }
+                size_t data_len;
+                uint8_t data_buffer[_PRV_64BIT_BUFFER_SIZE];
+
+                data_len = utils_encodeInt( dataP[i].value.asInteger, data_buffer );
+                if ( !prv_writeRecord( writerP, isInstance, dataP[i].type, dataP[i].id, data_buffer, data_len ) ) return false;
             }
             break;
 
             case LWM2M_TYPE_FLOAT:
             {
-                                     size_t data_len;
-                                     uint8_t data_buffer[_PRV_64BIT_BUFFER_SIZE];
-
-                                     data_len = utils_encodeFloat( dataP[i].value.asFloat, data_buffer );
-                                     headerLen = prv_createHeader( *bufferP + index, isInstance, dataP[i].type, dataP[i].id, data_len );
-                                     if ( headerLen == 0 )
-                                     {
-                                         length = 0;
-                                     }
-                                     else
-                                     {
-                                         index += headerLen;
-                                         nbiot_memmove( *bufferP + index, data_buffer, data_len );
-                                         index += data_len;
-                                     }
+                size_t data_len;
+                uint8_t data_buffer[_PRV_64BIT_BUFFER_SIZE];
+
+                data_len = utils_encodeFloat( dataP[i].value.asFloat, data_buffer );
+                if ( !prv_writeRecord( writerP, isInstance, dataP[i].type, dataP[i].id, data_buffer, data_len ) ) return false;
             }
             break;
 
             case LWM2M_TYPE_BOOLEAN:
-            headerLen = prv_createHeader( *bufferP + index, isInstance, dataP[i].type, dataP[i].id, 1 );
-            if ( headerLen == 0 )
             {
-                length = 0;
-            }
-            else
-            {
-                index += headerLen;
-                (*bufferP)[index] = dataP[i].value.asBoolean ? 1 : 0;
-                index += 1;
+                uint8_t value;
+
+                value = dataP[i].value.asBoolean ? 1 : 0;
+                if ( !prv_writeRecord( writerP, isInstance, dataP[i].type, dataP[i].id, &value, 1 ) ) return false;
             }
             break;
 
             default:
-            length = 0;
-            break;
+            return false;
         }
     }
 
-    if ( length == 0 )
+    return true;
+}
+
+size_t tlv_serializeBuffer( bool isResourceInstance,
+                            int size,
+                            lwm2m_data_t * dataP,
+                            uint8_t * buffer,
+                            size_t bufferLen )
+{
+    tlv_writer_t writer;
+
+    LOG_ARG( "isResourceInstance: %s, size: %d, bufferLen: %u", isResourceInstance ? "true" : "false", size, bufferLen );
+
+    writer.buffer = buffer;
+    writer.size = bufferLen;
+    writer.length = 0;
+    writer.growable = false;
+    writer.owned = false;
+    if ( !prv_writeData( &writer, isResourceInstance, size, dataP ) ) return 0;
+
+    return writer.length;
+}
+
+size_t tlv_serialize( bool isResourceInstance,
+                      int size,
+                      lwm2m_data_t * dataP,
+                      uint8_t ** bufferP )
+{
+    uint8_t scratch[_PRV_TLV_SCRATCH_SIZE];
+    tlv_writer_t writer;
+
+    LOG_ARG( "isResourceInstance: %s, size: %d", isResourceInstance ? "true" : "false", size );
+
+    *bufferP = NULL;
+
+    /* small payloads never touch the heap until the result is copied out */
+    writer.buffer = scratch;
+    writer.size = sizeof(scratch);
+    writer.length = 0;
+    writer.growable = true;
+    writer.owned = false;
+    if ( !prv_writeData( &writer, isResourceInstance, size, dataP )
+         || writer.length == 0 )
+    {
+        if ( writer.owned ) nbiot_free( writer.buffer );
+        return 0;
+    }
+
+    if ( writer.owned )
     {
-        nbiot_free( *bufferP );
+        *bufferP = writer.buffer;
+    }
+    else
+    {
+        *bufferP = (uint8_t *)nbiot_malloc( writer.length );
+        if ( *bufferP == NULL ) return 0;
+        nbiot_memmove( *bufferP, scratch, writer.length );
     }
 
-    LOG_ARG( "returning %u", length );
+    LOG_ARG( "returning %u", writer.length );
 
-    return length;
+    return writer.length;
 }
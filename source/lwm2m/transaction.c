@@ -9,10 +9,259 @@
 
 /*
 * Modulo mask (+1 and +0.5 for rounding) for a random number to get the tick number for the random
-* retransmission time between COAP_RESPONSE_TIMEOUT and COAP_RESPONSE_TIMEOUT*COAP_RESPONSE_RANDOM_FACTOR.
+* retransmission time between COAP_RESPONSE_TIMEOUT and COAP_RESPONSE_TIMEOUT*COAP_ACK_RANDOM_FACTOR.
 */
-#define COAP_RESPONSE_TIMEOUT_TICKS         (CLOCK_SECOND * COAP_RESPONSE_TIMEOUT)
-#define COAP_RESPONSE_TIMEOUT_BACKOFF_MASK  ((CLOCK_SECOND * COAP_RESPONSE_TIMEOUT * (COAP_RESPONSE_RANDOM_FACTOR - 1)) + 1.5)
+#define COAP_RESPONSE_TIMEOUT_TICKS         (CLOCK_PER_SECOND * COAP_RESPONSE_TIMEOUT)
+#define COAP_RESPONSE_TIMEOUT_BACKOFF_MASK  ((clock_t)((CLOCK_PER_SECOND * COAP_RESPONSE_TIMEOUT * (COAP_ACK_RANDOM_FACTOR - 1)) + 1.5))
+
+/*
+* Maximum number of free retained buffers kept per context.
+*/
+#ifndef LWM2M_BUFFER_POOL_SIZE
+#define LWM2M_BUFFER_POOL_SIZE              4
+#endif
+
+/*
+* Initial number of slots of the transaction index, doubled when half full.
+*/
+#ifndef LWM2M_TRANSACTION_INDEX_SIZE
+#define LWM2M_TRANSACTION_INDEX_SIZE        8
+#endif
+
+static uint8_t * prv_bufferAlloc( lwm2m_context_t * contextP )
+{
+    lwm2m_buffer_t * bufferP;
+
+    bufferP = contextP->bufferPool;
+    if ( NULL != bufferP )
+    {
+        contextP->bufferPool = bufferP->next;
+        contextP->bufferCount--;
+        return (uint8_t *)bufferP;
+    }
+
+    return (uint8_t *)nbiot_malloc( COAP_MAX_PACKET_SIZE );
+}
+
+static void prv_bufferFree( lwm2m_context_t * contextP,
+                            uint8_t * buffer )
+{
+    lwm2m_buffer_t * bufferP = (lwm2m_buffer_t *)buffer;
+
+    if ( LWM2M_BUFFER_POOL_SIZE > contextP->bufferCount )
+    {
+        bufferP->next = contextP->bufferPool;
+        contextP->bufferPool = bufferP;
+        contextP->bufferCount++;
+    }
+    else
+    {
+        nbiot_free( bufferP );
+    }
+}
+
+static void prv_freeBuffer( lwm2m_context_t * contextP,
+                            lwm2m_transaction_t * transacP )
+{
+    if ( transacP->buffer_pooled )
+    {
+        prv_bufferFree( contextP, transacP->buffer );
+    }
+    else
+    {
+        nbiot_free( transacP->buffer );
+    }
+
+    transacP->buffer = NULL;
+    transacP->buffer_pooled = false;
+}
+
+static void * prv_getSession( lwm2m_transaction_t * transacP )
+{
+    switch ( transacP->peerType )
+    {
+        case ENDPOINT_SERVER:
+        if ( NULL != transacP->peerP )
+        {
+            return ((lwm2m_server_t *)transacP->peerP)->sessionH;
+        }
+        break;
+
+        case ENDPOINT_UNKNOWN:
+        /* a peer outside the server list, peerP is its session */
+        return transacP->peerP;
+
+        default:
+        break;
+    }
+
+    return NULL;
+}
+
+static bool prv_hasToken( lwm2m_transaction_t * transacP )
+{
+    return 0 != ((coap_packet_t *)transacP->message)->token_len;
+}
+
+static uint16_t prv_hashToken( const uint8_t * token,
+                               size_t length )
+{
+    uint32_t key = 0;
+
+    while ( length-- > 0 )
+    {
+        key = key * 31 + *token++;
+    }
+
+    return (uint16_t)(key ^ (key >> 16));
+}
+
+static uint16_t prv_indexKey( lwm2m_transaction_t * transacP,
+                              bool byToken )
+{
+    if ( byToken )
+    {
+        coap_packet_t * messageP = (coap_packet_t *)transacP->message;
+
+        return prv_hashToken( messageP->token, messageP->token_len );
+    }
+
+    /* message IDs are allocated sequentially, they spread on their own */
+    return transacP->mID;
+}
+
+static void prv_indexInsert( lwm2m_transaction_t ** table,
+                             uint16_t mask,
+                             lwm2m_transaction_t * transacP,
+                             bool byToken )
+{
+    uint16_t pos;
+
+    pos = prv_indexKey( transacP, byToken ) & mask;
+    while ( NULL != table[pos] )
+    {
+        pos = (pos + 1) & mask;
+    }
+    table[pos] = transacP;
+}
+
+static void prv_indexRemove( lwm2m_transaction_t ** table,
+                             uint16_t mask,
+                             lwm2m_transaction_t * transacP,
+                             bool byToken )
+{
+    uint16_t pos;
+    uint16_t next;
+
+    pos = prv_indexKey( transacP, byToken ) & mask;
+    while ( transacP != table[pos] )
+    {
+        if ( NULL == table[pos] ) return;
+        pos = (pos + 1) & mask;
+    }
+    table[pos] = NULL;
+
+    /* shift back the entries of the probe sequence so that lookups never stop early */
+    for ( next = (pos + 1) & mask; NULL != table[next]; next = (next + 1) & mask )
+    {
+        uint16_t home = prv_indexKey( table[next], byToken ) & mask;
+
+        if ( ((next - home) & mask) >= ((next - pos) & mask) )
+        {
+            table[pos] = table[next];
+            table[next] = NULL;
+            pos = next;
+        }
+    }
+}
+
+static int prv_indexGrow( lwm2m_context_t * contextP )
+{
+    lwm2m_transaction_t ** midTable;
+    lwm2m_transaction_t ** tokenTable;
+    lwm2m_transaction_t * transacP;
+    uint16_t size;
+
+    size = contextP->transactionSize ? contextP->transactionSize * 2 : LWM2M_TRANSACTION_INDEX_SIZE;
+    if ( size <= contextP->transactionSize ) return -1;
+
+    midTable = (lwm2m_transaction_t **)nbiot_malloc( 2 * size * sizeof(lwm2m_transaction_t *) );
+    if ( NULL == midTable ) return -1;
+    nbiot_memzero( midTable, 2 * size * sizeof(lwm2m_transaction_t *) );
+    tokenTable = midTable + size;
+
+    for ( transacP = contextP->transactionList; NULL != transacP; transacP = transacP->next )
+    {
+        prv_indexInsert( midTable, size - 1, transacP, false );
+        if ( prv_hasToken( transacP ) )
+        {
+            prv_indexInsert( tokenTable, size - 1, transacP, true );
+        }
+    }
+
+    /* both tables share one allocation */
+    if ( NULL != contextP->transactionMid ) nbiot_free( contextP->transactionMid );
+    contextP->transactionMid = midTable;
+    contextP->transactionToken = tokenTable;
+    contextP->transactionSize = size;
+
+    return 0;
+}
+
+static lwm2m_transaction_t * prv_findByMid( lwm2m_context_t * contextP,
+                                            uint16_t mid,
+                                            void * fromSessionH )
+{
+    uint16_t mask;
+    uint16_t pos;
+
+    if ( 0 == contextP->transactionSize ) return NULL;
+
+    mask = contextP->transactionSize - 1;
+    for ( pos = mid & mask; NULL != contextP->transactionMid[pos]; pos = (pos + 1) & mask )
+    {
+        lwm2m_transaction_t * transacP = contextP->transactionMid[pos];
+
+        if ( transacP->mID == mid
+             && lwm2m_session_is_equal( fromSessionH, prv_getSession( transacP ), contextP->userData ) )
+        {
+            return transacP;
+        }
+    }
+
+    return NULL;
+}
+
+static lwm2m_transaction_t * prv_findByToken( lwm2m_context_t * contextP,
+                                              coap_packet_t * message,
+                                              void * fromSessionH )
+{
+    const uint8_t * token;
+    int len;
+    uint16_t mask;
+    uint16_t pos;
+
+    if ( 0 == contextP->transactionSize ) return NULL;
+
+    len = coap_get_header_token( message, &token );
+    if ( 0 == len ) return NULL;
+
+    mask = contextP->transactionSize - 1;
+    for ( pos = prv_hashToken( token, len ) & mask; NULL != contextP->transactionToken[pos]; pos = (pos + 1) & mask )
+    {
+        lwm2m_transaction_t * transacP = contextP->transactionToken[pos];
+        coap_packet_t * messageP = (coap_packet_t *)transacP->message;
+
+        if ( messageP->token_len == len
+             && nbiot_memcmp( messageP->token, token, len ) == 0
+             && lwm2m_session_is_equal( fromSessionH, prv_getSession( transacP ), contextP->userData ) )
+        {
+            return transacP;
+        }
+    }
+
+    return NULL;
+}
 
 static int prv_checkFinished( lwm2m_transaction_t * transacP,
                               coap_packet_t * receivedMessage )
@@ -151,20 +400,79 @@ error:
     return NULL;
 }
 
-void transaction_free( lwm2m_transaction_t * transacP )
+void transaction_free( lwm2m_context_t * contextP,
+                       lwm2m_transaction_t * transacP )
 {
     LOG( "Entering" );
+    timer_cancel( contextP, &transacP->timer );
     if ( transacP->message ) nbiot_free( transacP->message );
-    if ( transacP->buffer ) nbiot_free( transacP->buffer );
+    if ( transacP->buffer ) prv_freeBuffer( contextP, transacP );
     nbiot_free( transacP );
 }
 
+int transaction_add( lwm2m_context_t * contextP,
+                     lwm2m_transaction_t * transacP )
+{
+    LOG( "Entering" );
+    /* keep the load under one half so that probe sequences stay short */
+    if ( (contextP->transactionCount + 1) * 2 > contextP->transactionSize )
+    {
+        if ( 0 != prv_indexGrow( contextP ) ) return -1;
+    }
+
+    prv_indexInsert( contextP->transactionMid, contextP->transactionSize - 1, transacP, false );
+    if ( prv_hasToken( transacP ) )
+    {
+        prv_indexInsert( contextP->transactionToken, contextP->transactionSize - 1, transacP, true );
+    }
+    contextP->transactionCount++;
+    contextP->transactionList = (lwm2m_transaction_t *)LWM2M_LIST_ADD( contextP->transactionList, transacP );
+
+    return 0;
+}
+
+void transaction_clearIndex( lwm2m_context_t * contextP )
+{
+    LOG( "Entering" );
+    if ( NULL != contextP->transactionMid )
+    {
+        nbiot_free( contextP->transactionMid );
+        contextP->transactionMid = NULL;
+        contextP->transactionToken = NULL;
+    }
+    contextP->transactionSize = 0;
+    contextP->transactionCount = 0;
+}
+
+void transaction_clearBuffers( lwm2m_context_t * contextP )
+{
+    LOG( "Entering" );
+    while ( NULL != contextP->bufferPool )
+    {
+        lwm2m_buffer_t * bufferP;
+
+        bufferP = contextP->bufferPool;
+        contextP->bufferPool = bufferP->next;
+        nbiot_free( bufferP );
+    }
+    contextP->bufferCount = 0;
+}
+
 void transaction_remove( lwm2m_context_t * contextP,
                          lwm2m_transaction_t * transacP )
 {
     LOG( "Entering" );
     contextP->transactionList = (lwm2m_transaction_t *)LWM2M_LIST_RM( contextP->transactionList, transacP->mID, NULL );
-    transaction_free( transacP );
+    if ( 0 != contextP->transactionSize )
+    {
+        prv_indexRemove( contextP->transactionMid, contextP->transactionSize - 1, transacP, false );
+        if ( prv_hasToken( transacP ) )
+        {
+            prv_indexRemove( contextP->transactionToken, contextP->transactionSize - 1, transacP, true );
+        }
+        contextP->transactionCount--;
+    }
+    transaction_free( contextP, transacP );
 }
 
 bool transaction_handleResponse( lwm2m_context_t * contextP,
@@ -177,90 +485,74 @@ bool transaction_handleResponse( lwm2m_context_t * contextP,
     lwm2m_transaction_t * transacP;
 
     LOG( "Entering" );
-    transacP = contextP->transactionList;
-
-    while ( NULL != transacP )
+    transacP = NULL;
+    if ( (COAP_TYPE_ACK == message->type) || (COAP_TYPE_RST == message->type) )
     {
-        void * targetSessionH;
-
-        targetSessionH = NULL;
-        switch ( transacP->peerType )
+        transacP = prv_findByMid( contextP, message->mid, fromSessionH );
+        if ( NULL != transacP && !transacP->ack_received )
         {
-            case ENDPOINT_SERVER:
-            if ( NULL != transacP->peerP )
-            {
-                targetSessionH = ((lwm2m_server_t *)transacP->peerP)->sessionH;
-            }
-            break;
-
-            default:
-            break;
+            found = true;
+            transacP->ack_received = true;
+            reset = COAP_TYPE_RST == message->type;
         }
+    }
+    if ( !found )
+    {
+        /* separate response, matched by token */
+        transacP = prv_findByToken( contextP, message, fromSessionH );
+    }
+    if ( NULL == transacP ) return false;
 
-        if ( lwm2m_session_is_equal( fromSessionH, targetSessionH, contextP->userData ) == true )
+    if ( reset || prv_checkFinished( transacP, message ) )
+    {
+        /* HACK: If a message is sent from the monitor callback, */
+        /* it will arrive before the registration ACK. */
+        /* So we resend transaction that were denied for authentication reason. */
+        if ( !reset )
         {
-            if ( !transacP->ack_received )
+            if ( COAP_TYPE_CON == message->type && NULL != response )
             {
-                if ( (COAP_TYPE_ACK == message->type) || (COAP_TYPE_RST == message->type) )
-                {
-                    if ( transacP->mID == message->mid )
-                    {
-                        found = true;
-                        transacP->ack_received = true;
-                        reset = COAP_TYPE_RST == message->type;
-                    }
-                }
+                coap_init_message( response, COAP_TYPE_ACK, 0, message->mid );
+                message_send( contextP, response, fromSessionH );
             }
 
-            if ( reset || prv_checkFinished( transacP, message ) )
+            if ( (COAP_401_UNAUTHORIZED == message->code) && (COAP_MAX_RETRANSMIT > transacP->retrans_counter) )
             {
-                /* HACK: If a message is sent from the monitor callback, */
-                /* it will arrive before the registration ACK. */
-                /* So we resend transaction that were denied for authentication reason. */
-                if ( !reset )
-                {
-                    if ( COAP_TYPE_CON == message->type && NULL != response )
-                    {
-                        coap_init_message( response, COAP_TYPE_ACK, 0, message->mid );
-                        message_send( contextP, response, fromSessionH );
-                    }
-
-                    if ( (COAP_401_UNAUTHORIZED == message->code) && (COAP_MAX_RETRANSMIT > transacP->retrans_counter) )
-                    {
-                        transacP->ack_received = false;
-                        transacP->retrans_time += COAP_RESPONSE_TIMEOUT;
-                        return true;
-                    }
-                }
-                if ( transacP->callback != NULL )
-                {
-                    transacP->callback( transacP, message );
-                }
-                transaction_remove( contextP, transacP );
-                return true;
-            }
-            /* if we found our guy, exit */
-            if ( found )
-            {
-                time_t tv_sec = nbiot_time( );
-                if ( 0 <= tv_sec )
-                {
-                    transacP->retrans_time = tv_sec;
-                }
-                if ( transacP->response_timeout )
-                {
-                    transacP->retrans_time += transacP->response_timeout;
-                }
-                else
+                transacP->ack_received = false;
+                if ( !timer_schedule( contextP, &transacP->timer, NBIOT_TICK_ADD( transacP->timer.deadline, COAP_RESPONSE_TIMEOUT_TICKS ) ) )
                 {
-                    transacP->retrans_time += COAP_RESPONSE_TIMEOUT * transacP->retrans_counter;
+                    transaction_remove( contextP, transacP );
                 }
                 return true;
             }
         }
+        if ( transacP->callback != NULL )
+        {
+            transacP->callback( transacP, message );
+        }
+        transaction_remove( contextP, transacP );
+        return true;
+    }
+    /* if we found our guy, exit */
+    if ( found )
+    {
+        clock_t interval;
 
-        transacP = transacP->next;
+        if ( transacP->response_timeout )
+        {
+            interval = (clock_t)transacP->response_timeout * CLOCK_PER_SECOND;
+        }
+        else
+        {
+            interval = COAP_RESPONSE_TIMEOUT_TICKS * transacP->retrans_counter;
+        }
+        if ( !timer_schedule( contextP, &transacP->timer, NBIOT_TICK_ADD( nbiot_tick(), interval ) ) )
+        {
+            transaction_remove( contextP, transacP );
+        }
+        return true;
     }
+
     return false;
 }
 
@@ -272,17 +564,29 @@ int transaction_send( lwm2m_context_t * contextP,
     LOG( "Entering" );
     if ( transacP->buffer == NULL )
     {
-        transacP->buffer_len = coap_serialize_get_size( transacP->message );
-        if ( transacP->buffer_len == 0 ) return COAP_500_INTERNAL_SERVER_ERROR;
-
-        transacP->buffer = (uint8_t*)nbiot_malloc( transacP->buffer_len );
-        if ( transacP->buffer == NULL ) return COAP_500_INTERNAL_SERVER_ERROR;
+        /* retained until the transaction ends, take a pooled buffer if it fits */
+        transacP->buffer = prv_bufferAlloc( contextP );
+        if ( transacP->buffer == NULL )
+        {
+            transaction_remove( contextP, transacP );
+            return COAP_500_INTERNAL_SERVER_ERROR;
+        }
+        transacP->buffer_pooled = true;
 
-        transacP->buffer_len = coap_serialize_message( transacP->message, transacP->buffer );
+        transacP->buffer_len = coap_serialize_message( transacP->message, transacP->buffer, COAP_MAX_PACKET_SIZE );
+        if ( transacP->buffer_len > COAP_MAX_PACKET_SIZE )
+        {
+            prv_freeBuffer( contextP, transacP );
+            transacP->buffer = (uint8_t*)nbiot_malloc( transacP->buffer_len );
+            if ( transacP->buffer == NULL )
+            {
+                transaction_remove( contextP, transacP );
+                return COAP_500_INTERNAL_SERVER_ERROR;
+            }
+            transacP->buffer_len = coap_serialize_message( transacP->message, transacP->buffer, transacP->buffer_len );
+        }
         if ( transacP->buffer_len == 0 )
         {
-            nbiot_free( transacP->buffer );
-            transacP->buffer = NULL;
             transaction_remove( contextP, transacP );
             return COAP_500_INTERNAL_SERVER_ERROR;
         }
@@ -290,48 +594,35 @@ int transaction_send( lwm2m_context_t * contextP,
 
     if ( !transacP->ack_received )
     {
-        long unsigned timeout = 0;
-
         if ( 0 == transacP->retrans_counter )
         {
-            time_t tv_sec = nbiot_time( );
-            if ( 0 <= tv_sec )
-            {
-                transacP->retrans_time = tv_sec + COAP_RESPONSE_TIMEOUT;
-                transacP->retrans_counter = 1;
-                timeout = 0;
-            }
-            else
-            {
-                maxRetriesReached = true;
-            }
-        }
-        else
-        {
-            timeout = COAP_RESPONSE_TIMEOUT << (transacP->retrans_counter - 1);
+            /* initial timeout randomized in [ACK_TIMEOUT, ACK_TIMEOUT * ACK_RANDOM_FACTOR] */
+            transacP->retrans_timeout = COAP_RESPONSE_TIMEOUT_TICKS + (clock_t)nbiot_rand() % COAP_RESPONSE_TIMEOUT_BACKOFF_MASK;
+            transacP->retrans_counter = 1;
+            transacP->timer.ownerP = transacP;
+            transacP->timer.type = LWM2M_TIMER_TRANSACTION;
         }
 
         if ( COAP_MAX_RETRANSMIT + 1 >= transacP->retrans_counter )
         {
-            void * targetSessionH = NULL;
-
-            switch ( transacP->peerType )
+            if ( ENDPOINT_SERVER != transacP->peerType
+                 && ENDPOINT_UNKNOWN != transacP->peerType )
             {
-                case ENDPOINT_SERVER:
-                if ( NULL != transacP->peerP )
-                {
-                    targetSessionH = ((lwm2m_server_t *)transacP->peerP)->sessionH;
-                }
-                break;
-
-                default:
+                transaction_remove( contextP, transacP );
                 return COAP_500_INTERNAL_SERVER_ERROR;
             }
 
-            (void)lwm2m_buffer_send( targetSessionH, transacP->buffer, transacP->buffer_len, contextP->userData );
+            (void)lwm2m_buffer_send( prv_getSession( transacP ), transacP->buffer, transacP->buffer_len, contextP->userData );
 
-            transacP->retrans_time += timeout;
-            transacP->retrans_counter += 1;
+            if ( timer_schedule( contextP, &transacP->timer, NBIOT_TICK_ADD( nbiot_tick(), transacP->retrans_timeout ) ) )
+            {
+                transacP->retrans_timeout <<= 1;
+                transacP->retrans_counter += 1;
+            }
+            else
+            {
+                maxRetriesReached = true;
+            }
         }
         else
         {
@@ -351,49 +642,3 @@ int transaction_send( lwm2m_context_t * contextP,
 
     return 0;
 }
-
-void transaction_step( lwm2m_context_t * contextP,
-                       time_t currentTime,
-                       time_t * timeoutP )
-{
-    lwm2m_transaction_t * transacP;
-
-    LOG( "Entering" );
-    transacP = contextP->transactionList;
-    while ( transacP != NULL )
-    {
-        /* transaction_send() may remove transaction from the linked list */
-        lwm2m_transaction_t * nextP = transacP->next;
-        int removed = 0;
-
-        if ( transacP->retrans_time <= currentTime )
-        {
-            removed = transaction_send( contextP, transacP );
-        }
-
-        if ( 0 == removed )
-        {
-            time_t interval;
-
-            if ( transacP->retrans_time > currentTime )
-            {
-                interval = transacP->retrans_time - currentTime;
-            }
-            else
-            {
-                interval = 1;
-            }
-
-            if ( *timeoutP > interval )
-            {
-                *timeoutP = interval;
-            }
-        }
-        else
-        {
-            *timeoutP = 1;
-        }
-
-        transacP = nextP;
-    }
-}
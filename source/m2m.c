@@ -11,17 +11,9 @@ uint8_t lwm2m_buffer_send( void    *session,
                            size_t   length,
                            void     *userdata )
 {
-#ifdef HAVE_DTLS
-    int ret;
-    connection_t *conn;
-    nbiot_device_t *data;
-#else
     int ret;
-    size_t sent;
-    size_t offset;
     connection_t *conn;
     nbiot_device_t *data;
-#endif
 
     if ( NULL == session ||
          NULL == buffer ||
@@ -30,9 +22,9 @@ uint8_t lwm2m_buffer_send( void    *session,
         return COAP_500_INTERNAL_SERVER_ERROR;
     }
 
-#ifdef HAVE_DTLS
     conn = (connection_t*)session;
     data = (nbiot_device_t*)userdata;
+#ifdef HAVE_DTLS
     ret = dtls_write( &data->dtls,
                       conn->addr,
                       buffer,
@@ -42,24 +34,13 @@ uint8_t lwm2m_buffer_send( void    *session,
         return COAP_500_INTERNAL_SERVER_ERROR;
     }
 #else
-    offset = 0;
-    conn = (connection_t*)session;
-    data = (nbiot_device_t*)userdata;
-    while ( offset < length )
+    ret = nbiot_device_send( data,
+                             conn->addr,
+                             buffer,
+                             length );
+    if ( ret )
     {
-        ret = nbiot_udp_send( data->sock,
-                              buffer + offset,
-                              length - offset,
-                              &sent,
-                              conn->addr );
-        if ( ret < 0 )
-        {
-            return COAP_500_INTERNAL_SERVER_ERROR;
-        }
-        else
-        {
-            offset += sent;
-        }
+        return COAP_500_INTERNAL_SERVER_ERROR;
     }
 #endif
 
@@ -79,6 +60,7 @@ void* lwm2m_connect_server( uint16_t sec_instid,
     const char *uri;
     const char *addr;
     const char *port;
+    char *host;
     connection_t *conn;
     nbiot_device_t *dev;
 
@@ -121,22 +103,25 @@ void* lwm2m_connect_server( uint16_t sec_instid,
         return NULL;
     }
 
-    /* split string */
-    *(char*)port = '\0';
-    ++port;
+    /* copy host (server_uri may be shared by devices) */
+    host = (char*)nbiot_malloc( port - addr + 1 );
+    if ( NULL == host )
+    {
+        return NULL;
+    }
 
+    nbiot_memmove( host, addr, port - addr );
+    host[port - addr] = '\0';
     conn = connection_create( dev->connlist,
                               dev->sock,
-                              addr,
-                              nbiot_atoi(port--) );
+                              host,
+                              nbiot_atoi(port + 1) );
+    nbiot_free( host );
     if ( NULL != conn )
     {
         dev->connlist = conn;
     }
 
-    /* recover */
-    *(char*)port = ':';
-
     return conn;
 }
 
@@ -154,6 +139,9 @@ void lwm2m_close_connection( void *session,
 
     conn = (connection_t*)session;
     dev = (nbiot_device_t*)userdata;
+    /* 缓存的数据可能引用该连接的地址，未能发出的直接丢弃 */
+    nbiot_device_flush( dev );
+    nbiot_device_discard( dev, conn->addr );
     dev->connlist = connection_remove( dev->connlist, conn );
 }
 
@@ -68,6 +68,13 @@ void connection_destroy( connection_t *connlist );
 int create_resource_object( lwm2m_object_t   *obj,
                             nbiot_resource_t *data );
 
+/**
+ * 为resource object建立resource索引（配置完成后调用）
+ * @param obj 指向lwm2m_object_t内存
+ * @return 成功返回NBIOT_ERR_OK
+**/
+int index_resource_object( lwm2m_object_t *obj );
+
 /**
  * 判定resource是否存在
  * @param obj    指向lwm2m_object_t内存
@@ -85,6 +92,32 @@ bool check_resource_object( lwm2m_object_t *obj,
 **/
 void clear_resource_object( lwm2m_object_t *obj );
 
+/**
+ * 添加firmware object（/5/0）
+ * @param obj 指向lwm2m_object_t内存
+ *        dev 指向nbiot_device_t内存
+ *        fw  指向nbiot_firmware_t内存
+ * @return 成功返回NBIOT_ERR_OK
+**/
+int create_firmware_object( lwm2m_object_t   *obj,
+                            nbiot_device_t   *dev,
+                            nbiot_firmware_t *fw );
+
+/**
+ * 设置固件升级结果
+ * @param obj    指向lwm2m_object_t内存
+ *        result 升级结果
+ * @return 成功返回NBIOT_ERR_OK
+**/
+int result_firmware_object( lwm2m_object_t *obj,
+                            uint8_t         result );
+
+/**
+ * 清理firmware object（会终止进行中的下载）
+ * @param obj 指向lwm2m_object_t内存
+**/
+void clear_firmware_object( lwm2m_object_t *obj );
+
 #ifdef __cplusplus
 } /* extern "C" { */
 #endif
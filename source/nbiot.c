@@ -6,8 +6,136 @@
 #include <nbiot.h>
 #include "struct.h"
 
-/* 全局唯一实例 */
-static nbiot_device_t g_dev;
+/* 设备实例池 */
+typedef struct nbiot_device_pool_t
+{
+    nbiot_device_t *devs;
+    nbiot_device_t *free;
+    size_t          size;
+    size_t          used;
+    bool            fixed;
+} nbiot_device_pool_t;
+
+static nbiot_device_pool_t g_pool;
+
+/* 以下两个函数须持有全局锁调用 */
+static int nbiot_device_pool_create( size_t size )
+{
+    size_t i;
+
+    if ( NULL != g_pool.devs )
+    {
+        if ( g_pool.used )
+        {
+            return NBIOT_ERR_INTERNAL;
+        }
+
+        nbiot_free( g_pool.devs );
+        nbiot_memzero( &g_pool, sizeof(g_pool) );
+    }
+
+    g_pool.devs = (nbiot_device_t*)nbiot_malloc( sizeof(nbiot_device_t) * size );
+    if ( NULL == g_pool.devs )
+    {
+        return NBIOT_ERR_NO_MEMORY;
+    }
+
+    /* free list */
+    for ( i = 0; i < size; ++i )
+    {
+        g_pool.devs[i].next = (i + 1 < size) ? &g_pool.devs[i + 1] : NULL;
+    }
+
+    g_pool.free = g_pool.devs;
+    g_pool.size = size;
+    g_pool.used = 0;
+    g_pool.fixed = true;
+
+    return NBIOT_ERR_OK;
+}
+
+static void nbiot_device_pool_free( void )
+{
+    if ( NULL != g_pool.devs &&
+         0 == g_pool.used )
+    {
+        nbiot_free( g_pool.devs );
+        nbiot_memzero( &g_pool, sizeof(g_pool) );
+    }
+}
+
+int nbiot_device_pool_init( size_t size )
+{
+    int ret;
+
+    if ( 0 == size )
+    {
+        return NBIOT_ERR_BADPARAM;
+    }
+
+    nbiot_global_lock();
+    ret = nbiot_device_pool_create( size );
+    nbiot_global_unlock();
+
+    return ret;
+}
+
+void nbiot_device_pool_clear( void )
+{
+    nbiot_global_lock();
+    nbiot_device_pool_free();
+    nbiot_global_unlock();
+}
+
+static nbiot_device_t* nbiot_device_alloc( void )
+{
+    nbiot_device_t *dev = NULL;
+
+    nbiot_global_lock();
+    if ( NULL == g_pool.devs )
+    {
+        /* 未初始化时按默认大小创建，最后一个实例销毁时释放 */
+        if ( nbiot_device_pool_create(NBIOT_DEVICE_POOL_SIZE) )
+        {
+            nbiot_global_unlock();
+            return NULL;
+        }
+
+        g_pool.fixed = false;
+    }
+
+    dev = g_pool.free;
+    if ( NULL != dev )
+    {
+        g_pool.free = dev->next;
+        g_pool.used++;
+    }
+    nbiot_global_unlock();
+
+    if ( NULL != dev )
+    {
+        nbiot_memzero( dev, sizeof(nbiot_device_t) );
+    }
+
+    return dev;
+}
+
+static void nbiot_device_release( nbiot_device_t *dev )
+{
+    nbiot_memzero( dev, sizeof(nbiot_device_t) );
+
+    nbiot_global_lock();
+    dev->next = g_pool.free;
+    g_pool.free = dev;
+    g_pool.used--;
+
+    if ( 0 == g_pool.used &&
+         !g_pool.fixed )
+    {
+        nbiot_device_pool_free();
+    }
+    nbiot_global_unlock();
+}
 
 static inline lwm2m_object_t* nbiot_object_find( nbiot_device_t *dev,
                                                  uint16_t        objid )
@@ -17,7 +145,7 @@ static inline lwm2m_object_t* nbiot_object_find( nbiot_device_t *dev,
         return NULL;
     }
 
-    return (lwm2m_object_t*)LWM2M_LIST_FIND( dev->objlist, objid );
+    return (lwm2m_object_t*)LWM2M_INDEX_FIND( &dev->lwm2m.objectIndex, dev->objlist, objid );
 }
 
 static inline int nbiot_object_add( nbiot_device_t *dev,
@@ -30,45 +158,80 @@ static inline int nbiot_object_add( nbiot_device_t *dev,
     }
 
     dev->objlist = (lwm2m_object_t*)LWM2M_LIST_ADD( dev->objlist, obj );
+    lwm2m_list_index_clear( &dev->lwm2m.objectIndex );
 
     return NBIOT_ERR_OK;
 }
 
-#ifdef HAVE_DTLS
-static int send_to_peer( dtls_context_t  *ctx,
-                         const session_t *session,
-                         uint8_t         *data,
-                         size_t           len )
+int nbiot_device_send( nbiot_device_t         *dev,
+                       const nbiot_sockaddr_t *addr,
+                       const uint8_t          *buffer,
+                       size_t                  length )
 {
     int ret;
     size_t sent;
     size_t offset;
-    connection_t *conn;
-    nbiot_device_t *dev;
 
-    dev = (nbiot_device_t*)ctx->app;
-    if ( NULL == dev )
+#if NBIOT_SOCK_BATCH_SIZE > 1
+    if ( dev->tx_batch &&
+         length <= NBIOT_SOCK_BATCH_BUF_SIZE )
     {
-        return -1;
+        nbiot_datagram_t *msg;
+
+        if ( NULL == dev->tx_buff )
+        {
+            dev->tx_buff = (uint8_t*)nbiot_malloc( NBIOT_SOCK_BATCH_BUF_SIZE );
+        }
+
+        if ( NULL != dev->tx_buff )
+        {
+            if ( dev->tx_num >= NBIOT_SOCK_BATCH_SIZE ||
+                 dev->tx_used + length > NBIOT_SOCK_BATCH_BUF_SIZE )
+            {
+                ret = nbiot_device_flush( dev );
+
+                /* 队列仍然放不下时不发送，交由重传处理 */
+                if ( dev->tx_num >= NBIOT_SOCK_BATCH_SIZE ||
+                     dev->tx_used + length > NBIOT_SOCK_BATCH_BUF_SIZE )
+                {
+                    return ret ? ret : NBIOT_ERR_SOCKET;
+                }
+            }
+
+            msg = &dev->tx_msgs[dev->tx_num++];
+            msg->buff = dev->tx_buff + dev->tx_used;
+            msg->size = length;
+            msg->len = 0;
+            msg->addr = (nbiot_sockaddr_t*)addr;
+            nbiot_memmove( msg->buff, buffer, length );
+            dev->tx_used += length;
+
+            return NBIOT_ERR_OK;
+        }
     }
 
-    conn = connection_find( dev->connlist, session );
-    if ( NULL == conn )
+    /* 先发出队列中的数据，保持发送顺序 */
+    if ( dev->tx_num > 0 )
     {
-        return -1;
+        ret = nbiot_device_flush( dev );
+        if ( dev->tx_num > 0 )
+        {
+            return ret ? ret : NBIOT_ERR_SOCKET;
+        }
     }
+#endif
 
     offset = 0;
-    while ( offset < len )
+    while ( offset < length )
     {
         ret = nbiot_udp_send( dev->sock,
-                              data + offset,
-                              len - offset,
+                              buffer + offset,
+                              length - offset,
                               &sent,
-                              conn->addr );
+                              addr );
         if ( ret < 0 )
         {
-            return -1;
+            return ret;
         }
         else
         {
@@ -76,6 +239,109 @@ static int send_to_peer( dtls_context_t  *ctx,
         }
     }
 
+    return NBIOT_ERR_OK;
+}
+
+#if NBIOT_SOCK_BATCH_SIZE > 1
+/* 保留队列中从first开始、目标地址不是drop的数据报，并移到队列头部 */
+static void nbiot_device_compact( nbiot_device_t         *dev,
+                                  size_t                  first,
+                                  const nbiot_sockaddr_t *drop )
+{
+    size_t i;
+    size_t num = 0;
+    size_t used = 0;
+
+    for ( i = first; i < dev->tx_num; ++i )
+    {
+        nbiot_datagram_t msg = dev->tx_msgs[i];
+
+        if ( NULL != drop &&
+             msg.addr == drop )
+        {
+            continue;
+        }
+
+        nbiot_memmove( dev->tx_buff + used, msg.buff, msg.size );
+        msg.buff = dev->tx_buff + used;
+        dev->tx_msgs[num++] = msg;
+        used += msg.size;
+    }
+
+    dev->tx_num = num;
+    dev->tx_used = used;
+}
+#endif
+
+int nbiot_device_flush( nbiot_device_t *dev )
+{
+#if NBIOT_SOCK_BATCH_SIZE > 1
+    int ret = NBIOT_ERR_OK;
+    size_t count = 0;
+
+    if ( dev->tx_num > 0 )
+    {
+        ret = nbiot_udp_send_batch( dev->sock,
+                                    dev->tx_msgs,
+                                    dev->tx_num,
+                                    &count );
+
+        /* 出错的数据报丢弃（由重传机制处理），socket忙时未发出的数据报留在队列中 */
+        if ( ret && count < dev->tx_num )
+        {
+            ++count;
+        }
+        nbiot_device_compact( dev, count, NULL );
+        if ( NBIOT_ERR_OK == ret &&
+             dev->tx_num > 0 )
+        {
+            ret = NBIOT_ERR_SOCKET;
+        }
+    }
+
+    return ret;
+#else
+    return NBIOT_ERR_OK;
+#endif
+}
+
+void nbiot_device_discard( nbiot_device_t         *dev,
+                           const nbiot_sockaddr_t *addr )
+{
+#if NBIOT_SOCK_BATCH_SIZE > 1
+    nbiot_device_compact( dev, 0, addr );
+#else
+    (void)dev;
+    (void)addr;
+#endif
+}
+
+#ifdef HAVE_DTLS
+static int send_to_peer( dtls_context_t  *ctx,
+                         const session_t *session,
+                         uint8_t         *data,
+                         size_t           len )
+{
+    connection_t *conn;
+    nbiot_device_t *dev;
+
+    dev = (nbiot_device_t*)ctx->app;
+    if ( NULL == dev )
+    {
+        return -1;
+    }
+
+    conn = connection_find( dev->connlist, session );
+    if ( NULL == conn )
+    {
+        return -1;
+    }
+
+    if ( nbiot_device_send(dev,conn->addr,data,len) )
+    {
+        return -1;
+    }
+
     return 0;
 }
 
@@ -125,26 +391,23 @@ int nbiot_device_create( nbiot_device_t **dev,
         return NBIOT_ERR_BADPARAM;
     }
 
-    tmp = &g_dev;
+    tmp = nbiot_device_alloc();
     if ( NULL == tmp )
     {
         return NBIOT_ERR_NO_MEMORY;
     }
-    else
-    {
-        nbiot_memzero( tmp, sizeof(nbiot_device_t) );
-    }
 
     if ( nbiot_udp_create( &tmp->sock ) )
     {
-        nbiot_free( tmp );
+        nbiot_device_release( tmp );
 
         return NBIOT_ERR_INTERNAL;
     }
 
     if ( nbiot_udp_bind(tmp->sock,NULL,local_port) )
     {
-        nbiot_free( tmp );
+        nbiot_udp_close( tmp->sock );
+        nbiot_device_release( tmp );
 
         return NBIOT_ERR_INTERNAL;
     }
@@ -153,7 +416,7 @@ int nbiot_device_create( nbiot_device_t **dev,
     if ( dtls_init_context(&tmp->dtls,&dtls_cb,tmp) )
     {
         nbiot_udp_close( tmp->sock );
-        nbiot_free( tmp );
+        nbiot_device_release( tmp );
 
         return NBIOT_ERR_DTLS;
     }
@@ -166,7 +429,7 @@ int nbiot_device_create( nbiot_device_t **dev,
 #endif
         nbiot_udp_close( tmp->sock );
         lwm2m_close( &tmp->lwm2m );
-        nbiot_free( tmp );
+        nbiot_device_release( tmp );
 
         return NBIOT_ERR_INTERNAL;
     }
@@ -179,6 +442,7 @@ void nbiot_device_destroy( nbiot_device_t *dev )
 {
     if ( NULL != dev )
     {
+        int i;
         lwm2m_object_t *obj;
 
         /* close */
@@ -197,7 +461,6 @@ void nbiot_device_destroy( nbiot_device_t *dev )
                 case LWM2M_ACL_OBJECT_ID:
                 case LWM2M_DEVICE_OBJECT_ID:
                 case LWM2M_CONN_MONITOR_OBJECT_ID:
-                case LWM2M_FIRMWARE_UPDATE_OBJECT_ID:
                 case LWM2M_LOCATION_OBJECT_ID:
                 case LWM2M_CONN_STATS_OBJECT_ID:
                 {
@@ -207,7 +470,14 @@ void nbiot_device_destroy( nbiot_device_t *dev )
 
                 default:
                 {
-                    clear_resource_object( obj );
+                    if ( obj == dev->fwobj )
+                    {
+                        clear_firmware_object( obj );
+                    }
+                    else
+                    {
+                        clear_resource_object( obj );
+                    }
                 }
                 break;
             }
@@ -216,9 +486,14 @@ void nbiot_device_destroy( nbiot_device_t *dev )
         }
 
         /* free */
-        nbiot_free( dev->addr );
-        /* g_dev */
-        /* nbiot_free( dev ); */
+        for ( i = 0; i < NBIOT_SOCK_BATCH_SIZE; ++i )
+        {
+            nbiot_sockaddr_destroy( dev->addr[i] );
+        }
+#if NBIOT_SOCK_BATCH_SIZE > 1
+        nbiot_free( dev->tx_buff );
+#endif
+        nbiot_device_release( dev );
     }
 }
 
@@ -248,6 +523,25 @@ int nbiot_device_connect( nbiot_device_t *dev,
     return NBIOT_ERR_OK;
 }
 
+int nbiot_device_queue_mode( nbiot_device_t *dev,
+                             uint16_t        awake_time )
+{
+    if ( NULL == dev )
+    {
+        return NBIOT_ERR_BADPARAM;
+    }
+
+    /* 服务端列表已建立后不再生效 */
+    if ( NULL != dev->lwm2m.serverList )
+    {
+        return NBIOT_ERR_INTERNAL;
+    }
+
+    dev->data.awake_time = awake_time;
+
+    return NBIOT_ERR_OK;
+}
+
 int nbiot_device_close( nbiot_device_t *dev )
 {
     if ( NULL == dev )
@@ -255,6 +549,11 @@ int nbiot_device_close( nbiot_device_t *dev )
         return NBIOT_ERR_BADPARAM;
     }
 
+    if ( NULL != dev->loop )
+    {
+        nbiot_loop_remove( dev->loop, dev );
+    }
+
     if ( NULL != dev->sock )
     {
         nbiot_udp_close( dev->sock );
@@ -275,6 +574,12 @@ int nbiot_device_close( nbiot_device_t *dev )
         dev->connlist = NULL;
     }
 
+#if NBIOT_SOCK_BATCH_SIZE > 1
+    /* 未发出的数据报引用已销毁的连接地址 */
+    dev->tx_num = 0;
+    dev->tx_used = 0;
+#endif
+
     return NBIOT_ERR_OK;
 }
 
@@ -298,6 +603,13 @@ int nbiot_device_configure( nbiot_device_t   *dev,
     {
         bool exist = true;
 
+        /* /5由固件升级对象提供 */
+        if ( NULL != dev->fwobj &&
+             res_array[i]->objid == dev->fwobj->objID )
+        {
+            return NBIOT_ERR_BADPARAM;
+        }
+
         obj = nbiot_object_find( dev, res_array[i]->objid );
         if ( NULL == obj )
         {
@@ -336,6 +648,20 @@ int nbiot_device_configure( nbiot_device_t   *dev,
         }
     }
 
+    for ( obj = dev->objlist; NULL != obj; obj = obj->next )
+    {
+        if ( obj == dev->fwobj )
+        {
+            continue;
+        }
+
+        ret = index_resource_object( obj );
+        if ( ret )
+        {
+            return ret;
+        }
+    }
+
     if ( lwm2m_configure(&dev->lwm2m,
                           endpoint_name,
                           dev->objlist) )
@@ -346,6 +672,70 @@ int nbiot_device_configure( nbiot_device_t   *dev,
     return NBIOT_ERR_OK;
 }
 
+int nbiot_device_firmware( nbiot_device_t   *dev,
+                           nbiot_firmware_t *fw )
+{
+    int ret;
+    lwm2m_object_t *obj;
+
+    if ( NULL == dev ||
+         NULL == fw )
+    {
+        return NBIOT_ERR_BADPARAM;
+    }
+
+    /* 须在配置之前调用，且只能启用一次 */
+    if ( NULL != dev->lwm2m.objectList ||
+         NULL != dev->fwobj ||
+         NULL != nbiot_object_find(dev,LWM2M_FIRMWARE_UPDATE_OBJECT_ID) )
+    {
+        return NBIOT_ERR_INTERNAL;
+    }
+
+    obj = (lwm2m_object_t*)nbiot_malloc( sizeof(lwm2m_object_t) );
+    if ( NULL == obj )
+    {
+        return NBIOT_ERR_NO_MEMORY;
+    }
+
+    nbiot_memzero( obj, sizeof(lwm2m_object_t) );
+    ret = create_firmware_object( obj, dev, fw );
+    if ( ret )
+    {
+        nbiot_free( obj );
+
+        return ret;
+    }
+
+    ret = nbiot_object_add( dev, obj );
+    if ( ret )
+    {
+        clear_firmware_object( obj );
+        nbiot_free( obj );
+
+        return ret;
+    }
+
+    dev->fwobj = obj;
+    return NBIOT_ERR_OK;
+}
+
+int nbiot_device_firmware_result( nbiot_device_t *dev,
+                                  uint8_t         result )
+{
+    if ( NULL == dev )
+    {
+        return NBIOT_ERR_BADPARAM;
+    }
+
+    if ( NULL == dev->fwobj )
+    {
+        return NBIOT_ERR_NO_RESOURCE;
+    }
+
+    return result_firmware_object( dev->fwobj, result );
+}
+
 bool nbiot_device_ready( nbiot_device_t *dev )
 {
     if ( NULL == dev )
@@ -356,62 +746,94 @@ bool nbiot_device_ready( nbiot_device_t *dev )
     return (STATE_READY == dev->lwm2m.state);
 }
 
-int nbiot_device_step( nbiot_device_t *dev,
-                       time_t          timeout )
+int nbiot_device_process( nbiot_device_t *dev,
+                          clock_t        *timeout )
 {
     int ret;
-    size_t read;
+    size_t i;
+    size_t count;
+    bool sleeping;
     connection_t *conn;
-    uint8_t buff[NBIOT_SOCK_RECV_BUF_SIZE];
+    nbiot_datagram_t msgs[NBIOT_SOCK_BATCH_SIZE];
+    uint8_t buff[NBIOT_SOCK_BATCH_SIZE][NBIOT_SOCK_RECV_BUF_SIZE];
 
-    if ( NULL == dev )
+#if NBIOT_SOCK_BATCH_SIZE > 1
+    dev->tx_batch = true;
+#endif
+    for ( i = 0; i < NBIOT_SOCK_BATCH_SIZE; ++i )
     {
-        return NBIOT_ERR_BADPARAM;
+        msgs[i].buff = buff[i];
+        msgs[i].size = sizeof(buff[i]);
     }
 
+    /* 队列模式休眠期间接收已关闭，到达的数据直接丢弃 */
+    sleeping = lwm2m_is_sleeping( &dev->lwm2m );
+
     do
     {
-        ret = nbiot_udp_recv( dev->sock,
-                              buff,
-                              sizeof(buff),
-                              &read,
-                              &dev->addr );
+        for ( i = 0; i < NBIOT_SOCK_BATCH_SIZE; ++i )
+        {
+            msgs[i].addr = dev->addr[i];
+        }
+
+        ret = nbiot_udp_recv_batch( dev->sock,
+                                    msgs,
+                                    NBIOT_SOCK_BATCH_SIZE,
+                                    &count );
+        for ( i = 0; i < NBIOT_SOCK_BATCH_SIZE; ++i )
+        {
+            dev->addr[i] = msgs[i].addr;
+        }
+
         if ( ret )
         {
-            return ret;
+            break;
         }
 
-        if ( read > 0 )
+        for ( i = 0; i < count && !sleeping; ++i )
         {
-            conn = connection_find( dev->connlist, dev->addr );
+            conn = connection_find( dev->connlist, msgs[i].addr );
             if ( NULL != conn )
             {
 #ifdef HAVE_DTLS
-                ret = dtls_handle_message( &dev->dtls,
-                                           conn->addr,
-                                           buff,
-                                           read );
-                if ( ret != 0 )
+                if ( dtls_handle_message(&dev->dtls,
+                                         conn->addr,
+                                         msgs[i].buff,
+                                         msgs[i].len) )
                 {
-                    return NBIOT_ERR_DTLS;
+                    ret = NBIOT_ERR_DTLS;
+                    break;
                 }
 #else
                 lwm2m_handle_packet( &dev->lwm2m,
-                                     buff,
-                                     read,
+                                     msgs[i].buff,
+                                     msgs[i].len,
                                      conn );
 #endif
             }
         }
-        else
-        {
-            break;
-        }
-    } while(1);
+    } while ( !ret && count == NBIOT_SOCK_BATCH_SIZE );
 
-    if ( lwm2m_step(&dev->lwm2m,&timeout) )
+    if ( !ret &&
+         lwm2m_step(&dev->lwm2m,timeout) )
     {
-        return NBIOT_ERR_INTERNAL;
+        ret = NBIOT_ERR_INTERNAL;
+    }
+
+#if NBIOT_SOCK_BATCH_SIZE > 1
+    dev->tx_batch = false;
+    nbiot_device_flush( dev );
+
+    /* socket忙时未发出的数据报留在队列中，稍后重试 */
+    if ( dev->tx_num > 0 &&
+         *timeout > NBIOT_SOCK_RETRY_TIME )
+    {
+        *timeout = NBIOT_SOCK_RETRY_TIME;
+    }
+#endif
+    if ( ret )
+    {
+        return ret;
     }
 
     if ( STATE_RESET == dev->lwm2m.state )
@@ -422,6 +844,63 @@ int nbiot_device_step( nbiot_device_t *dev,
     return NBIOT_ERR_OK;
 }
 
+int nbiot_device_step( nbiot_device_t *dev,
+                       time_t          timeout )
+{
+    clock_t next;
+
+    if ( NULL == dev )
+    {
+        return NBIOT_ERR_BADPARAM;
+    }
+
+    next = (clock_t)timeout * CLOCK_PER_SECOND;
+    return nbiot_device_process( dev, &next );
+}
+
+int nbiot_device_wait( nbiot_device_t *dev,
+                       int             timeout )
+{
+    int ret;
+    clock_t next;
+
+    if ( NULL == dev ||
+         timeout < 0 )
+    {
+        return NBIOT_ERR_BADPARAM;
+    }
+
+    /* 处理已到达的数据，并获取协议栈下一个定时时刻 */
+    next = timeout;
+    ret = nbiot_device_process( dev, &next );
+    if ( ret )
+    {
+        return ret;
+    }
+
+    if ( next < 0 )
+    {
+        next = 0;
+    }
+
+    if ( next < timeout )
+    {
+        timeout = (int)next;
+    }
+
+    if ( timeout > 0 )
+    {
+        ret = nbiot_udp_wait( dev->sock, timeout );
+        if ( ret )
+        {
+            return ret;
+        }
+    }
+
+    next = 0;
+    return nbiot_device_process( dev, &next );
+}
+
 int nbiot_device_notify( nbiot_device_t *dev,
                          uint16_t        objid,
                          uint16_t        instid,
@@ -436,7 +915,8 @@ int nbiot_device_notify( nbiot_device_t *dev,
     }
 
     res_obj = nbiot_object_find( dev, objid );
-    if ( NULL == res_obj )
+    if ( NULL == res_obj ||
+         res_obj == dev->fwobj )
     {
         return NBIOT_ERR_NO_RESOURCE;
     }
@@ -459,3 +939,52 @@ int nbiot_device_notify( nbiot_device_t *dev,
 
     return NBIOT_ERR_OK;
 }
+
+int nbiot_device_notify_batch( nbiot_device_t   *dev,
+                               nbiot_resource_t *res_array[],
+                               size_t            res_num )
+{
+    size_t i;
+    lwm2m_uri_t uri;
+    lwm2m_object_t *res_obj;
+
+    if ( NULL == dev ||
+         NULL == res_array ||
+         0 == res_num )
+    {
+        return NBIOT_ERR_BADPARAM;
+    }
+
+    /* 先全部校验，避免只上报一部分 */
+    for ( i = 0; i < res_num; ++i )
+    {
+        if ( NULL == res_array[i] )
+        {
+            return NBIOT_ERR_BADPARAM;
+        }
+
+        res_obj = nbiot_object_find( dev, res_array[i]->objid );
+        if ( NULL == res_obj ||
+             res_obj == dev->fwobj ||
+             !check_resource_object(res_obj,
+                                    res_array[i]->instid,
+                                    res_array[i]->resid) )
+        {
+            return NBIOT_ERR_NO_RESOURCE;
+        }
+    }
+
+    /* 只做标记，同一订阅在下次驱动时合并为一条上报 */
+    uri.flag = LWM2M_URI_FLAG_OBJECT_ID |
+               LWM2M_URI_FLAG_INSTANCE_ID |
+               LWM2M_URI_FLAG_RESOURCE_ID;
+    for ( i = 0; i < res_num; ++i )
+    {
+        uri.objectId = res_array[i]->objid;
+        uri.instanceId = res_array[i]->instid;
+        uri.resourceId = res_array[i]->resid;
+        lwm2m_resource_value_changed( &dev->lwm2m, &uri );
+    }
+
+    return NBIOT_ERR_OK;
+}
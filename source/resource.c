@@ -17,6 +17,7 @@ typedef struct _instance_t
     struct _instance_t *next;    /* matches lwm2m_list_t::next */
     uint16_t            instid;  /* matches lwm2m_list_t::id */
     resource_t         *reslist; /* matches lwm2m_list_t */
+    lwm2m_list_index_t  resindex; /* index of reslist */
 }instance_t;
 
 static uint8_t prv_get_value( lwm2m_data_t *data,
@@ -50,18 +51,21 @@ static uint8_t prv_get_value( lwm2m_data_t *data,
 
         case NBIOT_VALUE_STRING:
         {
-            lwm2m_data_encode_nstring( tmp->value.as_str.str,
-                                       tmp->value.as_str.len,
-                                       data );
+            /* the resource outlives the read, no need for a copy */
+            lwm2m_data_encode_view( LWM2M_TYPE_STRING,
+                                    (uint8_t*)tmp->value.as_str.str,
+                                    tmp->value.as_str.len,
+                                    data );
             return COAP_205_CONTENT;
         }
         break;
 
         case NBIOT_VALUE_BINARY:
         {
-            lwm2m_data_encode_opaque( tmp->value.as_bin.bin,
-                                      tmp->value.as_bin.len,
-                                      data );
+            lwm2m_data_encode_view( LWM2M_TYPE_OPAQUE,
+                                    tmp->value.as_bin.bin,
+                                    tmp->value.as_bin.len,
+                                    data );
             return COAP_205_CONTENT;
         }
         break;
@@ -174,12 +178,33 @@ static uint8_t prv_set_value( lwm2m_data_t *data,
                 return COAP_400_BAD_REQUEST;
             }
 
-            val = data->value.asBuffer.buffer;
             len = data->value.asBuffer.length;
-            data->value.asBuffer.buffer = NULL;
-            data->value.asBuffer.length = 0;
+            if ( data->flag & LWM2M_DATA_FLAG_BORROWED )
+            {
+                /* borrowed from the request, reuse the current value when it fits */
+                val = tmp->value.as_bin.bin;
+                if ( NULL == val || len > tmp->value.as_bin.len )
+                {
+                    val = (uint8_t*)nbiot_malloc( len );
+                    if ( NULL == val )
+                    {
+                        return COAP_500_INTERNAL_SERVER_ERROR;
+                    }
+
+                    nbiot_free( tmp->value.as_bin.bin );
+                }
+
+                nbiot_memmove( val, data->value.asBuffer.buffer, len );
+            }
+            else
+            {
+                val = data->value.asBuffer.buffer;
+                data->value.asBuffer.buffer = NULL;
+                data->value.asBuffer.length = 0;
+
+                nbiot_free( tmp->value.as_bin.bin );
+            }
 
-            nbiot_free( tmp->value.as_bin.bin );
             tmp->value.as_bin.bin = val;
             tmp->value.as_bin.len = len;
 
@@ -202,7 +227,7 @@ static uint8_t prv_resource_read( uint16_t        instid,
     resource_t *res;
     instance_t *inst;
 
-    inst = (instance_t*)LWM2M_LIST_FIND( obj->instanceList, instid );
+    inst = (instance_t*)LWM2M_INDEX_FIND( &obj->instanceIndex, obj->instanceList, instid );
     if ( NULL == inst )
     {
         return COAP_404_NOT_FOUND;
@@ -224,7 +249,7 @@ static uint8_t prv_resource_read( uint16_t        instid,
 
         if ( i > 0 )
         {
-            *data = lwm2m_data_new( i );
+            *data = lwm2m_data_new_arena( obj->dataArena, i );
             if ( NULL == *data )
             {
                 return COAP_500_INTERNAL_SERVER_ERROR;
@@ -255,7 +280,7 @@ static uint8_t prv_resource_read( uint16_t        instid,
         i = 0;
         do
         {
-            res = (resource_t*)LWM2M_LIST_FIND( inst->reslist, (*data)[i].id );
+            res = (resource_t*)LWM2M_INDEX_FIND( &inst->resindex, inst->reslist, (*data)[i].id );
             if ( NULL == res )
             {
                 ret = COAP_404_NOT_FOUND;
@@ -288,7 +313,7 @@ static uint8_t prv_resource_write( uint16_t        instid,
     instance_t *inst;
     nbiot_resource_t *tmp;
 
-    inst = (instance_t*)LWM2M_LIST_FIND( obj->instanceList, instid );
+    inst = (instance_t*)LWM2M_INDEX_FIND( &obj->instanceIndex, obj->instanceList, instid );
     if ( NULL == inst )
     {
         return COAP_404_NOT_FOUND;
@@ -297,7 +322,7 @@ static uint8_t prv_resource_write( uint16_t        instid,
     i = 0;
     while ( i < num )
     {
-        res = (resource_t*)LWM2M_LIST_FIND( inst->reslist, data[i].id );
+        res = (resource_t*)LWM2M_INDEX_FIND( &inst->resindex, inst->reslist, data[i].id );
         if ( NULL == res )
         {
             ret = COAP_404_NOT_FOUND;
@@ -340,13 +365,13 @@ static uint8_t prv_resource_execute( uint16_t        instid,
     instance_t *inst;
     nbiot_resource_t *tmp;
 
-    inst = (instance_t*)LWM2M_LIST_FIND( obj->instanceList, instid );
+    inst = (instance_t*)LWM2M_INDEX_FIND( &obj->instanceIndex, obj->instanceList, instid );
     if ( NULL == inst )
     {
         return COAP_404_NOT_FOUND;
     }
 
-    res = (resource_t*)LWM2M_LIST_FIND( inst->reslist, resid );
+    res = (resource_t*)LWM2M_INDEX_FIND( &inst->resindex, inst->reslist, resid );
     if ( NULL == res )
     {
         return COAP_404_NOT_FOUND;
@@ -368,6 +393,51 @@ static uint8_t prv_resource_execute( uint16_t        instid,
     return COAP_204_CHANGED;
 }
 
+static uint8_t prv_resource_block( uint16_t        instid,
+                                   uint16_t        resid,
+                                   bool            execute,
+                                   uint32_t        offset,
+                                   uint8_t        *buffer,
+                                   int             length,
+                                   bool            more,
+                                   lwm2m_object_t *obj )
+{
+    resource_t *res;
+    instance_t *inst;
+    nbiot_resource_t *tmp;
+
+    inst = (instance_t*)LWM2M_INDEX_FIND( &obj->instanceIndex, obj->instanceList, instid );
+    if ( NULL == inst )
+    {
+        return COAP_404_NOT_FOUND;
+    }
+
+    res = (resource_t*)LWM2M_INDEX_FIND( &inst->resindex, inst->reslist, resid );
+    if ( NULL == res )
+    {
+        return COAP_404_NOT_FOUND;
+    }
+
+    tmp = res->data;
+    if ( !(tmp->flag & NBIOT_RESOURCE_BLOCK) || NULL == tmp->block )
+    {
+        /* reassembled and passed to write/execute */
+        return COAP_IGNORE;
+    }
+
+    if ( !(tmp->flag & (execute ? NBIOT_RESOURCE_EXECUTABLE : NBIOT_RESOURCE_WRITABLE)) )
+    {
+        return COAP_405_METHOD_NOT_ALLOWED;
+    }
+
+    if ( NBIOT_ERR_OK != (*tmp->block)(tmp, offset, buffer, length, more) )
+    {
+        return COAP_500_INTERNAL_SERVER_ERROR;
+    }
+
+    return COAP_204_CHANGED;
+}
+
 static uint8_t prv_resource_discover( uint16_t        instid,
                                       int            *num,
                                       lwm2m_data_t  **data,
@@ -377,7 +447,7 @@ static uint8_t prv_resource_discover( uint16_t        instid,
     resource_t *res;
     instance_t *inst;
 
-    inst = (instance_t*)LWM2M_LIST_FIND( obj->instanceList, instid );
+    inst = (instance_t*)LWM2M_INDEX_FIND( &obj->instanceIndex, obj->instanceList, instid );
     if ( NULL == inst )
     {
         return COAP_404_NOT_FOUND;
@@ -471,6 +541,7 @@ int create_resource_object( lwm2m_object_t   *obj,
         nbiot_memzero( res, sizeof(resource_t) );
         res->resid = data->resid;
         inst->reslist = (resource_t*)LWM2M_LIST_ADD( inst->reslist, res );
+        lwm2m_list_index_clear( &inst->resindex );
     }
 
     /* setting */
@@ -478,15 +549,41 @@ int create_resource_object( lwm2m_object_t   *obj,
     if ( !exist )
     {
         obj->instanceList = LWM2M_LIST_ADD( obj->instanceList, inst );
+        lwm2m_list_index_clear( &obj->instanceIndex );
         obj->readFunc     = prv_resource_read;
         obj->writeFunc    = prv_resource_write;
         obj->executeFunc  = prv_resource_execute;
+        obj->blockFunc    = prv_resource_block;
         obj->discoverFunc = prv_resource_discover;
     }
 
     return NBIOT_ERR_OK;
 }
 
+int index_resource_object( lwm2m_object_t *obj )
+{
+    instance_t *inst;
+
+    if ( NULL == obj )
+    {
+        return NBIOT_ERR_BADPARAM;
+    }
+
+    /* instanceIndex is built by lwm2m_configure() */
+    inst = (instance_t*)obj->instanceList;
+    while ( NULL != inst )
+    {
+        if ( LWM2M_INDEX_BUILD(&inst->resindex,inst->reslist) )
+        {
+            return NBIOT_ERR_NO_MEMORY;
+        }
+
+        inst = inst->next;
+    }
+
+    return NBIOT_ERR_OK;
+}
+
 bool check_resource_object( lwm2m_object_t *obj,
                             uint16_t        instid,
                             uint16_t        resid )
@@ -499,13 +596,13 @@ bool check_resource_object( lwm2m_object_t *obj,
         return false;
     }
 
-    inst = (instance_t*)LWM2M_LIST_FIND( obj->instanceList, instid );
+    inst = (instance_t*)LWM2M_INDEX_FIND( &obj->instanceIndex, obj->instanceList, instid );
     if ( NULL == inst )
     {
         return false;
     }
 
-    res = (resource_t*)LWM2M_LIST_FIND( inst->reslist, resid );
+    res = (resource_t*)LWM2M_INDEX_FIND( &inst->resindex, inst->reslist, resid );
     if ( NULL == res )
     {
         return false;
@@ -524,10 +621,12 @@ void clear_resource_object( lwm2m_object_t *obj )
         return;
     }
 
+    lwm2m_list_index_clear( &obj->instanceIndex );
     while ( NULL != obj->instanceList )
     {
         inst = (instance_t*)obj->instanceList;
         obj->instanceList = obj->instanceList->next;
+        lwm2m_list_index_clear( &inst->resindex );
 
         while ( NULL != inst->reslist )
         {
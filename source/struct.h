@@ -12,19 +12,80 @@
 #include <dtls.h>
 #endif
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* 批量发送缓存大小 */
+#define NBIOT_SOCK_BATCH_BUF_SIZE (NBIOT_SOCK_BATCH_SIZE * 256)
+/* 批量发送队列未发完时的重试间隔（毫秒） */
+#define NBIOT_SOCK_RETRY_TIME     10
+
 /* 设备实例 */
 struct nbiot_device_t
 {
-    lwm2m_userdata_t  data;
+    lwm2m_userdata_t  data; /* 必须为首个成员 */
     nbiot_socket_t   *sock;
-    nbiot_sockaddr_t *addr;
+    nbiot_sockaddr_t *addr[NBIOT_SOCK_BATCH_SIZE]; /* 接收数据的源地址 */
     connection_t     *connlist;
     lwm2m_object_t   *objlist;
+    lwm2m_object_t   *fwobj;  /* 固件升级对象（属于objlist） */
 
     lwm2m_context_t   lwm2m;
 #ifdef HAVE_DTLS
     dtls_context_t    dtls;
 #endif
+
+    nbiot_device_t   *next; /* 实例池空闲链表 */
+
+#if NBIOT_SOCK_BATCH_SIZE > 1
+    /* 批量发送（nbiot_device_process期间缓存，结束时一次发出） */
+    bool              tx_batch;
+    size_t            tx_num;
+    size_t            tx_used;
+    uint8_t          *tx_buff;
+    nbiot_datagram_t  tx_msgs[NBIOT_SOCK_BATCH_SIZE];
+#endif
+
+    /* 事件循环 */
+    nbiot_loop_t     *loop;
+    size_t            loop_index;
+    clock_t           deadline;
 };
 
+/**
+ * 发送数据（批量发送期间先缓存）
+ * @param dev    指向nbiot_device_t的内存
+ *        addr   目标地址
+ *        buffer 指向将要被发送的数据
+ *        length 将要被发送的数据字节数
+ * @return 成功返回NBIOT_ERR_OK
+**/
+int nbiot_device_send( nbiot_device_t         *dev,
+                       const nbiot_sockaddr_t *addr,
+                       const uint8_t          *buffer,
+                       size_t                  length );
+
+/**
+ * 发出批量发送期间缓存的数据
+ * @param dev 指向nbiot_device_t的内存
+ * @return 成功返回NBIOT_ERR_OK
+**/
+int nbiot_device_flush( nbiot_device_t *dev );
+void nbiot_device_discard( nbiot_device_t         *dev,
+                           const nbiot_sockaddr_t *addr );
+
+/**
+ * 处理已接收的数据并驱动协议栈
+ * @param dev     指向nbiot_device_t的内存
+ *        timeout [IN/OUT] 最长等待时间，返回协议栈下一个定时时刻（毫秒）
+ * @return 成功返回NBIOT_ERR_OK
+**/
+int nbiot_device_process( nbiot_device_t *dev,
+                          clock_t        *timeout );
+
+#ifdef __cplusplus
+} /* extern "C" { */
+#endif
+
 #endif /* NBIOT_SOURCE_STRUCT_H_ */
@@ -0,0 +1,286 @@
+/**
+ * Copyright (c) 2017 China Mobile IOT.
+ * All rights reserved.
+**/
+
+#include <gtest/gtest.h>
+#include <internals.h>
+
+static const char block_text[] = "ABCDEFGHIJKLMNOPabcdefghijklmnopQRSTUVWXYZ012345qrstuvwxyz6789!@tail";
+
+TEST( block, block1_reassembly )
+{
+    nbiot_init_environment();
+    {
+        lwm2m_block1_data_t *block1 = NULL;
+        uint8_t payload[16 * 40];
+        uint8_t *output = NULL;
+        size_t output_len = 0;
+        size_t capacity = 0;
+        int grown = 0;
+
+        for ( size_t i = 0; i < sizeof(payload); ++i )
+        {
+            payload[i] = (uint8_t)i;
+        }
+
+        /* without Size1 the buffer doubles, each byte is copied a bounded number of times */
+        for ( uint32_t num = 0; num < 40; ++num )
+        {
+            bool more = num < 39;
+
+            EXPECT_EQ( more ? COAP_231_CONTINUE : NO_ERROR,
+                       coap_block1_handler(&block1,(uint16_t)(100 + num),payload + num * 16,16,16,num,more,0,&output,&output_len) );
+            ASSERT_TRUE( block1 != NULL );
+            EXPECT_EQ( (num + 1) * 16, block1->block1bufferSize );
+            EXPECT_GE( block1->block1bufferCapacity, block1->block1bufferSize );
+            if ( block1->block1bufferCapacity != capacity )
+            {
+                if ( capacity )
+                {
+                    EXPECT_EQ( capacity * 2, block1->block1bufferCapacity );
+                }
+                capacity = block1->block1bufferCapacity;
+                ++grown;
+            }
+
+            /* a retransmission is not appended twice */
+            if ( 20 == num )
+            {
+                EXPECT_EQ( COAP_231_CONTINUE,
+                           coap_block1_handler(&block1,(uint16_t)(100 + num),payload + num * 16,16,16,num,true,0,&output,&output_len) );
+                EXPECT_EQ( (num + 1) * 16, block1->block1bufferSize );
+            }
+        }
+        EXPECT_EQ( 7, grown ); /* 16 .. 1024 */
+        ASSERT_EQ( sizeof(payload), output_len );
+        EXPECT_EQ( block1->block1buffer, output );
+        EXPECT_EQ( 0, memcmp(payload,output,sizeof(payload)) );
+
+        /* a new transfer with Size1 allocates the whole payload once */
+        EXPECT_EQ( COAP_231_CONTINUE,
+                   coap_block1_handler(&block1,200,payload,16,16,0,true,320,&output,&output_len) );
+        EXPECT_EQ( 320u, block1->block1bufferCapacity );
+        for ( uint32_t num = 1; num < 20; ++num )
+        {
+            coap_block1_handler( &block1, (uint16_t)(200 + num), payload + num * 16, 16, 16, num, num < 19, 0, &output, &output_len );
+            EXPECT_EQ( 320u, block1->block1bufferCapacity );
+        }
+        EXPECT_EQ( 320u, output_len );
+        EXPECT_EQ( 0, memcmp(payload,output,320) );
+
+        /* blocks out of order */
+        EXPECT_EQ( COAP_231_CONTINUE,
+                   coap_block1_handler(&block1,300,payload,16,16,0,true,0,&output,&output_len) );
+        EXPECT_EQ( COAP_408_REQ_ENTITY_INCOMPLETE,
+                   coap_block1_handler(&block1,301,payload,16,16,2,true,0,&output,&output_len) );
+        free_block1_buffer( block1 );
+
+        /* later blocks without the first one */
+        block1 = NULL;
+        EXPECT_EQ( COAP_408_REQ_ENTITY_INCOMPLETE,
+                   coap_block1_handler(&block1,400,payload,16,16,1,true,0,&output,&output_len) );
+        EXPECT_TRUE( block1 == NULL );
+    }
+    nbiot_clear_environment();
+}
+
+TEST( block, block1_too_large )
+{
+    nbiot_init_environment();
+    {
+        lwm2m_block1_data_t *block1 = NULL;
+        uint8_t payload[1024];
+        uint8_t *output = NULL;
+        size_t output_len = 0;
+
+        memset( payload, 'x', sizeof(payload) );
+
+        /* Size1 above the limit is refused before anything is allocated */
+        EXPECT_EQ( COAP_413_ENTITY_TOO_LARGE,
+                   coap_block1_handler(&block1,1,payload,16,16,0,true,NBIOT_BLOCK1_MAX_SIZE + 1,&output,&output_len) );
+        EXPECT_TRUE( block1 == NULL );
+
+        /* exactly the limit is fine */
+        EXPECT_EQ( COAP_231_CONTINUE,
+                   coap_block1_handler(&block1,2,payload,16,16,0,true,NBIOT_BLOCK1_MAX_SIZE,&output,&output_len) );
+        ASSERT_TRUE( block1 != NULL );
+        EXPECT_EQ( (size_t)NBIOT_BLOCK1_MAX_SIZE, block1->block1bufferCapacity );
+
+        /* without Size1 the block crossing the limit is refused */
+        uint32_t num;
+        uint16_t mid = 10;
+        int result = COAP_231_CONTINUE;
+        for ( num = 0; COAP_231_CONTINUE == result; ++num )
+        {
+            result = coap_block1_handler( &block1, mid++, payload, sizeof(payload), sizeof(payload), num, true, 0, &output, &output_len );
+            EXPECT_LE( block1->block1bufferCapacity, (size_t)NBIOT_BLOCK1_MAX_SIZE );
+        }
+        EXPECT_EQ( COAP_413_ENTITY_TOO_LARGE, result );
+        EXPECT_EQ( (uint32_t)(NBIOT_BLOCK1_MAX_SIZE / sizeof(payload) + 1), num );
+        EXPECT_EQ( (size_t)NBIOT_BLOCK1_MAX_SIZE, block1->block1bufferSize );
+
+        free_block1_buffer( block1 );
+    }
+    nbiot_clear_environment();
+}
+
+static struct
+{
+    uint8_t  result;
+    int      calls;
+    bool     execute;
+    bool     more;
+    uint16_t resid;
+    size_t   length;
+    uint8_t  buffer[128];
+} block_sink;
+
+static uint8_t block_callback( uint16_t        instid,
+                               uint16_t        resid,
+                               bool            execute,
+                               uint32_t        offset,
+                               uint8_t        *buffer,
+                               int             length,
+                               bool            more,
+                               lwm2m_object_t * )
+{
+    EXPECT_EQ( 0, instid );
+    EXPECT_EQ( block_sink.length, offset );
+    if ( COAP_204_CHANGED != block_sink.result )
+    {
+        return block_sink.result;
+    }
+
+    memcpy( block_sink.buffer + offset, buffer, length );
+    block_sink.length = offset + length;
+    block_sink.resid = resid;
+    block_sink.execute = execute;
+    block_sink.more = more;
+    block_sink.calls++;
+
+    return COAP_204_CHANGED;
+}
+
+/* a block1 request as it arrives, parsed in place */
+static void block_message( coap_packet_t *packet,
+                           uint8_t       *buffer,
+                           uint8_t        code,
+                           uint16_t       mid,
+                           const char    *path,
+                           unsigned int   format,
+                           uint32_t       num,
+                           bool           more )
+{
+    coap_packet_t message;
+    size_t offset = num * 16;
+    size_t length = sizeof(block_text) - 1 - offset;
+    size_t len;
+
+    if ( length > 16 )
+    {
+        length = 16;
+    }
+
+    coap_init_message( &message, COAP_TYPE_CON, code, mid );
+    coap_set_header_uri_path( &message, path );
+    coap_set_header_content_type( &message, format );
+    coap_set_header_block1( &message, num, more, 16 );
+    coap_set_payload( &message, block_text + offset, length );
+    len = coap_serialize_message( &message, buffer, COAP_MAX_PACKET_SIZE );
+    ASSERT_EQ( NO_ERROR, coap_parse_message(packet,buffer,(uint16_t)len) );
+}
+
+TEST( block, block1_stream )
+{
+    nbiot_init_environment();
+    {
+        lwm2m_context_t *context;
+        lwm2m_object_t object;
+        lwm2m_block1_data_t *block1 = NULL;
+        coap_packet_t packet;
+        uint8_t buffer[COAP_MAX_PACKET_SIZE];
+        uint32_t num;
+
+        context = (lwm2m_context_t*)nbiot_malloc( sizeof(lwm2m_context_t) );
+        ASSERT_TRUE( context != NULL );
+        lwm2m_init( context, NULL );
+        memset( &object, 0, sizeof(object) );
+        object.objID = 3200;
+        object.blockFunc = block_callback;
+        context->objectList = &object;
+        memset( &block_sink, 0, sizeof(block_sink) );
+        block_sink.result = COAP_204_CHANGED;
+
+        /* blocks are handed over in order as they arrive, nothing is buffered */
+        for ( num = 0; num * 16 < sizeof(block_text) - 1; ++num )
+        {
+            bool more = (num + 1) * 16 < sizeof(block_text) - 1;
+
+            block_message( &packet, buffer, COAP_PUT, (uint16_t)(10 + num), "/3200/0/5750", LWM2M_CONTENT_TEXT, num, more );
+            EXPECT_EQ( more ? COAP_231_CONTINUE : COAP_204_CHANGED,
+                       coap_block1_stream(context,&block1,&packet,16,num,more) );
+            ASSERT_TRUE( block1 != NULL );
+            EXPECT_TRUE( block1->streaming );
+            EXPECT_TRUE( block1->block1buffer == NULL );
+            EXPECT_EQ( (int)num + 1, block_sink.calls );
+            EXPECT_EQ( more, block_sink.more );
+
+            /* a retransmission gets the same answer without a second delivery */
+            if ( 1 == num )
+            {
+                EXPECT_EQ( COAP_231_CONTINUE, coap_block1_stream(context,&block1,&packet,16,num,more) );
+                EXPECT_EQ( 2, block_sink.calls );
+            }
+            coap_free_header( &packet );
+        }
+        EXPECT_EQ( sizeof(block_text) - 1, block_sink.length );
+        EXPECT_EQ( 0, memcmp(block_text,block_sink.buffer,block_sink.length) );
+        EXPECT_EQ( 5750, block_sink.resid );
+        EXPECT_FALSE( block_sink.execute );
+
+        /* a block out of order is incomplete */
+        memset( &block_sink, 0, sizeof(block_sink) );
+        block_sink.result = COAP_204_CHANGED;
+        block_message( &packet, buffer, COAP_POST, 30, "/3200/0/5523", LWM2M_CONTENT_TEXT, 0, true );
+        EXPECT_EQ( COAP_231_CONTINUE, coap_block1_stream(context,&block1,&packet,16,0,true) );
+        EXPECT_TRUE( block_sink.execute );
+        block_message( &packet, buffer, COAP_POST, 31, "/3200/0/5523", LWM2M_CONTENT_TEXT, 2, true );
+        EXPECT_EQ( COAP_408_REQ_ENTITY_INCOMPLETE, coap_block1_stream(context,&block1,&packet,16,2,true) );
+        EXPECT_EQ( 1, block_sink.calls );
+
+        /* another resource in the middle of a transfer is incomplete too */
+        block_message( &packet, buffer, COAP_POST, 32, "/3200/0/5524", LWM2M_CONTENT_TEXT, 1, true );
+        EXPECT_EQ( COAP_408_REQ_ENTITY_INCOMPLETE, coap_block1_stream(context,&block1,&packet,16,1,true) );
+
+        /* structured content and whole instances are reassembled */
+        block_message( &packet, buffer, COAP_PUT, 40, "/3200/0/5750", LWM2M_CONTENT_TLV, 0, true );
+        EXPECT_EQ( COAP_IGNORE, coap_block1_stream(context,&block1,&packet,16,0,true) );
+        block_message( &packet, buffer, COAP_PUT, 41, "/3200/0", LWM2M_CONTENT_TEXT, 0, true );
+        EXPECT_EQ( COAP_IGNORE, coap_block1_stream(context,&block1,&packet,16,0,true) );
+
+        /* the object declines, the transfer falls back to reassembly */
+        block_sink.result = COAP_IGNORE;
+        block_sink.length = 0;
+        block_message( &packet, buffer, COAP_PUT, 42, "/3200/0/5750", LWM2M_CONTENT_TEXT, 0, true );
+        EXPECT_EQ( COAP_IGNORE, coap_block1_stream(context,&block1,&packet,16,0,true) );
+        ASSERT_TRUE( block1 != NULL );
+        EXPECT_FALSE( block1->streaming );
+
+        /* the object gives up, later blocks are not delivered */
+        block_sink.result = COAP_204_CHANGED;
+        block_message( &packet, buffer, COAP_PUT, 43, "/3200/0/5750", LWM2M_CONTENT_OPAQUE, 0, true );
+        EXPECT_EQ( COAP_231_CONTINUE, coap_block1_stream(context,&block1,&packet,16,0,true) );
+        block_sink.result = COAP_500_INTERNAL_SERVER_ERROR;
+        block_message( &packet, buffer, COAP_PUT, 44, "/3200/0/5750", LWM2M_CONTENT_OPAQUE, 1, true );
+        EXPECT_EQ( COAP_500_INTERNAL_SERVER_ERROR, coap_block1_stream(context,&block1,&packet,16,1,true) );
+        EXPECT_TRUE( block1 == NULL );
+        block_message( &packet, buffer, COAP_PUT, 45, "/3200/0/5750", LWM2M_CONTENT_OPAQUE, 2, true );
+        EXPECT_EQ( COAP_IGNORE, coap_block1_stream(context,&block1,&packet,16,2,true) );
+
+        free_block1_buffer( block1 );
+        lwm2m_close( context );
+        nbiot_free( context );
+    }
+    nbiot_clear_environment();
+}
@@ -0,0 +1,257 @@
+/**
+ * Copyright (c) 2017 China Mobile IOT.
+ * All rights reserved.
+**/
+
+#include <gtest/gtest.h>
+#include <coap.h>
+#include <stdio.h>
+
+/* GET /3200/0/5750, Accept: application/vnd.oma.lwm2m+tlv */
+static uint8_t coap_read[] =
+{
+    0x44, 0x01, 0x12, 0x34, 0x01, 0x02, 0x03, 0x04,
+    0xB4, '3', '2', '0', '0', 0x01, '0', 0x04, '5', '7', '5', '0',
+    0x62, 0x2D, 0x16
+};
+
+/* GET /3200/0/5750 with Observe: 0 */
+static uint8_t coap_observe[] =
+{
+    0x44, 0x01, 0x12, 0x35, 0x01, 0x02, 0x03, 0x05,
+    0x60, 0x54, '3', '2', '0', '0', 0x01, '0', 0x04, '5', '7', '5', '0'
+};
+
+/* PUT /3200/0/5750?pmin=10&pmax=60 (write attributes) */
+static uint8_t coap_attributes[] =
+{
+    0x44, 0x03, 0x12, 0x36, 0x01, 0x02, 0x03, 0x06,
+    0xB4, '3', '2', '0', '0', 0x01, '0', 0x04, '5', '7', '5', '0',
+    0x47, 'p', 'm', 'i', 'n', '=', '1', '0', 0x07, 'p', 'm', 'a', 'x', '=', '6', '0'
+};
+
+/* PUT /ap/3200/0/5750?pmin=1&pmax=2&gt=3&lt=4&stp=5 (every attribute under an alternate path) */
+static uint8_t coap_attributes_all[] =
+{
+    0x40, 0x03, 0x12, 0x39,
+    0xB2, 'a', 'p', 0x04, '3', '2', '0', '0', 0x01, '0', 0x04, '5', '7', '5', '0',
+    0x46, 'p', 'm', 'i', 'n', '=', '1', 0x06, 'p', 'm', 'a', 'x', '=', '2',
+    0x04, 'g', 't', '=', '3', 0x04, 'l', 't', '=', '4', 0x05, 's', 't', 'p', '=', '5'
+};
+
+/* PUT /3200/0/5750, Content-Format: 42, Block1: 0/1/16 */
+static uint8_t coap_block[] =
+{
+    0x44, 0x03, 0x12, 0x37, 0x01, 0x02, 0x03, 0x07,
+    0xB4, '3', '2', '0', '0', 0x01, '0', 0x04, '5', '7', '5', '0',
+    0x11, 0x2A, 0xD1, 0x02, 0x08, 0xFF,
+    '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f'
+};
+
+/* 2.01 Created, Location-Path: /rd/5a3f (registration response) */
+static uint8_t coap_created[] =
+{
+    0x64, 0x41, 0x12, 0x38, 0x01, 0x02, 0x03, 0x08,
+    0x82, 'r', 'd', 0x04, '5', 'a', '3', 'f'
+};
+
+TEST( coap, parse )
+{
+    nbiot_init_environment();
+    {
+        coap_packet_t packet;
+        multi_option_t *opt;
+        uint32_t num;
+        uint8_t more;
+        uint16_t size;
+        uint8_t tiny[] = { 0x40, 0x01 };
+        uint8_t truncated[] = { 0x40, 0x01, 0x00, 0x01, 0xB4, '3', '2' };
+        uint8_t critical[] = { 0x40, 0x01, 0x00, 0x01, 0xD0, 0x10 };
+        uint8_t deep[] = { 0x40, 0x01, 0x00, 0x01, 0xB0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+        int count;
+
+        EXPECT_EQ( NO_ERROR, coap_parse_message(&packet,coap_read,sizeof(coap_read)) );
+        EXPECT_EQ( COAP_TYPE_CON, packet.type );
+        EXPECT_EQ( COAP_GET, packet.code );
+        EXPECT_EQ( 0x1234, packet.mid );
+        EXPECT_EQ( 4, packet.token_len );
+        EXPECT_EQ( 1, packet.accept_num );
+        EXPECT_EQ( 11542, packet.accept[0] );
+        EXPECT_EQ( (multi_option_t*)NULL, packet.uri_query );
+
+        /* the segments point into the datagram */
+        opt = packet.uri_path;
+        ASSERT_NE( (multi_option_t*)NULL, opt );
+        EXPECT_EQ( coap_read + 9, opt->data );
+        EXPECT_EQ( 4, opt->len );
+        opt = opt->next;
+        ASSERT_NE( (multi_option_t*)NULL, opt );
+        EXPECT_EQ( 0, memcmp(opt->data,"0",opt->len) );
+        opt = opt->next;
+        ASSERT_NE( (multi_option_t*)NULL, opt );
+        EXPECT_EQ( 0, memcmp(opt->data,"5750",opt->len) );
+        EXPECT_EQ( (multi_option_t*)NULL, opt->next );
+        coap_free_header( &packet );
+
+        EXPECT_EQ( NO_ERROR, coap_parse_message(&packet,coap_observe,sizeof(coap_observe)) );
+        EXPECT_TRUE( IS_OPTION(&packet,COAP_OPTION_OBSERVE) );
+        EXPECT_EQ( 0u, packet.observe );
+        EXPECT_EQ( 0, packet.accept_num );
+        ASSERT_NE( (multi_option_t*)NULL, packet.uri_path );
+        EXPECT_EQ( coap_observe + 10, packet.uri_path->data );
+        coap_free_header( &packet );
+
+        EXPECT_EQ( NO_ERROR, coap_parse_message(&packet,coap_attributes,sizeof(coap_attributes)) );
+        ASSERT_NE( (multi_option_t*)NULL, packet.uri_query );
+        EXPECT_EQ( 0, memcmp(packet.uri_query->data,"pmin=10",7) );
+        ASSERT_NE( (multi_option_t*)NULL, packet.uri_query->next );
+        EXPECT_EQ( 0, memcmp(packet.uri_query->next->data,"pmax=60",7) );
+        EXPECT_EQ( 0, coap_get_header_block1(&packet,NULL,NULL,NULL,NULL) );
+        coap_free_header( &packet );
+
+        /* fields of the previous packet do not leak into the next one */
+        EXPECT_EQ( NO_ERROR, coap_parse_message(&packet,coap_block,sizeof(coap_block)) );
+        EXPECT_EQ( 42, packet.content_type );
+        EXPECT_EQ( 0, packet.accept_num );
+        EXPECT_EQ( (multi_option_t*)NULL, packet.uri_query );
+        EXPECT_EQ( 1, coap_get_header_block1(&packet,&num,&more,&size,NULL) );
+        EXPECT_EQ( 0u, num );
+        EXPECT_EQ( 1, more );
+        EXPECT_EQ( 16, size );
+        EXPECT_EQ( 16, packet.payload_len );
+        EXPECT_EQ( coap_block + sizeof(coap_block) - 16, packet.payload );
+        coap_free_header( &packet );
+
+        EXPECT_EQ( NO_ERROR, coap_parse_message(&packet,coap_created,sizeof(coap_created)) );
+        EXPECT_EQ( COAP_TYPE_ACK, packet.type );
+        EXPECT_EQ( (multi_option_t*)NULL, packet.uri_path );
+        ASSERT_NE( (multi_option_t*)NULL, packet.location_path );
+        char *location = coap_get_multi_option_as_string( packet.location_path );
+        EXPECT_STREQ( "/rd/5a3f", location );
+        nbiot_free( location );
+        coap_free_header( &packet );
+
+        EXPECT_EQ( BAD_REQUEST_4_00, coap_parse_message(&packet,tiny,sizeof(tiny)) );
+        EXPECT_EQ( BAD_REQUEST_4_00, coap_parse_message(&packet,truncated,sizeof(truncated)) );
+        EXPECT_EQ( BAD_OPTION_4_02, coap_parse_message(&packet,critical,sizeof(critical)) );
+        /* a Write-Attributes with the deepest path and every attribute fits the views */
+        EXPECT_EQ( NO_ERROR, coap_parse_message(&packet,coap_attributes_all,sizeof(coap_attributes_all)) );
+        for ( count = 0, opt = packet.uri_path; opt != NULL; opt = opt->next ) ++count;
+        EXPECT_EQ( COAP_MAX_URI_PATH_NUM, count );
+        for ( count = 0, opt = packet.uri_query; opt != NULL; opt = opt->next ) ++count;
+        EXPECT_EQ( COAP_MAX_URI_QUERY_NUM, count );
+        ASSERT_NE( (multi_option_t*)NULL, opt = packet.uri_query->next->next->next->next );
+        EXPECT_EQ( 0, memcmp("stp=5",opt->data,opt->len) );
+        coap_free_header( &packet );
+
+        /* one segment more is a bad request, not an unsupported option */
+        EXPECT_EQ( BAD_REQUEST_4_00, coap_parse_message(&packet,deep,sizeof(deep)) );
+        EXPECT_STREQ( "Too many options", packet.error_message );
+    }
+    nbiot_clear_environment();
+}
+
+TEST( coap, serialize )
+{
+    nbiot_init_environment();
+    {
+        coap_packet_t message;
+        coap_packet_t packet;
+        coap_option_template_t tmpl;
+        uint8_t token[] = { 0x01, 0x02, 0x03, 0x04 };
+        uint8_t buffer[COAP_MAX_PACKET_SIZE];
+        uint8_t expected[COAP_MAX_PACKET_SIZE];
+        size_t expected_len;
+        size_t len;
+
+        /* oversized packets only report their length */
+        coap_init_message( &message, COAP_TYPE_CON, COAP_GET, 0x1234 );
+        coap_set_header_token( &message, token, sizeof(token) );
+        coap_set_header_uri_path( &message, "/3200/0/5750" );
+        coap_set_header_uri_query( &message, "?pmin=10&pmax=60" );
+        EXPECT_EQ( sizeof(coap_attributes), coap_serialize_message(&message,buffer,sizeof(coap_attributes) - 1) );
+        EXPECT_EQ( sizeof(coap_attributes), coap_serialize_message(&message,NULL,0) );
+        ASSERT_NE( (multi_option_t*)NULL, message.uri_path );
+        message.code = COAP_PUT;
+        message.mid = 0x1236;
+        memcpy( token, "\x01\x02\x03\x06", 4 );
+        coap_set_header_token( &message, token, sizeof(token) );
+        EXPECT_EQ( sizeof(coap_attributes), coap_serialize_message(&message,buffer,sizeof(coap_attributes)) );
+        EXPECT_EQ( 0, memcmp(buffer,coap_attributes,sizeof(coap_attributes)) );
+        EXPECT_EQ( (multi_option_t*)NULL, message.uri_path );
+
+        coap_init_message( &message, COAP_TYPE_CON, COAP_PUT, 0x1237 );
+        memcpy( token, "\x01\x02\x03\x07", 4 );
+        coap_set_header_token( &message, token, sizeof(token) );
+        coap_set_header_uri_path( &message, "/3200/0/5750" );
+        coap_set_header_content_type( &message, APPLICATION_OCTET_STREAM );
+        coap_set_header_block1( &message, 0, 1, 16 );
+        coap_set_payload( &message, "0123456789abcdef", 16 );
+        EXPECT_EQ( sizeof(coap_block), coap_serialize_message(&message,buffer,sizeof(buffer)) );
+        EXPECT_EQ( 0, memcmp(buffer,coap_block,sizeof(coap_block)) );
+
+        /* a notification through the template matches the plain encoding */
+        coap_init_message( &message, COAP_TYPE_NON, CONTENT_2_05, 0x4321 );
+        coap_set_header_content_type( &message, 11543 );
+        coap_set_header_block2( &message, 2, 0, 64 );
+        coap_set_payload( &message, "{\"bn\":\"/3200/0/\"}", 17 );
+        coap_set_header_token( &message, token, sizeof(token) );
+        coap_set_header_observe( &message, 0x10203 );
+        expected_len = coap_serialize_message( &message, expected, sizeof(expected) );
+        ASSERT_GT( expected_len, (size_t)0 );
+        ASSERT_LE( expected_len, sizeof(expected) );
+
+        EXPECT_EQ( 1, coap_set_option_template(&message,&tmpl,COAP_OPTION_OBSERVE) );
+        EXPECT_EQ( &tmpl, message.option_template );
+        EXPECT_EQ( 5, tmpl.length );
+        len = coap_serialize_message( &message, buffer, sizeof(buffer) );
+        EXPECT_EQ( expected_len, len );
+        EXPECT_EQ( 0, memcmp(buffer,expected,len) );
+
+        message.mid = 0x4322;
+        coap_set_header_token( &message, token, 2 );
+        coap_set_header_observe( &message, 7 );
+        len = coap_serialize_message( &message, buffer, sizeof(buffer) );
+        EXPECT_EQ( expected_len - 4, len );
+        ASSERT_EQ( NO_ERROR, coap_parse_message(&packet,buffer,(uint16_t)len) );
+        EXPECT_EQ( 0x4322, packet.mid );
+        EXPECT_EQ( 2, packet.token_len );
+        EXPECT_EQ( 7u, packet.observe );
+        EXPECT_EQ( 11543, packet.content_type );
+        EXPECT_EQ( 1, coap_get_header_block2(&packet,NULL,NULL,NULL,NULL) );
+        EXPECT_EQ( 2u, packet.block2_num );
+        EXPECT_EQ( 64, packet.block2_size );
+        EXPECT_EQ( 17, packet.payload_len );
+        coap_free_header( &packet );
+
+        /* without the anchor option the template cannot be spliced in */
+        message.options[COAP_OPTION_OBSERVE / OPTION_MAP_SIZE] &= ~(1 << (COAP_OPTION_OBSERVE % OPTION_MAP_SIZE));
+        len = coap_serialize_message( &message, buffer, sizeof(buffer) );
+        ASSERT_EQ( NO_ERROR, coap_parse_message(&packet,buffer,(uint16_t)len) );
+        EXPECT_EQ( 0, IS_OPTION(&packet,COAP_OPTION_OBSERVE) );
+        EXPECT_EQ( 11543, packet.content_type );
+        EXPECT_EQ( 2u, packet.block2_num );
+        coap_free_header( &packet );
+
+        /* ETags are opaque and keep all of their bytes */
+        coap_init_message( &message, COAP_TYPE_ACK, CONTENT_2_05, 0x1234 );
+        coap_set_header_etag( &message, (const uint8_t*)"\x00\x11\x22\x33\x44\x55\x66\x77", 8 );
+        len = coap_serialize_message( &message, buffer, sizeof(buffer) );
+        ASSERT_EQ( NO_ERROR, coap_parse_message(&packet,buffer,(uint16_t)len) );
+        {
+            const uint8_t *etag = NULL;
+
+            ASSERT_EQ( 8, coap_get_header_etag(&packet,&etag) );
+            EXPECT_EQ( 0, memcmp("\x00\x11\x22\x33\x44\x55\x66\x77",etag,8) );
+        }
+        coap_free_header( &packet );
+
+        /* templates are bounded */
+        coap_init_message( &message, COAP_TYPE_CON, COAP_GET, 0 );
+        coap_set_header_uri_query( &message, "?ep=868613030001234" );
+        EXPECT_EQ( 0, coap_set_option_template(&message,&tmpl,COAP_OPTION_OBSERVE) );
+        EXPECT_EQ( (const coap_option_template_t*)NULL, message.option_template );
+        coap_free_header( &message );
+    }
+    nbiot_clear_environment();
+}
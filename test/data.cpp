@@ -0,0 +1,121 @@
+/**
+ * Copyright (c) 2017 China Mobile IOT.
+ * All rights reserved.
+**/
+
+#include <gtest/gtest.h>
+#include <internals.h>
+#include <stdio.h>
+
+static bool data_in_arena( lwm2m_context_t *context, const void *pointer )
+{
+    const uint8_t *p = (const uint8_t*)pointer;
+
+    return p >= context->dataArena.buffer &&
+           p < context->dataArena.buffer + LWM2M_DATA_ARENA_SIZE;
+}
+
+static lwm2m_context_t *data_context( void )
+{
+    lwm2m_context_t *context;
+
+    context = (lwm2m_context_t*)nbiot_malloc( sizeof(lwm2m_context_t) );
+    if ( NULL != context )
+    {
+        nbiot_memzero( context, sizeof(lwm2m_context_t) );
+    }
+
+    return context;
+}
+
+/* what resource.c builds for an instance read */
+static lwm2m_data_t *data_instance( lwm2m_arena_t *arena, const char *text )
+{
+    lwm2m_data_t *res = lwm2m_data_new_arena( arena, 5 );
+
+    res[0].id = 5500;
+    lwm2m_data_encode_bool( true, res + 0 );
+    res[1].id = 5501;
+    lwm2m_data_encode_int( 100000, res + 1 );
+    res[2].id = 5700;
+    lwm2m_data_encode_float( 21.5, res + 2 );
+    res[3].id = 5750;
+    lwm2m_data_encode_view( LWM2M_TYPE_STRING, (uint8_t*)text, strlen(text), res + 3 );
+    res[4].id = 5751;
+    lwm2m_data_encode_string( text, res + 4 );
+
+    return res;
+}
+
+TEST( data, arena )
+{
+    nbiot_init_environment();
+    {
+        lwm2m_context_t *context;
+        lwm2m_context_t *other;
+        lwm2m_data_t *dataP;
+        lwm2m_data_t *otherP;
+
+        context = data_context();
+        other = data_context();
+        ASSERT_TRUE( context != NULL && other != NULL );
+
+        /* outside of a read everything is on the heap */
+        dataP = data_instance( &context->dataArena, "hello" );
+        EXPECT_TRUE( context->dataArena.buffer == NULL );
+        EXPECT_EQ( 0, dataP[0].flag & LWM2M_DATA_FLAG_ARENA );
+        lwm2m_data_free( 5, dataP );
+
+        data_arenaBegin( context );
+        ASSERT_TRUE( context->dataArena.buffer != NULL );
+        dataP = data_instance( &context->dataArena, "hello" );
+        EXPECT_TRUE( data_in_arena(context,dataP) );
+        EXPECT_EQ( LWM2M_DATA_FLAG_ARENA, dataP[4].flag );
+        EXPECT_EQ( LWM2M_DATA_FLAG_ARENA | LWM2M_DATA_FLAG_BORROWED, dataP[3].flag );
+        EXPECT_EQ( 0, memcmp("hello",dataP[4].value.asBuffer.buffer,5) );
+        EXPECT_EQ( 0, (int)((size_t)dataP & 7) );
+
+        /* a second context reading at the same time keeps its own arena */
+        data_arenaBegin( other );
+        otherP = lwm2m_data_new_arena( &other->dataArena, 2 );
+        EXPECT_TRUE( data_in_arena(other,otherP) );
+        EXPECT_FALSE( data_in_arena(context,otherP) );
+        lwm2m_data_free( 5, dataP );
+        data_arenaEnd( other );
+        EXPECT_EQ( (size_t)0, other->dataArena.used );
+        EXPECT_NE( (size_t)0, context->dataArena.used );
+        lwm2m_data_free( 2, otherP );
+
+        /* nested reads share the arena */
+        data_arenaBegin( context );
+        dataP = lwm2m_data_new_arena( &context->dataArena, 1 );
+        EXPECT_TRUE( data_in_arena(context,dataP) );
+        lwm2m_data_free( 1, dataP );
+        data_arenaEnd( context );
+        EXPECT_NE( (size_t)0, context->dataArena.used );
+
+        /* an array too large for what is left goes to the heap */
+        dataP = lwm2m_data_new_arena( &context->dataArena, LWM2M_DATA_ARENA_SIZE / sizeof(lwm2m_data_t) );
+        ASSERT_TRUE( dataP != NULL );
+        EXPECT_FALSE( data_in_arena(context,dataP) );
+        EXPECT_EQ( 0, dataP[0].flag );
+        lwm2m_data_free( LWM2M_DATA_ARENA_SIZE / sizeof(lwm2m_data_t), dataP );
+
+        data_arenaEnd( context );
+        EXPECT_EQ( (size_t)0, context->dataArena.used );
+        EXPECT_EQ( 0, context->dataArena.depth );
+
+        /* unbalanced end is ignored */
+        data_arenaEnd( context );
+        dataP = lwm2m_data_new_arena( &context->dataArena, 1 );
+        EXPECT_FALSE( data_in_arena(context,dataP) );
+        lwm2m_data_free( 1, dataP );
+
+        data_arenaClose( context );
+        EXPECT_TRUE( context->dataArena.buffer == NULL );
+        data_arenaClose( other );
+        nbiot_free( context );
+        nbiot_free( other );
+    }
+    nbiot_clear_environment();
+}
@@ -0,0 +1,1078 @@
+/**
+ * Copyright (c) 2017 China Mobile IOT.
+ * All rights reserved.
+**/
+
+#include <gtest/gtest.h>
+#include <nbiot.h>
+#include <internals.h>
+#include "../source/struct.h"
+#include <limits.h>
+#include <thread>
+#include <vector>
+
+/* a loopback LwM2M server driven from the test thread */
+typedef struct
+{
+    nbiot_socket_t   *sock;
+    nbiot_sockaddr_t *peer;
+    uint16_t          mid;
+    coap_packet_t     packet;
+    uint8_t           buff[COAP_MAX_PACKET_SIZE];
+} server_t;
+
+static void server_open( server_t *srv,
+                         uint16_t  port )
+{
+    memset( srv, 0, sizeof(server_t) );
+    srv->mid = 0x4000;
+    ASSERT_EQ( NBIOT_ERR_OK, nbiot_udp_create(&srv->sock) );
+    ASSERT_EQ( NBIOT_ERR_OK, nbiot_udp_bind(srv->sock,"127.0.0.1",port) );
+}
+
+static void server_close( server_t *srv )
+{
+    nbiot_udp_close( srv->sock );
+    nbiot_sockaddr_destroy( srv->peer );
+}
+
+/* steps the device until a datagram reaches the server, then parses it into srv->packet */
+static bool server_recv( server_t       *srv,
+                         nbiot_device_t *dev,
+                         int             timeout )
+{
+    size_t read;
+    time_t end = nbiot_time() + (timeout + 999) / 1000;
+
+    do
+    {
+        if ( NULL != dev )
+        {
+            nbiot_device_step( dev, 0 );
+        }
+
+        read = 0;
+        nbiot_udp_recv( srv->sock, srv->buff, sizeof(srv->buff), &read, &srv->peer );
+        if ( read > 0 )
+        {
+            return NO_ERROR == coap_parse_message( &srv->packet, srv->buff, (uint16_t)read );
+        }
+
+        nbiot_udp_wait( srv->sock, 10 );
+    } while ( nbiot_time() <= end );
+
+    return false;
+}
+
+static void server_send( server_t      *srv,
+                         coap_packet_t *message )
+{
+    uint8_t buffer[COAP_MAX_PACKET_SIZE];
+    size_t sent;
+    size_t len;
+
+    len = coap_serialize_message( message, buffer, sizeof(buffer) );
+    ASSERT_GE( sizeof(buffer), len );
+    nbiot_udp_send( srv->sock, buffer, len, &sent, srv->peer );
+}
+
+/* piggybacked answer to the last request received */
+static void server_ack( server_t *srv,
+                        uint8_t   code )
+{
+    coap_packet_t ack;
+
+    coap_init_message( &ack, COAP_TYPE_ACK, code, srv->packet.mid );
+    coap_set_header_token( &ack, srv->packet.token, srv->packet.token_len );
+    if ( COAP_201_CREATED == code )
+    {
+        coap_set_header_location_path( &ack, "/rd/5a3f" );
+    }
+    server_send( srv, &ack );
+}
+
+/* waits for the registration of dev and accepts it */
+static bool server_register( server_t       *srv,
+                             nbiot_device_t *dev )
+{
+    if ( !server_recv(srv,dev,3000) ||
+         COAP_POST != srv->packet.code )
+    {
+        return false;
+    }
+
+    server_ack( srv, COAP_201_CREATED );
+    nbiot_device_step( dev, 0 );
+
+    return nbiot_device_ready( dev );
+}
+
+/* sends a confirmable request (path, block1 option and payload set by the caller) and returns the answer code */
+static uint8_t server_request( server_t       *srv,
+                               nbiot_device_t *dev,
+                               coap_packet_t  *request )
+{
+    uint8_t token[] = { 0x54, 0x45, 0x53, 0x54 };
+
+    request->type = COAP_TYPE_CON;
+    request->mid = ++srv->mid;
+    coap_set_header_token( request, token, sizeof(token) );
+    server_send( srv, request );
+    while ( server_recv(srv,dev,3000) )
+    {
+        if ( COAP_TYPE_ACK == srv->packet.type &&
+             request->mid == srv->packet.mid )
+        {
+            return srv->packet.code;
+        }
+    }
+
+    return 0;
+}
+
+TEST( device, pool )
+{
+    nbiot_init_environment();
+    {
+        nbiot_device_t *dev[4] = { NULL };
+        nbiot_device_t *tmp = NULL;
+
+        EXPECT_EQ( NBIOT_ERR_BADPARAM, nbiot_device_pool_init(0) );
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_device_pool_init(4) );
+
+        for ( int i = 0; i < 4; ++i )
+        {
+            EXPECT_EQ( NBIOT_ERR_OK, nbiot_device_create(&dev[i],0) );
+            EXPECT_NE( (nbiot_device_t*)NULL, dev[i] );
+            for ( int j = 0; j < i; ++j )
+            {
+                EXPECT_NE( dev[j], dev[i] );
+            }
+        }
+
+        /* exhausted */
+        EXPECT_EQ( NBIOT_ERR_NO_MEMORY, nbiot_device_create(&tmp,0) );
+        EXPECT_EQ( NBIOT_ERR_INTERNAL, nbiot_device_pool_init(8) );
+
+        /* destroy releases the slot */
+        nbiot_device_destroy( dev[1] );
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_device_create(&tmp,0) );
+        EXPECT_EQ( dev[1], tmp );
+        dev[1] = tmp;
+
+        for ( int i = 0; i < 4; ++i )
+        {
+            nbiot_device_destroy( dev[i] );
+        }
+        nbiot_device_pool_clear();
+
+        /* default pool */
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_device_create(&tmp,0) );
+        nbiot_device_destroy( tmp );
+    }
+    nbiot_clear_environment();
+}
+
+TEST( device, pool_threads )
+{
+    nbiot_init_environment();
+    {
+        std::vector<std::thread> threads;
+        int failures[4] = { 0 };
+
+        /* one slot per thread, taken and given back concurrently */
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_device_pool_init(4) );
+        for ( int t = 0; t < 4; ++t )
+        {
+            threads.push_back( std::thread([t,&failures]()
+            {
+                for ( int i = 0; i < 200; ++i )
+                {
+                    nbiot_device_t *dev = NULL;
+
+                    if ( NBIOT_ERR_OK != nbiot_device_create(&dev,0) )
+                    {
+                        ++failures[t];
+                        continue;
+                    }
+                    nbiot_device_destroy( dev );
+                }
+            }) );
+        }
+        for ( size_t t = 0; t < threads.size(); ++t )
+        {
+            threads[t].join();
+            EXPECT_EQ( 0, failures[t] );
+        }
+        nbiot_device_pool_clear();
+    }
+    nbiot_clear_environment();
+}
+
+static int loop_errors = 0;
+static void loop_callback( nbiot_device_t *, int error )
+{
+    EXPECT_NE( NBIOT_ERR_OK, error );
+    ++loop_errors;
+}
+
+TEST( device, loop )
+{
+    nbiot_init_environment();
+    {
+        nbiot_loop_t *loop = NULL;
+        nbiot_device_t *dev[3] = { NULL };
+
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_device_pool_init(3) );
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_loop_create(&loop,loop_callback) );
+        for ( int i = 0; i < 3; ++i )
+        {
+            EXPECT_EQ( NBIOT_ERR_OK, nbiot_device_create(&dev[i],0) );
+            EXPECT_EQ( NBIOT_ERR_OK, nbiot_loop_add(loop,dev[i]) );
+        }
+        EXPECT_EQ( NBIOT_ERR_BADPARAM, nbiot_loop_add(loop,dev[0]) );
+
+        /* unconfigured devices fail once each, then back off */
+        loop_errors = 0;
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_loop_run(loop,0) );
+        EXPECT_EQ( 3, loop_errors );
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_loop_run(loop,0) );
+        EXPECT_EQ( 3, loop_errors );
+
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_loop_remove(loop,dev[1]) );
+        EXPECT_EQ( NBIOT_ERR_BADPARAM, nbiot_loop_remove(loop,dev[1]) );
+
+        /* destroy detaches from the loop */
+        for ( int i = 0; i < 3; ++i )
+        {
+            nbiot_device_destroy( dev[i] );
+        }
+        nbiot_loop_destroy( loop );
+        nbiot_device_pool_clear();
+    }
+    nbiot_clear_environment();
+}
+
+static std::vector<nbiot_device_t*> loop_order;
+static nbiot_device_t *loop_pair[2] = { NULL };
+static nbiot_device_t *loop_destroyed = NULL;
+static void loop_record( nbiot_device_t *dev, int )
+{
+    loop_order.push_back( dev );
+
+    /* the first of the pair to fail destroys the other one */
+    if ( NULL != loop_pair[0] )
+    {
+        loop_destroyed = dev == loop_pair[0] ? loop_pair[1] : loop_pair[0];
+        loop_pair[0] = NULL;
+        loop_pair[1] = NULL;
+        nbiot_device_destroy( loop_destroyed );
+    }
+}
+
+TEST( device, loop_order )
+{
+    nbiot_init_environment();
+    {
+        nbiot_loop_t *loop = NULL;
+        nbiot_device_t *dev[3] = { NULL };
+        clock_t now;
+        clock_t begin;
+        clock_t elapsed;
+
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_device_pool_init(3) );
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_loop_create(&loop,loop_record) );
+        for ( int i = 0; i < 3; ++i )
+        {
+            EXPECT_EQ( NBIOT_ERR_OK, nbiot_device_create(&dev[i],0) );
+        }
+
+        /* dev[0] is due in LONG_MAX ticks, the sum wraps below the current tick */
+        now = nbiot_tick();
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_loop_add(loop,dev[0]) );
+        dev[0]->deadline = (clock_t)((unsigned long)now + (unsigned long)(LONG_MAX - 10));
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_loop_add(loop,dev[1]) );
+        dev[1]->deadline = now - 20;
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_loop_add(loop,dev[2]) );
+        dev[2]->deadline = now - 10;
+
+        /* expired devices run by deadline, the wrapped one is not due */
+        loop_order.clear();
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_loop_run(loop,0) );
+        ASSERT_EQ( 2u, loop_order.size() );
+        EXPECT_EQ( dev[1], loop_order[0] );
+        EXPECT_EQ( dev[2], loop_order[1] );
+
+        /* failed devices retry a second later, the wait ends at that timer */
+        loop_order.clear();
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_loop_run(loop,0) );
+        EXPECT_EQ( 0u, loop_order.size() );
+        begin = nbiot_tick();
+        while ( loop_order.empty() && nbiot_tick() - begin < 3 * CLOCK_PER_SECOND )
+        {
+            EXPECT_EQ( NBIOT_ERR_OK, nbiot_loop_run(loop,3000) );
+        }
+        elapsed = nbiot_tick() - begin;
+        EXPECT_EQ( 2u, loop_order.size() );
+        EXPECT_GE( elapsed, CLOCK_PER_SECOND / 2 );
+        EXPECT_LT( elapsed, 2 * CLOCK_PER_SECOND );
+
+        for ( int i = 0; i < 3; ++i )
+        {
+            nbiot_device_destroy( dev[i] );
+        }
+        nbiot_loop_destroy( loop );
+        nbiot_device_pool_clear();
+    }
+    nbiot_clear_environment();
+}
+
+TEST( device, loop_destroy )
+{
+    nbiot_init_environment();
+    {
+        server_t srv;
+        nbiot_loop_t *loop = NULL;
+        nbiot_device_t *dev[2] = { NULL };
+        nbiot_sockaddr_t *addr[2] = { NULL };
+        size_t sent;
+
+        server_open( &srv, 5692 );
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_device_pool_init(2) );
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_loop_create(&loop,loop_record) );
+        for ( int i = 0; i < 2; ++i )
+        {
+            EXPECT_EQ( NBIOT_ERR_OK, nbiot_device_create(&dev[i],(uint16_t)(5693 + i)) );
+            EXPECT_EQ( NBIOT_ERR_OK, nbiot_loop_add(loop,dev[i]) );
+            EXPECT_EQ( NBIOT_ERR_OK, nbiot_udp_connect(srv.sock,"127.0.0.1",(uint16_t)(5693 + i),&addr[i]) );
+        }
+
+        /* the first run fails both, the next one is a second away */
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_loop_run(loop,0) );
+
+        /* both readable, the callback of the first destroys the other */
+        for ( int i = 0; i < 2; ++i )
+        {
+            EXPECT_EQ( NBIOT_ERR_OK, nbiot_udp_send(srv.sock,"x",1,&sent,addr[i]) );
+        }
+        loop_order.clear();
+        loop_pair[0] = dev[0];
+        loop_pair[1] = dev[1];
+        for ( int i = 0; i < 100 && loop_order.empty(); ++i )
+        {
+            EXPECT_EQ( NBIOT_ERR_OK, nbiot_loop_run(loop,100) );
+        }
+        ASSERT_EQ( 1u, loop_order.size() );
+        EXPECT_NE( loop_order[0], loop_destroyed );
+        dev[loop_destroyed == dev[0] ? 0 : 1] = NULL;
+
+        for ( int i = 0; i < 2; ++i )
+        {
+            nbiot_device_destroy( dev[i] );
+            nbiot_sockaddr_destroy( addr[i] );
+        }
+        nbiot_loop_destroy( loop );
+        nbiot_device_pool_clear();
+        server_close( &srv );
+    }
+    nbiot_clear_environment();
+}
+
+TEST( device, notify_batch )
+{
+    nbiot_init_environment();
+    {
+        server_t srv;
+        nbiot_device_t *dev = NULL;
+        nbiot_resource_t dis;
+        nbiot_resource_t dic;
+        nbiot_resource_t bad;
+        nbiot_resource_t *res[2] = { &dis, &dic };
+        nbiot_resource_t *mixed[2] = { &dis, &bad };
+        coap_packet_t request;
+        lwm2m_uri_t uri;
+        lwm2m_data_t *dataP = NULL;
+        int64_t value = 0;
+        bool flag = false;
+        int instance = 0;
+        int resource = 0;
+
+        memset( &dis, 0, sizeof(dis) );
+        dis.objid = 3200;
+        dis.instid = 0;
+        dis.resid = 5500;
+        dis.flag = NBIOT_RESOURCE_READABLE;
+        dis.type = NBIOT_VALUE_BOOLEAN;
+
+        memset( &dic, 0, sizeof(dic) );
+        dic.objid = 3200;
+        dic.instid = 0;
+        dic.resid = 5501;
+        dic.flag = NBIOT_RESOURCE_READABLE;
+        dic.type = NBIOT_VALUE_INTEGER;
+
+        bad = dic;
+        bad.resid = 5502;
+
+        server_open( &srv, 5698 );
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_device_create(&dev,0) );
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_device_connect(dev,"coap://127.0.0.1:5698",300) );
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_device_configure(dev,"1234;5678",res,2) );
+        ASSERT_TRUE( server_register(&srv,dev) );
+
+        EXPECT_EQ( NBIOT_ERR_BADPARAM, nbiot_device_notify_batch(NULL,res,2) );
+        EXPECT_EQ( NBIOT_ERR_BADPARAM, nbiot_device_notify_batch(dev,NULL,2) );
+        EXPECT_EQ( NBIOT_ERR_BADPARAM, nbiot_device_notify_batch(dev,res,0) );
+        EXPECT_EQ( NBIOT_ERR_NO_RESOURCE, nbiot_device_notify_batch(dev,mixed,2) );
+
+        /* the instance and one of its resources are observed */
+        coap_init_message( &request, COAP_TYPE_CON, COAP_GET, 0 );
+        coap_set_header_uri_path( &request, "/3200/0" );
+        coap_set_header_observe( &request, 0 );
+        ASSERT_EQ( COAP_205_CONTENT, server_request(&srv,dev,&request) );
+        coap_init_message( &request, COAP_TYPE_CON, COAP_GET, 0 );
+        coap_set_header_uri_path( &request, "/3200/0/5501" );
+        coap_set_header_observe( &request, 0 );
+        ASSERT_EQ( COAP_205_CONTENT, server_request(&srv,dev,&request) );
+
+        /* both changes reach the instance observer in one TLV, the resource observer gets its own */
+        dis.value.as_bool = true;
+        dic.value.as_int = 7;
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_device_notify_batch(dev,res,2) );
+        memset( &uri, 0, sizeof(uri) );
+        uri.flag = LWM2M_URI_FLAG_OBJECT_ID | LWM2M_URI_FLAG_INSTANCE_ID;
+        uri.objectId = 3200;
+        for ( int i = 0; i < 2; ++i )
+        {
+            ASSERT_TRUE( server_recv(&srv,dev,3000) );
+            EXPECT_EQ( COAP_205_CONTENT, srv.packet.code );
+            EXPECT_TRUE( IS_OPTION(&srv.packet,COAP_OPTION_OBSERVE) );
+            if ( LWM2M_CONTENT_TLV == srv.packet.content_type )
+            {
+                ++instance;
+                ASSERT_EQ( 2, lwm2m_data_parse(&uri,srv.packet.payload,srv.packet.payload_len,LWM2M_CONTENT_TLV,&dataP) );
+                EXPECT_EQ( 5500, dataP[0].id );
+                EXPECT_EQ( 1, lwm2m_data_decode_bool(dataP + 0,&flag) );
+                EXPECT_TRUE( flag );
+                EXPECT_EQ( 5501, dataP[1].id );
+                EXPECT_EQ( 1, lwm2m_data_decode_int(dataP + 1,&value) );
+                EXPECT_EQ( 7, value );
+                lwm2m_data_free( 2, dataP );
+            }
+            else
+            {
+                ++resource;
+                ASSERT_EQ( 1u, srv.packet.payload_len );
+                EXPECT_EQ( '7', srv.packet.payload[0] );
+            }
+        }
+        EXPECT_EQ( 1, instance );
+        EXPECT_EQ( 1, resource );
+        EXPECT_FALSE( server_recv(&srv,dev,500) );
+
+        nbiot_device_destroy( dev );
+        server_close( &srv );
+    }
+    nbiot_clear_environment();
+}
+
+/* the next raw datagram reaching the server */
+static size_t send_recv( server_t *srv )
+{
+    size_t read = 0;
+
+    for ( int i = 0; i < 100 && 0 == read; ++i )
+    {
+        nbiot_udp_recv( srv->sock, srv->buff, sizeof(srv->buff), &read, &srv->peer );
+        if ( 0 == read )
+        {
+            nbiot_udp_wait( srv->sock, 10 );
+        }
+    }
+
+    return read;
+}
+
+TEST( device, send_queue )
+{
+    nbiot_init_environment();
+    {
+        server_t srv;
+        nbiot_device_t *dev = NULL;
+        nbiot_sockaddr_t *good = NULL;
+        nbiot_sockaddr_t *bad = NULL;
+        static uint8_t large[NBIOT_SOCK_BATCH_BUF_SIZE + 1];
+
+        server_open( &srv, 5699 );
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_device_create(&dev,0) );
+        ASSERT_EQ( NBIOT_ERR_OK, nbiot_udp_connect(dev->sock,"127.0.0.1",5699,&good) );
+        /* the kernel refuses to send to port 0 */
+        ASSERT_EQ( NBIOT_ERR_OK, nbiot_udp_connect(dev->sock,"127.0.0.1",0,&bad) );
+
+        /* a failing datagram is dropped, the ones after it stay queued in order */
+        dev->tx_batch = true;
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_device_send(dev,good,(const uint8_t*)"1",1) );
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_device_send(dev,bad,(const uint8_t*)"x",1) );
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_device_send(dev,good,(const uint8_t*)"2",1) );
+        EXPECT_EQ( 3u, dev->tx_num );
+        EXPECT_NE( NBIOT_ERR_OK, nbiot_device_flush(dev) );
+        ASSERT_EQ( 1u, dev->tx_num );
+        EXPECT_EQ( '2', *(uint8_t*)dev->tx_msgs[0].buff );
+        EXPECT_EQ( 1u, send_recv(&srv) );
+        EXPECT_EQ( '1', srv.buff[0] );
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_device_flush(dev) );
+        EXPECT_EQ( 0u, dev->tx_num );
+        EXPECT_EQ( 1u, send_recv(&srv) );
+        EXPECT_EQ( '2', srv.buff[0] );
+
+        /* a datagram too large for the queue goes out after the queued ones */
+        memset( large, 'L', sizeof(large) );
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_device_send(dev,good,(const uint8_t*)"3",1) );
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_device_send(dev,good,large,sizeof(large)) );
+        EXPECT_EQ( 0u, dev->tx_num );
+        EXPECT_EQ( 1u, send_recv(&srv) );
+        EXPECT_EQ( '3', srv.buff[0] );
+        EXPECT_LT( 1u, send_recv(&srv) );
+        EXPECT_EQ( 'L', srv.buff[0] );
+
+        /* datagrams to a closed connection are discarded */
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_device_send(dev,bad,(const uint8_t*)"y",1) );
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_device_send(dev,good,(const uint8_t*)"4",1) );
+        nbiot_device_discard( dev, bad );
+        ASSERT_EQ( 1u, dev->tx_num );
+        EXPECT_EQ( '4', *(uint8_t*)dev->tx_msgs[0].buff );
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_device_flush(dev) );
+        EXPECT_EQ( 1u, send_recv(&srv) );
+        EXPECT_EQ( '4', srv.buff[0] );
+        dev->tx_batch = false;
+
+        nbiot_sockaddr_destroy( good );
+        nbiot_sockaddr_destroy( bad );
+        nbiot_device_destroy( dev );
+        server_close( &srv );
+    }
+    nbiot_clear_environment();
+}
+
+TEST( device, queue_mode )
+{
+    nbiot_init_environment();
+    {
+        nbiot_device_t *dev = NULL;
+
+        EXPECT_EQ( NBIOT_ERR_BADPARAM, nbiot_device_queue_mode(NULL,30) );
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_device_create(&dev,0) );
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_device_connect(dev,"coap://127.0.0.1:5683",300) );
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_device_queue_mode(dev,30) );
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_device_queue_mode(dev,0) );
+        nbiot_device_destroy( dev );
+    }
+    nbiot_clear_environment();
+}
+
+TEST( device, queue_mode_sleep )
+{
+    nbiot_init_environment();
+    {
+        server_t srv;
+        nbiot_device_t *dev = NULL;
+        nbiot_resource_t dic;
+        nbiot_resource_t *res[1] = { &dic };
+        coap_packet_t request;
+        uint8_t token[8];
+        size_t token_len;
+        uint32_t observe = 0;
+
+        memset( &dic, 0, sizeof(dic) );
+        dic.objid = 3200;
+        dic.instid = 0;
+        dic.resid = 5501;
+        dic.flag = NBIOT_RESOURCE_READABLE;
+        dic.type = NBIOT_VALUE_INTEGER;
+        dic.value.as_int = 1;
+
+        server_open( &srv, 5697 );
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_device_create(&dev,0) );
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_device_connect(dev,"coap://127.0.0.1:5697",300) );
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_device_queue_mode(dev,1) );
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_device_configure(dev,"1234;5678",res,1) );
+        ASSERT_TRUE( server_register(&srv,dev) );
+
+        coap_init_message( &request, COAP_TYPE_CON, COAP_GET, 0 );
+        coap_set_header_uri_path( &request, "/3200/0/5501" );
+        coap_set_header_observe( &request, 0 );
+        ASSERT_EQ( COAP_205_CONTENT, server_request(&srv,dev,&request) );
+        token_len = srv.packet.token_len;
+        memcpy( token, srv.packet.token, token_len );
+
+        /* the receive path goes down once the awake time is over */
+        for ( int i = 0; i < 300 && !lwm2m_is_sleeping(&dev->lwm2m); ++i )
+        {
+            nbiot_device_step( dev, 0 );
+            nbiot_udp_wait( srv.sock, 10 );
+        }
+        ASSERT_TRUE( lwm2m_is_sleeping(&dev->lwm2m) );
+
+        /* while sleeping requests are dropped and notifications held back */
+        dic.value.as_int = 2;
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_device_notify(dev,3200,0,5501) );
+        dic.value.as_int = 3;
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_device_notify(dev,3200,0,5501) );
+        coap_init_message( &request, COAP_TYPE_CON, COAP_GET, ++srv.mid );
+        coap_set_header_uri_path( &request, "/3200/0/5501" );
+        server_send( &srv, &request );
+        EXPECT_FALSE( server_recv(&srv,dev,500) );
+        EXPECT_TRUE( lwm2m_is_sleeping(&dev->lwm2m) );
+
+        /* the registration update wakes the device up */
+        EXPECT_EQ( 0, lwm2m_update_registration(&dev->lwm2m,0,false) );
+        ASSERT_TRUE( server_recv(&srv,dev,3000) );
+        EXPECT_EQ( COAP_POST, srv.packet.code );
+        EXPECT_FALSE( lwm2m_is_sleeping(&dev->lwm2m) );
+        server_ack( &srv, COAP_204_CHANGED );
+
+        /* then what changed meanwhile is sent, once with the latest value */
+        ASSERT_TRUE( server_recv(&srv,dev,3000) );
+        EXPECT_EQ( COAP_205_CONTENT, srv.packet.code );
+        EXPECT_EQ( 1, coap_get_header_observe(&srv.packet,&observe) );
+        ASSERT_EQ( token_len, srv.packet.token_len );
+        EXPECT_EQ( 0, memcmp(token,srv.packet.token,token_len) );
+        ASSERT_EQ( 1u, srv.packet.payload_len );
+        EXPECT_EQ( '3', srv.packet.payload[0] );
+        if ( COAP_TYPE_CON == srv.packet.type )
+        {
+            server_ack( &srv, 0 );
+        }
+        EXPECT_FALSE( server_recv(&srv,dev,500) );
+
+        nbiot_device_destroy( dev );
+        server_close( &srv );
+    }
+    nbiot_clear_environment();
+}
+
+static const uint8_t *firmware_source;
+static size_t firmware_received;
+static uint32_t firmware_expected;
+static int firmware_updates;
+
+static int firmware_write( nbiot_firmware_t *,
+                           size_t            offset,
+                           const uint8_t    *buffer,
+                           size_t            length )
+{
+    if ( NULL != firmware_source )
+    {
+        if ( 0 == offset )
+        {
+            firmware_received = 0;
+        }
+        EXPECT_EQ( firmware_received, offset );
+        EXPECT_EQ( 0, memcmp(firmware_source + offset,buffer,length) );
+        firmware_received = offset + length;
+    }
+
+    return NBIOT_ERR_OK;
+}
+
+static int firmware_verify( nbiot_firmware_t *,
+                            size_t            size,
+                            uint32_t          crc )
+{
+    EXPECT_EQ( firmware_received, size );
+
+    return crc == firmware_expected ? NBIOT_ERR_OK : NBIOT_ERR_INTERNAL;
+}
+
+static int firmware_update( nbiot_firmware_t * )
+{
+    ++firmware_updates;
+
+    return NBIOT_ERR_OK;
+}
+
+/* bit by bit, independent from the table driven one of firmware.c */
+static uint32_t firmware_crc32( const uint8_t *buffer,
+                                size_t         length )
+{
+    uint32_t crc = 0xFFFFFFFF;
+
+    for ( size_t i = 0; i < length; ++i )
+    {
+        crc ^= buffer[i];
+        for ( int j = 0; j < 8; ++j )
+        {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+    }
+
+    return ~crc;
+}
+
+TEST( device, firmware )
+{
+    nbiot_init_environment();
+    {
+        nbiot_device_t *dev = NULL;
+        nbiot_resource_t dis;
+        nbiot_resource_t pkg;
+        nbiot_resource_t *res[1] = { &dis };
+        nbiot_resource_t *bad[1] = { &pkg };
+        nbiot_firmware_t fw = { firmware_write, NULL, firmware_update };
+        nbiot_firmware_t nowrite = { NULL, NULL, firmware_update };
+
+        memset( &dis, 0, sizeof(dis) );
+        dis.objid = 3200;
+        dis.instid = 0;
+        dis.resid = 5500;
+        dis.flag = NBIOT_RESOURCE_READABLE;
+        dis.type = NBIOT_VALUE_BOOLEAN;
+
+        pkg = dis;
+        pkg.objid = 5;
+
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_device_create(&dev,0) );
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_device_connect(dev,"coap://127.0.0.1:5683",300) );
+        EXPECT_EQ( NBIOT_ERR_NO_RESOURCE, nbiot_device_firmware_result(dev,NBIOT_FIRMWARE_RESULT_SUCCESS) );
+        EXPECT_EQ( NBIOT_ERR_BADPARAM, nbiot_device_firmware(NULL,&fw) );
+        EXPECT_EQ( NBIOT_ERR_BADPARAM, nbiot_device_firmware(dev,&nowrite) );
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_device_firmware(dev,&fw) );
+        EXPECT_EQ( NBIOT_ERR_INTERNAL, nbiot_device_firmware(dev,&fw) );
+        EXPECT_EQ( NBIOT_ERR_BADPARAM, nbiot_device_configure(dev,"1234;5678",bad,1) );
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_device_configure(dev,"1234;5678",res,1) );
+
+        EXPECT_EQ( NBIOT_ERR_NO_RESOURCE, nbiot_device_notify(dev,5,0,3) );
+        EXPECT_EQ( NBIOT_ERR_BADPARAM, nbiot_device_firmware_result(dev,10) );
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_device_firmware_result(dev,NBIOT_FIRMWARE_RESULT_SUCCESS) );
+        nbiot_device_destroy( dev );
+    }
+    nbiot_clear_environment();
+}
+
+static char block_text[] = "ABCDEFGHIJKLMNOPabcdefghijklmnopQRSTUVWXYZ012345qrstuvwxyz6789!@tail";
+static size_t block_received;
+static int block_writes;
+
+static void block_write( nbiot_resource_t * )
+{
+    ++block_writes;
+}
+
+static int block_callback( nbiot_resource_t *res,
+                           size_t            offset,
+                           const uint8_t    *buffer,
+                           size_t            length,
+                           bool              )
+{
+    EXPECT_EQ( 5751, res->resid );
+    EXPECT_EQ( block_received, offset );
+    EXPECT_EQ( 0, memcmp(block_text + offset,buffer,length) );
+    block_received = offset + length;
+
+    return NBIOT_ERR_OK;
+}
+
+static uint8_t block_put( server_t       *srv,
+                          nbiot_device_t *dev,
+                          const char     *path,
+                          uint32_t        size1 )
+{
+    uint8_t code = 0;
+
+    for ( uint32_t num = 0; num * 16 < sizeof(block_text) - 1; ++num )
+    {
+        coap_packet_t request;
+        size_t length = sizeof(block_text) - 1 - num * 16;
+        bool more = length > 16;
+
+        coap_init_message( &request, COAP_TYPE_CON, COAP_PUT, 0 );
+        coap_set_header_uri_path( &request, path );
+        coap_set_header_content_type( &request, 0 ); /* text/plain */
+        coap_set_header_block1( &request, num, more, 16 );
+        if ( size1 && !num )
+        {
+            coap_set_header_size1( &request, size1 );
+        }
+        coap_set_payload( &request, block_text + num * 16, more ? 16 : length );
+        code = server_request( srv, dev, &request );
+        if ( code != (more ? COAP_231_CONTINUE : COAP_204_CHANGED) )
+        {
+            break;
+        }
+    }
+
+    return code;
+}
+
+TEST( device, block1 )
+{
+    nbiot_init_environment();
+    {
+        server_t srv;
+        nbiot_device_t *dev = NULL;
+        nbiot_resource_t legacy;
+        nbiot_resource_t sink;
+        nbiot_resource_t *res[2] = { &legacy, &sink };
+        uint32_t size1 = 0;
+
+        server_open( &srv, 5691 );
+
+        /* set field by field like pre-block callers, block is left as garbage */
+        memset( &legacy, 0xA5, sizeof(legacy) );
+        legacy.objid = 3200;
+        legacy.instid = 0;
+        legacy.resid = 5750;
+        legacy.flag = NBIOT_RESOURCE_READABLE | NBIOT_RESOURCE_WRITABLE;
+        legacy.type = NBIOT_VALUE_STRING;
+        legacy.value.as_str.str = NULL;
+        legacy.value.as_str.len = 0;
+        legacy.write = block_write;
+        legacy.execute = NULL;
+
+        sink = legacy;
+        sink.resid = 5751;
+        sink.flag |= NBIOT_RESOURCE_BLOCK;
+        sink.block = block_callback;
+
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_device_create(&dev,0) );
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_device_connect(dev,"coap://127.0.0.1:5691",300) );
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_device_configure(dev,"1234;5678",res,2) );
+        ASSERT_TRUE( server_register(&srv,dev) );
+
+        /* without NBIOT_RESOURCE_BLOCK the payload is reassembled and written */
+        block_writes = 0;
+        EXPECT_EQ( COAP_204_CHANGED, block_put(&srv,dev,"/3200/0/5750",0) );
+        EXPECT_EQ( 1, block_writes );
+        ASSERT_EQ( sizeof(block_text) - 1, legacy.value.as_str.len );
+        EXPECT_EQ( 0, memcmp(block_text,legacy.value.as_str.str,legacy.value.as_str.len) );
+
+        /* with it every block goes to the callback and the value is untouched */
+        block_writes = 0;
+        block_received = 0;
+        EXPECT_EQ( COAP_204_CHANGED, block_put(&srv,dev,"/3200/0/5751",0) );
+        EXPECT_EQ( sizeof(block_text) - 1, block_received );
+        EXPECT_EQ( 0, block_writes );
+        EXPECT_EQ( (char*)NULL, sink.value.as_str.str );
+
+        /* announcing more than NBIOT_BLOCK1_MAX_SIZE is refused up front */
+        EXPECT_EQ( COAP_413_ENTITY_TOO_LARGE, block_put(&srv,dev,"/3200/0/5750",NBIOT_BLOCK1_MAX_SIZE + 1) );
+        EXPECT_EQ( 1, coap_get_header_size1(&srv.packet,&size1) );
+        EXPECT_EQ( (uint32_t)NBIOT_BLOCK1_MAX_SIZE, size1 );
+
+        nbiot_device_destroy( dev );
+        nbiot_free( legacy.value.as_str.str );
+        server_close( &srv );
+    }
+    nbiot_clear_environment();
+}
+
+static uint8_t firmware_image[200];
+static int firmware_served;
+static uint8_t firmware_etag[COAP_ETAG_LEN]; /* sent with every block when not all zero */
+static bool firmware_etag_moves;             /* the first byte changes with the block number */
+
+/* reads an integer resource of /5/0 as plain text */
+static int firmware_get( server_t       *srv,
+                         nbiot_device_t *dev,
+                         const char     *path )
+{
+    coap_packet_t request;
+    int value = 0;
+
+    coap_init_message( &request, COAP_TYPE_CON, COAP_GET, 0 );
+    coap_set_header_uri_path( &request, path );
+    if ( COAP_205_CONTENT != server_request(srv,dev,&request) ||
+         LWM2M_CONTENT_TEXT != srv->packet.content_type )
+    {
+        return -1;
+    }
+
+    for ( size_t i = 0; i < srv->packet.payload_len; ++i )
+    {
+        value = value * 10 + (srv->packet.payload[i] - '0');
+    }
+
+    return value;
+}
+
+static uint8_t firmware_put( server_t       *srv,
+                             nbiot_device_t *dev,
+                             const char     *path,
+                             const char     *text )
+{
+    coap_packet_t request;
+
+    coap_init_message( &request, COAP_TYPE_CON, COAP_PUT, 0 );
+    coap_set_header_uri_path( &request, path );
+    coap_set_header_content_type( &request, LWM2M_CONTENT_TEXT );
+    coap_set_payload( &request, text, strlen(text) );
+
+    return server_request( srv, dev, &request );
+}
+
+/* writes the Package URI and serves firmware_image block by block, at most 'blocks' of them */
+static uint8_t firmware_pull( server_t       *srv,
+                              nbiot_device_t *dev,
+                              const char     *uri,
+                              int             blocks )
+{
+    uint8_t token[] = { 0x54, 0x45, 0x53, 0x54 };
+    coap_packet_t request;
+    uint8_t code = 0;
+    bool done = false;
+
+    coap_init_message( &request, COAP_TYPE_CON, COAP_PUT, ++srv->mid );
+    coap_set_header_token( &request, token, sizeof(token) );
+    coap_set_header_uri_path( &request, "/5/0/1" );
+    coap_set_header_content_type( &request, LWM2M_CONTENT_TEXT );
+    coap_set_payload( &request, uri, strlen(uri) );
+    server_send( srv, &request );
+
+    /* the download starts before the write is acknowledged */
+    firmware_served = 0;
+    while ( !(code && (done || firmware_served == blocks)) &&
+            server_recv(srv,dev,3000) )
+    {
+        if ( COAP_TYPE_ACK == srv->packet.type &&
+             request.mid == srv->packet.mid )
+        {
+            code = srv->packet.code;
+        }
+        else if ( COAP_GET == srv->packet.code &&
+                  firmware_served < blocks )
+        {
+            coap_packet_t ack;
+            uint32_t num = 0;
+            uint16_t size = 0;
+            size_t offset;
+            size_t length;
+
+            EXPECT_EQ( 1, coap_get_header_block2(&srv->packet,&num,NULL,&size,NULL) );
+            EXPECT_EQ( 0, memcmp("fw",srv->packet.uri_path->data,srv->packet.uri_path->len) );
+            /* the requested block and its headers fit NBIOT_SOCK_RECV_BUF_SIZE */
+            EXPECT_LE( size + 32u, (unsigned)NBIOT_SOCK_RECV_BUF_SIZE );
+            offset = num * size;
+            length = MIN( sizeof(firmware_image) - offset, size );
+            done = offset + length == sizeof(firmware_image);
+
+            coap_init_message( &ack, COAP_TYPE_ACK, COAP_205_CONTENT, srv->packet.mid );
+            coap_set_header_token( &ack, srv->packet.token, srv->packet.token_len );
+            coap_set_header_block2( &ack, num, !done, size );
+            if ( firmware_etag[COAP_ETAG_LEN - 1] )
+            {
+                uint8_t etag[COAP_ETAG_LEN];
+
+                memcpy( etag, firmware_etag, sizeof(etag) );
+                if ( firmware_etag_moves ) etag[0] += (uint8_t)num;
+                coap_set_header_etag( &ack, etag, sizeof(etag) );
+            }
+            coap_set_payload( &ack, firmware_image + offset, length );
+            server_send( srv, &ack );
+            ++firmware_served;
+        }
+    }
+
+    return code;
+}
+
+TEST( device, firmware_update )
+{
+    nbiot_init_environment();
+    {
+        server_t srv;
+        nbiot_device_t *dev = NULL;
+        nbiot_resource_t dis;
+        nbiot_resource_t *res[1] = { &dis };
+        nbiot_firmware_t fw = { firmware_write, firmware_verify, firmware_update };
+        coap_packet_t request;
+
+        memset( &dis, 0, sizeof(dis) );
+        dis.objid = 3200;
+        dis.instid = 0;
+        dis.resid = 5500;
+        dis.flag = NBIOT_RESOURCE_READABLE;
+        dis.type = NBIOT_VALUE_BOOLEAN;
+        for ( size_t i = 0; i < sizeof(firmware_image); ++i )
+        {
+            firmware_image[i] = (uint8_t)(i * 7 + 3);
+        }
+
+        server_open( &srv, 5695 );
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_device_create(&dev,0) );
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_device_connect(dev,"coap://127.0.0.1:5695",300) );
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_device_firmware(dev,&fw) );
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_device_configure(dev,"1234;5678",res,1) );
+        ASSERT_TRUE( server_register(&srv,dev) );
+
+        /* push: every block1 block goes straight to the write callback */
+        firmware_source = (const uint8_t*)block_text;
+        firmware_received = 0;
+        firmware_expected = firmware_crc32( firmware_source, sizeof(block_text) - 1 );
+        EXPECT_EQ( COAP_204_CHANGED, block_put(&srv,dev,"/5/0/0",0) );
+        EXPECT_EQ( sizeof(block_text) - 1, firmware_received );
+        EXPECT_EQ( NBIOT_FIRMWARE_DOWNLOADED, firmware_get(&srv,dev,"/5/0/3") );
+        EXPECT_EQ( NBIOT_FIRMWARE_RESULT_INITIAL, firmware_get(&srv,dev,"/5/0/5") );
+
+        /* execute starts the update, the application reports its result */
+        firmware_updates = 0;
+        coap_init_message( &request, COAP_TYPE_CON, COAP_POST, 0 );
+        coap_set_header_uri_path( &request, "/5/0/2" );
+        EXPECT_EQ( COAP_204_CHANGED, server_request(&srv,dev,&request) );
+        EXPECT_EQ( 1, firmware_updates );
+        EXPECT_EQ( NBIOT_FIRMWARE_UPDATING, firmware_get(&srv,dev,"/5/0/3") );
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_device_firmware_result(dev,NBIOT_FIRMWARE_RESULT_SUCCESS) );
+        EXPECT_EQ( NBIOT_FIRMWARE_IDLE, firmware_get(&srv,dev,"/5/0/3") );
+        EXPECT_EQ( NBIOT_FIRMWARE_RESULT_SUCCESS, firmware_get(&srv,dev,"/5/0/5") );
+
+        /* pull: the device downloads the package from the URI with block2 */
+        firmware_source = firmware_image;
+        firmware_received = 0;
+        firmware_expected = firmware_crc32( firmware_image, sizeof(firmware_image) );
+        memcpy( firmware_etag, "\x01\x02\x03\x04\x05\x06\x07\x08", COAP_ETAG_LEN );
+        EXPECT_EQ( COAP_204_CHANGED, firmware_pull(&srv,dev,"coap://127.0.0.1:5695/fw",INT_MAX) );
+        EXPECT_LT( 1, firmware_served );
+        EXPECT_EQ( NBIOT_FIRMWARE_DOWNLOADED, firmware_get(&srv,dev,"/5/0/3") );
+        EXPECT_EQ( sizeof(firmware_image), firmware_received );
+        EXPECT_TRUE( NULL == dev->lwm2m.downloadP );
+
+        /* a CRC-32 the verify callback does not accept is an integrity check failure */
+        firmware_expected = ~firmware_expected;
+        EXPECT_EQ( COAP_204_CHANGED, firmware_pull(&srv,dev,"coap://127.0.0.1:5695/fw",INT_MAX) );
+        EXPECT_EQ( NBIOT_FIRMWARE_IDLE, firmware_get(&srv,dev,"/5/0/3") );
+        EXPECT_EQ( NBIOT_FIRMWARE_RESULT_CRC_FAILED, firmware_get(&srv,dev,"/5/0/5") );
+        EXPECT_EQ( sizeof(firmware_image), firmware_received );
+
+        /* an 8-byte ETag changing beyond its last 4 bytes is another representation */
+        firmware_expected = ~firmware_expected;
+        firmware_etag_moves = true;
+        EXPECT_EQ( COAP_204_CHANGED, firmware_pull(&srv,dev,"coap://127.0.0.1:5695/fw",2) );
+        EXPECT_EQ( NBIOT_FIRMWARE_IDLE, firmware_get(&srv,dev,"/5/0/3") );
+        EXPECT_EQ( NBIOT_FIRMWARE_RESULT_CONNECTION_LOST, firmware_get(&srv,dev,"/5/0/5") );
+        EXPECT_GT( sizeof(firmware_image), firmware_received );
+        EXPECT_TRUE( NULL == dev->lwm2m.downloadP );
+        firmware_etag_moves = false;
+        memset( firmware_etag, 0, sizeof(firmware_etag) );
+
+        /* only the transport of the server is supported */
+        EXPECT_EQ( COAP_204_CHANGED, firmware_put(&srv,dev,"/5/0/1","http://127.0.0.1/fw") );
+        EXPECT_EQ( NBIOT_FIRMWARE_IDLE, firmware_get(&srv,dev,"/5/0/3") );
+        EXPECT_EQ( NBIOT_FIRMWARE_RESULT_PROTOCOL, firmware_get(&srv,dev,"/5/0/5") );
+        EXPECT_TRUE( NULL == dev->lwm2m.downloadP );
+
+        /* an empty URI cancels a download in progress */
+        firmware_expected = ~firmware_expected;
+        EXPECT_EQ( COAP_204_CHANGED, firmware_pull(&srv,dev,"coap://127.0.0.1:5695/fw",1) );
+        EXPECT_EQ( NBIOT_FIRMWARE_DOWNLOADING, firmware_get(&srv,dev,"/5/0/3") );
+        EXPECT_TRUE( NULL != dev->lwm2m.downloadP );
+        EXPECT_EQ( COAP_204_CHANGED, firmware_put(&srv,dev,"/5/0/1","") );
+        EXPECT_TRUE( NULL == dev->lwm2m.downloadP );
+        EXPECT_EQ( NBIOT_FIRMWARE_IDLE, firmware_get(&srv,dev,"/5/0/3") );
+        EXPECT_EQ( NBIOT_FIRMWARE_RESULT_INITIAL, firmware_get(&srv,dev,"/5/0/5") );
+        EXPECT_GT( sizeof(firmware_image), firmware_received );
+
+        firmware_source = NULL;
+        nbiot_device_destroy( dev );
+        server_close( &srv );
+    }
+    nbiot_clear_environment();
+}
@@ -0,0 +1,197 @@
+/**
+ * Copyright (c) 2017 China Mobile IOT.
+ * All rights reserved.
+**/
+
+#include <gtest/gtest.h>
+#include <internals.h>
+
+#define OBSERVE_COUNT 8
+
+static int observe_reads = 0;
+static uint8_t observe_read( uint16_t        instanceId,
+                             int            *numDataP,
+                             lwm2m_data_t  **dataArrayP,
+                             lwm2m_object_t * )
+{
+    for ( int i = 0; i < *numDataP; ++i )
+    {
+        lwm2m_data_encode_int( instanceId, (*dataArrayP) + i );
+    }
+    ++observe_reads;
+
+    return COAP_205_CONTENT;
+}
+
+static lwm2m_uri_t observe_uri( uint16_t instanceId )
+{
+    lwm2m_uri_t uri;
+
+    memset( &uri, 0, sizeof(uri) );
+    uri.flag = LWM2M_URI_FLAG_OBJECT_ID | LWM2M_URI_FLAG_INSTANCE_ID | LWM2M_URI_FLAG_RESOURCE_ID;
+    uri.objectId = 3200;
+    uri.instanceId = instanceId;
+    uri.resourceId = 5700;
+
+    return uri;
+}
+
+static lwm2m_watcher_t *observe_watcher( lwm2m_context_t *context,
+                                         uint16_t         instanceId )
+{
+    lwm2m_uri_t uri = observe_uri( instanceId );
+    lwm2m_observed_t *observedP = observe_findByUri( context, &uri );
+
+    return observedP ? observedP->watcherList : NULL;
+}
+
+/* an observe GET with a maximum period of 'pmax' seconds */
+static void observe_start( lwm2m_context_t *context,
+                           lwm2m_server_t  *server,
+                           uint16_t         instanceId,
+                           uint32_t         pmax )
+{
+    lwm2m_uri_t uri = observe_uri( instanceId );
+    lwm2m_attributes_t attr;
+    lwm2m_data_t data;
+    coap_packet_t message;
+    coap_packet_t response;
+
+    memset( &data, 0, sizeof(data) );
+    lwm2m_data_encode_int( instanceId, &data );
+    coap_init_message( &message, COAP_TYPE_CON, COAP_GET, 1 );
+    coap_set_header_token( &message, (const uint8_t*)"TEST", 4 );
+    coap_set_header_observe( &message, 0 );
+    coap_init_message( &response, COAP_TYPE_ACK, COAP_205_CONTENT, 1 );
+    EXPECT_EQ( COAP_205_CONTENT, observe_handleRequest(context,&uri,server,1,&data,&message,&response) );
+
+    memset( &attr, 0, sizeof(attr) );
+    attr.toSet = LWM2M_ATTR_FLAG_MAX_PERIOD;
+    attr.maxPeriod = pmax;
+    EXPECT_EQ( COAP_204_CHANGED, observe_setParameters(context,&uri,server,&attr) );
+}
+
+TEST( observe, watcher_timers )
+{
+    nbiot_init_environment();
+    {
+        lwm2m_context_t *context;
+        lwm2m_object_t object;
+        lwm2m_server_t server;
+        lwm2m_list_t instances[OBSERVE_COUNT];
+        lwm2m_watcher_t *watcherP;
+        lwm2m_timer_t *timerP;
+        lwm2m_uri_t uri;
+        lwm2m_attributes_t attr;
+        clock_t now;
+
+        context = (lwm2m_context_t*)nbiot_malloc( sizeof(lwm2m_context_t) );
+        ASSERT_TRUE( context != NULL );
+        lwm2m_init( context, NULL );
+        memset( &object, 0, sizeof(object) );
+        memset( instances, 0, sizeof(instances) );
+        for ( int i = 0; i < OBSERVE_COUNT; ++i )
+        {
+            instances[i].id = (uint16_t)i;
+            instances[i].next = i + 1 < OBSERVE_COUNT ? instances + i + 1 : NULL;
+        }
+        object.objID = 3200;
+        object.instanceList = instances;
+        object.readFunc = observe_read;
+        context->objectList = &object;
+        memset( &server, 0, sizeof(server) );
+
+        /* every watcher with a period has its own timer */
+        for ( int i = 0; i < OBSERVE_COUNT; ++i )
+        {
+            observe_start( context, &server, (uint16_t)i, (uint32_t)i + 1 );
+        }
+        EXPECT_EQ( OBSERVE_COUNT, context->timerCount );
+        EXPECT_TRUE( context->observedReady == NULL );
+        for ( int i = 0; i < OBSERVE_COUNT; ++i )
+        {
+            watcherP = observe_watcher( context, (uint16_t)i );
+            ASSERT_TRUE( watcherP != NULL );
+            EXPECT_NE( 0, watcherP->timer.index );
+            EXPECT_EQ( LWM2M_TIMER_OBSERVE, watcherP->timer.type );
+            EXPECT_EQ( watcherP->lastTime + (clock_t)(i + 1) * CLOCK_PER_SECOND, watcherP->timer.deadline );
+        }
+
+        /* nothing expired, nothing is read */
+        watcherP = observe_watcher( context, 0 );
+        now = watcherP->lastTime;
+        observe_reads = 0;
+        observe_step( context, now );
+        EXPECT_EQ( 0, observe_reads );
+
+        /* only the expired watcher is stepped, then it is rescheduled */
+        now += CLOCK_PER_SECOND + CLOCK_PER_SECOND / 2;
+        timerP = timer_pop( context, now );
+        ASSERT_TRUE( timerP == &watcherP->timer );
+        EXPECT_TRUE( NULL == timer_pop(context,now) );
+        observe_timerExpired( context, (lwm2m_observed_t*)timerP->ownerP );
+        observe_step( context, now );
+        EXPECT_EQ( 1, observe_reads );
+        EXPECT_EQ( now, watcherP->lastTime );
+        EXPECT_EQ( now + CLOCK_PER_SECOND, watcherP->timer.deadline );
+        EXPECT_EQ( OBSERVE_COUNT, context->timerCount );
+
+        /* a changed value without pmin is read at once, it stays pending without a condition met */
+        observe_reads = 0;
+        uri = observe_uri( 3 );
+        lwm2m_resource_value_changed( context, &uri );
+        observe_step( context, now );
+        EXPECT_EQ( 1, observe_reads );
+        EXPECT_TRUE( observe_watcher(context,3)->update );
+
+        /* with pmin it waits for the pmin timer */
+        memset( &attr, 0, sizeof(attr) );
+        attr.toSet = LWM2M_ATTR_FLAG_MIN_PERIOD;
+        attr.minPeriod = 1;
+        uri = observe_uri( 7 );
+        EXPECT_EQ( COAP_204_CHANGED, observe_setParameters(context,&uri,&server,&attr) );
+        watcherP = observe_watcher( context, 7 );
+        observe_reads = 0;
+        lwm2m_resource_value_changed( context, &uri );
+        observe_step( context, watcherP->lastTime );
+        EXPECT_EQ( 0, observe_reads );
+        EXPECT_TRUE( watcherP->update );
+        EXPECT_EQ( watcherP->lastTime + CLOCK_PER_SECOND, watcherP->timer.deadline );
+
+        /* a change while queued by its timer still tags the watcher */
+        uri = observe_uri( 5 );
+        watcherP = observe_watcher( context, 5 );
+        observe_timerExpired( context, observe_findByUri(context,&uri) );
+        lwm2m_resource_value_changed( context, &uri );
+        EXPECT_TRUE( watcherP->update );
+        observe_reads = 0;
+        observe_step( context, watcherP->lastTime );
+        EXPECT_EQ( 1, observe_reads );
+        watcherP = observe_watcher( context, 7 );
+
+        /* a sleeping server drops the timers, waking up queues its observations and the pending changes */
+        server.sleeping = true;
+        for ( int i = 0; i < OBSERVE_COUNT; ++i )
+        {
+            observe_timerExpired( context, observe_findByUri(context,&(uri = observe_uri((uint16_t)i))) );
+        }
+        observe_reads = 0;
+        observe_step( context, now );
+        EXPECT_EQ( 0, observe_reads );
+        EXPECT_EQ( 0, context->timerCount );
+        server.sleeping = false;
+        observe_wakeUp( context, &server );
+        observe_step( context, watcherP->lastTime );
+        EXPECT_EQ( 2, observe_reads ); /* 3 and 5, 7 waits for its pmin */
+        EXPECT_EQ( OBSERVE_COUNT, context->timerCount );
+
+        /* a cancelled watcher leaves the heap */
+        observe_cancel( context, LWM2M_MAX_ID, NULL );
+        EXPECT_EQ( OBSERVE_COUNT - 1, context->timerCount );
+
+        lwm2m_close( context );
+        EXPECT_EQ( 0, context->timerCount );
+        nbiot_free( context );
+    }
+    nbiot_clear_environment();
+}
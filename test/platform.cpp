@@ -6,6 +6,8 @@
 #include <gtest/gtest.h>
 #include <platform.h>
 #include <error.h>
+#include <vector>
+#include <thread>
 
 TEST( platform, normal )
 {
@@ -68,4 +70,171 @@ TEST( platform, normal )
         nbiot_sockaddr_destroy( src_s );
     }
     nbiot_clear_environment();
-}
\ No newline at end of file
+}
+TEST( platform, batch )
+{
+    nbiot_init_environment();
+    {
+        nbiot_socket_t *server = NULL;
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_udp_create(&server) );
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_udp_bind(server,"localhost",5639) );
+
+        nbiot_socket_t *client = NULL;
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_udp_create(&client) );
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_udp_bind(client,"localhost",56390) );
+
+        nbiot_sockaddr_t *dest = NULL;
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_udp_connect(client,"localhost",5639,&dest) );
+
+        const char *str[3] = { "first", "second datagram", "third" };
+        nbiot_datagram_t out[3];
+        for ( int i = 0; i < 3; ++i )
+        {
+            out[i].buff = (void*)str[i];
+            out[i].size = strlen( str[i] ) + 1;
+            out[i].addr = dest;
+        }
+
+        size_t count = 0;
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_udp_send_batch(client,out,3,&count) );
+        EXPECT_EQ( 3u, count );
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_udp_wait(server,1000) );
+
+        char buf[4][32];
+        nbiot_datagram_t in[4];
+        for ( int i = 0; i < 4; ++i )
+        {
+            in[i].buff = buf[i];
+            in[i].size = sizeof(buf[i]);
+            in[i].addr = NULL;
+        }
+
+        size_t total = 0;
+        for ( int retry = 0; retry < 10 && total < 3; ++retry )
+        {
+            EXPECT_EQ( NBIOT_ERR_OK, nbiot_udp_recv_batch(server,in+total,4-total,&count) );
+            total += count;
+            nbiot_udp_wait( server, 100 );
+        }
+        EXPECT_EQ( 3u, total );
+        for ( size_t i = 0; i < total; ++i )
+        {
+            EXPECT_STREQ( str[i], buf[i] );
+            EXPECT_EQ( out[i].size, in[i].len );
+        }
+
+        /* nothing left */
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_udp_recv_batch(server,in,4,&count) );
+        EXPECT_EQ( 0u, count );
+
+        for ( int i = 0; i < 4; ++i )
+        {
+            nbiot_sockaddr_destroy( in[i].addr );
+        }
+        nbiot_sockaddr_destroy( dest );
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_udp_close(client) );
+        EXPECT_EQ( NBIOT_ERR_OK, nbiot_udp_close(server) );
+    }
+    nbiot_clear_environment();
+}
+
+#ifdef NBIOT_MEMORY_POOL
+TEST( platform, memory_pool )
+{
+    nbiot_init_environment();
+    {
+        nbiot_memory_stats_t stats;
+        void *ptr[4] = { NULL };
+
+        nbiot_memory_stats( &stats );
+        EXPECT_EQ( (size_t)NBIOT_MEMORY_POOL_SIZE, stats.total );
+        EXPECT_EQ( (size_t)0, stats.used );
+
+        /* size classes */
+        ptr[0] = nbiot_malloc( 1 );
+        ptr[1] = nbiot_malloc( 16 );
+        ptr[2] = nbiot_malloc( 100 );
+        EXPECT_EQ( (char*)ptr[0] + 16, (char*)ptr[1] );
+        nbiot_memory_stats( &stats );
+        EXPECT_EQ( (size_t)(16 + 16 + 128), stats.used );
+        EXPECT_EQ( (size_t)(2 * NBIOT_MEMORY_SLAB_SIZE), stats.slabs );
+        EXPECT_EQ( (size_t)0, stats.fallback );
+
+        /* oversize falls back to the heap */
+        ptr[3] = nbiot_malloc( NBIOT_MEMORY_SLAB_SIZE + 1 );
+        EXPECT_NE( (void*)NULL, ptr[3] );
+        nbiot_memory_stats( &stats );
+        EXPECT_EQ( (size_t)1, stats.fallback );
+
+        for ( int i = 0; i < 4; ++i )
+        {
+            nbiot_free( ptr[i] );
+        }
+        nbiot_memory_stats( &stats );
+        EXPECT_EQ( (size_t)0, stats.used );
+        EXPECT_EQ( (size_t)(16 + 16 + 128), stats.peak );
+        EXPECT_EQ( 100, stats.fragmentation );
+
+        /* freed blocks are reused */
+        ptr[0] = nbiot_malloc( 8 );
+        EXPECT_EQ( ptr[1], ptr[0] );
+        nbiot_free( ptr[0] );
+
+        /* exhausted pool falls back to the heap */
+        std::vector<void*> blocks;
+        for ( size_t i = 0; i <= stats.total / 512; ++i )
+        {
+            blocks.push_back( nbiot_malloc(512) );
+        }
+        nbiot_memory_stats( &stats );
+        EXPECT_EQ( stats.total, stats.slabs );
+        EXPECT_LT( (size_t)1, stats.fallback );
+        for ( size_t i = 0; i < blocks.size(); ++i )
+        {
+            nbiot_free( blocks[i] );
+        }
+    }
+    nbiot_clear_environment();
+}
+
+TEST( platform, memory_pool_threads )
+{
+    nbiot_init_environment();
+    {
+        nbiot_memory_stats_t stats;
+        std::vector<std::thread> threads;
+
+        /* devices on different threads share the pool */
+        for ( int t = 0; t < 4; ++t )
+        {
+            threads.push_back( std::thread([t]()
+            {
+                void *ptr[32];
+
+                for ( int round = 0; round < 20000; ++round )
+                {
+                    for ( int i = 0; i < 32; ++i )
+                    {
+                        ptr[i] = nbiot_malloc( (size_t)(8 << ((i + t) % 6)) );
+                        memset( ptr[i], t, 8 );
+                    }
+                    for ( int i = 0; i < 32; ++i )
+                    {
+                        EXPECT_EQ( t, *(uint8_t*)ptr[i] );
+                        nbiot_free( ptr[i] );
+                    }
+                }
+            }) );
+        }
+        for ( size_t t = 0; t < threads.size(); ++t )
+        {
+            threads[t].join();
+        }
+
+        nbiot_memory_stats( &stats );
+        EXPECT_EQ( (size_t)0, stats.used );
+        EXPECT_LE( stats.slabs, stats.total );
+    }
+    nbiot_clear_environment();
+}
+#endif
@@ -0,0 +1,627 @@
+/**
+ * Copyright (c) 2017 China Mobile IOT.
+ * All rights reserved.
+**/
+
+#include <gtest/gtest.h>
+#include <internals.h>
+#include <string>
+
+static const uint8_t senml_opaque[] = { 0x00, 0x01, 0x02, 0xFF };
+
+static lwm2m_uri_t senml_uri( int depth )
+{
+    lwm2m_uri_t uri;
+
+    memset( &uri, 0, sizeof(uri) );
+    uri.objectId = 3200;
+    uri.flag = LWM2M_URI_FLAG_OBJECT_ID;
+    if ( depth > 1 )
+    {
+        uri.flag |= LWM2M_URI_FLAG_INSTANCE_ID;
+    }
+    if ( depth > 2 )
+    {
+        uri.flag |= LWM2M_URI_FLAG_RESOURCE_ID;
+        uri.resourceId = 5700;
+    }
+
+    return uri;
+}
+
+/* the resources of /3200/i, one of each type */
+static lwm2m_data_t *senml_resources( int i, size_t *count )
+{
+    lwm2m_data_t *res = lwm2m_data_new( 7 );
+    lwm2m_data_t *multi = lwm2m_data_new( 2 );
+
+    res[0].id = 5500;
+    lwm2m_data_encode_bool( i == 0, res + 0 );
+    res[1].id = 5501;
+    lwm2m_data_encode_int( -100000 - i, res + 1 );
+    res[2].id = 5700;
+    lwm2m_data_encode_float( 21.5 + i, res + 2 );
+    res[3].id = 5750;
+    lwm2m_data_encode_string( "a \"quoted\"\\\ttab", res + 3 );
+    res[4].id = 5800;
+    res[4].type = LWM2M_TYPE_OBJECT_LINK;
+    res[4].value.asObjLink.objectId = 3303;
+    res[4].value.asObjLink.objectInstanceId = (uint16_t)(7 + i);
+    multi[0].id = 0;
+    lwm2m_data_encode_int( 42, multi + 0 );
+    multi[1].id = 3;
+    lwm2m_data_encode_int( 0x123456789LL, multi + 1 );
+    res[5].id = 5850;
+    res[5].type = LWM2M_TYPE_MULTIPLE_RESOURCE;
+    res[5].value.asChildren.count = 2;
+    res[5].value.asChildren.array = multi;
+    res[6].id = 5900;
+    lwm2m_data_encode_opaque( (uint8_t*)senml_opaque, sizeof(senml_opaque), res + 6 );
+
+    *count = 7;
+    return res;
+}
+
+static lwm2m_data_t *senml_instances( int count )
+{
+    lwm2m_data_t *instances = lwm2m_data_new( count );
+
+    for ( int i = 0; i < count; ++i )
+    {
+        size_t size;
+        lwm2m_data_t *res = senml_resources( i, &size );
+
+        instances[i].id = (uint16_t)i;
+        instances[i].type = LWM2M_TYPE_OBJECT_INSTANCE;
+        instances[i].value.asChildren.count = size;
+        instances[i].value.asChildren.array = res;
+    }
+
+    return instances;
+}
+
+static size_t senml_used( void )
+{
+#ifdef NBIOT_MEMORY_POOL
+    nbiot_memory_stats_t stats;
+
+    nbiot_memory_stats( &stats );
+    return stats.used;
+#else
+    return 0;
+#endif
+}
+
+/*
+ * Checks a parsed tree against the tree it was serialized from.
+ * TLV leaves come back as opaque, strings of a JSON payload stay strings
+ * and opaques stay the base64 text.
+*/
+static void senml_check( lwm2m_media_type_t  format,
+                         const lwm2m_data_t *expected,
+                         const lwm2m_data_t *parsed,
+                         size_t              size )
+{
+    for ( size_t i = 0; i < size; ++i )
+    {
+        const lwm2m_data_t *e = expected + i;
+        const lwm2m_data_t *p = parsed + i;
+        int64_t value;
+        double real;
+        bool flag;
+
+        SCOPED_TRACE( e->id );
+        ASSERT_EQ( e->id, p->id );
+        switch ( e->type )
+        {
+            case LWM2M_TYPE_OBJECT:
+            case LWM2M_TYPE_OBJECT_INSTANCE:
+            case LWM2M_TYPE_MULTIPLE_RESOURCE:
+            ASSERT_EQ( e->type, p->type );
+            ASSERT_EQ( e->value.asChildren.count, p->value.asChildren.count );
+            senml_check( format, e->value.asChildren.array, p->value.asChildren.array, e->value.asChildren.count );
+            break;
+
+            case LWM2M_TYPE_INTEGER:
+            EXPECT_EQ( 1, lwm2m_data_decode_int(p,&value) );
+            EXPECT_EQ( e->value.asInteger, value );
+            break;
+
+            case LWM2M_TYPE_FLOAT:
+            EXPECT_EQ( 1, lwm2m_data_decode_float(p,&real) );
+            if ( format == LWM2M_CONTENT_TLV )
+            {
+                /* TLV writes floats in single precision when they fit */
+                EXPECT_EQ( (double)(float)e->value.asFloat, real );
+            }
+            else
+            {
+                EXPECT_EQ( e->value.asFloat, real );
+            }
+            break;
+
+            case LWM2M_TYPE_BOOLEAN:
+            EXPECT_EQ( 1, lwm2m_data_decode_bool(p,&flag) );
+            EXPECT_EQ( e->value.asBoolean, flag );
+            break;
+
+            case LWM2M_TYPE_STRING:
+            EXPECT_EQ( format == LWM2M_CONTENT_TLV ? LWM2M_TYPE_OPAQUE : LWM2M_TYPE_STRING, p->type );
+            ASSERT_EQ( e->value.asBuffer.length, p->value.asBuffer.length );
+            EXPECT_EQ( 0, memcmp(e->value.asBuffer.buffer,p->value.asBuffer.buffer,p->value.asBuffer.length) );
+            break;
+
+            case LWM2M_TYPE_OPAQUE:
+            if ( format == LWM2M_CONTENT_JSON )
+            {
+                EXPECT_EQ( LWM2M_TYPE_STRING, p->type );
+                ASSERT_EQ( 8u, p->value.asBuffer.length );
+                EXPECT_EQ( 0, memcmp("AAEC/w==",p->value.asBuffer.buffer,8) );
+            }
+            else
+            {
+                EXPECT_EQ( LWM2M_TYPE_OPAQUE, p->type );
+                ASSERT_EQ( e->value.asBuffer.length, p->value.asBuffer.length );
+                EXPECT_EQ( 0, memcmp(e->value.asBuffer.buffer,p->value.asBuffer.buffer,p->value.asBuffer.length) );
+            }
+            break;
+
+            case LWM2M_TYPE_OBJECT_LINK:
+            if ( format == LWM2M_CONTENT_TLV )
+            {
+                ASSERT_EQ( 4u, p->value.asBuffer.length );
+                EXPECT_EQ( e->value.asObjLink.objectId, (p->value.asBuffer.buffer[0] << 8) | p->value.asBuffer.buffer[1] );
+                EXPECT_EQ( e->value.asObjLink.objectInstanceId, (p->value.asBuffer.buffer[2] << 8) | p->value.asBuffer.buffer[3] );
+            }
+            else
+            {
+                EXPECT_EQ( LWM2M_TYPE_OBJECT_LINK, p->type );
+                EXPECT_EQ( e->value.asObjLink.objectId, p->value.asObjLink.objectId );
+                EXPECT_EQ( e->value.asObjLink.objectInstanceId, p->value.asObjLink.objectInstanceId );
+            }
+            break;
+
+            default:
+            ADD_FAILURE();
+            break;
+        }
+    }
+}
+
+/* serializes in 'format' and in TLV, both must parse back to 'dataP' */
+static void senml_roundTrip( lwm2m_media_type_t format,
+                             lwm2m_uri_t       *uriP,
+                             int                size,
+                             lwm2m_data_t      *dataP,
+                             std::string       *text )
+{
+    lwm2m_media_type_t formats[2] = { format, LWM2M_CONTENT_TLV };
+
+    for ( int f = 0; f < 2; ++f )
+    {
+        lwm2m_media_type_t used = formats[f];
+        lwm2m_data_t *parsed = NULL;
+        uint8_t *buffer = NULL;
+        size_t length;
+
+        SCOPED_TRACE( used );
+        length = lwm2m_data_serialize( uriP, size, dataP, &used, &buffer );
+        ASSERT_NE( 0u, length );
+        EXPECT_EQ( formats[f], used );
+        if ( 0 == f && NULL != text )
+        {
+            text->assign( (const char*)buffer, length );
+        }
+        ASSERT_EQ( size, lwm2m_data_parse(uriP,buffer,length,formats[f],&parsed) );
+        senml_check( formats[f], dataP, parsed, size );
+        lwm2m_data_free( size, parsed );
+        nbiot_free( buffer );
+    }
+}
+
+/* every prefix of a valid payload is refused without leaking */
+static void senml_truncated( lwm2m_media_type_t format,
+                             lwm2m_uri_t       *uriP,
+                             const uint8_t     *payload,
+                             size_t             length )
+{
+    size_t used = senml_used();
+
+    for ( size_t i = 0; i < length; ++i )
+    {
+        lwm2m_data_t *parsed = (lwm2m_data_t*)&parsed;
+        uint8_t *buffer = (uint8_t*)nbiot_malloc( i + 1 );
+
+        memcpy( buffer, payload, i );
+        SCOPED_TRACE( i );
+        EXPECT_EQ( 0, lwm2m_data_parse(uriP,buffer,i,format,&parsed) );
+        EXPECT_TRUE( parsed == NULL );
+        nbiot_free( buffer );
+    }
+    EXPECT_EQ( used, senml_used() );
+}
+
+static int senml_parse( lwm2m_media_type_t format,
+                        lwm2m_uri_t       *uriP,
+                        const void        *payload,
+                        size_t             length,
+                        lwm2m_data_t     **dataP )
+{
+    uint8_t buffer[256];
+
+    memcpy( buffer, payload, length );
+    return lwm2m_data_parse( uriP, buffer, length, format, dataP );
+}
+
+TEST( senml, json_round_trip )
+{
+    nbiot_init_environment();
+    {
+        lwm2m_uri_t uri;
+        lwm2m_data_t *dataP;
+        std::string text;
+        size_t count;
+
+        /* single resource */
+        uri = senml_uri( 3 );
+        dataP = lwm2m_data_new( 1 );
+        dataP->id = 5700;
+        lwm2m_data_encode_float( -0.125, dataP );
+        senml_roundTrip( LWM2M_CONTENT_JSON, &uri, 1, dataP, &text );
+        EXPECT_EQ( "{\"bn\":\"/3200/0/\",\"e\":[{\"n\":\"5700\",\"v\":-0.125}]}", text );
+        lwm2m_data_free( 1, dataP );
+
+        /* instance, base64 opaque included */
+        uri = senml_uri( 2 );
+        dataP = senml_resources( 0, &count );
+        senml_roundTrip( LWM2M_CONTENT_JSON, &uri, (int)count, dataP, &text );
+        EXPECT_NE( std::string::npos, text.find("{\"n\":\"5750\",\"sv\":\"a \\\"quoted\\\"\\\\\\ttab\"}") );
+        EXPECT_NE( std::string::npos, text.find("{\"n\":\"5800\",\"ov\":\"3303:7\"}") );
+        EXPECT_NE( std::string::npos, text.find("{\"n\":\"5850/3\",\"v\":4886718345}") );
+        EXPECT_NE( std::string::npos, text.find("{\"n\":\"5900\",\"sv\":\"AAEC/w==\"}") );
+        lwm2m_data_free( (int)count, dataP );
+
+        /* instances of an object, multiple resources inside */
+        uri = senml_uri( 1 );
+        dataP = senml_instances( 2 );
+        senml_roundTrip( LWM2M_CONTENT_JSON, &uri, 2, dataP, &text );
+        EXPECT_EQ( 0u, text.find("{\"bn\":\"/3200/\",\"e\":[{\"n\":\"0/5500\",\"bv\":true}") );
+        lwm2m_data_free( 2, dataP );
+    }
+    nbiot_clear_environment();
+}
+
+TEST( senml, json_parse )
+{
+    nbiot_init_environment();
+    {
+        static const char unordered[] =
+            " { \"e\" : [ {\"sv\":\"caf\\u00e9\\n\",\"n\":\"1/5750\"} ,\n"
+            "{\"t\":3,\"n\":\"0/5501\",\"v\":-7,\"x\":{\"a\":[1,2]}},{\"n\":\"1/5700\",\"v\":1.5E+2},{\"n\":\"0/5700\",\"v\":-25e-2} ],"
+            " \"bt\":0, \"bn\":\"/3200/\" } ";
+        lwm2m_uri_t uri = senml_uri( 1 );
+        lwm2m_data_t *dataP = NULL;
+        lwm2m_data_t *res;
+        int64_t value;
+        double real;
+
+        /* the base name after the records, unknown keys and spaces */
+        ASSERT_EQ( 2, senml_parse(LWM2M_CONTENT_JSON,&uri,unordered,sizeof(unordered) - 1,&dataP) );
+        EXPECT_EQ( 0, dataP[0].id );
+        ASSERT_EQ( 2u, dataP[0].value.asChildren.count );
+        res = dataP[0].value.asChildren.array;
+        EXPECT_EQ( 5501, res[0].id );
+        EXPECT_EQ( 1, lwm2m_data_decode_int(res + 0,&value) );
+        EXPECT_EQ( -7, value );
+        EXPECT_EQ( 5700, res[1].id );
+        EXPECT_EQ( 1, lwm2m_data_decode_float(res + 1,&real) );
+        EXPECT_EQ( -0.25, real );
+        EXPECT_EQ( 1, dataP[1].id );
+        ASSERT_EQ( 2u, dataP[1].value.asChildren.count );
+        res = dataP[1].value.asChildren.array;
+        EXPECT_EQ( 5700, res[0].id );
+        EXPECT_EQ( 1, lwm2m_data_decode_float(res + 0,&real) );
+        EXPECT_EQ( 150.0, real );
+        EXPECT_EQ( 5750, res[1].id );
+        ASSERT_EQ( 6u, res[1].value.asBuffer.length );
+        EXPECT_EQ( 0, memcmp("caf\xc3\xa9\n",res[1].value.asBuffer.buffer,6) );
+        lwm2m_data_free( 2, dataP );
+    }
+    nbiot_clear_environment();
+}
+
+TEST( senml, json_invalid )
+{
+    nbiot_init_environment();
+    {
+        static const struct
+        {
+            const char *name;
+            int         depth;
+            const char *payload;
+        } invalid[] =
+        {
+            { "no records",        2, "{\"bn\":\"/3200/0/\"}" },
+            { "empty records",     2, "{\"bn\":\"/3200/0/\",\"e\":[]}" },
+            { "trailing data",     2, "{\"bn\":\"/3200/0/\",\"e\":[{\"n\":\"1\",\"v\":1}]}x" },
+            { "no value",          2, "{\"bn\":\"/3200/0/\",\"e\":[{\"n\":\"1\"}]}" },
+            { "two values",        2, "{\"bn\":\"/3200/0/\",\"e\":[{\"n\":\"1\",\"v\":1,\"bv\":true}]}" },
+            { "bad number",        2, "{\"bn\":\"/3200/0/\",\"e\":[{\"n\":\"1\",\"v\":1x}]}" },
+            { "bad exponent",      2, "{\"bn\":\"/3200/0/\",\"e\":[{\"n\":\"1\",\"v\":1.5E}]}" },
+            { "bad escape",        2, "{\"bn\":\"/3200/0/\",\"e\":[{\"n\":\"1\",\"sv\":\"\\q\"}]}" },
+            { "bad objlnk",        2, "{\"bn\":\"/3200/0/\",\"e\":[{\"n\":\"1\",\"ov\":\"3303\"}]}" },
+            { "bad name",          2, "{\"bn\":\"/3200/0/\",\"e\":[{\"n\":\"a\",\"v\":1}]}" },
+            { "too deep",          2, "{\"bn\":\"/3200/0/\",\"e\":[{\"n\":\"1/2/3\",\"v\":1}]}" },
+            { "outside the uri",   2, "{\"bn\":\"/3200/1/\",\"e\":[{\"n\":\"1\",\"v\":1}]}" },
+            { "other object",      2, "{\"bn\":\"/3201/0/\",\"e\":[{\"n\":\"1\",\"v\":1}]}" },
+            { "not a resource",    1, "{\"bn\":\"/3200/\",\"e\":[{\"n\":\"0\",\"v\":1}]}" },
+            { "duplicate",         2, "{\"bn\":\"/3200/0/\",\"e\":[{\"n\":\"1\",\"v\":1},{\"n\":\"1\",\"v\":2}]}" },
+            { "value and child",   2, "{\"bn\":\"/3200/0/\",\"e\":[{\"n\":\"1\",\"v\":1},{\"n\":\"1/0\",\"v\":2}]}" },
+        };
+        size_t used = senml_used();
+
+        for ( size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); ++i )
+        {
+            lwm2m_uri_t uri = senml_uri( invalid[i].depth );
+            lwm2m_data_t *dataP = (lwm2m_data_t*)&dataP;
+
+            SCOPED_TRACE( invalid[i].name );
+            EXPECT_EQ( 0, senml_parse(LWM2M_CONTENT_JSON,&uri,invalid[i].payload,strlen(invalid[i].payload),&dataP) );
+            EXPECT_TRUE( dataP == NULL );
+        }
+        EXPECT_EQ( used, senml_used() );
+    }
+    nbiot_clear_environment();
+}
+
+TEST( senml, json_truncated )
+{
+    nbiot_init_environment();
+    {
+        lwm2m_uri_t uri = senml_uri( 1 );
+        lwm2m_media_type_t format = LWM2M_CONTENT_JSON;
+        lwm2m_data_t *dataP;
+        uint8_t *buffer;
+        size_t length;
+
+        dataP = senml_instances( 2 );
+        length = lwm2m_data_serialize( &uri, 2, dataP, &format, &buffer );
+        ASSERT_NE( 0u, length );
+        lwm2m_data_free( 2, dataP );
+
+        senml_truncated( LWM2M_CONTENT_JSON, &uri, buffer, length );
+        nbiot_free( buffer );
+    }
+    nbiot_clear_environment();
+}
+
+/* strings are copied out of the payload before a later record fails */
+TEST( senml, json_partial_free )
+{
+    nbiot_init_environment();
+    {
+        static const char *failing[] =
+        {
+            /* the last record cannot be parsed */
+            "{\"bn\":\"/3200/0/\",\"e\":[{\"n\":\"1\",\"sv\":\"first\"},{\"n\":\"2\",\"sv\":\"second\"},{\"n\":\"3\",\"v\":\"x\"}]}",
+            /* the last record has a bad name after its value */
+            "{\"bn\":\"/3200/0/\",\"e\":[{\"n\":\"1\",\"sv\":\"first\"},{\"sv\":\"second\",\"n\":\"x\"}]}",
+            /* all parsed, the tree fails on the duplicate after strings were moved into it */
+            "{\"bn\":\"/3200/0/\",\"e\":[{\"n\":\"1\",\"sv\":\"first\"},{\"n\":\"2/0\",\"sv\":\"second\"},{\"n\":\"2/0\",\"sv\":\"third\"}]}",
+        };
+        lwm2m_uri_t uri = senml_uri( 2 );
+        size_t used = senml_used();
+
+        for ( size_t i = 0; i < sizeof(failing) / sizeof(failing[0]); ++i )
+        {
+            lwm2m_data_t *dataP = NULL;
+
+            SCOPED_TRACE( i );
+            EXPECT_EQ( 0, senml_parse(LWM2M_CONTENT_JSON,&uri,failing[i],strlen(failing[i]),&dataP) );
+            EXPECT_TRUE( dataP == NULL );
+            EXPECT_EQ( used, senml_used() );
+        }
+    }
+    nbiot_clear_environment();
+}
+
+TEST( senml, cbor_round_trip )
+{
+    nbiot_init_environment();
+    {
+        static const uint8_t single[] =
+        {
+            0x81, 0xA3,
+            0x21, 0x68, '/', '3', '2', '0', '0', '/', '0', '/',
+            0x00, 0x64, '5', '7', '0', '0',
+            0x02, 0xFA, 0x41, 0xAC, 0x00, 0x00
+        };
+        lwm2m_uri_t uri;
+        lwm2m_data_t *dataP;
+        std::string text;
+        size_t count;
+
+        /* single resource, 21.5 fits in single precision */
+        uri = senml_uri( 3 );
+        dataP = lwm2m_data_new( 1 );
+        dataP->id = 5700;
+        lwm2m_data_encode_float( 21.5, dataP );
+        senml_roundTrip( LWM2M_CONTENT_SENML_CBOR, &uri, 1, dataP, &text );
+        EXPECT_EQ( std::string((const char*)single,sizeof(single)), text );
+
+        /* 0.1 needs double precision */
+        lwm2m_data_encode_float( 0.1, dataP );
+        senml_roundTrip( LWM2M_CONTENT_SENML_CBOR, &uri, 1, dataP, &text );
+        ASSERT_EQ( sizeof(single) + 4, text.size() );
+        EXPECT_EQ( std::string("\x02\xFB\x3F\xB9\x99\x99\x99\x99\x99\x9A",10), text.substr(sizeof(single) - 6) );
+        lwm2m_data_free( 1, dataP );
+
+        /* instance, opaque as a byte string */
+        uri = senml_uri( 2 );
+        dataP = senml_resources( 1, &count );
+        senml_roundTrip( LWM2M_CONTENT_SENML_CBOR, &uri, (int)count, dataP, &text );
+        EXPECT_NE( std::string::npos, text.find(std::string("\x08\x44\x00\x01\x02\xFF",6)) );
+        EXPECT_NE( std::string::npos, text.find("\x63vlo\x66" "3303:8") );
+        lwm2m_data_free( (int)count, dataP );
+
+        /* instances of an object, the base name is written once */
+        uri = senml_uri( 1 );
+        dataP = senml_instances( 2 );
+        senml_roundTrip( LWM2M_CONTENT_SENML_CBOR, &uri, 2, dataP, &text );
+        EXPECT_EQ( 0u, text.find("\x90\xA3\x21\x66/3200/") );
+        EXPECT_EQ( text.find("/3200/"), text.rfind("/3200/") );
+        lwm2m_data_free( 2, dataP );
+    }
+    nbiot_clear_environment();
+}
+
+TEST( senml, cbor_floats )
+{
+    nbiot_init_environment();
+    {
+        static const struct
+        {
+            uint8_t value[9];
+            size_t  length;
+            double  expected;
+        } floats[] =
+        {
+            { { 0xF9, 0x3C, 0x00 }, 3, 1.0 },
+            { { 0xF9, 0xC5, 0x00 }, 3, -5.0 },
+            { { 0xF9, 0x35, 0x55 }, 3, 0.333251953125 },
+            { { 0xF9, 0x7B, 0xFF }, 3, 65504.0 },
+            { { 0xF9, 0x00, 0x01 }, 3, 5.9604644775390625e-8 },
+            { { 0xFA, 0xC1, 0xAC, 0x00, 0x00 }, 5, -21.5 },
+            { { 0xFA, 0x3D, 0xCC, 0xCC, 0xCD }, 5, (double)0.1f },
+            { { 0xFB, 0x3F, 0xB9, 0x99, 0x99, 0x99, 0x99, 0x99, 0x9A }, 9, 0.1 },
+            { { 0xFB, 0xC0, 0x93, 0x4A, 0x45, 0x6D, 0x5C, 0xFA, 0xAD }, 9, -1234.5678 },
+        };
+        lwm2m_uri_t uri = senml_uri( 3 );
+
+        for ( size_t i = 0; i < sizeof(floats) / sizeof(floats[0]); ++i )
+        {
+            uint8_t payload[32] = { 0x81, 0xA2, 0x21, 0x6C, '/', '3', '2', '0', '0', '/', '0', '/', '5', '7', '0', '0', 0x02 };
+            lwm2m_data_t *dataP = NULL;
+            double real;
+
+            SCOPED_TRACE( i );
+            memcpy( payload + 17, floats[i].value, floats[i].length );
+            ASSERT_EQ( 1, senml_parse(LWM2M_CONTENT_SENML_CBOR,&uri,payload,17 + floats[i].length,&dataP) );
+            EXPECT_EQ( LWM2M_TYPE_FLOAT, dataP->type );
+            EXPECT_EQ( 1, lwm2m_data_decode_float(dataP,&real) );
+            EXPECT_EQ( floats[i].expected, real );
+            lwm2m_data_free( 1, dataP );
+        }
+
+        /* half precision infinity and NaN have no lwm2m value */
+        {
+            static const uint8_t infinity[] = { 0x81, 0xA2, 0x21, 0x6C, '/', '3', '2', '0', '0', '/', '0', '/', '5', '7', '0', '0', 0x02, 0xF9, 0x7C, 0x00 };
+            lwm2m_data_t *dataP = NULL;
+
+            EXPECT_EQ( 0, senml_parse(LWM2M_CONTENT_SENML_CBOR,&uri,infinity,sizeof(infinity),&dataP) );
+        }
+    }
+    nbiot_clear_environment();
+}
+
+TEST( senml, cbor_invalid )
+{
+    nbiot_init_environment();
+    {
+        static const struct
+        {
+            const char *name;
+            int         depth;
+            uint8_t     payload[32];
+            size_t      length;
+        } invalid[] =
+        {
+            { "not an array",     2, { 0xA1, 0x00, 0x61, '1' }, 4 },
+            { "empty array",      2, { 0x80 }, 1 },
+            { "count too large",  2, { 0x9A, 0xFF, 0xFF, 0xFF, 0xFF }, 5 },
+            { "indefinite",       2, { 0x9F, 0xA2, 0x00, 0x61, '1', 0x02, 0x01, 0xFF }, 8 },
+            { "no value",         2, { 0x81, 0xA2, 0x21, 0x68, '/', '3', '2', '0', '0', '/', '0', '/', 0x00, 0x61, '1' }, 15 },
+            { "two values",       2, { 0x81, 0xA4, 0x21, 0x68, '/', '3', '2', '0', '0', '/', '0', '/', 0x00, 0x61, '1', 0x02, 0x01, 0x04, 0xF5 }, 19 },
+            { "text as value",    2, { 0x81, 0xA3, 0x21, 0x68, '/', '3', '2', '0', '0', '/', '0', '/', 0x00, 0x61, '1', 0x02, 0x61, '1' }, 18 },
+            { "bytes as string",  2, { 0x81, 0xA3, 0x21, 0x68, '/', '3', '2', '0', '0', '/', '0', '/', 0x00, 0x61, '1', 0x03, 0x41, '1' }, 18 },
+            { "trailing item",    2, { 0x81, 0xA3, 0x21, 0x68, '/', '3', '2', '0', '0', '/', '0', '/', 0x00, 0x61, '1', 0x02, 0x01, 0x00 }, 18 },
+            { "outside the uri",  2, { 0x81, 0xA3, 0x21, 0x68, '/', '3', '2', '0', '0', '/', '1', '/', 0x00, 0x61, '1', 0x02, 0x01 }, 17 },
+            { "not a resource",   1, { 0x81, 0xA3, 0x21, 0x66, '/', '3', '2', '0', '0', '/', 0x00, 0x61, '0', 0x02, 0x01 }, 15 },
+            { "duplicate",        2, { 0x82, 0xA3, 0x21, 0x68, '/', '3', '2', '0', '0', '/', '0', '/', 0x00, 0x61, '1', 0x02, 0x01,
+                                       0xA2, 0x00, 0x61, '1', 0x02, 0x02 }, 23 },
+        };
+        size_t used = senml_used();
+
+        for ( size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); ++i )
+        {
+            lwm2m_uri_t uri = senml_uri( invalid[i].depth );
+            lwm2m_data_t *dataP = (lwm2m_data_t*)&dataP;
+
+            SCOPED_TRACE( invalid[i].name );
+            EXPECT_EQ( 0, senml_parse(LWM2M_CONTENT_SENML_CBOR,&uri,invalid[i].payload,invalid[i].length,&dataP) );
+            EXPECT_TRUE( dataP == NULL );
+        }
+        EXPECT_EQ( used, senml_used() );
+    }
+    nbiot_clear_environment();
+}
+
+TEST( senml, cbor_truncated )
+{
+    nbiot_init_environment();
+    {
+        lwm2m_uri_t uri = senml_uri( 1 );
+        lwm2m_media_type_t format = LWM2M_CONTENT_SENML_CBOR;
+        lwm2m_data_t *dataP;
+        uint8_t *buffer;
+        size_t length;
+
+        dataP = senml_instances( 2 );
+        length = lwm2m_data_serialize( &uri, 2, dataP, &format, &buffer );
+        ASSERT_NE( 0u, length );
+        lwm2m_data_free( 2, dataP );
+
+        senml_truncated( LWM2M_CONTENT_SENML_CBOR, &uri, buffer, length );
+        nbiot_free( buffer );
+    }
+    nbiot_clear_environment();
+}
+
+TEST( senml, cbor_partial_free )
+{
+    nbiot_init_environment();
+    {
+        static const struct
+        {
+            uint8_t payload[48];
+            size_t  length;
+        } failing[] =
+        {
+            /* the second record has a bad value after the first string was copied */
+            { { 0x82, 0xA3, 0x21, 0x68, '/', '3', '2', '0', '0', '/', '0', '/', 0x00, 0x61, '1', 0x03, 0x63, 'a', 'b', 'c',
+                0xA2, 0x00, 0x61, '2', 0x02, 0x61, 'x' }, 27 },
+            /* the second record fails on its name after its own bytes were copied */
+            { { 0x82, 0xA3, 0x21, 0x68, '/', '3', '2', '0', '0', '/', '0', '/', 0x00, 0x61, '1', 0x03, 0x63, 'a', 'b', 'c',
+                0xA2, 0x08, 0x42, 0x01, 0x02, 0x00, 0x61, 'x' }, 28 },
+            /* all parsed, the tree fails on the duplicate */
+            { { 0x83, 0xA3, 0x21, 0x68, '/', '3', '2', '0', '0', '/', '0', '/', 0x00, 0x61, '1', 0x03, 0x63, 'a', 'b', 'c',
+                0xA2, 0x00, 0x63, '2', '/', '0', 0x03, 0x61, 'd',
+                0xA2, 0x00, 0x63, '2', '/', '0', 0x03, 0x61, 'e' }, 38 },
+            /* all parsed, trailing bytes */
+            { { 0x81, 0xA3, 0x21, 0x68, '/', '3', '2', '0', '0', '/', '0', '/', 0x00, 0x61, '1', 0x03, 0x63, 'a', 'b', 'c', 0x00 }, 21 },
+        };
+        lwm2m_uri_t uri = senml_uri( 2 );
+        size_t used = senml_used();
+
+        for ( size_t i = 0; i < sizeof(failing) / sizeof(failing[0]); ++i )
+        {
+            lwm2m_data_t *dataP = NULL;
+
+            SCOPED_TRACE( i );
+            EXPECT_EQ( 0, senml_parse(LWM2M_CONTENT_SENML_CBOR,&uri,failing[i].payload,failing[i].length,&dataP) );
+            EXPECT_TRUE( dataP == NULL );
+            EXPECT_EQ( used, senml_used() );
+        }
+    }
+    nbiot_clear_environment();
+}
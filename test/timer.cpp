@@ -0,0 +1,84 @@
+/**
+ * Copyright (c) 2017 China Mobile IOT.
+ * All rights reserved.
+**/
+
+#include <gtest/gtest.h>
+#include <internals.h>
+#include <limits.h>
+
+TEST( timer, wrap )
+{
+    nbiot_init_environment();
+    {
+        lwm2m_context_t *context;
+        lwm2m_timer_t timers[3];
+        clock_t now = (clock_t)(LONG_MAX - 30);
+        clock_t timeout = 1000;
+
+        context = (lwm2m_context_t*)nbiot_malloc( sizeof(lwm2m_context_t) );
+        ASSERT_TRUE( context != NULL );
+        lwm2m_init( context, NULL );
+        memset( timers, 0, sizeof(timers) );
+
+        /* timers[0] is due after the tick wrapped, so it is the last one */
+        EXPECT_TRUE( timer_schedule(context,timers + 0,NBIOT_TICK_ADD(now,40)) );
+        EXPECT_TRUE( timer_schedule(context,timers + 1,NBIOT_TICK_ADD(now,20)) );
+        EXPECT_TRUE( timer_schedule(context,timers + 2,NBIOT_TICK_ADD(now,10)) );
+        EXPECT_GT( 0, (long)timers[0].deadline );
+        EXPECT_EQ( 3, context->timerCount );
+
+        timer_timeout( context, now, &timeout );
+        EXPECT_EQ( 10, timeout );
+        EXPECT_TRUE( NULL == timer_pop(context,now) );
+
+        now = NBIOT_TICK_ADD( now, 35 );
+        EXPECT_GT( 0, (long)now );
+        EXPECT_TRUE( timers + 2 == timer_pop(context,now) );
+        EXPECT_TRUE( timers + 1 == timer_pop(context,now) );
+        EXPECT_TRUE( NULL == timer_pop(context,now) );
+        timeout = 1000;
+        timer_timeout( context, now, &timeout );
+        EXPECT_EQ( 5, timeout );
+
+        now = NBIOT_TICK_ADD( now, 5 );
+        EXPECT_TRUE( timers + 0 == timer_pop(context,now) );
+        EXPECT_EQ( 0, context->timerCount );
+
+        lwm2m_close( context );
+        nbiot_free( context );
+    }
+    nbiot_clear_environment();
+}
+
+TEST( timer, ready )
+{
+    nbiot_init_environment();
+    {
+        lwm2m_context_t *context;
+        lwm2m_timer_t timer;
+        lwm2m_observed_t observed;
+        clock_t timeout = 1000;
+
+        context = (lwm2m_context_t*)nbiot_malloc( sizeof(lwm2m_context_t) );
+        ASSERT_TRUE( context != NULL );
+        lwm2m_init( context, NULL );
+        memset( &timer, 0, sizeof(timer) );
+        memset( &observed, 0, sizeof(observed) );
+
+        EXPECT_TRUE( timer_schedule(context,&timer,100) );
+        timer_timeout( context, 0, &timeout );
+        EXPECT_EQ( 100, timeout );
+
+        /* a tagged observation does not wait for the next timer */
+        context->observedReady = &observed;
+        timer_timeout( context, 0, &timeout );
+        EXPECT_EQ( 0, timeout );
+        context->observedReady = NULL;
+
+        timer_cancel( context, &timer );
+        lwm2m_close( context );
+        nbiot_free( context );
+    }
+    nbiot_clear_environment();
+}
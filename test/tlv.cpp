@@ -0,0 +1,175 @@
+/**
+ * Copyright (c) 2017 China Mobile IOT.
+ * All rights reserved.
+**/
+
+#include <gtest/gtest.h>
+#include <internals.h>
+#include <stdio.h>
+
+static char tlv_text[300];
+
+/* /3200/0 and /3200/1, the second one holds a string longer than 0xFF */
+static lwm2m_data_t *tlv_instances( int *size )
+{
+    lwm2m_data_t *instances = lwm2m_data_new( 2 );
+
+    for ( int i = 0; i < 2; ++i )
+    {
+        lwm2m_data_t *res = lwm2m_data_new( 5 );
+        lwm2m_data_t *multi = lwm2m_data_new( 2 );
+
+        res[0].id = 5500;
+        lwm2m_data_encode_bool( i == 0, res + 0 );
+        res[1].id = 5501;
+        lwm2m_data_encode_int( 100000 + i, res + 1 );
+        res[2].id = 5700;
+        lwm2m_data_encode_float( 21.5, res + 2 );
+        res[3].id = 5750;
+        lwm2m_data_encode_nstring( tlv_text, i == 0 ? 5 : sizeof(tlv_text), res + 3 );
+        multi[0].id = 0;
+        lwm2m_data_encode_int( -1, multi + 0 );
+        multi[1].id = 1;
+        multi[1].type = LWM2M_TYPE_OBJECT_LINK;
+        multi[1].value.asObjLink.objectId = 3303;
+        multi[1].value.asObjLink.objectInstanceId = 7;
+        res[4].id = 11;
+        res[4].type = LWM2M_TYPE_MULTIPLE_RESOURCE;
+        res[4].value.asChildren.count = 2;
+        res[4].value.asChildren.array = multi;
+
+        instances[i].id = (uint16_t)i;
+        instances[i].type = LWM2M_TYPE_OBJECT_INSTANCE;
+        instances[i].value.asChildren.count = 5;
+        instances[i].value.asChildren.array = res;
+    }
+
+    *size = 2;
+    return instances;
+}
+
+TEST( tlv, serialize )
+{
+    nbiot_init_environment();
+    {
+        lwm2m_data_t *dataP;
+        lwm2m_data_t *parsed;
+        uint8_t *buffer;
+        uint8_t fixed[512];
+        size_t length;
+        int size;
+
+        memset( tlv_text, 'x', sizeof(tlv_text) );
+        dataP = tlv_instances( &size );
+
+        /* /3200/0 fits in 8 bit length fields */
+        length = tlv_serialize( false, 1, dataP, &buffer );
+        ASSERT_EQ( (size_t)41, length );
+        EXPECT_EQ( 0, memcmp( "\x08\x00\x26\xe1\x15\x7c\x01", buffer, 7 ) );
+        EXPECT_EQ( 0, memcmp( "\x88\x0b\x09\x41\x00\xff\x44\x01\x0c\xe7\x00\x07", buffer + 29, 12 ) );
+        EXPECT_EQ( length, tlv_serializeBuffer( false, 1, dataP, fixed, length ) );
+        EXPECT_EQ( 0, memcmp( buffer, fixed, length ) );
+        EXPECT_EQ( (size_t)0, tlv_serializeBuffer( false, 1, dataP, fixed, length - 1 ) );
+        nbiot_free( buffer );
+
+        /* /3200/1 moves the string and the instance to 16 bit lengths */
+        length = tlv_serialize( false, size, dataP, &buffer );
+        ASSERT_EQ( (size_t)380, length );
+        EXPECT_EQ( 0, memcmp( "\x10\x01\x01\x4f\xe1\x15\x7c\x00", buffer + 41, 8 ) );
+        EXPECT_EQ( 0, memcmp( "\xf0\x16\x76\x01\x2c", buffer + 63, 5 ) );
+        EXPECT_EQ( length, tlv_serializeBuffer( false, size, dataP, fixed, sizeof(fixed) ) );
+        EXPECT_EQ( 0, memcmp( buffer, fixed, length ) );
+        EXPECT_EQ( (size_t)0, tlv_serializeBuffer( false, size, dataP, fixed, length - 1 ) );
+
+        ASSERT_EQ( size, tlv_parse( buffer, length, false, &parsed ) );
+        for ( int i = 0; i < size; ++i )
+        {
+            lwm2m_data_t *res = parsed[i].value.asChildren.array;
+            lwm2m_data_t *multi;
+            int64_t value;
+            double real;
+            bool flag;
+
+            EXPECT_EQ( LWM2M_TYPE_OBJECT_INSTANCE, parsed[i].type );
+            EXPECT_EQ( i, parsed[i].id );
+            ASSERT_EQ( (size_t)5, parsed[i].value.asChildren.count );
+            EXPECT_EQ( 1, lwm2m_data_decode_bool( res + 0, &flag ) );
+            EXPECT_EQ( i == 0, flag );
+            EXPECT_EQ( 1, lwm2m_data_decode_int( res + 1, &value ) );
+            EXPECT_EQ( 100000 + i, value );
+            EXPECT_EQ( 1, lwm2m_data_decode_float( res + 2, &real ) );
+            EXPECT_EQ( 21.5, real );
+            EXPECT_EQ( 5750, res[3].id );
+            EXPECT_EQ( i == 0 ? (size_t)5 : sizeof(tlv_text), res[3].value.asBuffer.length );
+            EXPECT_EQ( 0, memcmp( tlv_text, res[3].value.asBuffer.buffer, res[3].value.asBuffer.length ) );
+            EXPECT_EQ( LWM2M_TYPE_MULTIPLE_RESOURCE, res[4].type );
+            ASSERT_EQ( (size_t)2, res[4].value.asChildren.count );
+            multi = res[4].value.asChildren.array;
+            EXPECT_EQ( 1, lwm2m_data_decode_int( multi + 0, &value ) );
+            EXPECT_EQ( -1, value );
+            ASSERT_EQ( 4u, multi[1].value.asBuffer.length );
+            EXPECT_EQ( 0, memcmp( "\x0c\xe7\x00\x07", multi[1].value.asBuffer.buffer, 4 ) );
+        }
+        lwm2m_data_free( size, parsed );
+        nbiot_free( buffer );
+        lwm2m_data_free( size, dataP );
+    }
+    nbiot_clear_environment();
+}
+
+TEST( tlv, parse_view )
+{
+    nbiot_init_environment();
+    {
+        lwm2m_data_t *dataP;
+        lwm2m_data_t *parsed;
+        uint8_t *buffer;
+        size_t length;
+        int size;
+
+        memset( tlv_text, 'y', sizeof(tlv_text) );
+        dataP = tlv_instances( &size );
+        length = tlv_serialize( false, size, dataP, &buffer );
+        ASSERT_NE( (size_t)0, length );
+        lwm2m_data_free( size, dataP );
+
+        ASSERT_EQ( size, tlv_parse( buffer, length, true, &parsed ) );
+        for ( int i = 0; i < size; ++i )
+        {
+            lwm2m_data_t *res = parsed[i].value.asChildren.array;
+            lwm2m_data_t *multi;
+            int64_t value;
+
+            EXPECT_EQ( LWM2M_TYPE_OBJECT_INSTANCE, parsed[i].type );
+            EXPECT_EQ( 0, parsed[i].flag );
+            ASSERT_EQ( (size_t)5, parsed[i].value.asChildren.count );
+            for ( int j = 0; j < 4; ++j )
+            {
+                EXPECT_EQ( LWM2M_TYPE_OPAQUE, res[j].type );
+                EXPECT_EQ( LWM2M_DATA_FLAG_BORROWED, res[j].flag );
+                EXPECT_GE( res[j].value.asBuffer.buffer, buffer );
+                EXPECT_LE( res[j].value.asBuffer.buffer + res[j].value.asBuffer.length, buffer + length );
+            }
+            EXPECT_EQ( 1, lwm2m_data_decode_int( res + 1, &value ) );
+            EXPECT_EQ( 100000 + i, value );
+            EXPECT_EQ( i == 0 ? (size_t)5 : sizeof(tlv_text), res[3].value.asBuffer.length );
+            EXPECT_EQ( 0, memcmp( tlv_text, res[3].value.asBuffer.buffer, res[3].value.asBuffer.length ) );
+
+            /* re-encoding a borrowed value makes it owned again */
+            lwm2m_data_encode_nstring( tlv_text, 3, res + 3 );
+            EXPECT_EQ( LWM2M_TYPE_STRING, res[3].type );
+            EXPECT_EQ( 0, res[3].flag );
+
+            multi = res[4].value.asChildren.array;
+            ASSERT_EQ( (size_t)2, res[4].value.asChildren.count );
+            EXPECT_EQ( buffer + (i == 0 ? 37 : length - 4), multi[1].value.asBuffer.buffer );
+        }
+        lwm2m_data_free( size, parsed );
+
+        /* a truncated instance is rejected as a whole */
+        EXPECT_EQ( 0, tlv_parse( buffer, 20, true, &parsed ) );
+        EXPECT_TRUE( parsed == NULL );
+        nbiot_free( buffer );
+    }
+    nbiot_clear_environment();
+}
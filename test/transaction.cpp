@@ -0,0 +1,44 @@
+/**
+ * Copyright (c) 2017 China Mobile IOT.
+ * All rights reserved.
+**/
+
+#include <gtest/gtest.h>
+#include <internals.h>
+
+static int transaction_ended = 0;
+static void transaction_callback( lwm2m_transaction_t *, void * )
+{
+    ++transaction_ended;
+}
+
+TEST( transaction, send_failure )
+{
+    nbiot_init_environment();
+    {
+        lwm2m_context_t *context;
+        lwm2m_transaction_t *transacP;
+
+        context = (lwm2m_context_t*)nbiot_malloc( sizeof(lwm2m_context_t) );
+        ASSERT_TRUE( context != NULL );
+        lwm2m_init( context, NULL );
+
+        /* a transaction that cannot be sent is removed, the caller must not free it again */
+        transacP = transaction_new( COAP_TYPE_CON, COAP_GET, NULL, NULL, 0x1234, 4, NULL, ENDPOINT_CLIENT, context );
+        ASSERT_TRUE( transacP != NULL );
+        transacP->callback = transaction_callback;
+        EXPECT_EQ( 0, transaction_add(context,transacP) );
+        EXPECT_EQ( 1, context->transactionCount );
+
+        transaction_ended = 0;
+        EXPECT_NE( 0, transaction_send(context,transacP) );
+        EXPECT_EQ( 0, context->transactionCount );
+        EXPECT_TRUE( context->transactionList == NULL );
+        EXPECT_EQ( 0, context->timerCount );
+        EXPECT_EQ( 0, transaction_ended );
+
+        lwm2m_close( context );
+        nbiot_free( context );
+    }
+    nbiot_clear_environment();
+}